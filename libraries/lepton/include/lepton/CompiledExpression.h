@@ -54,6 +54,9 @@ class ParsedExpression;
  * is visible.
  * 
  * A CompiledExpression is created by calling createCompiledExpression() on a ParsedExpression.
+ * Alternatively, you can create one that evaluates a set of ParsedExpressions at once, such as an
+ * energy and its derivatives.  Subexpressions that appear in more than one of them are then only
+ * computed once on each evaluation.
  * 
  * WARNING: CompiledExpression is NOT thread safe.  You should never access a CompiledExpression from two threads at
  * the same time.
@@ -63,6 +66,14 @@ class LEPTON_EXPORT CompiledExpression {
 public:
     CompiledExpression();
     CompiledExpression(const CompiledExpression& expression);
+    /**
+     * Create a CompiledExpression that evaluates several expressions together.  Common subexpressions
+     * are shared between all of them.  After calling evaluate(), the value of each expression can be
+     * retrieved with getOutputValue().
+     *
+     * @param expressions    the expressions to evaluate.  The order determines the output indices.
+     */
+    CompiledExpression(const std::vector<ParsedExpression>& expressions);
     ~CompiledExpression();
     CompiledExpression& operator=(const CompiledExpression& expression);
     /**
@@ -82,17 +93,33 @@ public:
     void setVariableLocations(std::map<std::string, double*>& variableLocations);
     /**
      * Evaluate the expression.  The values of all variables should have been set before calling this.
+     * If this object was created from several expressions, all of them are evaluated and the value of
+     * the first one is returned.
      */
     double evaluate() const;
+    /**
+     * Get the number of expressions that are computed by evaluate().
+     */
+    int getNumOutputs() const;
+    /**
+     * Get the value of one of the expressions, as computed by the most recent call to evaluate().
+     *
+     * @param index    the index of the expression, in the order they were passed to the constructor
+     */
+    double getOutputValue(int index) const {
+        return workspace[outputIndex[index]];
+    }
 private:
     friend class ParsedExpression;
     CompiledExpression(const ParsedExpression& expression);
+    void compileOutputs(const std::vector<ParsedExpression>& expressions);
     void compileExpression(const ExpressionTreeNode& node, std::vector<std::pair<ExpressionTreeNode, int> >& temps);
     int findTempIndex(const ExpressionTreeNode& node, std::vector<std::pair<ExpressionTreeNode, int> >& temps);
     std::map<std::string, double*> variablePointers;
     std::vector<std::pair<double*, double*> > variablesToCopy;
     std::vector<std::vector<int> > arguments;
     std::vector<int> target;
+    std::vector<int> outputIndex;
     std::vector<Operation*> operation;
     std::map<std::string, int> variableIndices;
     std::set<std::string> variableNames;
@@ -44,9 +44,26 @@ CompiledExpression::CompiledExpression() : jitCode(NULL) {
 }
 
 CompiledExpression::CompiledExpression(const ParsedExpression& expression) : jitCode(NULL) {
-    ParsedExpression expr = expression.optimize(); // Just in case it wasn't already optimized.
+    compileOutputs(vector<ParsedExpression>(1, expression));
+}
+
+CompiledExpression::CompiledExpression(const vector<ParsedExpression>& expressions) : jitCode(NULL) {
+    if (expressions.size() == 0)
+        throw Exception("CompiledExpression: At least one expression must be specified");
+    compileOutputs(expressions);
+}
+
+void CompiledExpression::compileOutputs(const vector<ParsedExpression>& expressions) {
+    // Compile all the expressions into a single sequence of operations.  Since every expression shares
+    // the same list of temporaries, any subexpression that has already been compiled for an earlier
+    // output is reused rather than being computed again.
+
     vector<pair<ExpressionTreeNode, int> > temps;
-    compileExpression(expr.getRootNode(), temps);
+    for (auto& expression : expressions) {
+        ParsedExpression expr = expression.optimize(); // Just in case it wasn't already optimized.
+        compileExpression(expr.getRootNode(), temps);
+        outputIndex.push_back(temps[findTempIndex(expr.getRootNode(), temps)].second);
+    }
     int maxArguments = 1;
     for (int i = 0; i < (int) operation.size(); i++)
         if (operation[i]->getNumArguments() > maxArguments)
@@ -70,6 +87,7 @@ CompiledExpression::CompiledExpression(const CompiledExpression& expression) : j
 CompiledExpression& CompiledExpression::operator=(const CompiledExpression& expression) {
     arguments = expression.arguments;
     target = expression.target;
+    outputIndex = expression.outputIndex;
     variableIndices = expression.variableIndices;
     variableNames = expression.variableNames;
     workspace.resize(expression.workspace.size());
@@ -88,7 +106,7 @@ void CompiledExpression::compileExpression(const ExpressionTreeNode& node, vecto
     // Process the child nodes.
     
     vector<int> args;
-    for (int i = 0; i < node.getChildren().size(); i++) {
+    for (int i = 0; i < (int) node.getChildren().size(); i++) {
         compileExpression(node.getChildren()[i], temps);
         args.push_back(findTempIndex(node.getChildren()[i], temps));
     }
@@ -110,7 +128,7 @@ void CompiledExpression::compileExpression(const ExpressionTreeNode& node, vecto
             // If the arguments are sequential, we can just pass a pointer to the first one.
             
             bool sequential = true;
-            for (int i = 1; i < args.size(); i++)
+            for (int i = 1; i < (int) args.size(); i++)
                 if (args[i] != args[i-1]+1)
                     sequential = false;
             if (sequential)
@@ -167,25 +185,29 @@ double CompiledExpression::evaluate() const {
 #ifdef LEPTON_USE_JIT
     return jitCode();
 #else
-    for (int i = 0; i < variablesToCopy.size(); i++)
+    for (int i = 0; i < (int) variablesToCopy.size(); i++)
         *variablesToCopy[i].first = *variablesToCopy[i].second;
 
     // Loop over the operations and evaluate each one.
     
-    for (int step = 0; step < operation.size(); step++) {
+    for (int step = 0; step < (int) operation.size(); step++) {
         const vector<int>& args = arguments[step];
         if (args.size() == 1)
             workspace[target[step]] = operation[step]->evaluate(&workspace[args[0]], dummyVariables);
         else {
-            for (int i = 0; i < args.size(); i++)
+            for (int i = 0; i < (int) args.size(); i++)
                 argValues[i] = workspace[args[i]];
             workspace[target[step]] = operation[step]->evaluate(&argValues[0], dummyVariables);
         }
     }
-    return workspace[workspace.size()-1];
+    return workspace[outputIndex[0]];
 #endif
 }
 
+int CompiledExpression::getNumOutputs() const {
+    return outputIndex.size();
+}
+
 #ifdef LEPTON_USE_JIT
 static double evaluateOperation(Operation* op, double* args) {
     static map<string, double> dummyVariables;
@@ -393,7 +415,14 @@ void CompiledExpression::generateJitCode() {
                 call->setRet(0, workspaceVar[target[step]]);
         }
     }
-    c.ret(workspaceVar[workspace.size()-1]);
+    
+    // Store the outputs so they can be retrieved with getOutputValue().
+    
+    X86Gp outputPointer = c.newIntPtr();
+    c.mov(outputPointer, imm_ptr(&workspace[0]));
+    for (int index : outputIndex)
+        c.movsd(x86::ptr(outputPointer, 8*index, 0), workspaceVar[index]);
+    c.ret(workspaceVar[outputIndex[0]]);
     c.endFunc();
     c.finalize();
     runtime.add(&jitCode, &code);
@@ -116,6 +116,15 @@ public:
      * energy directly, <i>or</i> add it to an internal buffer so that it will be included here.
      */
     virtual double finishComputation(ContextImpl& context, bool includeForce, bool includeEnergy, int groups, bool& valid) = 0;
+    /**
+     * Get whether every force kernel on this platform returns its energy directly, so finishComputation() never
+     * adds any energy of its own.  When this is true, the energies returned by individual ForceImpls can be
+     * attributed to the force groups or parameter values they were computed for, which allows several of them
+     * to be computed within a single evaluation.  The default implementation returns false.
+     */
+    virtual bool isEnergyReturnedByForces() const {
+        return false;
+    }
 };
 
 /**
@@ -1517,6 +1526,20 @@ public:
      * @param includeEnergy       true if potential energy should be computed
      */
     virtual void beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeEnergy) = 0;
+    /**
+     * Begin computing the energy, and optionally the force.  Kernels that can skip the force
+     * calculation when it is not needed should override this.  The default implementation always
+     * computes forces.  Adding this virtual method changed the layout of the class, so plugins
+     * that implement this kernel must be recompiled against this version of the header.
+     *
+     * @param io                  an object that coordinates data transfer
+     * @param periodicBoxVectors  the vectors defining the periodic box (measured in nm)
+     * @param includeEnergy       true if potential energy should be computed
+     * @param includeForces       true if forces should be computed
+     */
+    virtual void beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeEnergy, bool includeForces) {
+        beginComputation(io, periodicBoxVectors, includeEnergy);
+    }
     /**
      * Finish computing the force and energy.
      * 
@@ -1590,6 +1613,20 @@ public:
      * @param includeEnergy       true if potential energy should be computed
      */
     virtual void beginComputation(CalcPmeReciprocalForceKernel::IO& io, const Vec3* periodicBoxVectors, bool includeEnergy) = 0;
+    /**
+     * Begin computing the energy, and optionally the force.  Kernels that can skip the force
+     * calculation when it is not needed should override this.  The default implementation always
+     * computes forces.  Adding this virtual method changed the layout of the class, so plugins
+     * that implement this kernel must be recompiled against this version of the header.
+     *
+     * @param io                  an object that coordinates data transfer
+     * @param periodicBoxVectors  the vectors defining the periodic box (measured in nm)
+     * @param includeEnergy       true if potential energy should be computed
+     * @param includeForces       true if forces should be computed
+     */
+    virtual void beginComputation(CalcPmeReciprocalForceKernel::IO& io, const Vec3* periodicBoxVectors, bool includeEnergy, bool includeForces) {
+        beginComputation(io, periodicBoxVectors, includeEnergy);
+    }
     /**
      * Finish computing the force and energy.
      * 
@@ -125,6 +125,33 @@ public:
      * and energies.  Group i will be included if (groups&(1<<i)) != 0.  The default value includes all groups.
      */
     State getState(int types, bool enforcePeriodicBox=false, int groups=0xFFFFFFFF) const;
+    /**
+     * Get the potential energy of each force group.  This gives the same result as calling
+     * getState(State::Energy, false, 1<<i) for every group i, but is usually much faster, because
+     * work shared by all groups (such as updating neighbor lists) is done only once.
+     *
+     * @param groups a set of bit flags for which force groups to compute energies for.  Group i will be
+     * included if (groups&(1<<i)) != 0.  The default value includes all groups.
+     * @return a vector of length 32, where element i is the potential energy of force group i (measured in kJ/mol),
+     * or 0 if that group was not included
+     */
+    std::vector<double> getPotentialEnergyByGroup(int groups=0xFFFFFFFF) const;
+    /**
+     * Get the potential energy of the current configuration for each of a list of sets of parameter values.
+     * This gives the same result as calling setParameter() for every parameter in a set followed by
+     * getState(State::Energy, false, groups), but is usually much faster.  Forces that do not depend on
+     * any of the parameters being varied are evaluated only once, and work shared by all sets (such as
+     * updating neighbor lists) is done only once.  This is useful for free energy methods such as MBAR
+     * that need the energy of each configuration in many thermodynamic states.  When this method returns,
+     * all parameters have the same values they had before it was called.
+     *
+     * @param parameterSets each element is a map of parameter names to values.  Any parameter that does not
+     * appear in a set keeps its current value for that set.
+     * @param groups a set of bit flags for which force groups to include.  Group i will be included
+     * if (groups&(1<<i)) != 0.  The default value includes all groups.
+     * @return the potential energy (measured in kJ/mol) for each element of parameterSets
+     */
+    std::vector<double> getPotentialEnergyForParameters(const std::vector<std::map<std::string, double> >& parameterSets, int groups=0xFFFFFFFF) const;
     /**
      * Copy information from a State object into this Context.  This restores the Context to
      * approximately the same state it was in when the State was created.  If the State does not include
@@ -260,6 +287,10 @@ public:
      * with different versions of OpenMM are also often incompatible.  If a checkpoint cannot be loaded,
      * that is signaled by throwing an exception.
      * 
+     * Checkpoints created by the CPU platform before it saved the state of its random number generators
+     * can still be loaded.  In rare cases, telling them apart from newer checkpoints requires rewinding
+     * the stream, so loading one from a stream that does not support seeking may throw an exception.
+     * 
      * @param stream    an input stream the checkpoint data should be read from
      */
     void loadCheckpoint(std::istream& stream);
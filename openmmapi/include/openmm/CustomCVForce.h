@@ -251,6 +251,13 @@ public:
      * call updateParametersInContext() on it, you need to pass that inner Context to it.
      * This method returns a reference to it.
      * 
+     * On some platforms (currently Reference and CPU), the inner Context does not keep its own
+     * copy of the particle positions, velocities, and periodic box vectors.  It directly uses the
+     * ones stored in the outer Context.  Calling setPositions(), setVelocities(), setState(), or
+     * setPeriodicBoxVectors() on the inner Context, or loading a checkpoint into it, therefore
+     * throws an exception on those platforms.  Modify the outer Context instead.  Likewise, you
+     * should never step the inner Context's integrator or apply constraints to it.
+     * 
      * @param context    the Context containing the CustomCVForce
      * @return the inner Context used to evaluate the collective variables
      */
@@ -196,6 +196,28 @@ public:
      * @return the potential energy of the system, or 0 if includeEnergy is false
      */
     double calcForcesAndEnergy(bool includeForces, bool includeEnergy, int groups=0xFFFFFFFF);
+    /**
+     * Calculate the potential energy of each force group (in kJ/mol).  When possible this is done in a
+     * single evaluation: the platform's setup and cleanup run once, and each ForceImpl is invoked
+     * separately for each group it belongs to.
+     *
+     * @param groups   a set of bit flags for which force groups to include.  Group i will be included
+     *                 if (groups&(1<<i)) != 0.
+     * @return a vector of length 32, where element i is the energy of group i, or 0 if it was not included
+     */
+    std::vector<double> calcEnergyByGroup(int groups=0xFFFFFFFF);
+    /**
+     * Calculate the potential energy (in kJ/mol) for each of a list of sets of parameter values.  Forces
+     * that do not depend on any of the parameters being varied are evaluated only once and their
+     * energy is shared by all sets.  On return, all parameters have their original values.
+     *
+     * @param parameterSets  each element is a map of parameter names to values.  Parameters not
+     *                       listed keep their current values.
+     * @param groups         a set of bit flags for which force groups to include.  Group i will be included
+     *                       if (groups&(1<<i)) != 0.
+     * @return the potential energy for each element of parameterSets
+     */
+    std::vector<double> calcEnergyForParameters(const std::vector<std::map<std::string, double> >& parameterSets, int groups=0xFFFFFFFF);
     /**
      * Get the set of force group flags that were passed to the most recent call to calcForcesAndEnergy().
      * 
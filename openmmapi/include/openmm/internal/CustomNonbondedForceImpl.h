@@ -39,15 +39,19 @@
 #include <utility>
 #include <map>
 #include <string>
+#include <vector>
 
 namespace OpenMM {
 
+class ThreadPool;
+
 /**
  * This is the internal implementation of CustomNonbondedForce.
  */
 
 class OPENMM_EXPORT CustomNonbondedForceImpl : public ForceImpl {
 public:
+    class LongRangeCorrectionData;
     CustomNonbondedForceImpl(const CustomNonbondedForce& owner);
     ~CustomNonbondedForceImpl();
     void initialize(ContextImpl& context);
@@ -67,13 +71,59 @@ public:
      * also compute the corresponding derivatives of the correction.
      */
     static void calcLongRangeCorrection(const CustomNonbondedForce& force, const Context& context, double& coefficient, std::vector<double>& derivatives);
+    /**
+     * Analyze a force and record the information needed to compute its long range correction.  This
+     * should be called again whenever the per-particle parameters change.  Any integrals that were
+     * previously cached in the LongRangeCorrectionData are kept, so only pairs of particle classes whose
+     * parameters have changed need to be computed again.
+     */
+    static void prepareLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data);
+    /**
+     * Compute the long range correction using information that was recorded by prepareLongRangeCorrection().
+     * Integrals are cached based on the parameter values, so values that have been seen before are
+     * reused rather than recomputed.  The cache holds the integrals for the most recently used 16 sets of
+     * parameter values, and discards the least recently used ones beyond that.  This is equivalent to the
+     * other form of calcLongRangeCorrection(), but is much faster when it is called repeatedly, such as when
+     * a global parameter alternates between a few values.
+     *
+     * @param force        the force to compute the correction for
+     * @param data         the data that was created by prepareLongRangeCorrection()
+     * @param context      the Context from which to get the values of global parameters
+     * @param coefficient  on exit, the coefficient which, when divided by the box volume, gives the correction
+     * @param derivatives  on exit, the derivatives of the coefficient with respect to parameters
+     * @param threads      if not NULL, the integrals that are not already cached are computed in parallel
+     *                     on this ThreadPool
+     */
+    static void calcLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data, const Context& context,
+            double& coefficient, std::vector<double>& derivatives, ThreadPool* threads=NULL);
 private:
-    static double integrateInteraction(Lepton::CompiledExpression& expression, const std::vector<double>& params1, const std::vector<double>& params2,
-            const CustomNonbondedForce& force, const Context& context, const std::vector<std::string>& paramNames);
+    static void integrateInteraction(Lepton::CompiledExpression& expression, const std::vector<double>& params1, const std::vector<double>& params2,
+            const CustomNonbondedForce& force, const std::vector<std::string>& paramNames, std::vector<double>& result);
     const CustomNonbondedForce& owner;
     Kernel kernel;
 };
 
+/**
+ * This class holds the information needed to compute the long range correction for a CustomNonbondedForce,
+ * along with the integrals that have been computed so far.
+ */
+class CustomNonbondedForceImpl::LongRangeCorrectionData {
+public:
+    LongRangeCorrectionData();
+private:
+    friend class CustomNonbondedForceImpl;
+    bool hasCorrection;
+    int numParticles;
+    std::vector<std::vector<double> > classes;
+    std::vector<std::pair<int, int> > classPairs;
+    std::vector<long long int> pairCounts;
+    std::vector<std::string> paramNames, globalParamNames;
+    Lepton::CompiledExpression expression;
+    std::vector<Lepton::CompiledExpression> threadExpression;
+    std::map<std::vector<double>, std::pair<std::vector<double>, long long> > cache;
+    long long cacheClock;
+};
+
 } // namespace OpenMM
 
 #endif /*OPENMM_CUSTOMNONBONDEDFORCEIMPL_H_*/
@@ -34,7 +34,9 @@
 
 #define NOMINMAX
 #include "windowsExport.h"
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <pthread.h>
 #include <vector>
 
@@ -49,23 +51,67 @@ namespace OpenMM {
  * next syncThreads(), and the final call waits until they exit from the Task's execute() method.
  * After calling waitForThreads() to block at a synchronization point, the parent thread should
  * call resumeThreads() to instruct the worker threads to resume.
+ *
+ * When the parent thread has nothing else to do while the task runs, call executeAndWait() instead.
+ * This runs thread 0's share of the task on the calling thread instead of waking a worker, so all
+ * cores do useful work and one fewer thread needs to be woken.
+ *
+ * A ThreadPool may be shared by several masters running on different threads, such as Contexts that are
+ * used concurrently.  Each task is a parallel region that lasts from the call to execute() until the
+ * threads exit from the task.  Regions never overlap: a master that calls execute() while another
+ * master's region is running blocks until it is finished, and waiting masters are served in the order
+ * they arrived.
+ *
+ * By default, waiting threads block immediately, which releases their cores but means every
+ * synchronization pays the latency of waking them up.  If spin waiting is enabled, threads instead
+ * busy-wait for a short time before blocking.  This greatly reduces the cost of each synchronization
+ * when tasks are short and follow each other quickly, at the cost of extra CPU time while waiting.
  */
 class OPENMM_EXPORT ThreadPool {
 public:
     class Task;
     class ThreadData;
+    class WorkQueue;
     /**
      * Create a ThreadPool.
      *
      * @param numThreads  the number of worker threads to create.  If this is 0 (the default), the
      *                    number of threads is set equal to the number of logical CPU cores available
+     * @param spinWait    if true, threads waiting at synchronization points busy-wait for a short
+     *                    time before blocking
      */
-    ThreadPool(int numThreads=0);
+    ThreadPool(int numThreads=0, bool spinWait=false);
     ~ThreadPool();
+    /**
+     * Get a ThreadPool that is shared by everything in the process that requests the same settings.
+     * The pool is created the first time it is requested, and deleted when the last reference to it
+     * is released.
+     *
+     * @param numThreads  the number of worker threads.  If this is 0 (the default), the number of threads
+     *                    is set equal to the number of logical CPU cores available
+     * @param spinWait    if true, threads waiting at synchronization points busy-wait for a short
+     *                    time before blocking
+     * @param cores       the cores to bind the worker threads to, as for setThreadAffinity()
+     */
+    static std::shared_ptr<ThreadPool> getSharedThreadPool(int numThreads=0, bool spinWait=false, const std::vector<int>& cores=std::vector<int>());
     /**
      * Get the number of worker threads in the pool.
      */
     int getNumThreads() const;
+    /**
+     * Get whether threads busy-wait for a short time before blocking.
+     */
+    bool getSpinWait() const;
+    /**
+     * Bind the worker threads to specific processor cores.  Worker thread i is bound to the core
+     * cores[i%cores.size()].  If cores is empty, this has no effect.  This is currently only supported on
+     * Linux, and has no effect on other operating systems.  Once the threads are bound, executeAndWait()
+     * runs thread 0's share of the work on the first worker thread instead of the calling thread, so every
+     * thread index keeps running on its own core.
+     *
+     * @param cores  the indices of the cores to bind the worker threads to
+     */
+    void setThreadAffinity(const std::vector<int>& cores);
     /**
      * Execute a Task in parallel on the worker threads.
      */
@@ -74,6 +120,15 @@ public:
      * Execute a function in parallel on the worker threads.
      */
     void execute(std::function<void (ThreadPool&, int)> task);
+    /**
+     * Execute a function in parallel and block until it has completed.  The calling thread executes
+     * the function for thread index 0 itself, while the worker threads execute it for all other indices.
+     * If setThreadAffinity() has bound the worker threads to cores, all indices run on the worker threads.
+     * The function may call syncThreads(), which then acts as a barrier across all threads.  Because the
+     * calling thread is busy executing the function, it cannot do any other work between the phases;
+     * tasks that require that should use execute() instead.
+     */
+    void executeAndWait(std::function<void (ThreadPool&, int)> task);
     /**
      * This is called by the worker threads to block until all threads have reached the same point
      * and the master thread instructs them to continue by calling resumeThreads().
@@ -89,11 +144,19 @@ public:
      */
     void resumeThreads();
 private:
-    bool isDeleted;
-    int numThreads, waitCount;
+    void beginRegion();
+    void endRegion();
+    void waitForWorkers();
+    bool isDeleted, spinWait;
+    int numThreads;
+    std::atomic<int> numActive, waitCount, generation, helperGeneration, numSleeping, tasksFinished, nextTicket, nowServing;
+    std::atomic<bool> firstWorkerSleeping, masterSleeping, callerRunning;
+    bool threadsBound;
+    std::atomic<const void*> regionOwner;
+    pthread_t callerThread;
     std::vector<pthread_t> thread;
     std::vector<ThreadData*> threadData;
-    pthread_cond_t startCondition, endCondition;
+    pthread_cond_t startCondition, firstWorkerCondition, endCondition, regionCondition;
     pthread_mutex_t lock;
     Task* currentTask;
     std::function<void (ThreadPool& pool, int)> currentFunction;
@@ -113,6 +176,59 @@ public:
     virtual void execute(ThreadPool& pool, int threadIndex) = 0;
 };
 
+/**
+ * A WorkQueue divides a range of work items among the threads of a ThreadPool, using work stealing
+ * to balance the load.  Each thread starts out owning a contiguous share of the range and takes
+ * items from the front of it.  When its own share is used up, it steals half the remaining items
+ * from the back of another thread's share.
+ *
+ * Items with nearby indices usually involve nearby atoms, so each thread mostly works on a compact
+ * region of the system, and threads only touch each other's data once the load becomes imbalanced.
+ * This avoids the contention of a single shared counter.
+ *
+ * Call reset() from the master thread while no thread is taking work, then have each thread call
+ * getNextRange() until it returns false.
+ */
+class OPENMM_EXPORT ThreadPool::WorkQueue {
+public:
+    WorkQueue();
+    ~WorkQueue();
+    /**
+     * Prepare to distribute a new range of work items.
+     *
+     * @param pool       the ThreadPool whose threads will take work from the queue
+     * @param numItems   the number of work items.  The items are numbered 0 to numItems-1.
+     * @param chunkSize  the maximum number of items returned by each call to getNextRange()
+     */
+    void reset(const ThreadPool& pool, int numItems, int chunkSize=1);
+    /**
+     * Get the next range of work items for a thread to process.
+     *
+     * @param threadIndex  the index of the thread requesting work
+     * @param start        on exit, the first item in the range
+     * @param end          on exit, one past the last item in the range
+     * @return true if a range was returned, or false if there is no work left
+     */
+    bool getNextRange(int threadIndex, int& start, int& end);
+    /**
+     * Get the next single work item for a thread to process.  This is equivalent to getNextRange(),
+     * except that it returns only one item at a time regardless of the chunk size.
+     *
+     * @param threadIndex  the index of the thread requesting work
+     * @param item         on exit, the index of the item to process
+     * @return true if an item was returned, or false if there is no work left
+     */
+    bool getNextItem(int threadIndex, int& item);
+private:
+    class Range;
+    WorkQueue(const WorkQueue&);
+    WorkQueue& operator=(const WorkQueue&);
+    bool take(int threadIndex, int count, int& start, int& end);
+    bool steal(int threadIndex);
+    Range* ranges;
+    int numRanges, chunkSize;
+};
+
 } // namespace OpenMM
 
 #endif // OPENMM_THREAD_POOL_H_
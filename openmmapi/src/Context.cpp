@@ -153,6 +153,14 @@ State Context::getState(int types, bool enforcePeriodicBox, int groups) const {
     return builder.getState();
 }
 
+vector<double> Context::getPotentialEnergyByGroup(int groups) const {
+    return impl->calcEnergyByGroup(groups);
+}
+
+vector<double> Context::getPotentialEnergyForParameters(const vector<map<string, double> >& parameterSets, int groups) const {
+    return impl->calcEnergyForParameters(parameterSets, groups);
+}
+
 void Context::setState(const State& state) {
     setTime(state.getTime());
     Vec3 a, b, c;
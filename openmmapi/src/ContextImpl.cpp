@@ -307,6 +307,108 @@ double ContextImpl::calcForcesAndEnergy(bool includeForces, bool includeEnergy,
     }
 }
 
+vector<double> ContextImpl::calcEnergyByGroup(int groups) {
+    if (!hasSetPositions)
+        throw OpenMMException("Particle positions have not been set");
+    CalcForcesAndEnergyKernel& kernel = initializeForcesKernel.getAs<CalcForcesAndEnergyKernel>();
+    vector<double> energy(32, 0.0);
+    if (!kernel.isEnergyReturnedByForces()) {
+        // The platform accumulates energy internally, so it cannot be attributed to individual
+        // groups.  Evaluate each group separately.
+
+        for (int i = 0; i < 32; i++)
+            if ((groups&(1<<i)) != 0)
+                energy[i] = calcForcesAndEnergy(false, true, 1<<i);
+        lastForceGroups = groups;
+        return energy;
+    }
+    lastForceGroups = groups;
+    while (true) {
+        kernel.beginComputation(*this, false, true, groups);
+        for (auto force : forceImpls)
+            for (int i = 0; i < 32; i++)
+                if ((groups&(1<<i)) != 0)
+                    energy[i] += force->calcForcesAndEnergy(*this, false, true, 1<<i);
+        bool valid = true;
+        kernel.finishComputation(*this, false, true, groups, valid);
+        if (valid)
+            return energy;
+        energy.assign(32, 0.0);
+    }
+}
+
+static void applyParameterSet(ContextImpl& context, const map<string, double>& paramSet, const map<string, double>& originalValues) {
+    // Parameters that are varied by other sets but not by this one are restored to their original values.
+
+    for (auto& param : originalValues) {
+        auto value = paramSet.find(param.first);
+        context.setParameter(param.first, value == paramSet.end() ? param.second : value->second);
+    }
+}
+
+vector<double> ContextImpl::calcEnergyForParameters(const vector<map<string, double> >& parameterSets, int groups) {
+    if (!hasSetPositions)
+        throw OpenMMException("Particle positions have not been set");
+
+    // Identify the parameters being varied, and which forces depend on them.
+
+    map<string, double> originalValues;
+    for (auto& paramSet : parameterSets)
+        for (auto& param : paramSet)
+            originalValues[param.first] = getParameter(param.first);
+    vector<ForceImpl*> dependentForces, independentForces;
+    for (auto force : forceImpls) {
+        bool dependent = false;
+        for (auto& param : force->getDefaultParameters())
+            if (originalValues.find(param.first) != originalValues.end())
+                dependent = true;
+        if (dependent)
+            dependentForces.push_back(force);
+        else
+            independentForces.push_back(force);
+    }
+    CalcForcesAndEnergyKernel& kernel = initializeForcesKernel.getAs<CalcForcesAndEnergyKernel>();
+    vector<double> energy(parameterSets.size());
+    try {
+        if (kernel.isEnergyReturnedByForces()) {
+            lastForceGroups = groups;
+            while (true) {
+                kernel.beginComputation(*this, false, true, groups);
+                double sharedEnergy = 0.0;
+                for (auto force : independentForces)
+                    sharedEnergy += force->calcForcesAndEnergy(*this, false, true, groups);
+                for (int i = 0; i < (int) parameterSets.size(); i++) {
+                    applyParameterSet(*this, parameterSets[i], originalValues);
+                    energy[i] = sharedEnergy;
+                    for (auto force : dependentForces)
+                        energy[i] += force->calcForcesAndEnergy(*this, false, true, groups);
+                }
+                bool valid = true;
+                kernel.finishComputation(*this, false, true, groups, valid);
+                if (valid)
+                    break;
+            }
+        }
+        else {
+            // The platform accumulates energy internally, so it cannot be attributed to individual
+            // parameter sets.  Evaluate each one separately.
+
+            for (int i = 0; i < (int) parameterSets.size(); i++) {
+                applyParameterSet(*this, parameterSets[i], originalValues);
+                energy[i] = calcForcesAndEnergy(false, true, groups);
+            }
+        }
+    }
+    catch (...) {
+        for (auto& param : originalValues)
+            setParameter(param.first, param.second);
+        throw;
+    }
+    for (auto& param : originalValues)
+        setParameter(param.first, param.second);
+    return energy;
+}
+
 int& ContextImpl::getLastForceGroups() {
     return lastForceGroups;
 }
@@ -36,6 +36,7 @@
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/internal/CustomNonbondedForceImpl.h"
 #include "openmm/internal/SplineFitter.h"
+#include "openmm/internal/ThreadPool.h"
 #include "openmm/kernels.h"
 #include "ReferenceTabulatedFunction.h"
 #include "lepton/ParsedExpression.h"
@@ -44,6 +45,7 @@
 #include <sstream>
 #include <utility>
 #include <algorithm>
+#include <atomic>
 
 using namespace OpenMM;
 using namespace std;
@@ -71,7 +73,7 @@ void CustomNonbondedForceImpl::initialize(ContextImpl& context) {
     int numParameters = owner.getNumPerParticleParameters();
     for (int i = 0; i < owner.getNumParticles(); i++) {
         owner.getParticleParameters(i, parameters);
-        if (parameters.size() != numParameters) {
+        if ((int) parameters.size() != numParameters) {
             stringstream msg;
             msg << "CustomNonbondedForce: Wrong number of parameters for particle ";
             msg << i;
@@ -158,16 +160,25 @@ void CustomNonbondedForceImpl::updateParametersInContext(ContextImpl& context) {
     context.systemChanged();
 }
 
+CustomNonbondedForceImpl::LongRangeCorrectionData::LongRangeCorrectionData() : hasCorrection(false), numParticles(0), cacheClock(0) {
+}
+
 void CustomNonbondedForceImpl::calcLongRangeCorrection(const CustomNonbondedForce& force, const Context& context, double& coefficient, vector<double>& derivatives) {
-    if (force.getNonbondedMethod() == CustomNonbondedForce::NoCutoff || force.getNonbondedMethod() == CustomNonbondedForce::CutoffNonPeriodic) {
-        coefficient = 0.0;
+    LongRangeCorrectionData data;
+    prepareLongRangeCorrection(force, data);
+    calcLongRangeCorrection(force, data, context, coefficient, derivatives);
+}
+
+void CustomNonbondedForceImpl::prepareLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data) {
+    data.hasCorrection = (force.getNonbondedMethod() == CustomNonbondedForce::CutoffPeriodic);
+    if (!data.hasCorrection)
         return;
-    }
     
     // Identify all particle classes (defined by parameters), and record the class of each particle.
     
     int numParticles = force.getNumParticles();
-    vector<vector<double> > classes;
+    vector<vector<double> >& classes = data.classes;
+    classes.clear();
     map<vector<double>, int> classIndex;
     vector<int> atomClass(numParticles);
     vector<double> parameters;
@@ -222,47 +233,170 @@ void CustomNonbondedForceImpl::calcLongRangeCorrection(const CustomNonbondedForc
                 }
         }
     }
+    data.numParticles = numParticles;
+    data.classPairs.clear();
+    data.pairCounts.clear();
+    for (auto& count : interactionCount) {
+        data.classPairs.push_back(count.first);
+        data.pairCounts.push_back(count.second);
+    }
     
-    // Compute the coefficient.
+    // Compile a single expression that computes the energy and all requested parameter derivatives.  This only
+    // needs to be done the first time, since the energy function cannot change.
     
+    if (data.expression.getNumOutputs() > 0)
+        return;
     map<string, Lepton::CustomFunction*> functions;
     for (int i = 0; i < force.getNumFunctions(); i++)
         functions[force.getTabulatedFunctionName(i)] = createReferenceTabulatedFunction(force.getTabulatedFunction(i));
-    double nPart = (double) numParticles;
-    double numInteractions = (nPart*(nPart+1))/2;
-    Lepton::CompiledExpression expression = Lepton::Parser::parse(force.getEnergyFunction(), functions).createCompiledExpression();
-    vector<string> paramNames;
+    Lepton::ParsedExpression energyExpression = Lepton::Parser::parse(force.getEnergyFunction(), functions);
+    vector<Lepton::ParsedExpression> expressions;
+    expressions.push_back(energyExpression.optimize());
+    for (int i = 0; i < force.getNumEnergyParameterDerivatives(); i++)
+        expressions.push_back(energyExpression.differentiate(force.getEnergyParameterDerivativeName(i)).optimize());
+    data.expression = Lepton::CompiledExpression(expressions);
+    for (auto& function : functions)
+        delete function.second;
+    data.paramNames.clear();
     for (int i = 0; i < force.getNumPerParticleParameters(); i++) {
         stringstream name1, name2;
         name1 << force.getPerParticleParameterName(i) << 1;
         name2 << force.getPerParticleParameterName(i) << 2;
-        paramNames.push_back(name1.str());
-        paramNames.push_back(name2.str());
+        data.paramNames.push_back(name1.str());
+        data.paramNames.push_back(name2.str());
     }
-    double sum = 0;
-    for (int i = 0; i < numClasses; i++)
-        for (int j = i; j < numClasses; j++)
-            sum += interactionCount[make_pair(i, j)]*integrateInteraction(expression, classes[i], classes[j], force, context, paramNames);
-    sum /= numInteractions;
-    coefficient = 2*M_PI*nPart*nPart*sum;
     
-    // Now do the same for parameter derivatives.
+    // Record which global parameters the integrals depend on.
     
-    int numDerivs = force.getNumEnergyParameterDerivatives();
-    derivatives.resize(numDerivs);
-    for (int k = 0; k < numDerivs; k++) {
-        expression = Lepton::Parser::parse(force.getEnergyFunction(), functions).differentiate(force.getEnergyParameterDerivativeName(k)).createCompiledExpression();
-        sum = 0;
-        for (int i = 0; i < numClasses; i++)
-            for (int j = i; j < numClasses; j++)
-                sum += interactionCount[make_pair(i, j)]*integrateInteraction(expression, classes[i], classes[j], force, context, paramNames);
-        sum /= numInteractions;
-        derivatives[k] = 2*M_PI*nPart*nPart*sum;
+    const set<string>& variables = data.expression.getVariables();
+    data.globalParamNames.clear();
+    for (int i = 0; i < force.getNumGlobalParameters(); i++)
+        if (variables.find(force.getGlobalParameterName(i)) != variables.end())
+            data.globalParamNames.push_back(force.getGlobalParameterName(i));
+}
+
+void CustomNonbondedForceImpl::calcLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data, const Context& context,
+            double& coefficient, vector<double>& derivatives, ThreadPool* threads) {
+    if (!data.hasCorrection) {
+        coefficient = 0.0;
+        return;
+    }
+    if (data.expression.getVariables().find("r") == data.expression.getVariables().end())
+        throw OpenMMException("CustomNonbondedForce: Cannot use long range correction with a force that does not depend on r.");
+    
+    // The cache is keyed by the parameters of the two classes, followed by the values of the global parameters.
+    // Each entry records when it was last used, so the least recently used ones can be discarded.
+    
+    long long currentTime = ++data.cacheClock;
+    vector<double> globalValues;
+    for (auto& name : data.globalParamNames)
+        globalValues.push_back(context.getParameter(name));
+    int numPairs = data.classPairs.size();
+    vector<vector<double>*> pairIntegrals(numPairs);
+    vector<int> pairsToCompute;
+    for (int i = 0; i < numPairs; i++) {
+        // The expression is symmetric, so order the two classes consistently to make the best use of the cache.
+        
+        const vector<double>* params1 = &data.classes[data.classPairs[i].first];
+        const vector<double>* params2 = &data.classes[data.classPairs[i].second];
+        if (*params2 < *params1)
+            swap(params1, params2);
+        vector<double> key = *params1;
+        key.insert(key.end(), params2->begin(), params2->end());
+        key.insert(key.end(), globalValues.begin(), globalValues.end());
+        auto entry = data.cache.find(key);
+        if (entry == data.cache.end()) {
+            entry = data.cache.insert(make_pair(key, make_pair(vector<double>(), currentTime))).first;
+            pairsToCompute.push_back(i);
+        }
+        entry->second.second = currentTime;
+        pairIntegrals[i] = &entry->second.first;
     }
+    
+    // Compute any integrals that were not found in the cache.  Each thread needs its own copy of the expression.
+    
+    if (pairsToCompute.size() > 0) {
+        int numThreads = (threads == NULL ? 1 : threads->getNumThreads());
+        while ((int) data.threadExpression.size() < numThreads)
+            data.threadExpression.push_back(data.expression);
+        for (int i = 0; i < numThreads; i++) {
+            Lepton::CompiledExpression& expression = data.threadExpression[i];
+            for (int j = 0; j < (int) globalValues.size(); j++)
+                expression.getVariableReference(data.globalParamNames[j]) = globalValues[j];
+        }
+        atomic<int> nextIndex(0);
+        vector<string> errors(numThreads);
+        auto computeIntegrals = [&] (int threadIndex) {
+            try {
+                while (true) {
+                    int index = nextIndex++;
+                    if (index >= (int) pairsToCompute.size())
+                        break;
+                    int pair = pairsToCompute[index];
+                    integrateInteraction(data.threadExpression[threadIndex], data.classes[data.classPairs[pair].first],
+                            data.classes[data.classPairs[pair].second], force, data.paramNames, *pairIntegrals[pair]);
+                }
+            }
+            catch (exception& ex) {
+                errors[threadIndex] = ex.what();
+                nextIndex = pairsToCompute.size();
+            }
+        };
+        if (threads == NULL)
+            computeIntegrals(0);
+        else {
+            threads->executeAndWait([&] (ThreadPool& pool, int threadIndex) { computeIntegrals(threadIndex); });
+        }
+        for (auto& error : errors)
+            if (error.size() > 0) {
+                // Remove the incomplete entries so they will not be used later.
+                
+                for (auto iter = data.cache.begin(); iter != data.cache.end(); )
+                    if (iter->second.first.size() == 0)
+                        iter = data.cache.erase(iter);
+                    else
+                        ++iter;
+                throw OpenMMException(error);
+            }
+    }
+    
+    // If the cache holds more than 16 sets of parameter values, discard the least recently used entries.  The
+    // ones used in this call are the most recent, so they are always kept.
+    
+    const int maxCacheSize = 16*numPairs;
+    if ((int) data.cache.size() > maxCacheSize) {
+        vector<long long> lastUsed;
+        for (auto& entry : data.cache)
+            lastUsed.push_back(entry.second.second);
+        int numToRemove = data.cache.size()-maxCacheSize;
+        nth_element(lastUsed.begin(), lastUsed.begin()+numToRemove-1, lastUsed.end());
+        long long threshold = lastUsed[numToRemove-1];
+        for (auto iter = data.cache.begin(); iter != data.cache.end() && numToRemove > 0; )
+            if (iter->second.second <= threshold) {
+                iter = data.cache.erase(iter);
+                numToRemove--;
+            }
+            else
+                ++iter;
+    }
+    
+    // Compute the coefficient and derivatives.
+    
+    int numOutputs = data.expression.getNumOutputs();
+    vector<double> sum(numOutputs, 0.0);
+    for (int i = 0; i < numPairs; i++)
+        for (int j = 0; j < numOutputs; j++)
+            sum[j] += data.pairCounts[i]*(*pairIntegrals[i])[j];
+    double nPart = (double) data.numParticles;
+    double numInteractions = (nPart*(nPart+1))/2;
+    coefficient = 2*M_PI*nPart*nPart*sum[0]/numInteractions;
+    derivatives.resize(numOutputs-1);
+    for (int i = 1; i < numOutputs; i++)
+        derivatives[i-1] = 2*M_PI*nPart*nPart*sum[i]/numInteractions;
 }
 
-double CustomNonbondedForceImpl::integrateInteraction(Lepton::CompiledExpression& expression, const vector<double>& params1, const vector<double>& params2,
-        const CustomNonbondedForce& force, const Context& context, const vector<string>& paramNames) {
+void CustomNonbondedForceImpl::integrateInteraction(Lepton::CompiledExpression& expression, const vector<double>& params1, const vector<double>& params2,
+        const CustomNonbondedForce& force, const vector<string>& paramNames, vector<double>& result) {
     const set<string>& variables = expression.getVariables();
     for (int i = 0; i < force.getNumPerParticleParameters(); i++) {
         if (variables.find(paramNames[2*i]) != variables.end())
@@ -270,29 +404,23 @@ double CustomNonbondedForceImpl::integrateInteraction(Lepton::CompiledExpression
         if (variables.find(paramNames[2*i+1]) != variables.end())
             expression.getVariableReference(paramNames[2*i+1]) = params2[i];
     }
-    for (int i = 0; i < force.getNumGlobalParameters(); i++) {
-        const string& name = force.getGlobalParameterName(i);
-        if (variables.find(name) != variables.end())
-            expression.getVariableReference(name) = context.getParameter(name);
-    }
+    
+    // The expression computes the energy and its parameter derivatives together.  They are all integrated at
+    // once, but each one stops being updated as soon as it has converged.
     
     // To integrate from r_cutoff to infinity, make the change of variables x=r_cutoff/r and integrate from 0 to 1.
     // This introduces another r^2 into the integral, which along with the r^2 in the formula for the correction
     // means we multiply the function by r^4.  Use the midpoint method.
 
-    double* rPointer;
-    try {
-        rPointer = &expression.getVariableReference("r");
-    }
-    catch (exception& ex) {
-        throw OpenMMException("CustomNonbondedForce: Cannot use long range correction with a force that does not depend on r.");
-    }
+    double* rPointer = &expression.getVariableReference("r");
+    int numOutputs = expression.getNumOutputs();
     double cutoff = force.getCutoffDistance();
-    double sum = 0;
+    vector<double> sum(numOutputs, 0.0), newSum(numOutputs);
+    vector<bool> converged(numOutputs, false);
+    int numConverged = 0;
     int numPoints = 1;
     for (int iteration = 0; ; iteration++) {
-        double oldSum = sum;
-        double newSum = 0;
+        newSum.assign(numOutputs, 0.0);
         for (int i = 0; i < numPoints; i++) {
             if (i%3 == 1)
                 continue;
@@ -300,10 +428,21 @@ double CustomNonbondedForceImpl::integrateInteraction(Lepton::CompiledExpression
             double r = cutoff/x;
             *rPointer = r;
             double r2 = r*r;
-            newSum += expression.evaluate()*r2*r2;
+            expression.evaluate();
+            for (int j = 0; j < numOutputs; j++)
+                newSum[j] += expression.getOutputValue(j)*r2*r2;
         }
-        sum = newSum/numPoints + oldSum/3;
-        if (iteration > 2 && (fabs((sum-oldSum)/sum) < 1e-5 || sum == 0))
+        for (int j = 0; j < numOutputs; j++) {
+            if (converged[j])
+                continue;
+            double oldSum = sum[j];
+            sum[j] = newSum[j]/numPoints + oldSum/3;
+            if (iteration > 2 && (fabs((sum[j]-oldSum)/sum[j]) < 1e-5 || sum[j] == 0)) {
+                converged[j] = true;
+                numConverged++;
+            }
+        }
+        if (numConverged == numOutputs)
             break;
         if (iteration == 8)
             throw OpenMMException("CustomNonbondedForce: Long range correction did not converge.  Does the energy go to 0 faster than 1/r^2?");
@@ -312,14 +451,14 @@ double CustomNonbondedForceImpl::integrateInteraction(Lepton::CompiledExpression
     
     // If a switching function is used, integrate over the switching interval.
     
-    double sum2 = 0;
+    vector<double> sum2(numOutputs, 0.0);
     if (force.getUseSwitchingFunction()) {
         double rswitch = force.getSwitchingDistance();
-        sum2 = 0;
+        converged.assign(numOutputs, false);
+        numConverged = 0;
         numPoints = 1;
         for (int iteration = 0; ; iteration++) {
-            double oldSum = sum2;
-            double newSum = 0;
+            newSum.assign(numOutputs, 0.0);
             for (int i = 0; i < numPoints; i++) {
                 if (i%3 == 1)
                     continue;
@@ -327,16 +466,30 @@ double CustomNonbondedForceImpl::integrateInteraction(Lepton::CompiledExpression
                 double r = rswitch+x*(cutoff-rswitch);
                 double switchValue = x*x*x*(10+x*(-15+x*6));
                 *rPointer = r;
-                newSum += switchValue*expression.evaluate()*r*r;
+                expression.evaluate();
+                for (int j = 0; j < numOutputs; j++)
+                    newSum[j] += switchValue*expression.getOutputValue(j)*r*r;
+            }
+            for (int j = 0; j < numOutputs; j++) {
+                if (converged[j])
+                    continue;
+                double oldSum = sum2[j];
+                sum2[j] = newSum[j]/numPoints + oldSum/3;
+                if (iteration > 2 && (fabs((sum2[j]-oldSum)/sum2[j]) < 1e-5 || sum2[j] == 0)) {
+                    converged[j] = true;
+                    numConverged++;
+                }
             }
-            sum2 = newSum/numPoints + oldSum/3;
-            if (iteration > 2 && (fabs((sum2-oldSum)/sum2) < 1e-5 || sum2 == 0))
+            if (numConverged == numOutputs)
                 break;
             if (iteration == 8)
                 throw OpenMMException("CustomNonbondedForce: Long range correction did not converge.  Is the energy finite everywhere in the switching interval?");
             numPoints *= 3;
         }
-        sum2 *= cutoff-rswitch;
+        for (int j = 0; j < numOutputs; j++)
+            sum2[j] *= cutoff-rswitch;
     }
-    return sum/cutoff+sum2;
+    result.resize(numOutputs);
+    for (int j = 0; j < numOutputs; j++)
+        result[j] = sum[j]/cutoff+sum2[j];
 }
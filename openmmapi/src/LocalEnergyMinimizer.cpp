@@ -35,6 +35,7 @@
 #include "openmm/VerletIntegrator.h"
 #include "lbfgs.h"
 #include <cmath>
+#include <map>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -69,7 +70,13 @@ struct MinimizerData {
             catch (...) {
                 cpuPlatform = &Platform::getPlatformByName("Reference");
             }
-            cpuContext = new Context(context.getSystem(), cpuIntegrator, *cpuPlatform);
+            // Use the CPU platform's shared threads, so this does not add another full set of threads for
+            // every context being minimized.
+
+            map<string, string> properties;
+            if (cpuPlatform->getName() == "CPU")
+                properties["SharedThreadPool"] = "true";
+            cpuContext = new Context(context.getSystem(), cpuIntegrator, *cpuPlatform, properties);
             cpuContext->setState(context.getState(State::Positions | State::Velocities | State::Parameters));
         }
         return *cpuContext;
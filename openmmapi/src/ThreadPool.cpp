@@ -31,11 +31,42 @@
 
 #include "openmm/internal/ThreadPool.h"
 #include "openmm/internal/hardware.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <thread>
+#ifdef __linux__
+    #include <sched.h>
+#endif
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define PAUSE_CPU() _mm_pause()
+#else
+    #define PAUSE_CPU()
+#endif
 
 using namespace std;
 
 namespace OpenMM {
 
+/**
+ * The number of iterations a thread spins for before blocking, when spin waiting is enabled.
+ * This corresponds to roughly 50-500 microseconds depending on the processor.
+ */
+static const int SPIN_ITERATIONS = 20000;
+
+/**
+ * Pause briefly while spin waiting.  Every so often this yields the processor, so that a spinning
+ * thread does not starve the threads it is waiting for if there are more threads than cores.
+ */
+static void spinPause(int iteration) {
+    if (iteration%256 == 255)
+        this_thread::yield();
+    else
+        PAUSE_CPU();
+}
+
 class ThreadPool::ThreadData {
 public:
     ThreadData(ThreadPool& owner, int index) : owner(owner), index(index), isDeleted(false) {
@@ -45,16 +76,26 @@ public:
             owner.currentTask->execute(owner, index);
         else
             owner.currentFunction(owner, index);
+        owner.tasksFinished++;
     }
     ThreadPool& owner;
     int index;
     bool isDeleted;
-    Task* currentTask;
-    function<void (ThreadPool& pool, int)> currentFunction;
 };
 
+/**
+ * The ThreadData for the worker thread that is currently running, or NULL if it is not a worker thread.
+ */
+static thread_local ThreadPool::ThreadData* currentThreadData = NULL;
+
+/**
+ * The address of this variable identifies the current thread as the owner of a parallel region.
+ */
+static thread_local char regionOwnerTag;
+
 static void* threadBody(void* args) {
     ThreadPool::ThreadData& data = *reinterpret_cast<ThreadPool::ThreadData*>(args);
+    currentThreadData = &data;
     while (true) {
         // Wait for the signal to start running.
         
@@ -67,75 +108,371 @@ static void* threadBody(void* args) {
     return 0;
 }
 
-ThreadPool::ThreadPool(int numThreads) : currentTask(NULL) {
+ThreadPool::ThreadPool(int numThreads, bool spinWait) : spinWait(spinWait), waitCount(0), generation(0), helperGeneration(0),
+        numSleeping(0), tasksFinished(0), nextTicket(0), nowServing(0), firstWorkerSleeping(false), masterSleeping(false),
+        callerRunning(false), threadsBound(false), regionOwner(NULL), currentTask(NULL) {
     if (numThreads <= 0)
         numThreads = getNumProcessors();
     this->numThreads = numThreads;
+    numActive = numThreads;
     pthread_cond_init(&startCondition, NULL);
+    pthread_cond_init(&firstWorkerCondition, NULL);
     pthread_cond_init(&endCondition, NULL);
+    pthread_cond_init(&regionCondition, NULL);
     pthread_mutex_init(&lock, NULL);
     thread.resize(numThreads);
-    pthread_mutex_lock(&lock);
-    waitCount = 0;
     for (int i = 0; i < numThreads; i++) {
         ThreadData* data = new ThreadData(*this, i);
         data->isDeleted = false;
         threadData.push_back(data);
         pthread_create(&thread[i], NULL, threadBody, data);
     }
-    while (waitCount < numThreads)
-        pthread_cond_wait(&endCondition, &lock);
-    pthread_mutex_unlock(&lock);
+    waitForThreads();
 }
 
 ThreadPool::~ThreadPool() {
     for (auto data : threadData)
         data->isDeleted = true;
-    pthread_mutex_lock(&lock);
-    pthread_cond_broadcast(&startCondition);
-    pthread_mutex_unlock(&lock);
+    resumeThreads();
     for (auto t : thread)
         pthread_join(t, NULL);
     pthread_mutex_destroy(&lock);
     pthread_cond_destroy(&startCondition);
+    pthread_cond_destroy(&firstWorkerCondition);
     pthread_cond_destroy(&endCondition);
+    pthread_cond_destroy(&regionCondition);
+}
+
+shared_ptr<ThreadPool> ThreadPool::getSharedThreadPool(int numThreads, bool spinWait, const vector<int>& cores) {
+    static pthread_mutex_t sharedPoolsLock = PTHREAD_MUTEX_INITIALIZER;
+    static map<string, weak_ptr<ThreadPool> > sharedPools;
+    if (numThreads <= 0)
+        numThreads = getNumProcessors();
+    stringstream key;
+    key << numThreads << " " << spinWait;
+    for (int core : cores)
+        key << " " << core;
+    pthread_mutex_lock(&sharedPoolsLock);
+    shared_ptr<ThreadPool> threads = sharedPools[key.str()].lock();
+    if (threads == NULL) {
+        try {
+            threads = make_shared<ThreadPool>(numThreads, spinWait);
+            threads->setThreadAffinity(cores);
+        }
+        catch (...) {
+            pthread_mutex_unlock(&sharedPoolsLock);
+            throw;
+        }
+        sharedPools[key.str()] = threads;
+    }
+    pthread_mutex_unlock(&sharedPoolsLock);
+    return threads;
 }
 
 int ThreadPool::getNumThreads() const {
     return numThreads;
 }
 
+bool ThreadPool::getSpinWait() const {
+    return spinWait;
+}
+
+void ThreadPool::setThreadAffinity(const vector<int>& cores) {
+    if (cores.size() == 0)
+        return;
+#ifdef __linux__
+    for (int i = 0; i < numThreads; i++) {
+        int core = cores[i%cores.size()];
+        if (core < 0 || core >= CPU_SETSIZE) {
+            stringstream message;
+            message << "Illegal core index for thread affinity: " << core;
+            throw OpenMMException(message.str());
+        }
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(core, &cpuSet);
+        if (pthread_setaffinity_np(thread[i], sizeof(cpuSet), &cpuSet) != 0) {
+            stringstream message;
+            message << "Failed to bind thread to core " << core;
+            throw OpenMMException(message.str());
+        }
+    }
+    threadsBound = true;
+#endif
+}
+
 void ThreadPool::execute(Task& task) {
+    beginRegion();
     currentTask = &task;
     resumeThreads();
 }
 
 void ThreadPool::execute(function<void (ThreadPool&, int)> task) {
+    beginRegion();
     currentTask = NULL;
     currentFunction = task;
     resumeThreads();
 }
 
+void ThreadPool::executeAndWait(function<void (ThreadPool&, int)> task) {
+    if (threadsBound) {
+        // The calling thread is not bound to a core, so running thread 0's share here would move it away
+        // from the memory the first worker allocated.  Run it on the first worker instead, and act as the
+        // master thread for any synchronization points.
+
+        beginRegion();
+        currentTask = NULL;
+        currentFunction = task;
+        resumeThreads();
+        waitForWorkers();
+        while (tasksFinished < numThreads) {
+            resumeThreads();
+            waitForWorkers();
+        }
+        endRegion();
+        return;
+    }
+
+    // Wake up workers 1 through numThreads-1, and execute thread 0's share of the work on this thread.
+    // The first worker thread is left sleeping.
+
+    beginRegion();
+    currentTask = NULL;
+    currentFunction = task;
+    callerThread = pthread_self();
+    callerRunning = true;
+    numActive = numThreads-1;
+    resumeThreads();
+    task(*this, 0);
+    waitForWorkers();
+    callerRunning = false;
+    numActive = numThreads;
+    endRegion();
+}
+
+void ThreadPool::beginRegion() {
+    // If this thread already owns the current region, it is calling execute() again in the middle of a task
+    // to restart the threads.  That continues the same region.
+
+    if (regionOwner == &regionOwnerTag)
+        return;
+
+    // Take a ticket and wait until it is called.  This serves masters in the order they arrive.
+
+    int ticket = nextTicket++;
+    if (nowServing != ticket) {
+        pthread_mutex_lock(&lock);
+        while (nowServing != ticket)
+            pthread_cond_wait(&regionCondition, &lock);
+        pthread_mutex_unlock(&lock);
+    }
+    regionOwner = &regionOwnerTag;
+    tasksFinished = 0;
+}
+
+void ThreadPool::endRegion() {
+    regionOwner = NULL;
+    if (++nowServing != nextTicket) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_broadcast(&regionCondition);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+// The waiting and waking sides below each write one atomic variable and then read another
+// (waitCount and masterSleeping, or the generation counters and numSleeping or firstWorkerSleeping).  Since all these operations
+// are sequentially consistent, at least one side always sees the other's write, so either the
+// waiter notices it need not block or the waker notices it must signal.  The mutex is only
+// used when a thread actually blocks.
+
 void ThreadPool::syncThreads() {
-    pthread_mutex_lock(&lock);
-    waitCount++;
-    pthread_cond_signal(&endCondition);
-    pthread_cond_wait(&startCondition, &lock);
-    pthread_mutex_unlock(&lock);
+    if (callerRunning && pthread_equal(pthread_self(), callerThread)) {
+        // The calling thread is executing thread 0 inside executeAndWait(), so it takes the role of the
+        // master thread as well: wait for the other threads to get here, then let them continue.
+
+        waitForThreads();
+        resumeThreads();
+        return;
+    }
+
+    // The first worker is only woken by execute() and the resumeThreads() calls that follow it, since
+    // executeAndWait() runs its share of the work on the calling thread.  The others are woken by both.
+
+    bool isFirstWorker = (currentThreadData != NULL && &currentThreadData->owner == this && currentThreadData->index == 0);
+    int currentGeneration = generation;
+    int currentHelperGeneration = helperGeneration;
+    auto isWaiting = [&] () {
+        return (generation == currentGeneration && (isFirstWorker || helperGeneration == currentHelperGeneration));
+    };
+    if (++waitCount == numActive && masterSleeping) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&endCondition);
+        pthread_mutex_unlock(&lock);
+    }
+    if (spinWait)
+        for (int i = 0; i < SPIN_ITERATIONS && isWaiting(); i++)
+            spinPause(i);
+    if (isWaiting()) {
+        pthread_mutex_lock(&lock);
+        if (isFirstWorker) {
+            firstWorkerSleeping = true;
+            while (isWaiting())
+                pthread_cond_wait(&firstWorkerCondition, &lock);
+            firstWorkerSleeping = false;
+        }
+        else {
+            numSleeping++;
+            while (isWaiting())
+                pthread_cond_wait(&startCondition, &lock);
+            numSleeping--;
+        }
+        pthread_mutex_unlock(&lock);
+    }
 }
 
 void ThreadPool::waitForThreads() {
-    pthread_mutex_lock(&lock);
-    while (waitCount < numThreads)
-        pthread_cond_wait(&endCondition, &lock);
-    pthread_mutex_unlock(&lock);
+    waitForWorkers();
+
+    // If all threads have exited from the task, the region is over and another master may start one.
+
+    if (tasksFinished == numActive && !callerRunning)
+        endRegion();
+}
+
+void ThreadPool::waitForWorkers() {
+    if (spinWait)
+        for (int i = 0; i < SPIN_ITERATIONS && waitCount < numActive; i++)
+            spinPause(i);
+    if (waitCount < numActive) {
+        pthread_mutex_lock(&lock);
+        masterSleeping = true;
+        while (waitCount < numActive)
+            pthread_cond_wait(&endCondition, &lock);
+        masterSleeping = false;
+        pthread_mutex_unlock(&lock);
+    }
 }
 
 void ThreadPool::resumeThreads() {
-    pthread_mutex_lock(&lock);
     waitCount = 0;
-    pthread_cond_broadcast(&startCondition);
-    pthread_mutex_unlock(&lock);
+    bool wakeFirstWorker = !callerRunning;
+    if (wakeFirstWorker)
+        generation++;
+    else
+        helperGeneration++;
+    if (numSleeping > 0) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_broadcast(&startCondition);
+        pthread_mutex_unlock(&lock);
+    }
+    if (wakeFirstWorker && firstWorkerSleeping) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&firstWorkerCondition);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+/**
+ * The range of work items currently owned by one thread.  The first and last items are packed into a single
+ * 64 bit value so that both can be updated with one compare-and-swap.  It is padded to fill a cache line, so
+ * threads taking work from their own ranges do not interfere with each other.
+ */
+class ThreadPool::WorkQueue::Range {
+public:
+    static long long pack(int start, int end) {
+        return (long long) (((unsigned long long) (unsigned int) start << 32) | (unsigned int) end);
+    }
+    static int getStart(long long value) {
+        return (int) (value >> 32);
+    }
+    static int getEnd(long long value) {
+        return (int) (unsigned int) value;
+    }
+    Range() : value(0) {
+    }
+    std::atomic<long long> value;
+    char padding[64-sizeof(std::atomic<long long>)];
+};
+
+ThreadPool::WorkQueue::WorkQueue() : ranges(NULL), numRanges(0), chunkSize(1) {
+}
+
+ThreadPool::WorkQueue::~WorkQueue() {
+    if (ranges != NULL)
+        delete[] ranges;
+}
+
+void ThreadPool::WorkQueue::reset(const ThreadPool& pool, int numItems, int chunkSize) {
+    int numThreads = pool.getNumThreads();
+    if (numThreads != numRanges) {
+        if (ranges != NULL)
+            delete[] ranges;
+        ranges = new Range[numThreads];
+        numRanges = numThreads;
+    }
+    this->chunkSize = max(1, chunkSize);
+    for (int i = 0; i < numThreads; i++) {
+        int start = (int) ((long long) i*numItems/numThreads);
+        int end = (int) ((long long) (i+1)*numItems/numThreads);
+        ranges[i].value = Range::pack(start, end);
+    }
+}
+
+bool ThreadPool::WorkQueue::getNextRange(int threadIndex, int& start, int& end) {
+    return take(threadIndex, chunkSize, start, end);
+}
+
+bool ThreadPool::WorkQueue::getNextItem(int threadIndex, int& item) {
+    int end;
+    return take(threadIndex, 1, item, end);
+}
+
+bool ThreadPool::WorkQueue::take(int threadIndex, int count, int& start, int& end) {
+    Range& range = ranges[threadIndex];
+    long long value = range.value;
+    while (true) {
+        int first = Range::getStart(value);
+        int last = Range::getEnd(value);
+        if (first < last) {
+            int next = min(first+count, last);
+            if (range.value.compare_exchange_weak(value, Range::pack(next, last))) {
+                start = first;
+                end = next;
+                return true;
+            }
+        }
+        else {
+            if (!steal(threadIndex))
+                return false;
+            value = range.value;
+        }
+    }
+}
+
+bool ThreadPool::WorkQueue::steal(int threadIndex) {
+    // Look for another thread with work remaining, and take half of it.  The stolen items are stored as this
+    // thread's range, which is empty, so no other thread can modify it before the store.  A thread's range
+    // only ever shrinks until it is empty, and any items stored in it afterward are ones nobody has taken yet.
+    // A range therefore never returns to a value another thread saw earlier, and a compare-and-swap based on
+    // an outdated value always fails.
+
+    for (int i = 1; i < numRanges; i++) {
+        Range& victim = ranges[(threadIndex+i)%numRanges];
+        long long value = victim.value;
+        while (true) {
+            int first = Range::getStart(value);
+            int last = Range::getEnd(value);
+            int remaining = last-first;
+            if (remaining <= 0)
+                break;
+            int count = min(remaining, max(chunkSize, remaining/2));
+            if (victim.value.compare_exchange_weak(value, Range::pack(first, last-count))) {
+                ranges[threadIndex].value = Range::pack(last-count, last);
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
 } // namespace OpenMM
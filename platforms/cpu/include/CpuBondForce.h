@@ -48,19 +48,29 @@ class OPENMM_EXPORT_CPU CpuBondForce {
 public:
     CpuBondForce();
     /**
-     * Analyze the set of bonds and decide which to compute with each thread.
+     * Analyze the set of bonds and decide which to compute with each thread.  If deterministic is true,
+     * all bonds are instead computed in order on the calling thread, so the forces and energy do not
+     * depend on the number of threads.
      */
-    void initialize(int numAtoms, int numBonds, int numAtomsPerBond, std::vector<std::vector<int> >& bondAtoms, ThreadPool& threads);
+    void initialize(int numAtoms, int numBonds, int numAtomsPerBond, std::vector<std::vector<int> >& bondAtoms, ThreadPool& threads, bool deterministic=false);
     /**
      * Compute the forces from all bonds.
      */
     void calculateForce(std::vector<OpenMM::Vec3>& atomCoordinates, std::vector<std::vector<double> >& parameters, std::vector<OpenMM::Vec3>& forces, 
             double* totalEnergy, ReferenceBondIxn& referenceBondIxn);
+    /**
+     * Compute the forces from all bonds, using a separate ReferenceBondIxn for each thread.  This should be used
+     * when the interaction holds intermediate state and cannot be shared between threads.  Each thread also
+     * accumulates derivatives with respect to parameters into its own element of threadEnergyParamDerivs,
+     * which must have one array of the appropriate length per thread.  The caller is responsible for summing them.
+     */
+    void calculateForce(std::vector<OpenMM::Vec3>& atomCoordinates, std::vector<std::vector<double> >& parameters, std::vector<OpenMM::Vec3>& forces,
+            double* totalEnergy, std::vector<ReferenceBondIxn*>& threadBondIxn, std::vector<std::vector<double> >& threadEnergyParamDerivs);
     /**
      * This routine contains the code executed by each thread.
      */
     void threadComputeForce(ThreadPool& threads, int threadIndex, std::vector<OpenMM::Vec3>& atomCoordinates, std::vector<std::vector<double> >& parameters,
-            std::vector<OpenMM::Vec3>& forces, double* totalEnergy, ReferenceBondIxn& referenceBondIxn);
+            std::vector<OpenMM::Vec3>& forces, double* totalEnergy, ReferenceBondIxn& referenceBondIxn, double* energyParamDerivs=NULL);
 private:
     bool canAssignBond(int bond, int thread, std::vector<int>& atomThread);
     void assignBond(int bond, int thread, std::vector<int>& atomThread, std::vector<int>& bondThread, std::vector<std::set<int> >& atomBonds, std::list<int>& candidateBonds);
@@ -0,0 +1,114 @@
+
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Peter Eastman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OPENMM_CPU_CUSTOM_EXTERNAL_FORCE_H__
+#define OPENMM_CPU_CUSTOM_EXTERNAL_FORCE_H__
+
+#include "AlignedArray.h"
+#include "openmm/Vec3.h"
+#include "openmm/internal/CompiledExpressionSet.h"
+#include "openmm/internal/ThreadPool.h"
+#include "lepton/CompiledExpression.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace OpenMM {
+
+class CpuCustomExternalForce {
+private:
+
+    class ThreadData;
+    ThreadPool& threads;
+    int numParameters;
+    std::vector<int> particles;
+    std::vector<double> particleParams;
+    std::vector<ThreadData*> threadData;
+    std::vector<double> threadEnergy;
+    // The following variables are used to make information accessible to the individual threads.
+    std::vector<Vec3>* atomCoordinates;
+    const std::map<std::string, double>* globalParameters;
+    std::vector<AlignedArray<float> >* threadForce;
+    bool includeForces, includeEnergy;
+
+    /**
+     * This routine contains the code executed by each thread.
+     */
+    void threadComputeForce(ThreadPool& threads, int threadIndex);
+
+public:
+    /**
+     * Create a new CpuCustomExternalForce.
+     *
+     * @param expression      a CompiledExpression whose outputs are the energy, dE/dx, dE/dy, and dE/dz, in that order
+     * @param parameterNames  the names of the per-particle parameters
+     * @param particles       the index of each particle the force is applied to
+     * @param threads         the thread pool to use
+     */
+    CpuCustomExternalForce(const Lepton::CompiledExpression& expression, const std::vector<std::string>& parameterNames,
+                           const std::vector<int>& particles, ThreadPool& threads);
+
+    ~CpuCustomExternalForce();
+
+    /**
+     * Get the index of each particle the force is applied to.
+     */
+    const std::vector<int>& getParticles() const {
+        return particles;
+    }
+
+    /**
+     * Set the per-particle parameters for one of the particles the force is applied to.
+     *
+     * @param index       the index within the force (not the particle index within the System)
+     * @param parameters  the parameter values
+     */
+    void setParticleParameters(int index, const std::vector<double>& parameters);
+
+    /**
+     * Calculate the interaction.
+     *
+     * @param atomCoordinates    atom coordinates
+     * @param globalParameters   the values of global parameters
+     * @param threadForce        the collection of arrays for each thread to add forces to
+     * @param includeForces      whether to compute forces
+     * @param includeEnergy      whether to compute energy
+     * @param energy             the total energy is added to this
+     */
+    void calculateIxn(std::vector<Vec3>& atomCoordinates, const std::map<std::string, double>& globalParameters,
+                      std::vector<AlignedArray<float> >& threadForce, bool includeForces, bool includeEnergy, double& energy);
+};
+
+class CpuCustomExternalForce::ThreadData {
+public:
+    ThreadData(const Lepton::CompiledExpression& expression, const std::vector<std::string>& parameterNames);
+    Lepton::CompiledExpression expression;
+    CompiledExpressionSet expressionSet;
+    double x, y, z;
+    std::vector<double> param;
+};
+
+} // namespace OpenMM
+
+#endif // OPENMM_CPU_CUSTOM_EXTERNAL_FORCE_H__
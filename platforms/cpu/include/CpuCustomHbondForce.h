@@ -0,0 +1,218 @@
+
+/* Portions copyright (c) 2009-2018 Stanford University and Simbios.
+ * Contributors: Peter Eastman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OPENMM_CPU_CUSTOM_HBOND_FORCE_H__
+#define OPENMM_CPU_CUSTOM_HBOND_FORCE_H__
+
+#include "AlignedArray.h"
+#include "openmm/CustomHbondForce.h"
+#include "openmm/internal/CompiledExpressionSet.h"
+#include "openmm/internal/ThreadPool.h"
+#include "openmm/internal/vectorize.h"
+#include "lepton/CompiledExpression.h"
+#include "lepton/ParsedExpression.h"
+#include <atomic>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace OpenMM {
+
+class CpuCustomHbondForce {
+private:
+
+    class DistanceTermInfo;
+    class AngleTermInfo;
+    class DihedralTermInfo;
+    class ThreadData;
+    int numDonors, numAcceptors;
+    bool useCutoff, usePeriodic;
+    double cutoffDistance;
+    float recipBoxSize[3];
+    Vec3 periodicBoxVectors[3];
+    AlignedArray<fvec4> periodicBoxVec4;
+    ThreadPool& threads;
+    std::vector<std::vector<int> > donorAtoms, acceptorAtoms;
+    std::vector<std::set<int> > exclusions;
+    std::vector<ThreadData*> threadData;
+    // The following variables are used for sorting acceptors into cells.
+    int numCells[3];
+    float cellOrigin[3], cellScale[3];
+    std::vector<int> cellStart, cellAcceptors;
+    // The following variables are used to make information accessible to the individual threads.
+    float* posq;
+    std::vector<std::vector<double> >* donorParameters;
+    std::vector<std::vector<double> >* acceptorParameters;
+    const std::map<std::string, double>* globalParameters;
+    std::vector<AlignedArray<float> >* threadForce;
+    bool includeForces, includeEnergy;
+    std::atomic<int> atomicCounter;
+
+    /**
+     * This routine contains the code executed by each thread.
+     */
+    void threadComputeForce(ThreadPool& threads, int threadIndex);
+
+    /**
+     * Sort the acceptors into a grid of cells based on the position of their first atom.
+     */
+    void assignAcceptorsToCells();
+
+    /**
+     * Find the cell containing a position.  In the periodic case, cells are defined in fractional coordinates.
+     */
+    void getCellCoordinates(const float* pos, int* cell) const;
+
+    /**
+     * Identify the acceptors that might interact with a donor.  If a cutoff is used, this includes only
+     * acceptors whose first atom is within the cutoff of the donor's first atom.
+     */
+    void findAcceptors(int donor, ThreadData& data);
+
+    /**
+     * Compute the geometry of every donor-acceptor group in the current batch, then evaluate the interactions.
+     */
+    void calculateBatch(int donor, float* forces, ThreadData& data);
+
+    /**
+     * Compute the displacement and squared distance between two points, optionally using
+     * periodic boundary conditions.
+     */
+    void computeDelta(const fvec4& posI, const fvec4& posJ, fvec4& deltaR, float& r2) const;
+
+    static float computeAngle(const fvec4& vi, const fvec4& vj, float v2i, float v2j, float sign);
+
+    static float getDihedralAngleBetweenThreeVectors(const fvec4& v1, const fvec4& v2, const fvec4& v3, fvec4& cross1, fvec4& cross2, const fvec4& signVector);
+
+public:
+    /**
+     * Create a new CpuCustomHbondForce.
+     *
+     * @param force      the CustomHbondForce to create it for
+     * @param threads    the thread pool to use
+     */
+    CpuCustomHbondForce(const CustomHbondForce& force, ThreadPool& threads);
+
+    ~CpuCustomHbondForce();
+
+    /**
+     * Set the force to use a cutoff.
+     *
+     * @param distance   the cutoff distance
+     */
+    void setUseCutoff(double distance);
+
+    /**
+     * Set the force to use periodic boundary conditions.  This requires that a cutoff has
+     * already been set, and the smallest side of the periodic box is at least twice the cutoff
+     * distance.
+     *
+     * @param periodicBoxVectors    the vectors defining the periodic box
+     */
+    void setPeriodic(Vec3* periodicBoxVectors);
+
+    /**
+     * Get the list of atoms for each donor group.
+     */
+    const std::vector<std::vector<int> >& getDonorAtoms() const {
+        return donorAtoms;
+    }
+
+    /**
+     * Get the list of atoms for each acceptor group.
+     */
+    const std::vector<std::vector<int> >& getAcceptorAtoms() const {
+        return acceptorAtoms;
+    }
+
+    /**
+     * Calculate the interaction.
+     *
+     * @param posq               atom coordinates in float format
+     * @param donorParameters    donor parameter values (donorParameters[donorIndex][parameterIndex])
+     * @param acceptorParameters acceptor parameter values (acceptorParameters[acceptorIndex][parameterIndex])
+     * @param globalParameters   the values of global parameters
+     * @param threadForce        the collection of arrays for each thread to add forces to
+     * @param includeForces      whether to compute forces
+     * @param includeEnergy      whether to compute energy
+     * @param energy             the total energy is added to this
+     */
+    void calculateIxn(AlignedArray<float>& posq, std::vector<std::vector<double> >& donorParameters, std::vector<std::vector<double> >& acceptorParameters,
+                      const std::map<std::string, double>& globalParameters, std::vector<AlignedArray<float> >& threadForce,
+                      bool includeForces, bool includeEnergy, double& energy);
+};
+
+class CpuCustomHbondForce::DistanceTermInfo {
+public:
+    int p1, p2, variableIndex;
+    Lepton::CompiledExpression forceExpression;
+    int delta;
+    float deltaSign;
+    DistanceTermInfo(const std::string& name, const std::vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data);
+};
+
+class CpuCustomHbondForce::AngleTermInfo {
+public:
+    int p1, p2, p3, variableIndex;
+    Lepton::CompiledExpression forceExpression;
+    int delta1, delta2;
+    float delta1Sign, delta2Sign;
+    AngleTermInfo(const std::string& name, const std::vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data);
+};
+
+class CpuCustomHbondForce::DihedralTermInfo {
+public:
+    int p1, p2, p3, p4, variableIndex;
+    Lepton::CompiledExpression forceExpression;
+    int delta1, delta2, delta3;
+    DihedralTermInfo(const std::string& name, const std::vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data);
+};
+
+class CpuCustomHbondForce::ThreadData {
+public:
+    CompiledExpressionSet expressionSet;
+    Lepton::CompiledExpression energyExpression;
+    std::vector<int> donorParamIndex, acceptorParamIndex;
+    std::vector<std::pair<int, int> > deltaPairs;
+    std::vector<DistanceTermInfo> distanceTerms;
+    std::vector<AngleTermInfo> angleTerms;
+    std::vector<DihedralTermInfo> dihedralTerms;
+    // Per-interaction values for the current batch, stored with all values for one interaction contiguous.
+    std::vector<int> batchAcceptors;
+    AlignedArray<fvec4> delta, cross1, cross2;
+    std::vector<float> normDelta, norm2Delta, angles, dihedrals;
+    AlignedArray<fvec4> f;
+    double energy;
+    ThreadData(const CustomHbondForce& force, Lepton::ParsedExpression& energyExpr,
+            std::map<std::string, std::vector<int> >& distances, std::map<std::string, std::vector<int> >& angles, std::map<std::string, std::vector<int> >& dihedrals);
+    /**
+     * Request a pair of particles whose distance or displacement vector is needed in the computation.
+     */
+    void requestDeltaPair(int p1, int p2, int& pairIndex, float& pairSign, bool allowReversed);
+};
+
+} // namespace OpenMM
+
+#endif // OPENMM_CPU_CUSTOM_HBOND_FORCE_H__
@@ -26,8 +26,8 @@
 #define OPENMM_CPU_CUSTOM_MANY_PARTICLE_FORCE_H__
 
 #include "ReferenceForce.h"
+#include "AlignedArray.h"
 #include "ReferenceBondIxn.h"
-#include "CpuNeighborList.h"
 #include "openmm/CustomManyParticleForce.h"
 #include "openmm/internal/CompiledExpressionSet.h"
 #include "openmm/internal/ThreadPool.h"
@@ -52,17 +52,23 @@ private:
     class ThreadData;
     int numParticles, numParticlesPerSet, numPerParticleParameters, numTypes;
     bool useCutoff, usePeriodic, triclinic, centralParticleMode;
-    double cutoffDistance;
+    double cutoffDistance, paddedCutoff;
     float recipBoxSize[3];
     Vec3 periodicBoxVectors[3];
     AlignedArray<fvec4> periodicBoxVec4;
-    CpuNeighborList* neighborList;
     ThreadPool& threads;
     std::vector<std::set<int> > exclusions;
     std::vector<int> particleTypes;
     std::vector<int> orderIndex;
     std::vector<std::vector<int> > particleOrder;
     std::vector<std::vector<int> > particleNeighbors;
+    // The following variables are used for building the neighbor list.
+    bool neighborsValid;
+    std::vector<float> lastPositions;
+    Vec3 lastBoxVectors[3];
+    int numCells[3];
+    float cellOrigin[3], cellScale[3];
+    std::vector<int> cellStart, cellAtoms, atomCell;
     std::vector<ThreadData*> threadData;
     // The following variables are used to make information accessible to the individual threads.
     float* posq;
@@ -77,6 +83,27 @@ private:
      */
     void threadComputeForce(ThreadPool& threads, int threadIndex);
 
+    /**
+     * Determine whether any particle has moved far enough that the neighbor list must be rebuilt.
+     */
+    bool needNeighborListRebuild() const;
+
+    /**
+     * Rebuild the neighbor list.  Particles are sorted into a grid of cells, after which each thread finds the
+     * neighbors of a subset of particles.
+     */
+    void computeNeighborList();
+
+    /**
+     * Find the cell containing a position.  In the periodic case, cells are defined in fractional coordinates.
+     */
+    void getCellCoordinates(const float* pos, int* cell) const;
+
+    /**
+     * This routine contains the code executed by each thread to find the neighbors of particles.
+     */
+    void threadComputeNeighbors(int threadIndex);
+
     /**
      * This is called recursively to loop over all possible combination of a set of particles and evaluate the
      * interaction for each one.
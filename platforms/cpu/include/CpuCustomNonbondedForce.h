@@ -45,11 +45,17 @@ class CpuCustomNonbondedForce {
 
          Constructor
 
+         @param expression        a CompiledExpression whose outputs are the energy, dE/dr, and the
+                                  derivatives of the energy with respect to each global parameter
+                                  listed in energyParamDerivs, in that order
+         @param energyExpression  a CompiledExpression with the same outputs except dE/dr, which is
+                                  used when forces are not needed
+
          --------------------------------------------------------------------------------------- */
 
-       CpuCustomNonbondedForce(const Lepton::CompiledExpression& energyExpression, const Lepton::CompiledExpression& forceExpression,
-                               const std::vector<std::string>& parameterNames, const std::vector<std::set<int> >& exclusions,
-                               const std::vector<Lepton::CompiledExpression> energyParamDerivExpressions, ThreadPool& threads);
+       CpuCustomNonbondedForce(const Lepton::CompiledExpression& expression, const Lepton::CompiledExpression& energyExpression,
+                               const std::vector<std::string>& parameterNames,
+                               const std::vector<std::set<int> >& exclusions, ThreadPool& threads);
 
       /**---------------------------------------------------------------------------------------
 
@@ -103,6 +109,33 @@ class CpuCustomNonbondedForce {
 
       void setPeriodic(Vec3* periodicBoxVectors);
 
+      /**---------------------------------------------------------------------------------------
+
+         Evaluate interactions by interpolating from tables instead of evaluating the expression
+         for every pair.  A separate table of the energy and its derivative as a function of r is
+         built for every pair of particle types.  This requires that a cutoff has already been set,
+         and it is only used for interactions found through the neighbor list.  If there are more
+         than MaxTabulatedTypes types, tabulation is disabled.
+
+         @param expression      a CompiledExpression whose outputs are the energy, dE/dr, and d2E/dr2
+         @param particleType    the type of each particle.  All particles of the same type must have
+                                identical per-particle parameters.
+         @param numTypes        the number of distinct particle types
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseTabulation(const Lepton::CompiledExpression& expression, const std::vector<int>& particleType, int numTypes);
+
+      /**
+       * The maximum number of particle types for which tables will be built.
+       */
+      static const int MaxTabulatedTypes = 32;
+
+      /**
+       * The number of intervals in the table for each pair of types.
+       */
+      static const int NumTableIntervals = 1024;
+
       /**---------------------------------------------------------------------------------------
 
          Calculate custom pair ixn
@@ -129,6 +162,7 @@ private:
     bool periodic;
     bool triclinic;
     bool useInteractionGroups;
+    bool useTabulation, tablesValid;
     const CpuNeighborList* neighborList;
     float recipBoxSize[3];
     Vec3 periodicBoxVectors[3];
@@ -140,6 +174,12 @@ private:
     std::vector<std::string> paramNames;
     std::vector<std::pair<int, int> > groupInteractions;
     std::vector<double> threadEnergy;
+    int numTypes;
+    float tableStart, tableSpacing;
+    std::vector<int> particleType, typeAtom, pairTableOffset;
+    std::vector<std::pair<int, int> > tablePairs;
+    std::vector<float> table;
+    std::map<std::string, double> tableGlobalParameters;
     // The following variables are used to make information accessible to the individual threads.
     int numberOfAtoms;
     float* posq;
@@ -155,6 +195,11 @@ private:
      */
     void threadComputeForce(ThreadPool& threads, int threadIndex);
 
+    /**
+     * This routine contains the code executed by each thread to build the interpolation tables.
+     */
+    void threadComputeTables(ThreadPool& threads, int threadIndex);
+
     /**
      * Calculate the interaction between two atoms.
      * 
@@ -164,10 +209,23 @@ private:
      * @param forces           force array (forces added)
      * @param totalEnergy      total energy
      * @param boxSize          the size of the periodic box
-     * @param boxSize          the inverse size of the periodic box
+     * @param invBoxSize       the inverse size of the periodic box
      */
     void calculateOneIxn(int atom1, int atom2, ThreadData& data, float* forces, double& totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize);
 
+    /**
+     * Calculate all the interactions for one block of the neighbor list by interpolating from the tables.
+     * Pairs are processed four at a time.
+     *
+     * @param blockIndex       the index of the block to process
+     * @param data             workspace for the current thread
+     * @param forces           force array (forces added)
+     * @param totalEnergy      total energy
+     * @param boxSize          the size of the periodic box
+     * @param invBoxSize       the inverse size of the periodic box
+     */
+    void calculateBlockTabulatedIxn(int blockIndex, ThreadData& data, float* forces, double& totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize);
+
     /**
      * Compute the displacement and squared distance between two points, optionally using
      * periodic boundary conditions.
@@ -177,12 +235,13 @@ private:
 
 class CpuCustomNonbondedForce::ThreadData {
 public:
-    ThreadData(const Lepton::CompiledExpression& energyExpression, const Lepton::CompiledExpression& forceExpression, const std::vector<std::string>& parameterNames,
-            const std::vector<Lepton::CompiledExpression> energyParamDerivExpressions);
+    ThreadData(const Lepton::CompiledExpression& expression, const Lepton::CompiledExpression& energyExpression, const std::vector<std::string>& parameterNames);
+    void setTableExpression(const Lepton::CompiledExpression& expression);
+    Lepton::CompiledExpression expression;
     Lepton::CompiledExpression energyExpression;
-    Lepton::CompiledExpression forceExpression;
-    std::vector<Lepton::CompiledExpression> energyParamDerivExpressions;
+    Lepton::CompiledExpression tableExpression;
     CompiledExpressionSet expressionSet;
+    std::map<std::string, double*> variableLocations;
     std::vector<double> particleParam;
     double r;
     std::vector<double> energyParamDerivs; 
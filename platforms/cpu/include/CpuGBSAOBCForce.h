@@ -27,6 +27,7 @@
 
 #include "AlignedArray.h"
 #include "openmm/internal/ThreadPool.h"
+#include "CpuNeighborList.h"
 #include "openmm/internal/vectorize.h"
 #include <atomic>
 #include <set>
@@ -40,11 +41,13 @@ public:
     CpuGBSAOBCForce();
 
     /**
-     * Set the force to use a cutoff.
+     * Set the force to use a cutoff.  Only pairs found in the neighbor list are considered, so the
+     * list must have been built with a maximum distance of at least the cutoff.
      * 
      * @param distance    the cutoff distance
+     * @param neighbors   the neighbor list to use
      */
-    void setUseCutoff(float distance);
+    void setUseCutoff(float distance, const CpuNeighborList& neighbors);
 
     /**
      * 
@@ -97,6 +100,12 @@ public:
      */
     void threadComputeForce(ThreadPool& threads, int threadIndex);
 
+    /**
+     * This routine contains the code executed by each thread when a cutoff is used.  It loops over
+     * the pairs in the neighbor list instead of over all pairs of atoms.
+     */
+    void threadComputeNeighborListForce(ThreadPool& threads, int threadIndex);
+
 private:
     bool cutoff;
     bool periodic;
@@ -105,7 +114,11 @@ private:
     std::vector<std::pair<float, float> > particleParams;        
     AlignedArray<float> bornRadii;
     std::vector<AlignedArray<float> > threadBornForces;
+    std::vector<AlignedArray<float> > threadBornSums;
     AlignedArray<float> obcChain;
+    AlignedArray<float> scaledBornForces;
+    const CpuNeighborList* neighborList;
+    std::vector<int> atomSortedIndex;
     std::vector<double> threadEnergy;
     std::vector<float> logTable;
     float logDX, logDXInv;
@@ -129,6 +142,18 @@ private:
      * Evaluate log(x) using a lookup table for speed.
      */
     fvec4 fastLog(const fvec4& x);
+
+    /**
+     * Compute the contribution of one atom (with the given scaled radius) to the Born radius sum of
+     * another (with the given offset radius).  Lanes that are not included are set to zero.
+     */
+    fvec4 computeBornSumTerm(const fvec4& r, const fvec4& offsetRadius, const fvec4& scaledRadius, ivec4 include);
+
+    /**
+     * Compute the derivative of the Born radius sum with respect to distance, divided by r, for the
+     * same pairs as computeBornSumTerm().  Lanes that are not included are set to zero.
+     */
+    fvec4 computeBornSumDerivative(const fvec4& r, const fvec4& offsetRadius, const fvec4& scaledRadius, ivec4 include);
 };
 
 } // namespace OpenMM
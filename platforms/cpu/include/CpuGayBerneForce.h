@@ -91,7 +91,7 @@ private:
     Vec3 const* positions;
     std::vector<AlignedArray<float> >* threadForce;
     Vec3* boxVectors;
-    std::atomic<int> atomicCounter;
+    ThreadPool::WorkQueue workQueue;
 
     void computeEllipsoidFrames(const std::vector<Vec3>& positions);
     
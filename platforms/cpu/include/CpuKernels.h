@@ -33,7 +33,9 @@
  * -------------------------------------------------------------------------- */
 
 #include "CpuBondForce.h"
+#include "CpuCustomExternalForce.h"
 #include "CpuCustomGBForce.h"
+#include "CpuCustomHbondForce.h"
 #include "CpuCustomManyParticleForce.h"
 #include "CpuCustomNonbondedForce.h"
 #include "CpuGayBerneForce.h"
@@ -43,13 +45,44 @@
 #include "CpuNeighborList.h"
 #include "CpuNonbondedForce.h"
 #include "CpuPlatform.h"
+#include "CpuRMSDForce.h"
+#include "ReferenceCustomCentroidBondIxn.h"
+#include "ReferenceCustomCompoundBondIxn.h"
+#include "ReferenceKernels.h"
 #include "openmm/kernels.h"
 #include "openmm/System.h"
+#include "openmm/internal/CustomNonbondedForceImpl.h"
+#include "lepton/CustomFunction.h"
 #include <array>
 #include <tuple>
 
 namespace OpenMM {
 
+/**
+ * This kernel provides methods for setting and retrieving various state data.  It extends the reference
+ * implementation to also save the CPU platform's random number generators in checkpoints.
+ */
+class CpuUpdateStateDataKernel : public ReferenceUpdateStateDataKernel {
+public:
+    CpuUpdateStateDataKernel(std::string name, const Platform& platform, ReferencePlatform::PlatformData& referenceData, CpuPlatform::PlatformData& data) :
+            ReferenceUpdateStateDataKernel(name, platform, referenceData), data(data) {
+    }
+    /**
+     * Create a checkpoint recording the current state of the Context.
+     * 
+     * @param stream    an output stream the checkpoint data should be written to
+     */
+    void createCheckpoint(ContextImpl& context, std::ostream& stream);
+    /**
+     * Load a checkpoint that was written by createCheckpoint().
+     * 
+     * @param stream    an input stream the checkpoint data should be read from
+     */
+    void loadCheckpoint(ContextImpl& context, std::istream& stream);
+private:
+    CpuPlatform::PlatformData& data;
+};
+
 /**
  * This kernel is invoked at the beginning and end of force and energy computations.  It gives the
  * Platform a chance to clear buffers and do other initialization at the beginning, and to do any
@@ -89,6 +122,13 @@ public:
      * energy directly, <i>or</i> add it to an internal buffer so that it will be included here.
      */
     double finishComputation(ContextImpl& context, bool includeForce, bool includeEnergy, int groups, bool& valid);
+    /**
+     * Get whether every force kernel on this platform returns its energy directly, so finishComputation() never
+     * adds any energy of its own.
+     */
+    bool isEnergyReturnedByForces() const {
+        return true;
+    }
 private:
     CpuPlatform::PlatformData& data;
     Kernel referenceKernel;
@@ -320,12 +360,15 @@ public:
      */
     void copyParametersToContext(ContextImpl& context, const CustomNonbondedForce& force);
 private:   
+    void updateTabulation();
     CpuPlatform::PlatformData& data;
     int numParticles;
     std::vector<std::vector<double> > particleParamArray;
     double nonbondedCutoff, switchingDistance, periodicBoxSize[3], longRangeCoefficient;
-    bool useSwitchingFunction, hasInitializedLongRangeCorrection;
+    bool useSwitchingFunction, hasInitializedLongRangeCorrection, useTabulation;
+    Lepton::CompiledExpression tabulatedExpression;
     CustomNonbondedForce* forceCopy;
+    CustomNonbondedForceImpl::LongRangeCorrectionData longRangeCorrectionData;
     std::map<std::string, double> globalParamValues;
     std::vector<std::set<int> > exclusions;
     std::vector<std::string> parameterNames, globalParameterNames, energyParamDerivNames;
@@ -464,6 +507,225 @@ private:
     NonbondedMethod nonbondedMethod;
 };
 
+/**
+ * This kernel is invoked by CustomExternalForce to calculate the forces acting on the system and the energy of the system.
+ */
+class CpuCalcCustomExternalForceKernel : public CalcCustomExternalForceKernel {
+public:
+    CpuCalcCustomExternalForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) : CalcCustomExternalForceKernel(name, platform),
+            data(data), ixn(NULL) {
+    }
+    ~CpuCalcCustomExternalForceKernel();
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param force      the CustomExternalForce this kernel will be used for
+     */
+    void initialize(const System& system, const CustomExternalForce& force);
+    /**
+     * Execute the kernel to calculate the forces and/or energy.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @return the potential energy due to the force
+     */
+    double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the CustomExternalForce to copy the parameters from
+     */
+    void copyParametersToContext(ContextImpl& context, const CustomExternalForce& force);
+private:
+    CpuPlatform::PlatformData& data;
+    int numParticles;
+    CpuCustomExternalForce* ixn;
+    std::vector<std::string> globalParameterNames;
+    Vec3* boxVectors;
+};
+
+/**
+ * This kernel is invoked by CustomHbondForce to calculate the forces acting on the system and the energy of the system.
+ */
+class CpuCalcCustomHbondForceKernel : public CalcCustomHbondForceKernel {
+public:
+    CpuCalcCustomHbondForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) : CalcCustomHbondForceKernel(name, platform),
+            data(data), ixn(NULL) {
+    }
+    ~CpuCalcCustomHbondForceKernel();
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param force      the CustomHbondForce this kernel will be used for
+     */
+    void initialize(const System& system, const CustomHbondForce& force);
+    /**
+     * Execute the kernel to calculate the forces and/or energy.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @return the potential energy due to the force
+     */
+    double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the CustomHbondForce to copy the parameters from
+     */
+    void copyParametersToContext(ContextImpl& context, const CustomHbondForce& force);
+private:
+    CpuPlatform::PlatformData& data;
+    int numDonors, numAcceptors;
+    double cutoffDistance;
+    std::vector<std::vector<double> > donorParamArray, acceptorParamArray;
+    CpuCustomHbondForce* ixn;
+    std::vector<std::string> globalParameterNames;
+    NonbondedMethod nonbondedMethod;
+};
+
+/**
+ * This kernel is invoked by CustomCompoundBondForce to calculate the forces acting on the system and the energy of the system.
+ */
+class CpuCalcCustomCompoundBondForceKernel : public CalcCustomCompoundBondForceKernel {
+public:
+    CpuCalcCustomCompoundBondForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) :
+            CalcCustomCompoundBondForceKernel(name, platform), data(data), usePeriodic(false) {
+    }
+    ~CpuCalcCustomCompoundBondForceKernel();
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param force      the CustomCompoundBondForce this kernel will be used for
+     */
+    void initialize(const System& system, const CustomCompoundBondForce& force);
+    /**
+     * Execute the kernel to calculate the forces and/or energy.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @return the potential energy due to the force
+     */
+    double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the CustomCompoundBondForce to copy the parameters from
+     */
+    void copyParametersToContext(ContextImpl& context, const CustomCompoundBondForce& force);
+private:
+    CpuPlatform::PlatformData& data;
+    int numBonds;
+    std::vector<std::vector<int> > bondAtoms;
+    std::vector<std::vector<double> > bondParamArray;
+    std::vector<ReferenceCustomCompoundBondIxn*> threadIxn;
+    std::vector<std::vector<double> > threadEnergyParamDerivs;
+    std::vector<std::string> globalParameterNames, energyParamDerivNames;
+    CpuBondForce bondForce;
+    bool usePeriodic;
+};
+
+/**
+ * This kernel is invoked by CustomCentroidBondForce to calculate the forces acting on the system and the energy of the system.
+ */
+class CpuCalcCustomCentroidBondForceKernel : public CalcCustomCentroidBondForceKernel {
+public:
+    CpuCalcCustomCentroidBondForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) :
+            CalcCustomCentroidBondForceKernel(name, platform), data(data), usePeriodic(false) {
+    }
+    ~CpuCalcCustomCentroidBondForceKernel();
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param force      the CustomCentroidBondForce this kernel will be used for
+     */
+    void initialize(const System& system, const CustomCentroidBondForce& force);
+    /**
+     * Execute the kernel to calculate the forces and/or energy.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @return the potential energy due to the force
+     */
+    double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the CustomCentroidBondForce to copy the parameters from
+     */
+    void copyParametersToContext(ContextImpl& context, const CustomCentroidBondForce& force);
+private:
+    void computeGroupCenters(std::vector<Vec3>& atomCoordinates);
+    void applyGroupForces(std::vector<Vec3>& forces);
+    CpuPlatform::PlatformData& data;
+    int numGroups, numBonds;
+    std::vector<std::vector<int> > bondGroups;
+    std::vector<std::vector<double> > bondParamArray;
+    // The atoms in all groups, stored consecutively by group along with their weights.
+    std::vector<int> groupStart, groupAtoms;
+    std::vector<double> groupWeights;
+    // The groups each atom belongs to, stored consecutively by atom.
+    std::vector<int> forceAtoms, atomStart, atomGroups;
+    std::vector<double> atomWeights;
+    std::vector<std::vector<std::pair<int, Vec3> > > threadPartialCenters;
+    std::vector<Vec3> groupCenters, groupForces;
+    std::vector<ReferenceCustomCentroidBondIxn*> threadIxn;
+    std::vector<std::vector<double> > threadEnergyParamDerivs;
+    std::vector<std::string> globalParameterNames, energyParamDerivNames;
+    CpuBondForce bondForce;
+    bool usePeriodic;
+};
+
+/**
+ * This kernel is invoked by RMSDForce to calculate the forces acting on the system and the energy of the system.
+ */
+class CpuCalcRMSDForceKernel : public CalcRMSDForceKernel {
+public:
+    CpuCalcRMSDForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) : CalcRMSDForceKernel(name, platform),
+            data(data), ixn(NULL) {
+    }
+    ~CpuCalcRMSDForceKernel();
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param force      the RMSDForce this kernel will be used for
+     */
+    void initialize(const System& system, const RMSDForce& force);
+    /**
+     * Execute the kernel to calculate the forces and/or energy.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @return the potential energy due to the force
+     */
+    double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the RMSDForce to copy the parameters from
+     */
+    void copyParametersToContext(ContextImpl& context, const RMSDForce& force);
+private:
+    std::vector<int> getParticles(const RMSDForce& force) const;
+    CpuPlatform::PlatformData& data;
+    int numParticles, numReferencePositions;
+    CpuRMSDForce* ixn;
+};
+
 /**
  * This kernel is invoked by GayBerneForce to calculate the forces acting on the system.
  */
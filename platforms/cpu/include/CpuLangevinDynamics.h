@@ -96,6 +96,7 @@ private:
     OpenMM::ThreadPool& threads;
     OpenMM::CpuRandom& random;
     std::vector<OpenMM_SFMT::SFMT> threadRandom;
+    std::vector<std::vector<float> > threadNoise;
     // The following variables are used to make information accessible to the individual threads.
     int numberOfAtoms;
     OpenMM::Vec3* atomCoordinates;
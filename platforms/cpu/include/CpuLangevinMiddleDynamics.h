@@ -27,6 +27,7 @@
 #define __CPU_LANGEVIN_MIDDLE_DYNAMICS_H__
 
 #include "ReferenceLangevinMiddleDynamics.h"
+#include "ReferenceSETTLEAlgorithm.h"
 #include "CpuRandom.h"
 #include "openmm/internal/ThreadPool.h"
 #include "sfmt/SFMT.h"
@@ -52,6 +53,23 @@ public:
      */
     ~CpuLangevinMiddleDynamics();
 
+    /**
+     * Advance the system by one time step.
+     *
+     * When the only constraints are SETTLE clusters, the whole step is done in a single parallel region.  The atoms
+     * are divided between threads so that every cluster belongs to one thread, which lets each thread integrate and
+     * constrain its own atoms without waiting for the others.  Otherwise this does the same thing as
+     * ReferenceLangevinMiddleDynamics::update(), with each part of the step parallelized separately.
+     *
+     * @param context             the context this integrator is updating
+     * @param atomCoordinates     atom coordinates
+     * @param velocities          velocities
+     * @param masses              atom masses
+     * @param tolerance           the constraint tolerance
+     */
+    void update(OpenMM::ContextImpl& context, std::vector<OpenMM::Vec3>& atomCoordinates, std::vector<OpenMM::Vec3>& velocities,
+                std::vector<double>& masses, double tolerance);
+
     /**
      * First update step.
      * 
@@ -91,9 +109,16 @@ private:
     void threadUpdate1(int threadIndex);
     void threadUpdate2(int threadIndex);
     void threadUpdate3(int threadIndex);
+    void initializeFusedStep(OpenMM::ContextImpl& context);
+    void threadUpdateFused(int threadIndex, std::vector<OpenMM::Vec3>& atomCoordinates, std::vector<OpenMM::Vec3>& velocities,
+                           std::vector<OpenMM::Vec3>& forces, double tolerance);
     OpenMM::ThreadPool& threads;
     OpenMM::CpuRandom& random;
     std::vector<OpenMM_SFMT::SFMT> threadRandom;
+    std::vector<std::vector<float> > threadNoise;
+    bool hasInitializedFusedStep, useFusedStep;
+    std::vector<int> threadAtomStart;
+    std::vector<ReferenceSETTLEAlgorithm*> threadSettle;
     // The following variables are used to make information accessible to the individual threads.
     int numberOfAtoms;
     OpenMM::Vec3* atomCoordinates;
@@ -53,6 +53,17 @@ public:
     int getBlockSize() const;
     const std::vector<int32_t>& getSortedAtoms() const;
     const std::vector<int>& getBlockNeighbors(int blockIndex) const;
+    /**
+     * Get the neighbors of a block as positions in the array returned by getSortedAtoms(), rather than
+     * as atom indices.  This allows per-atom data to be stored in sorted order, so that atoms which are
+     * close together in space are also close together in memory.
+     */
+    const std::vector<int>& getBlockSortedNeighbors(int blockIndex) const;
+    /**
+     * Get the number of times computeNeighborList() has been called.  Callers that store data in sorted
+     * order can compare this to a saved value to tell when the order may have changed.
+     */
+    int getNumBuilds() const;
 
     /**
      * Bitset for a single block, marking which indexes should be excluded. This data type needs to be big
@@ -68,10 +79,11 @@ public:
     void threadComputeNeighborList(ThreadPool& threads, int threadIndex);
     void runThread(int index);
 private:
-    int blockSize;
+    int blockSize, numBuilds;
     std::vector<int> sortedAtoms;
     std::vector<float> sortedPositions;
     std::vector<std::vector<int> > blockNeighbors;
+    std::vector<std::vector<int> > blockSortedNeighbors;
     std::vector<std::vector<BlockExclusionMask> > blockExclusions;
     // The following variables are used to make information accessible to the individual threads.
     float minx, maxx, miny, maxy, minz, maxz;
@@ -83,7 +95,7 @@ private:
     int numAtoms;
     bool usePeriodic;
     float maxDistance;
-    std::atomic<int> atomicCounter;
+    ThreadPool::WorkQueue workQueue;
 };
 
 } // namespace OpenMM
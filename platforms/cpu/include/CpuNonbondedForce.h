@@ -133,6 +133,31 @@ class CpuNonbondedForce {
 
       void setPeriodicExceptions(bool periodic);
 
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to accumulate direct space forces in 64-bit fixed point.  Each block of
+         interactions is computed in single precision, then converted and added to threadFixedForce,
+         so the result does not depend on which thread computes each block.  Forces are then added to
+         threadFixedForce instead of the threadForce array passed to calculateDirectIxn().  The energy
+         of each block is recorded separately and summed in a fixed order.
+
+         @param threadFixedForce  one array per thread with three values per atom, or NULL to use
+                                  floating point accumulation
+         @param scale             the factor by which values are multiplied before conversion
+
+         --------------------------------------------------------------------------------------- */
+
+      void setFixedPointForces(std::vector<std::vector<long long> >* threadFixedForce, double scale);
+
+      /**---------------------------------------------------------------------------------------
+
+         Notify the force that the atom parameters passed to calculateDirectIxn() have changed.
+         It keeps copies of them in the neighbor list's sorted order, which must then be rebuilt.
+
+         --------------------------------------------------------------------------------------- */
+
+      void setParametersChanged();
+
       /**---------------------------------------------------------------------------------------
       
          Calculate Ewald ixn
@@ -146,12 +171,15 @@ class CpuNonbondedForce {
                                  exclusions[atomIndex] contains the list of exclusions for that atom
          @param forces           force array (forces added)
          @param totalEnergy      total energy
+         @param threads          the thread pool to use (for plain Ewald)
+         @param includeForces    whether to compute forces (for plain Ewald).  If false, only the energy is computed.
             
          --------------------------------------------------------------------------------------- */
 
       void calculateReciprocalIxn(int numberOfAtoms, float* posq, const std::vector<Vec3>& atomCoordinates,
                                   const std::vector<std::pair<float, float> >& atomParameters, const std::vector<float> &C6params,
-                                  const std::vector<std::set<int> >& exclusions, std::vector<Vec3>& forces, double* totalEnergy) const;
+                                  const std::vector<std::set<int> >& exclusions, std::vector<Vec3>& forces, double* totalEnergy, ThreadPool& threads,
+                                  bool includeForces=true) const;
       
       /**---------------------------------------------------------------------------------------
       
@@ -166,11 +194,13 @@ class CpuNonbondedForce {
          @param forces           force array (forces added)
          @param totalEnergy      total energy
          @param threads          the thread pool to use
+         @param includeForces    whether to compute forces.  If false, only the energy is computed.
       
          --------------------------------------------------------------------------------------- */
           
       void calculateDirectIxn(int numberOfAtoms, float* posq, const std::vector<Vec3>& atomCoordinates, const std::vector<std::pair<float, float> >& atomParameters,
-            const std::vector<float>& C6params, const std::vector<std::set<int> >& exclusions, std::vector<AlignedArray<float> >& threadForce, double* totalEnergy, ThreadPool& threads);
+            const std::vector<float>& C6params, const std::vector<std::set<int> >& exclusions, std::vector<AlignedArray<float> >& threadForce, double* totalEnergy, ThreadPool& threads,
+            bool includeForces=true);
 
     /**
      * This routine contains the code executed by each thread.
@@ -206,10 +236,22 @@ protected:
         float const *C6params;
         std::set<int> const* exclusions;
         std::vector<AlignedArray<float> >* threadForce;
-        bool includeEnergy;
+        bool includeEnergy, includeForces;
+        // Copies of the per-atom data in the order of the neighbor list's sorted atoms, so the block
+        // loops can load them contiguously.  The positions are copied on every call, but the LJ
+        // parameters are copied only when the neighbor list is rebuilt or the parameters change.
+        AlignedArray<float> sortedPosq;
+        std::vector<float> sortedSigma, sortedEpsilon, sortedC6params;
+        int sortedNeighborListBuild;
+        bool sortedParametersValid;
+        // In fixed point mode, forces for one block or atom are accumulated here before being converted.
+        std::vector<AlignedArray<float> > threadScratchForce;
         float inverseRcut6;
         float inverseRcut6Expterm;
-        std::atomic<int> atomicCounter;
+        ThreadPool::WorkQueue workQueue;
+        std::vector<std::vector<long long> >* threadFixedForce;
+        std::vector<double> blockEnergy, exclusionEnergy;
+        double fixedPointScale;
 
         static const float TWO_OVER_SQRT_PI;
         static const int NUM_TABLE_POINTS;
@@ -226,6 +268,39 @@ protected:
          --------------------------------------------------------------------------------------- */
           
       void calculateOneIxn(int atom1, int atom2, float* forces, double* totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize);
+
+      /**---------------------------------------------------------------------------------------
+
+         Convert a force that was accumulated in single precision to fixed point, add it to
+         the fixed point array, and clear it.
+
+         @param forces           force array (forces cleared)
+         @param index            the element of forces to convert
+         @param atom             the atom the force acts on
+         @param fixedForces      fixed point force array (forces added)
+
+         --------------------------------------------------------------------------------------- */
+
+      void flushFixedPointForce(float* forces, int index, int atom, long long* fixedForces) {
+          float* f = forces+4*index;
+          for (int i = 0; i < 3; i++)
+              fixedForces[3*atom+i] += (long long) (f[i]*fixedPointScale);
+          fvec4(0.0f).store(f);
+      }
+
+      /**---------------------------------------------------------------------------------------
+
+         Add a force to a single atom, either in single precision or in fixed point.
+
+         --------------------------------------------------------------------------------------- */
+
+      void addAtomForce(int atom, const fvec4& force, float* forces, long long* fixedForces) {
+          if (fixedForces == NULL)
+              (fvec4(forces+4*atom)+force).store(forces+4*atom);
+          else
+              for (int i = 0; i < 3; i++)
+                  fixedForces[3*atom+i] += (long long) (force[i]*fixedPointScale);
+      }
             
       /**---------------------------------------------------------------------------------------
       
@@ -76,9 +76,10 @@ protected:
     /**
     * Templatized implementation of calculateBlockIxn. It can handle both Ewald and non-ewald interactions
     * through a template parameter since the code is so similar for the two cases. Note also that the
-    * floating-point SIMD type is also templated to allow any suitable type to be used.
+    * floating-point SIMD type is also templated to allow any suitable type to be used.  When INCLUDE_FORCES
+    * is false, only the energy is computed.
     */
-    template <int PERIODIC_TYPE, BlockType BLOCK_TYPE>
+    template <int PERIODIC_TYPE, BlockType BLOCK_TYPE, bool INCLUDE_FORCES>
     void calculateBlockIxnImpl(int blockIndex, float* forces, double* totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize, const fvec4& blockCenter);
 
     /**
@@ -138,18 +139,18 @@ void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnHandler(int blockIndex, float
         using std::min;
         using std::max;
 
-        const int32_t* blockAtom = &neighborList->getSortedAtoms()[blockSize*blockIndex];
+        const float* blockPosq = &sortedPosq[4*blockSize*blockIndex];
         float minx, maxx, miny, maxy, minz, maxz;
-        minx = maxx = posq[4*blockAtom[0]];
-        miny = maxy = posq[4*blockAtom[0]+1];
-        minz = maxz = posq[4*blockAtom[0]+2];
+        minx = maxx = blockPosq[0];
+        miny = maxy = blockPosq[1];
+        minz = maxz = blockPosq[2];
         for (int i = 1; i < blockSize; i++) {
-            minx = min(minx, posq[4*blockAtom[i]]);
-            maxx = max(maxx, posq[4*blockAtom[i]]);
-            miny = min(miny, posq[4*blockAtom[i]+1]);
-            maxy = max(maxy, posq[4*blockAtom[i]+1]);
-            minz = min(minz, posq[4*blockAtom[i]+2]);
-            maxz = max(maxz, posq[4*blockAtom[i]+2]);
+            minx = min(minx, blockPosq[4*i]);
+            maxx = max(maxx, blockPosq[4*i]);
+            miny = min(miny, blockPosq[4*i+1]);
+            maxy = max(maxy, blockPosq[4*i+1]);
+            minz = min(minz, blockPosq[4*i+2]);
+            maxz = max(maxz, blockPosq[4*i+2]);
         }
         blockCenter = fvec4(0.5f*(minx+maxx), 0.5f*(miny+maxy), 0.5f*(minz+maxz), 0.0f);
         if (!(minx < cutoffDistance || miny < cutoffDistance || minz < cutoffDistance ||
@@ -165,28 +166,44 @@ void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnHandler(int blockIndex, float
             periodicType = PeriodicPerInteraction;
     }
     
-    // Call the appropriate version depending on what calculation is required for periodic boundary conditions.
-    if (periodicType == NoPeriodic)
-        calculateBlockIxnImpl<NoPeriodic, BLOCK_TYPE>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
-    else if (periodicType == PeriodicPerAtom)
-        calculateBlockIxnImpl<PeriodicPerAtom, BLOCK_TYPE>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
-    else if (periodicType == PeriodicPerInteraction)
-        calculateBlockIxnImpl<PeriodicPerInteraction, BLOCK_TYPE>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
-    else if (periodicType == PeriodicTriclinic)
-        calculateBlockIxnImpl<PeriodicTriclinic, BLOCK_TYPE>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
+    // Call the appropriate version depending on what calculation is required for periodic boundary conditions,
+    // and whether forces are needed.
+    if (includeForces) {
+        if (periodicType == NoPeriodic)
+            calculateBlockIxnImpl<NoPeriodic, BLOCK_TYPE, true>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
+        else if (periodicType == PeriodicPerAtom)
+            calculateBlockIxnImpl<PeriodicPerAtom, BLOCK_TYPE, true>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
+        else if (periodicType == PeriodicPerInteraction)
+            calculateBlockIxnImpl<PeriodicPerInteraction, BLOCK_TYPE, true>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
+        else if (periodicType == PeriodicTriclinic)
+            calculateBlockIxnImpl<PeriodicTriclinic, BLOCK_TYPE, true>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
+    }
+    else {
+        if (periodicType == NoPeriodic)
+            calculateBlockIxnImpl<NoPeriodic, BLOCK_TYPE, false>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
+        else if (periodicType == PeriodicPerAtom)
+            calculateBlockIxnImpl<PeriodicPerAtom, BLOCK_TYPE, false>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
+        else if (periodicType == PeriodicPerInteraction)
+            calculateBlockIxnImpl<PeriodicPerInteraction, BLOCK_TYPE, false>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
+        else if (periodicType == PeriodicTriclinic)
+            calculateBlockIxnImpl<PeriodicTriclinic, BLOCK_TYPE, false>(blockIndex, forces, totalEnergy, boxSize, invBoxSize, blockCenter);
+    }
 }
 
 template<typename FVEC>
-template <int PERIODIC_TYPE, BlockType BLOCK_TYPE>
+template <int PERIODIC_TYPE, BlockType BLOCK_TYPE, bool INCLUDE_FORCES>
 void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnImpl(int blockIndex, float* forces, double* totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize, const fvec4& blockCenter) {
-    // Load the positions and parameters of the atoms in the block.
+    // Load the positions and parameters of the atoms in the block.  They are stored in sorted order,
+    // so the block atoms are contiguous in memory.  Forces are stored by atom index.
 
-    const int32_t* blockAtom = &neighborList->getSortedAtoms()[blockSize * blockIndex];
+    const int firstIndex = blockSize*blockIndex;
+    const int32_t* blockAtom = &neighborList->getSortedAtoms()[firstIndex];
+    const float* atomPosq = &sortedPosq[0];
     fvec4 blockAtomPosq[blockSize];
     FVEC blockAtomForceX(0.0f), blockAtomForceY(0.0f), blockAtomForceZ(0.0f);
     FVEC blockAtomX, blockAtomY, blockAtomZ, blockAtomCharge;
     for (int i = 0; i < blockSize; i++) {
-        blockAtomPosq[i] = fvec4(posq+4*blockAtom[i]);
+        blockAtomPosq[i] = fvec4(atomPosq+4*(firstIndex+i));
         if (PERIODIC_TYPE == PeriodicPerAtom)
             blockAtomPosq[i] -= floor((blockAtomPosq[i]-blockCenter)*invBoxSize+0.5f)*boxSize; // :TODO: Apply one to blockAtom?
     }
@@ -194,18 +211,14 @@ void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnImpl(int blockIndex, float* f
     transpose(blockAtomPosq, blockAtomX, blockAtomY, blockAtomZ, blockAtomCharge);
     blockAtomCharge *= ONE_4PI_EPS0;
 
-    // Not the most efficient way to do this, but it works across all types we care about, and this isn't where
-    // the cycles are spent anyway.
-    FVEC blockAtomSigma = {};
-    FVEC blockAtomEpsilon = {};
-    for (int i=0; i<blockSize; ++i)
-    {
-        ((float*)&blockAtomSigma)[i] = atomParameters[blockAtom[i]].first;
-        ((float*)&blockAtomEpsilon)[i] = atomParameters[blockAtom[i]].second;
-    }
+    const float* atomSigma = &sortedSigma[0];
+    const float* atomEpsilon = &sortedEpsilon[0];
+    const FVEC blockAtomSigma(atomSigma+firstIndex);
+    const FVEC blockAtomEpsilon(atomEpsilon+firstIndex);
 
-    // Ewald needs C6 data gathered from a table. Unused variable for non-ewald.
-    const FVEC C6s = (BLOCK_TYPE == BlockType::EWALD) ? FVEC(C6params, blockAtom) : FVEC();
+    // LJPME needs the C6 parameters. Unused variable otherwise.
+    const float* atomC6 = (ljpme ? &sortedC6params[0] : NULL);
+    const FVEC C6s = (BLOCK_TYPE == BlockType::EWALD && ljpme) ? FVEC(atomC6+firstIndex) : FVEC();
 
     const bool needPeriodic = (PERIODIC_TYPE == PeriodicPerInteraction || PERIODIC_TYPE == PeriodicTriclinic);
     const float invSwitchingInterval = 1/(cutoffDistance-switchingDistance);
@@ -213,6 +226,7 @@ void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnImpl(int blockIndex, float* f
 
     // Loop over neighbors for this block.
     const auto& neighbors = neighborList->getBlockNeighbors(blockIndex);
+    const auto& sortedNeighbors = neighborList->getBlockSortedNeighbors(blockIndex);
     const auto& exclusions = neighborList->getBlockExclusions(blockIndex);
     FVEC partialEnergy = {};
 
@@ -220,11 +234,12 @@ void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnImpl(int blockIndex, float* f
         // Load the next neighbor.
         
         int atom = neighbors[i];
+        int sortedIndex = sortedNeighbors[i];
         
         // Compute the distances to the block atoms.
         
         FVEC dx, dy, dz, r2;
-        fvec4 atomPos(posq+4*atom);
+        fvec4 atomPos(atomPosq+4*sortedIndex);
         if (PERIODIC_TYPE == PeriodicPerAtom)
             atomPos -= floor((atomPos-blockCenter)*invBoxSize+0.5f)*boxSize;
         getDeltaR<PERIODIC_TYPE>(atomPos, blockAtomX, blockAtomY, blockAtomZ, dx, dy, dz, r2, boxSize, invBoxSize);
@@ -238,30 +253,34 @@ void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnImpl(int blockIndex, float* f
         const auto inverseR = rsqrt(r2);
         const auto r = r2*inverseR;
         FVEC energy, dEdR;
-        float atomEpsilon = atomParameters[atom].second;
-        if (atomEpsilon != 0.0f) {
-            const auto sig = blockAtomSigma+atomParameters[atom].first;
+        float epsilon = atomEpsilon[sortedIndex];
+        if (epsilon != 0.0f) {
+            const auto sig = blockAtomSigma+atomSigma[sortedIndex];
             const auto sig2 = (inverseR*sig)*(inverseR*sig);
             const auto sig6 = sig2*sig2*sig2;
-            const auto eps = blockAtomEpsilon*atomEpsilon;
+            const auto eps = blockAtomEpsilon*epsilon;
             const auto epsSig6 = eps*sig6;
-            dEdR = epsSig6*(12.0f*sig6 - 6.0f);
+            if (INCLUDE_FORCES)
+                dEdR = epsSig6*(12.0f*sig6 - 6.0f);
             energy = epsSig6*(sig6-1.0f);
             if (useSwitch) {
                 const auto t = blendZero((r-switchingDistance)*invSwitchingInterval, r>switchingDistance);
                 const auto switchValue = 1+t*t*t*(-10.0f+t*(15.0f-t*6.0f));
-                const auto switchDeriv = t*t*(-30.0f+t*(60.0f-t*30.0f))*invSwitchingInterval;
-                dEdR = switchValue*dEdR - energy*switchDeriv*r;
+                if (INCLUDE_FORCES) {
+                    const auto switchDeriv = t*t*(-30.0f+t*(60.0f-t*30.0f))*invSwitchingInterval;
+                    dEdR = switchValue*dEdR - energy*switchDeriv*r;
+                }
                 energy *= switchValue;
             }
             if (BLOCK_TYPE == BlockType::EWALD && ljpme) {
-                const auto C6ij = C6s*C6params[atom];
+                const auto C6ij = C6s*atomC6[sortedIndex];
                 const auto inverseR2 = inverseR*inverseR;
                 const auto mysig2 = sig*sig;
                 const auto mysig6 = mysig2*mysig2*mysig2;
                 const auto emult = C6ij*inverseR2*inverseR2*inverseR2*approximateFunctionFromTable(exptermsTable, r, FVEC(exptermsDXInv));
                 const auto potentialShift = eps*(1.0f-mysig6*inverseRcut6)*mysig6*inverseRcut6 - C6ij*inverseRcut6Expterm;
-                dEdR += 6.0f*C6ij*inverseR2*inverseR2*inverseR2*approximateFunctionFromTable(dExptermsTable, r, FVEC(exptermsDXInv));
+                if (INCLUDE_FORCES)
+                    dEdR += 6.0f*C6ij*inverseR2*inverseR2*inverseR2*approximateFunctionFromTable(dExptermsTable, r, FVEC(exptermsDXInv));
                 energy += emult + potentialShift;
             }
 
@@ -270,19 +289,21 @@ void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnImpl(int blockIndex, float* f
             energy = 0.0f;
             dEdR = 0.0f;
         }
-        const auto chargeProd = blockAtomCharge*posq[4*atom+3];
-        if (BLOCK_TYPE == BlockType::EWALD)
-        {
-            dEdR += chargeProd*inverseR*approximateFunctionFromTable(ewaldScaleTable, r, FVEC(ewaldDXInv));
-        }
-        else
-        {
-            if (cutoff)
-                dEdR += chargeProd*(inverseR-2.0f*krf*r2);
+        const auto chargeProd = blockAtomCharge*atomPosq[4*sortedIndex+3];
+        if (INCLUDE_FORCES) {
+            if (BLOCK_TYPE == BlockType::EWALD)
+            {
+                dEdR += chargeProd*inverseR*approximateFunctionFromTable(ewaldScaleTable, r, FVEC(ewaldDXInv));
+            }
             else
-                dEdR += chargeProd*inverseR;
+            {
+                if (cutoff)
+                    dEdR += chargeProd*(inverseR-2.0f*krf*r2);
+                else
+                    dEdR += chargeProd*inverseR;
+            }
+            dEdR *= inverseR*inverseR;
         }
-        dEdR *= inverseR*inverseR;
 
         // Accumulate energies.
         if (totalEnergy) {
@@ -301,6 +322,8 @@ void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnImpl(int blockIndex, float* f
         }
 
         // Accumulate forces.
+        if (!INCLUDE_FORCES)
+            continue;
         dEdR = blendZero(dEdR, include);
         const auto fx = dx*dEdR;
         const auto fy = dy*dEdR;
@@ -316,6 +339,8 @@ void CpuNonbondedForceFvec<FVEC>::calculateBlockIxnImpl(int blockIndex, float* f
     
     if (totalEnergy)
         *totalEnergy += reduceAdd(partialEnergy);
+    if (!INCLUDE_FORCES)
+        return;
 
     // Record the forces on the block atoms.
     fvec4 f[blockSize];
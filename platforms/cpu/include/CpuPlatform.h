@@ -40,6 +40,7 @@
 #include "openmm/internal/ThreadPool.h"
 #include "windowsExportCpu.h"
 #include <map>
+#include <memory>
 
 namespace OpenMM {
     
@@ -60,6 +61,7 @@ public:
     bool supportsDoublePrecision() const;
     static bool isProcessorSupported();
     void contextCreated(ContextImpl& context, const std::map<std::string, std::string>& properties) const;
+    void linkedContextCreated(ContextImpl& context, ContextImpl& originalContext) const;
     void contextDestroyed(ContextImpl& context) const;
     /**
      * This is the name of the parameter for selecting the number of threads to use.
@@ -70,13 +72,60 @@ public:
     }
     /**
      * This is the name of the parameter for requesting that force computations be deterministic.  Setting
-     * this to "true" DOES NOT GUARANTEE that the forces will actually be fully deterministic, but it does
-     * try to reduce the variation in them at the cost of a small loss in performance.
+     * this to "true" makes nonbonded forces and the PME charge grid accumulate in 64-bit fixed point, and
+     * computes bonded forces and nonbonded exceptions in a fixed order on one thread, so they do not depend
+     * on how work is divided between threads.  Each thread needs its own fixed point copy of the forces and
+     * of the PME grid, which takes numThreads*(24*numParticles+8*gridSize) bytes in addition to the usual
+     * buffers.  Other multithreaded forces, such as the custom nonbonded, GB, many particle, hbond, external,
+     * RMSD, and Gay-Berne forces, are not affected and may still vary with the number of threads.
      */
     static const std::string& CpuDeterministicForces() {
         static const std::string key = "DeterministicForces";
         return key;
     }
+    /**
+     * This is the name of the parameter for requesting that CustomNonbondedForces be computed by interpolating
+     * from tables when possible.  If this is "true", a CustomNonbondedForce that uses a cutoff, has a small number
+     * of distinct sets of per-particle parameters, does not compute parameter derivatives, and whose energy
+     * is a smooth function of r is evaluated from cubic spline tables built for every pair of particle types.
+     * This can be much faster for complicated expressions, at the cost of a small interpolation error.
+     */
+    static const std::string& CpuTabulateCustomNonbonded() {
+        static const std::string key = "TabulateCustomNonbonded";
+        return key;
+    }
+    /**
+     * This is the name of the parameter for requesting that worker threads busy-wait for a short time at
+     * synchronization points before blocking.  Setting this to "true" reduces the latency of each parallel
+     * operation, which can noticeably speed up small and medium sized systems, but it uses more CPU time
+     * and should only be used when the threads are not competing with other work for the same cores.
+     */
+    static const std::string& CpuSpinWait() {
+        static const std::string key = "SpinWait";
+        return key;
+    }
+    /**
+     * This is the name of the parameter for binding worker threads to processor cores.  It may be "none" (the
+     * default) to let the operating system place threads, "compact" to fill the cores of one processor socket
+     * before using the next, "scatter" to spread threads evenly across sockets, or an explicit comma separated
+     * list of core indices and ranges such as "0-7,16-23".  Binding threads keeps each one close to the memory
+     * it works on, which matters on systems with multiple sockets.  This is currently only supported on Linux.
+     */
+    static const std::string& CpuThreadAffinity() {
+        static const std::string key = "ThreadAffinity";
+        return key;
+    }
+    /**
+     * This is the name of the parameter for requesting that the context use a thread pool shared with other
+     * contexts.  If this is "true", all contexts in the process that set it and use the same number of threads,
+     * SpinWait, and ThreadAffinity settings share one set of worker threads.  Their parallel operations take
+     * turns in the order they were requested.  This avoids oversubscribing the cores when many contexts are
+     * used at once, for example when running several replicas in one process.
+     */
+    static const std::string& CpuSharedThreadPool() {
+        static const std::string key = "SharedThreadPool";
+        return key;
+    }
     /**
      * We cannot use the standard mechanism for platform data, because that is already used by the superclass.
      * Instead, we maintain a table of ContextImpls to PlatformDatas.
@@ -84,26 +133,36 @@ public:
     static PlatformData& getPlatformData(ContextImpl& context);
     static const PlatformData& getPlatformData(const ContextImpl& context);
 private:
+    void createPlatformData(ContextImpl& context, const std::map<std::string, std::string>& properties, std::shared_ptr<ThreadPool> threads) const;
     static std::map<const ContextImpl*, PlatformData*> contextData;
 };
 
 class CpuPlatform::PlatformData {
 public:
-    PlatformData(int numParticles, int numThreads, bool deterministicForces);
+    PlatformData(int numParticles, std::shared_ptr<ThreadPool> threadPool, bool deterministicForces, bool tabulateCustomNonbonded,
+            const std::string& threadAffinity, bool sharedThreadPool);
     ~PlatformData();
     void requestNeighborList(double cutoffDistance, double padding, bool useExclusions, const std::vector<std::set<int> >& exclusionList);
     int requestPosqIndex();
     AlignedArray<float> posq;
     std::vector<AlignedArray<float> > threadForce;
-    ThreadPool threads;
+    std::shared_ptr<ThreadPool> threadPool;
+    ThreadPool& threads;
     bool isPeriodic;
     CpuRandom random;
     std::map<std::string, std::string> propertyValues;
     CpuNeighborList* neighborList;
     double cutoff, paddedCutoff;
-    bool anyExclusions, deterministicForces;
+    bool anyExclusions, deterministicForces, tabulateCustomNonbonded;
     int currentPosqIndex, nextPosqIndex;
     std::vector<std::set<int> > exclusions;
+    /**
+     * When deterministicForces is true, kernels may add forces to these arrays (three values per atom) as 64-bit
+     * fixed point values, multiplied by FIXED_POINT_SCALE.  Integer addition is associative, so the sum does not
+     * depend on which thread computed each contribution.  Otherwise they are empty.
+     */
+    std::vector<std::vector<long long> > threadFixedForce;
+    static const double FIXED_POINT_SCALE;
 };
 
 } // namespace OpenMM
@@ -0,0 +1,100 @@
+
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Peter Eastman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OPENMM_CPU_RMSD_FORCE_H__
+#define OPENMM_CPU_RMSD_FORCE_H__
+
+#include "AlignedArray.h"
+#include "openmm/Vec3.h"
+#include "openmm/internal/ThreadPool.h"
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * This class computes RMSDForce on multiple threads.  It uses the same quaternion based algorithm
+ * as the reference implementation, but accumulates the centroid and correlation matrix as a
+ * parallel reduction in a single pass over the particles.
+ */
+class CpuRMSDForce {
+private:
+    /**
+     * The number of values accumulated by each thread: the sum of positions (3), the correlation
+     * matrix (9), and the sum of squared positions (1).  Positions are measured relative to origin.
+     */
+    static const int NumSums = 13;
+    ThreadPool& threads;
+    std::vector<int> particles;
+    std::vector<double> referencePos;
+    double sumRefSquared;
+    std::vector<double> threadSums;
+    // The following variables are used to make information accessible to the individual threads.
+    std::vector<Vec3>* atomCoordinates;
+    std::vector<AlignedArray<float> >* threadForce;
+    Vec3 origin, center;
+    double U[3][3];
+    double forceScale;
+
+    /**
+     * Compute this thread's contribution to the centroid and correlation matrix.
+     */
+    void threadComputeSums(int threadIndex);
+
+    /**
+     * Apply forces to this thread's block of particles.
+     */
+    void threadApplyForces(int threadIndex);
+
+public:
+    /**
+     * Create a new CpuRMSDForce.
+     *
+     * @param referencePos   the reference positions of all particles in the System
+     * @param particles      the indices of the particles to include
+     * @param threads        the thread pool to use
+     */
+    CpuRMSDForce(const std::vector<Vec3>& referencePos, const std::vector<int>& particles, ThreadPool& threads);
+
+    /**
+     * Change the reference positions and the set of particles to include.
+     *
+     * @param referencePos   the reference positions of all particles in the System
+     * @param particles      the indices of the particles to include
+     */
+    void setParameters(const std::vector<Vec3>& referencePos, const std::vector<int>& particles);
+
+    /**
+     * Calculate the interaction.
+     *
+     * @param atomCoordinates    atom coordinates
+     * @param threadForce        the collection of arrays for each thread to add forces to
+     * @param includeForces      whether to compute forces
+     * @return the RMSD
+     */
+    double calculateIxn(std::vector<Vec3>& atomCoordinates, std::vector<AlignedArray<float> >& threadForce, bool includeForces);
+};
+
+} // namespace OpenMM
+
+#endif // OPENMM_CPU_RMSD_FORCE_H__
@@ -34,6 +34,7 @@
 
 #include "sfmt/SFMT.h"
 #include "windowsExportCpu.h"
+#include <iosfwd>
 #include <vector>
 
 namespace OpenMM {
@@ -47,7 +48,28 @@ public:
     ~CpuRandom();
     void initialize(int seed, int numThreads);
     float getGaussianRandom(int threadIndex);
+    /**
+     * Generate many Gaussian random numbers at once.  This is much faster than calling getGaussianRandom()
+     * repeatedly, since the transformation is done four pairs of values at a time with SIMD instructions.
+     *
+     * @param threadIndex  the index of the thread generating the values
+     * @param values       the generated values are stored into this array
+     * @param count        the number of values to generate
+     */
+    void getGaussianRandoms(int threadIndex, float* values, int count);
     float getUniformRandom(int threadIndex);
+    /**
+     * Write the internal state of all the generators to a checkpoint.
+     */
+    void createCheckpoint(std::ostream& stream) const;
+    /**
+     * Restore the internal state of all the generators from a checkpoint.  If the checkpoint does not
+     * contain it, the stream is left where it was and the generators are not changed.
+     *
+     * @param stream      the stream to read the checkpoint from
+     * @param numThreads  the number of threads to create generators for, if they have not been initialized yet
+     */
+    void loadCheckpoint(std::istream& stream, int numThreads);
 private:
     bool hasInitialized;
     int randomSeed;
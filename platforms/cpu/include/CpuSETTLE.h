@@ -67,9 +67,15 @@ public:
      * @param tolerance        the constraint tolerance
      */
     void applyToVelocities(std::vector<OpenMM::Vec3>& atomCoordinates, std::vector<OpenMM::Vec3>& velocities, std::vector<double>& inverseMasses, double tolerance);
+
+    /**
+     * Get the parameters of all clusters, in the form expected by the ReferenceSETTLEAlgorithm constructor.
+     */
+    void getClusterParameters(std::vector<int>& atom1, std::vector<int>& atom2, std::vector<int>& atom3, std::vector<double>& distance1, std::vector<double>& distance2) const;
 private:
     std::vector<ReferenceSETTLEAlgorithm*> threadSettle;
     ThreadPool& threads;
+    ThreadPool::WorkQueue workQueue;
 };
 
 } // namespace OpenMM
@@ -38,12 +38,22 @@ using namespace std;
 CpuBondForce::CpuBondForce() {
 }
 
-void CpuBondForce::initialize(int numAtoms, int numBonds, int numAtomsPerBond, vector<vector<int> >& bondAtoms, ThreadPool& threads) {
+void CpuBondForce::initialize(int numAtoms, int numBonds, int numAtomsPerBond, vector<vector<int> >& bondAtoms, ThreadPool& threads, bool deterministic) {
     this->numBonds = numBonds;
     this->numAtomsPerBond = numAtomsPerBond;
     this->bondAtoms = bondAtoms.empty() ? nullptr : bondAtoms.data();
     this->threads = &threads;
     int numThreads = threads.getNumThreads();
+    if (deterministic) {
+        // Treat every bond as an "extra" bond, so they are all computed in the same order on one thread.
+
+        threadBonds.clear();
+        threadBonds.resize(numThreads);
+        extraBonds.resize(numBonds);
+        for (int bond = 0; bond < numBonds; bond++)
+            extraBonds[bond] = bond;
+        return;
+    }
     int targetBondsPerThread = numBonds/numThreads;
     
     // Record the bonds that include each atom.
@@ -169,11 +179,10 @@ void CpuBondForce::calculateForce(vector<Vec3>& atomCoordinates, vector<vector<d
     // Have the worker threads compute their forces.
     
     vector<double> threadEnergy(threads->getNumThreads(), 0);
-    threads->execute([&] (ThreadPool& threads, int threadIndex) {
+    threads->executeAndWait([&] (ThreadPool& threads, int threadIndex) {
         double* energy = (totalEnergy == NULL ? NULL : &threadEnergy[threadIndex]);
         threadComputeForce(threads, threadIndex, atomCoordinates, parameters, forces, energy, referenceBondIxn);
     });
-    threads->waitForThreads();
     
     // Compute any "extra" bonds.
     
@@ -189,12 +198,36 @@ void CpuBondForce::calculateForce(vector<Vec3>& atomCoordinates, vector<vector<d
             *totalEnergy += threadEnergy[i];
 }
 
+void CpuBondForce::calculateForce(vector<Vec3>& atomCoordinates, vector<vector<double> >& parameters, vector<Vec3>& forces,
+        double* totalEnergy, vector<ReferenceBondIxn*>& threadBondIxn, vector<vector<double> >& threadEnergyParamDerivs) {
+    // Have the worker threads compute their forces, each with its own interaction.
+
+    vector<double> threadEnergy(threads->getNumThreads(), 0);
+    threads->executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+        double* energy = (totalEnergy == NULL ? NULL : &threadEnergy[threadIndex]);
+        threadComputeForce(threads, threadIndex, atomCoordinates, parameters, forces, energy, *threadBondIxn[threadIndex], threadEnergyParamDerivs[threadIndex].data());
+    });
+
+    // Compute any "extra" bonds.
+
+    for (int i = 0; i < extraBonds.size(); i++) {
+        int bond = extraBonds[i];
+        threadBondIxn[0]->calculateBondIxn(bondAtoms[bond], atomCoordinates, parameters[bond], forces, totalEnergy, threadEnergyParamDerivs[0].data());
+    }
+
+    // Compute the total energy.
+
+    if (totalEnergy != NULL)
+        for (int i = 0; i < threads->getNumThreads(); i++)
+            *totalEnergy += threadEnergy[i];
+}
+
 void CpuBondForce::threadComputeForce(ThreadPool& threads, int threadIndex, vector<Vec3>& atomCoordinates, vector<vector<double> >& parameters, vector<Vec3>& forces, 
-            double* totalEnergy, ReferenceBondIxn& referenceBondIxn) {
+            double* totalEnergy, ReferenceBondIxn& referenceBondIxn, double* energyParamDerivs) {
     vector<int>& bonds = threadBonds[threadIndex];
     int numBonds = bonds.size();
     for (int i = 0; i < numBonds; i++) {
         int bond = bonds[i];
-        referenceBondIxn.calculateBondIxn(bondAtoms[bond], atomCoordinates, parameters[bond], forces, totalEnergy, NULL);
+        referenceBondIxn.calculateBondIxn(bondAtoms[bond], atomCoordinates, parameters[bond], forces, totalEnergy, energyParamDerivs);
     }
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Peter Eastman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "CpuCustomExternalForce.h"
+
+using namespace OpenMM;
+using namespace std;
+
+CpuCustomExternalForce::ThreadData::ThreadData(const Lepton::CompiledExpression& expression, const vector<string>& parameterNames) :
+            expression(expression) {
+    map<string, double*> variableLocations;
+    variableLocations["x"] = &x;
+    variableLocations["y"] = &y;
+    variableLocations["z"] = &z;
+    param.resize(parameterNames.size());
+    for (int i = 0; i < (int) parameterNames.size(); i++)
+        variableLocations[parameterNames[i]] = &param[i];
+    this->expression.setVariableLocations(variableLocations);
+    expressionSet.registerExpression(this->expression);
+}
+
+CpuCustomExternalForce::CpuCustomExternalForce(const Lepton::CompiledExpression& expression, const vector<string>& parameterNames,
+            const vector<int>& particles, ThreadPool& threads) : threads(threads), numParameters(parameterNames.size()), particles(particles) {
+    particleParams.resize(particles.size()*numParameters);
+    for (int i = 0; i < threads.getNumThreads(); i++)
+        threadData.push_back(new ThreadData(expression, parameterNames));
+    threadEnergy.resize(threads.getNumThreads());
+}
+
+CpuCustomExternalForce::~CpuCustomExternalForce() {
+    for (auto data : threadData)
+        delete data;
+}
+
+void CpuCustomExternalForce::setParticleParameters(int index, const vector<double>& parameters) {
+    for (int i = 0; i < numParameters; i++)
+        particleParams[index*numParameters+i] = parameters[i];
+}
+
+void CpuCustomExternalForce::calculateIxn(vector<Vec3>& atomCoordinates, const map<string, double>& globalParameters,
+            vector<AlignedArray<float> >& threadForce, bool includeForces, bool includeEnergy, double& energy) {
+    // Record the parameters for the threads.
+
+    this->atomCoordinates = &atomCoordinates;
+    this->globalParameters = &globalParameters;
+    this->threadForce = &threadForce;
+    this->includeForces = includeForces;
+    this->includeEnergy = includeEnergy;
+
+    // Signal the threads to start running and wait for them to finish.
+
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex); });
+
+    // Combine the energies from all the threads.
+
+    if (includeEnergy)
+        for (int i = 0; i < threads.getNumThreads(); i++)
+            energy += threadEnergy[i];
+}
+
+void CpuCustomExternalForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
+    // Each thread processes a contiguous block of particles.  Every particle requires the same amount
+    // of work, so there is no need for dynamic load balancing.
+
+    int numThreads = threads.getNumThreads();
+    int numParticles = particles.size();
+    int start = (int) (((long long) numParticles*threadIndex)/numThreads);
+    int end = (int) (((long long) numParticles*(threadIndex+1))/numThreads);
+    ThreadData& data = *threadData[threadIndex];
+    for (auto& param : *globalParameters)
+        data.expressionSet.setVariable(data.expressionSet.getVariableIndex(param.first), param.second);
+    float* forces = &(*threadForce)[threadIndex][0];
+    vector<Vec3>& pos = *atomCoordinates;
+    const double* params = particleParams.data();
+    double energy = 0;
+    for (int i = start; i < end; i++) {
+        int particle = particles[i];
+        data.x = pos[particle][0];
+        data.y = pos[particle][1];
+        data.z = pos[particle][2];
+        for (int j = 0; j < numParameters; j++)
+            data.param[j] = params[i*numParameters+j];
+
+        // The energy and all three derivatives are computed in a single pass.
+
+        data.expression.evaluate();
+        if (includeForces) {
+            forces[4*particle] -= (float) data.expression.getOutputValue(1);
+            forces[4*particle+1] -= (float) data.expression.getOutputValue(2);
+            forces[4*particle+2] -= (float) data.expression.getOutputValue(3);
+        }
+        if (includeEnergy)
+            energy += data.expression.getOutputValue(0);
+    }
+    threadEnergy[threadIndex] = energy;
+}
@@ -0,0 +1,526 @@
+
+/* Portions copyright (c) 2009-2018 Stanford University and Simbios.
+ * Contributors: Peter Eastman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sstream>
+#include <utility>
+
+#include "SimTKOpenMMUtilities.h"
+#include "CpuCustomHbondForce.h"
+#include "ReferenceTabulatedFunction.h"
+#include "openmm/internal/CustomHbondForceImpl.h"
+#include "lepton/CustomFunction.h"
+
+using namespace OpenMM;
+using namespace std;
+
+CpuCustomHbondForce::CpuCustomHbondForce(const CustomHbondForce& force, ThreadPool& threads) :
+            threads(threads), useCutoff(false), usePeriodic(false) {
+    numDonors = force.getNumDonors();
+    numAcceptors = force.getNumAcceptors();
+    donorAtoms.resize(numDonors);
+    acceptorAtoms.resize(numAcceptors);
+    vector<double> parameters;
+    for (int i = 0; i < numDonors; i++) {
+        int d1, d2, d3;
+        force.getDonorParameters(i, d1, d2, d3, parameters);
+        donorAtoms[i] = {d1, d2, d3};
+    }
+    for (int i = 0; i < numAcceptors; i++) {
+        int a1, a2, a3;
+        force.getAcceptorParameters(i, a1, a2, a3, parameters);
+        acceptorAtoms[i] = {a1, a2, a3};
+    }
+
+    // Record exclusions.
+
+    exclusions.resize(numDonors);
+    for (int i = 0; i < force.getNumExclusions(); i++) {
+        int donor, acceptor;
+        force.getExclusionParticles(i, donor, acceptor);
+        exclusions[donor].insert(acceptor);
+    }
+
+    // Create custom functions for the tabulated functions.
+
+    map<string, Lepton::CustomFunction*> functions;
+    for (int i = 0; i < force.getNumFunctions(); i++)
+        functions[force.getTabulatedFunctionName(i)] = createReferenceTabulatedFunction(force.getTabulatedFunction(i));
+
+    // Parse the expression and create the objects used to calculate the interaction.
+
+    map<string, vector<int> > distances;
+    map<string, vector<int> > angles;
+    map<string, vector<int> > dihedrals;
+    Lepton::ParsedExpression energyExpr = CustomHbondForceImpl::prepareExpression(force, functions, distances, angles, dihedrals);
+    for (int i = 0; i < threads.getNumThreads(); i++)
+        threadData.push_back(new ThreadData(force, energyExpr, distances, angles, dihedrals));
+    if (force.getNonbondedMethod() != CustomHbondForce::NoCutoff)
+        setUseCutoff(force.getCutoffDistance());
+
+    // Delete the custom functions.
+
+    for (auto& function : functions)
+        delete function.second;
+}
+
+CpuCustomHbondForce::~CpuCustomHbondForce() {
+    for (auto data : threadData)
+        delete data;
+}
+
+void CpuCustomHbondForce::setUseCutoff(double distance) {
+    useCutoff = true;
+    cutoffDistance = distance;
+}
+
+void CpuCustomHbondForce::setPeriodic(Vec3* periodicBoxVectors) {
+    assert(useCutoff);
+    assert(periodicBoxVectors[0][0] >= 2.0*cutoffDistance);
+    assert(periodicBoxVectors[1][1] >= 2.0*cutoffDistance);
+    assert(periodicBoxVectors[2][2] >= 2.0*cutoffDistance);
+    usePeriodic = true;
+    this->periodicBoxVectors[0] = periodicBoxVectors[0];
+    this->periodicBoxVectors[1] = periodicBoxVectors[1];
+    this->periodicBoxVectors[2] = periodicBoxVectors[2];
+    recipBoxSize[0] = (float) (1.0/periodicBoxVectors[0][0]);
+    recipBoxSize[1] = (float) (1.0/periodicBoxVectors[1][1]);
+    recipBoxSize[2] = (float) (1.0/periodicBoxVectors[2][2]);
+    periodicBoxVec4.resize(3);
+    periodicBoxVec4[0] = fvec4(periodicBoxVectors[0][0], periodicBoxVectors[0][1], periodicBoxVectors[0][2], 0);
+    periodicBoxVec4[1] = fvec4(periodicBoxVectors[1][0], periodicBoxVectors[1][1], periodicBoxVectors[1][2], 0);
+    periodicBoxVec4[2] = fvec4(periodicBoxVectors[2][0], periodicBoxVectors[2][1], periodicBoxVectors[2][2], 0);
+}
+
+void CpuCustomHbondForce::calculateIxn(AlignedArray<float>& posq, vector<vector<double> >& donorParameters, vector<vector<double> >& acceptorParameters,
+                                       const map<string, double>& globalParameters, vector<AlignedArray<float> >& threadForce,
+                                       bool includeForces, bool includeEnergy, double& energy) {
+    // Record the parameters for the threads.
+
+    this->posq = &posq[0];
+    this->donorParameters = &donorParameters;
+    this->acceptorParameters = &acceptorParameters;
+    this->globalParameters = &globalParameters;
+    this->threadForce = &threadForce;
+    this->includeForces = includeForces;
+    this->includeEnergy = includeEnergy;
+    if (useCutoff)
+        assignAcceptorsToCells();
+    atomicCounter = 0;
+
+    // Signal the threads to start running and wait for them to finish.
+
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex); });
+
+    // Combine the energies from all the threads.
+
+    if (includeEnergy) {
+        int numThreads = threads.getNumThreads();
+        for (int i = 0; i < numThreads; i++)
+            energy += threadData[i]->energy;
+    }
+}
+
+void CpuCustomHbondForce::assignAcceptorsToCells() {
+    double width[3];
+    if (usePeriodic) {
+        Vec3* box = periodicBoxVectors;
+        double volume = box[0][0]*box[1][1]*box[2][2];
+        width[0] = volume/sqrt(box[1].cross(box[2]).dot(box[1].cross(box[2])));
+        width[1] = volume/sqrt(box[2].cross(box[0]).dot(box[2].cross(box[0])));
+        width[2] = volume/sqrt(box[0].cross(box[1]).dot(box[0].cross(box[1])));
+        for (int i = 0; i < 3; i++)
+            cellOrigin[i] = 0.0f;
+    }
+    else {
+        Vec3 minPos, maxPos;
+        for (int i = 0; i < numAcceptors; i++) {
+            const float* pos = posq+4*acceptorAtoms[i][0];
+            for (int j = 0; j < 3; j++) {
+                minPos[j] = (i == 0 ? pos[j] : min(minPos[j], (double) pos[j]));
+                maxPos[j] = (i == 0 ? pos[j] : max(maxPos[j], (double) pos[j]));
+            }
+        }
+        for (int j = 0; j < 3; j++) {
+            width[j] = maxPos[j]-minPos[j];
+            cellOrigin[j] = (float) minPos[j];
+        }
+    }
+
+    // Divide space into cells that are at least as wide as the cutoff, but don't create
+    // more cells than are useful for the number of acceptors.
+
+    int maxCellsPerAxis = max(1, (int) ceil(2*cbrt((double) numAcceptors)));
+    for (int i = 0; i < 3; i++) {
+        numCells[i] = max(1, min(maxCellsPerAxis, (int) floor(width[i]/cutoffDistance)));
+        cellScale[i] = (float) (usePeriodic ? numCells[i] : (width[i] > 0 ? numCells[i]/width[i] : 0.0));
+    }
+    int totalCells = numCells[0]*numCells[1]*numCells[2];
+    cellStart.assign(totalCells+1, 0);
+    cellAcceptors.resize(numAcceptors);
+    vector<int> acceptorCell(numAcceptors);
+    for (int i = 0; i < numAcceptors; i++) {
+        int cell[3];
+        getCellCoordinates(posq+4*acceptorAtoms[i][0], cell);
+        acceptorCell[i] = cell[0]+numCells[0]*(cell[1]+numCells[1]*cell[2]);
+        cellStart[acceptorCell[i]+1]++;
+    }
+    for (int i = 0; i < totalCells; i++)
+        cellStart[i+1] += cellStart[i];
+    vector<int> cellPos(cellStart.begin(), cellStart.end()-1);
+    for (int i = 0; i < numAcceptors; i++)
+        cellAcceptors[cellPos[acceptorCell[i]]++] = i;
+}
+
+void CpuCustomHbondForce::getCellCoordinates(const float* pos, int* cell) const {
+    float s[3];
+    if (usePeriodic) {
+        // Convert to fractional coordinates.  The box vectors are in reduced form, so this is just a
+        // triangular solve.
+
+        s[2] = pos[2]*recipBoxSize[2];
+        s[1] = (pos[1]-s[2]*(float) periodicBoxVectors[2][1])*recipBoxSize[1];
+        s[0] = (pos[0]-s[2]*(float) periodicBoxVectors[2][0]-s[1]*(float) periodicBoxVectors[1][0])*recipBoxSize[0];
+        for (int i = 0; i < 3; i++)
+            s[i] -= floorf(s[i]);
+    }
+    else
+        for (int i = 0; i < 3; i++)
+            s[i] = pos[i]-cellOrigin[i];
+    for (int i = 0; i < 3; i++)
+        cell[i] = max(0, min(numCells[i]-1, (int) (s[i]*cellScale[i])));
+}
+
+void CpuCustomHbondForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
+    float* forces = &(*threadForce)[threadIndex][0];
+    ThreadData& data = *threadData[threadIndex];
+    data.energy = 0;
+    for (auto& param : *globalParameters)
+        data.expressionSet.setVariable(data.expressionSet.getVariableIndex(param.first), param.second);
+    while (true) {
+        int donor = atomicCounter++;
+        if (donor >= numDonors)
+            break;
+        findAcceptors(donor, data);
+        if (data.batchAcceptors.size() > 0)
+            calculateBatch(donor, forces, data);
+    }
+}
+
+void CpuCustomHbondForce::findAcceptors(int donor, ThreadData& data) {
+    vector<int>& batch = data.batchAcceptors;
+    const set<int>& excluded = exclusions[donor];
+    batch.clear();
+    if (!useCutoff) {
+        for (int acceptor = 0; acceptor < numAcceptors; acceptor++)
+            if (excluded.find(acceptor) == excluded.end())
+                batch.push_back(acceptor);
+        return;
+    }
+
+    // Search the cells adjacent to the one containing the donor.
+
+    const float* donorPos = posq+4*donorAtoms[donor][0];
+    fvec4 pos1(donorPos);
+    float cutoff2 = (float) (cutoffDistance*cutoffDistance);
+    int cell[3];
+    getCellCoordinates(donorPos, cell);
+    int cellRange[3][3], rangeSize[3];
+    for (int axis = 0; axis < 3; axis++) {
+        rangeSize[axis] = 0;
+        if (usePeriodic && numCells[axis] <= 3)
+            for (int j = 0; j < numCells[axis]; j++)
+                cellRange[axis][rangeSize[axis]++] = j;
+        else
+            for (int j = cell[axis]-1; j <= cell[axis]+1; j++) {
+                if (usePeriodic)
+                    cellRange[axis][rangeSize[axis]++] = (j+numCells[axis])%numCells[axis];
+                else if (j >= 0 && j < numCells[axis])
+                    cellRange[axis][rangeSize[axis]++] = j;
+            }
+    }
+    for (int i = 0; i < rangeSize[2]; i++)
+        for (int j = 0; j < rangeSize[1]; j++)
+            for (int k = 0; k < rangeSize[0]; k++) {
+                int cellIndex = cellRange[0][k]+numCells[0]*(cellRange[1][j]+numCells[1]*cellRange[2][i]);
+                for (int m = cellStart[cellIndex]; m < cellStart[cellIndex+1]; m++) {
+                    int acceptor = cellAcceptors[m];
+                    fvec4 deltaR;
+                    float r2;
+                    computeDelta(pos1, fvec4(posq+4*acceptorAtoms[acceptor][0]), deltaR, r2);
+                    if (r2 < cutoff2 && excluded.find(acceptor) == excluded.end())
+                        batch.push_back(acceptor);
+                }
+            }
+}
+
+void CpuCustomHbondForce::calculateBatch(int donor, float* forces, ThreadData& data) {
+    CompiledExpressionSet& expressionSet = data.expressionSet;
+    int numInBatch = data.batchAcceptors.size();
+    int numDeltas = data.deltaPairs.size();
+    int numAngles = data.angleTerms.size();
+    int numDihedrals = data.dihedralTerms.size();
+    AlignedArray<fvec4>& delta = data.delta;
+    AlignedArray<fvec4>& cross1 = data.cross1;
+    AlignedArray<fvec4>& cross2 = data.cross2;
+    vector<float>& normDelta = data.normDelta;
+    vector<float>& norm2Delta = data.norm2Delta;
+    if (delta.size() < numInBatch*numDeltas) {
+        delta.resize(numInBatch*numDeltas);
+        normDelta.resize(numInBatch*numDeltas);
+        norm2Delta.resize(numInBatch*numDeltas);
+    }
+    if (data.angles.size() < numInBatch*numAngles)
+        data.angles.resize(numInBatch*numAngles);
+    if (cross1.size() < numInBatch*numDihedrals) {
+        cross1.resize(numInBatch*numDihedrals);
+        cross2.resize(numInBatch*numDihedrals);
+        data.dihedrals.resize(numInBatch*numDihedrals);
+    }
+
+    // Record the donor parameters, which are the same for every interaction in the batch.
+
+    for (int i = 0; i < (int) data.donorParamIndex.size(); i++)
+        expressionSet.setVariable(data.donorParamIndex[i], (*donorParameters)[donor][i]);
+
+    // Compute the geometry of every interaction in the batch.  Atoms 0-2 are the acceptor atoms and
+    // 3-5 are the donor atoms.
+
+    int atoms[6];
+    for (int i = 0; i < 3; i++)
+        atoms[i+3] = donorAtoms[donor][i];
+    for (int b = 0; b < numInBatch; b++) {
+        for (int i = 0; i < 3; i++)
+            atoms[i] = acceptorAtoms[data.batchAcceptors[b]][i];
+        for (int i = 0; i < numDeltas; i++) {
+            int index = b*numDeltas+i;
+            int p1 = atoms[data.deltaPairs[i].first];
+            int p2 = atoms[data.deltaPairs[i].second];
+            computeDelta(fvec4(posq+4*p1), fvec4(posq+4*p2), delta[index], norm2Delta[index]);
+            normDelta[index] = sqrtf(norm2Delta[index]);
+        }
+    }
+    for (int b = 0; b < numInBatch; b++) {
+        int offset = b*numDeltas;
+        for (int i = 0; i < numAngles; i++) {
+            const AngleTermInfo& term = data.angleTerms[i];
+            data.angles[b*numAngles+i] = computeAngle(delta[offset+term.delta1], delta[offset+term.delta2], norm2Delta[offset+term.delta1],
+                    norm2Delta[offset+term.delta2], term.delta1Sign*term.delta2Sign);
+        }
+        for (int i = 0; i < numDihedrals; i++) {
+            const DihedralTermInfo& term = data.dihedralTerms[i];
+            int index = b*numDihedrals+i;
+            data.dihedrals[index] = getDihedralAngleBetweenThreeVectors(delta[offset+term.delta1], delta[offset+term.delta2], delta[offset+term.delta3],
+                    cross1[index], cross2[index], delta[offset+term.delta1]);
+        }
+    }
+
+    // Evaluate the interactions.
+
+    AlignedArray<fvec4>& f = data.f;
+    for (int b = 0; b < numInBatch; b++) {
+        int acceptor = data.batchAcceptors[b];
+        for (int i = 0; i < 3; i++)
+            atoms[i] = acceptorAtoms[acceptor][i];
+        for (int i = 0; i < (int) data.acceptorParamIndex.size(); i++)
+            expressionSet.setVariable(data.acceptorParamIndex[i], (*acceptorParameters)[acceptor][i]);
+        int offset = b*numDeltas;
+        for (auto& term : data.distanceTerms)
+            expressionSet.setVariable(term.variableIndex, normDelta[offset+term.delta]);
+        for (int i = 0; i < numAngles; i++)
+            expressionSet.setVariable(data.angleTerms[i].variableIndex, data.angles[b*numAngles+i]);
+        for (int i = 0; i < numDihedrals; i++)
+            expressionSet.setVariable(data.dihedralTerms[i].variableIndex, data.dihedrals[b*numDihedrals+i]);
+        if (includeForces) {
+            for (int i = 0; i < 6; i++)
+                f[i] = fvec4(0.0f);
+
+            // Apply forces based on distances.
+
+            for (auto& term : data.distanceTerms) {
+                float dEdR = (float) (term.forceExpression.evaluate()*term.deltaSign/(normDelta[offset+term.delta]));
+                fvec4 force = -dEdR*delta[offset+term.delta];
+                f[term.p1] -= force;
+                f[term.p2] += force;
+            }
+
+            // Apply forces based on angles.
+
+            for (auto& term : data.angleTerms) {
+                float dEdTheta = (float) term.forceExpression.evaluate();
+                const fvec4& delta1 = delta[offset+term.delta1];
+                const fvec4& delta2 = delta[offset+term.delta2];
+                fvec4 thetaCross = cross(delta1, delta2);
+                float lengthThetaCross = sqrtf(dot3(thetaCross, thetaCross));
+                if (lengthThetaCross < 1.0e-6f)
+                    lengthThetaCross = 1.0e-6f;
+                float termA = dEdTheta*term.delta2Sign/(norm2Delta[offset+term.delta1]*lengthThetaCross);
+                float termC = -dEdTheta*term.delta1Sign/(norm2Delta[offset+term.delta2]*lengthThetaCross);
+                fvec4 force1 = termA*cross(delta1, thetaCross);
+                fvec4 force3 = termC*cross(delta2, thetaCross);
+                fvec4 force2 = -(force1+force3);
+                f[term.p1] += force1;
+                f[term.p2] += force2;
+                f[term.p3] += force3;
+            }
+
+            // Apply forces based on dihedrals.
+
+            for (int i = 0; i < numDihedrals; i++) {
+                const DihedralTermInfo& term = data.dihedralTerms[i];
+                int index = b*numDihedrals+i;
+                float dEdTheta = (float) term.forceExpression.evaluate();
+                float normCross1 = dot3(cross1[index], cross1[index]);
+                float normBC = normDelta[offset+term.delta2];
+                float forceFactors[4];
+                forceFactors[0] = (-dEdTheta*normBC)/normCross1;
+                float normCross2 = dot3(cross2[index], cross2[index]);
+                forceFactors[3] = (dEdTheta*normBC)/normCross2;
+                forceFactors[1] = dot3(delta[offset+term.delta1], delta[offset+term.delta2]);
+                forceFactors[1] /= norm2Delta[offset+term.delta2];
+                forceFactors[2] = dot3(delta[offset+term.delta3], delta[offset+term.delta2]);
+                forceFactors[2] /= norm2Delta[offset+term.delta2];
+                fvec4 force1 = forceFactors[0]*cross1[index];
+                fvec4 force4 = forceFactors[3]*cross2[index];
+                fvec4 s = forceFactors[1]*force1 - forceFactors[2]*force4;
+                f[term.p1] += force1;
+                f[term.p2] -= force1-s;
+                f[term.p3] -= force4+s;
+                f[term.p4] += force4;
+            }
+
+            // Store the forces.
+
+            for (int i = 0; i < 6; i++)
+                if (atoms[i] >= 0)
+                    (fvec4(forces+4*atoms[i])+f[i]).store(forces+4*atoms[i]);
+        }
+
+        // Add the energy
+
+        if (includeEnergy)
+            data.energy += data.energyExpression.evaluate();
+    }
+}
+
+void CpuCustomHbondForce::computeDelta(const fvec4& posI, const fvec4& posJ, fvec4& deltaR, float& r2) const {
+    deltaR = posJ-posI;
+    if (usePeriodic) {
+        deltaR -= periodicBoxVec4[2]*floorf(deltaR[2]*recipBoxSize[2]+0.5f);
+        deltaR -= periodicBoxVec4[1]*floorf(deltaR[1]*recipBoxSize[1]+0.5f);
+        deltaR -= periodicBoxVec4[0]*floorf(deltaR[0]*recipBoxSize[0]+0.5f);
+    }
+    r2 = dot3(deltaR, deltaR);
+}
+
+float CpuCustomHbondForce::computeAngle(const fvec4& vi, const fvec4& vj, float v2i, float v2j, float sign) {
+    float dot = dot3(vi, vj)*sign;
+    float cosine = dot/sqrtf(v2i*v2j);
+    if (cosine > 0.99f || cosine < -0.99f) {
+        // We're close to the singularity in acos(), so take the cross product and use asin() instead.
+
+        fvec4 cross12 = cross(vi, vj);
+        float scale = v2i*v2j;
+        float angle = asinf(sqrtf(dot3(cross12, cross12)/scale));
+        if (cosine < 0.0f)
+            angle = (float) (M_PI-angle);
+        return angle;
+    }
+    return acosf(cosine);
+}
+
+float CpuCustomHbondForce::getDihedralAngleBetweenThreeVectors(const fvec4& v1, const fvec4& v2, const fvec4& v3, fvec4& cross1, fvec4& cross2, const fvec4& signVector) {
+    cross1 = cross(v1, v2);
+    cross2 = cross(v2, v3);
+    float angle = computeAngle(cross1, cross2, dot3(cross1, cross1), dot3(cross2, cross2), 1.0f);
+    float dotProduct = dot3(signVector, cross2);
+    if (dotProduct < 0)
+        angle = -angle;
+    return angle;
+}
+
+CpuCustomHbondForce::DistanceTermInfo::DistanceTermInfo(const string& name, const vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data) :
+        p1(atoms[0]), p2(atoms[1]), forceExpression(forceExpression) {
+    variableIndex = data.expressionSet.getVariableIndex(name);
+    data.requestDeltaPair(p1, p2, delta, deltaSign, true);
+}
+
+CpuCustomHbondForce::AngleTermInfo::AngleTermInfo(const string& name, const vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data) :
+        p1(atoms[0]), p2(atoms[1]), p3(atoms[2]), forceExpression(forceExpression) {
+    variableIndex = data.expressionSet.getVariableIndex(name);
+    data.requestDeltaPair(p1, p2, delta1, delta1Sign, true);
+    data.requestDeltaPair(p3, p2, delta2, delta2Sign, true);
+}
+
+CpuCustomHbondForce::DihedralTermInfo::DihedralTermInfo(const string& name, const vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data) :
+        p1(atoms[0]), p2(atoms[1]), p3(atoms[2]), p4(atoms[3]), forceExpression(forceExpression) {
+    variableIndex = data.expressionSet.getVariableIndex(name);
+    float sign;
+    data.requestDeltaPair(p2, p1, delta1, sign, false);
+    data.requestDeltaPair(p2, p3, delta2, sign, false);
+    data.requestDeltaPair(p4, p3, delta3, sign, false);
+}
+
+CpuCustomHbondForce::ThreadData::ThreadData(const CustomHbondForce& force, Lepton::ParsedExpression& energyExpr,
+            map<string, vector<int> >& distances, map<string, vector<int> >& angles, map<string, vector<int> >& dihedrals) {
+    f.resize(6);
+    energyExpression = energyExpr.createCompiledExpression();
+    expressionSet.registerExpression(energyExpression);
+    for (int i = 0; i < force.getNumPerDonorParameters(); i++)
+        donorParamIndex.push_back(expressionSet.getVariableIndex(force.getPerDonorParameterName(i)));
+    for (int i = 0; i < force.getNumPerAcceptorParameters(); i++)
+        acceptorParamIndex.push_back(expressionSet.getVariableIndex(force.getPerAcceptorParameterName(i)));
+
+    // Differentiate the energy to get expressions for the force.
+
+    for (auto& term : distances)
+        distanceTerms.push_back(CpuCustomHbondForce::DistanceTermInfo(term.first, term.second, energyExpr.differentiate(term.first).optimize().createCompiledExpression(), *this));
+    for (auto& term : angles)
+        angleTerms.push_back(CpuCustomHbondForce::AngleTermInfo(term.first, term.second, energyExpr.differentiate(term.first).optimize().createCompiledExpression(), *this));
+    for (auto& term : dihedrals)
+        dihedralTerms.push_back(CpuCustomHbondForce::DihedralTermInfo(term.first, term.second, energyExpr.differentiate(term.first).optimize().createCompiledExpression(), *this));
+    for (auto& term : distanceTerms)
+        expressionSet.registerExpression(term.forceExpression);
+    for (auto& term : angleTerms)
+        expressionSet.registerExpression(term.forceExpression);
+    for (auto& term : dihedralTerms)
+        expressionSet.registerExpression(term.forceExpression);
+}
+
+void CpuCustomHbondForce::ThreadData::requestDeltaPair(int p1, int p2, int& pairIndex, float& pairSign, bool allowReversed) {
+    for (int i = 0; i < (int) deltaPairs.size(); i++) {
+        if (deltaPairs[i].first == p1 && deltaPairs[i].second == p2) {
+            pairIndex = i;
+            pairSign = 1;
+            return;
+        }
+        if (deltaPairs[i].first == p2 && deltaPairs[i].second == p1 && allowReversed) {
+            pairIndex = i;
+            pairSign = -1;
+            return;
+        }
+    }
+    pairIndex = deltaPairs.size();
+    pairSign = 1;
+    deltaPairs.push_back(make_pair(p1, p2));
+}
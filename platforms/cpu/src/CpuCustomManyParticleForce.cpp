@@ -37,7 +37,7 @@ using namespace OpenMM;
 using namespace std;
 
 CpuCustomManyParticleForce::CpuCustomManyParticleForce(const CustomManyParticleForce& force, ThreadPool& threads) :
-            threads(threads), useCutoff(false), usePeriodic(false), neighborList(NULL) {
+            threads(threads), useCutoff(false), usePeriodic(false), neighborsValid(false) {
     numParticles = force.getNumParticles();
     numParticlesPerSet = force.getNumParticlesPerSet();
     numPerParticleParameters = force.getNumPerParticleParameters();
@@ -81,8 +81,6 @@ CpuCustomManyParticleForce::CpuCustomManyParticleForce(const CustomManyParticleF
 }
 
 CpuCustomManyParticleForce::~CpuCustomManyParticleForce() {
-    if (neighborList != NULL)
-        delete neighborList;
     for (auto data : threadData)
         delete data;
 }
@@ -98,38 +96,13 @@ void CpuCustomManyParticleForce::calculateIxn(AlignedArray<float>& posq, vector<
     this->threadForce = &threadForce;
     this->includeForces = includeForces;
     this->includeEnergy = includeEnergy;
+    if (useCutoff && numParticles > 0 && (!neighborsValid || needNeighborListRebuild()))
+        computeNeighborList();
     atomicCounter = 0;
-    if (useCutoff) {
-        // Construct a neighbor list.  We use CpuNeighborList to do this, but then copy the result
-        // into a new data structure.  This is needed because in UniqueCentralParticle mode, the
-        // the neighbor list needs to include symmetric pairs.
-        
-        particleNeighbors.resize(numParticles);
-        for (int i = 0; i < numParticles; i++)
-            particleNeighbors[i].clear();
-        neighborList->computeNeighborList(numParticles, posq, exclusions, periodicBoxVectors, usePeriodic, cutoffDistance, threads);
-        for (int blockIndex = 0; blockIndex < neighborList->getNumBlocks(); blockIndex++) {
-            const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-            const auto& exclusions = neighborList->getBlockExclusions(blockIndex);
-            int numNeighbors = neighbors.size();
-            for (int i = 0; i < 4; i++) {
-                int p1 = neighborList->getSortedAtoms()[4*blockIndex+i];
-                for (int j = 0; j < numNeighbors; j++) {
-                    if ((exclusions[j] & (1<<i)) == 0) {
-                        int p2 = neighbors[j];
-                        particleNeighbors[p1].push_back(p2);
-                        if (centralParticleMode)
-                            particleNeighbors[p2].push_back(p1);
-                    }
-                }
-            }
-        }
-    }
     
     // Signal the threads to start running and wait for them to finish.
     
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex); });
-    threads.waitForThreads();
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex); });
     
     // Combine the energies from all the threads.
     
@@ -177,11 +150,170 @@ void CpuCustomManyParticleForce::threadComputeForce(ThreadPool& threads, int thr
     }
 }
 
+bool CpuCustomManyParticleForce::needNeighborListRebuild() const {
+    // The list includes all pairs within the padded cutoff, so it remains valid until some particle has moved
+    // by half the padding distance.  A change to the periodic box always requires rebuilding it.
+    
+    if (usePeriodic)
+        for (int i = 0; i < 3; i++)
+            if (periodicBoxVectors[i] != lastBoxVectors[i])
+                return true;
+    float padding = (float) (paddedCutoff-cutoffDistance);
+    float maxMove2 = 0.25f*padding*padding;
+    for (int i = 0; i < numParticles; i++) {
+        float dx = posq[4*i]-lastPositions[3*i];
+        float dy = posq[4*i+1]-lastPositions[3*i+1];
+        float dz = posq[4*i+2]-lastPositions[3*i+2];
+        if (dx*dx+dy*dy+dz*dz > maxMove2)
+            return true;
+    }
+    return false;
+}
+
+void CpuCustomManyParticleForce::computeNeighborList() {
+    // Select the padding.  With periodic boundary conditions, the padded cutoff may not exceed half the
+    // width of the box, or the minimum image convention would no longer identify every neighbor.
+    
+    paddedCutoff = 1.1*cutoffDistance;
+    double width[3];
+    if (usePeriodic) {
+        Vec3* box = periodicBoxVectors;
+        double volume = box[0][0]*box[1][1]*box[2][2];
+        width[0] = volume/sqrt(box[1].cross(box[2]).dot(box[1].cross(box[2])));
+        width[1] = volume/sqrt(box[2].cross(box[0]).dot(box[2].cross(box[0])));
+        width[2] = volume/sqrt(box[0].cross(box[1]).dot(box[0].cross(box[1])));
+        paddedCutoff = min(paddedCutoff, 0.5*min(width[0], min(width[1], width[2])));
+        paddedCutoff = max(paddedCutoff, cutoffDistance);
+        for (int i = 0; i < 3; i++)
+            cellOrigin[i] = 0.0f;
+    }
+    else {
+        Vec3 minPos(posq[0], posq[1], posq[2]), maxPos = minPos;
+        for (int i = 1; i < numParticles; i++)
+            for (int j = 0; j < 3; j++) {
+                minPos[j] = min(minPos[j], (double) posq[4*i+j]);
+                maxPos[j] = max(maxPos[j], (double) posq[4*i+j]);
+            }
+        for (int j = 0; j < 3; j++) {
+            width[j] = maxPos[j]-minPos[j];
+            cellOrigin[j] = (float) minPos[j];
+        }
+    }
+    
+    // Divide space into cells that are at least as wide as the padded cutoff, but don't create
+    // more cells than are useful for the number of particles.
+    
+    int maxCellsPerAxis = max(1, (int) ceil(2*cbrt((double) numParticles)));
+    for (int i = 0; i < 3; i++) {
+        numCells[i] = max(1, min(maxCellsPerAxis, (int) floor(width[i]/paddedCutoff)));
+        cellScale[i] = (float) (usePeriodic ? numCells[i] : (width[i] > 0 ? numCells[i]/width[i] : 0.0));
+    }
+    
+    // Sort the particles into cells.
+    
+    int totalCells = numCells[0]*numCells[1]*numCells[2];
+    cellStart.assign(totalCells+1, 0);
+    cellAtoms.resize(numParticles);
+    atomCell.resize(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        int cell[3];
+        getCellCoordinates(posq+4*i, cell);
+        atomCell[i] = cell[0]+numCells[0]*(cell[1]+numCells[1]*cell[2]);
+        cellStart[atomCell[i]+1]++;
+    }
+    for (int i = 0; i < totalCells; i++)
+        cellStart[i+1] += cellStart[i];
+    vector<int> cellPos(cellStart.begin(), cellStart.end()-1);
+    for (int i = 0; i < numParticles; i++)
+        cellAtoms[cellPos[atomCell[i]]++] = i;
+    
+    // Find the neighbors of each particle.
+    
+    particleNeighbors.resize(numParticles);
+    atomicCounter = 0;
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadComputeNeighbors(threadIndex); });
+    lastPositions.resize(3*numParticles);
+    for (int i = 0; i < numParticles; i++)
+        for (int j = 0; j < 3; j++)
+            lastPositions[3*i+j] = posq[4*i+j];
+    if (usePeriodic)
+        for (int i = 0; i < 3; i++)
+            lastBoxVectors[i] = periodicBoxVectors[i];
+    neighborsValid = true;
+}
+
+void CpuCustomManyParticleForce::getCellCoordinates(const float* pos, int* cell) const {
+    float s[3];
+    if (usePeriodic) {
+        // Convert to fractional coordinates.  The box vectors are in reduced form, so this is just a
+        // triangular solve.
+        
+        s[2] = pos[2]*recipBoxSize[2];
+        s[1] = (pos[1]-s[2]*(float) periodicBoxVectors[2][1])*recipBoxSize[1];
+        s[0] = (pos[0]-s[2]*(float) periodicBoxVectors[2][0]-s[1]*(float) periodicBoxVectors[1][0])*recipBoxSize[0];
+        for (int i = 0; i < 3; i++)
+            s[i] -= floorf(s[i]);
+    }
+    else
+        for (int i = 0; i < 3; i++)
+            s[i] = pos[i]-cellOrigin[i];
+    for (int i = 0; i < 3; i++)
+        cell[i] = max(0, min(numCells[i]-1, (int) (s[i]*cellScale[i])));
+}
+
+void CpuCustomManyParticleForce::threadComputeNeighbors(int threadIndex) {
+    // In UniqueCentralParticle mode every particle needs all of its neighbors.  Otherwise each set is
+    // found starting from its lowest index particle, so only neighbors with higher indices are needed.
+    
+    fvec4 boxSize(periodicBoxVectors[0][0], periodicBoxVectors[1][1], periodicBoxVectors[2][2], 0);
+    fvec4 invBoxSize(recipBoxSize[0], recipBoxSize[1], recipBoxSize[2], 0);
+    float paddedCutoff2 = (float) (paddedCutoff*paddedCutoff);
+    vector<int> cellRange[3];
+    while (true) {
+        int i = atomicCounter++;
+        if (i >= numParticles)
+            break;
+        vector<int>& neighbors = particleNeighbors[i];
+        neighbors.clear();
+        int cell[3];
+        getCellCoordinates(posq+4*i, cell);
+        for (int axis = 0; axis < 3; axis++) {
+            cellRange[axis].clear();
+            if (usePeriodic && numCells[axis] <= 3)
+                for (int j = 0; j < numCells[axis]; j++)
+                    cellRange[axis].push_back(j);
+            else
+                for (int j = cell[axis]-1; j <= cell[axis]+1; j++) {
+                    if (usePeriodic)
+                        cellRange[axis].push_back((j+numCells[axis])%numCells[axis]);
+                    else if (j >= 0 && j < numCells[axis])
+                        cellRange[axis].push_back(j);
+                }
+        }
+        fvec4 pos1(posq+4*i);
+        for (int z : cellRange[2])
+            for (int y : cellRange[1])
+                for (int x : cellRange[0]) {
+                    int cellIndex = x+numCells[0]*(y+numCells[1]*z);
+                    for (int k = cellStart[cellIndex]; k < cellStart[cellIndex+1]; k++) {
+                        int j = cellAtoms[k];
+                        if (j == i || (!centralParticleMode && j < i))
+                            continue;
+                        fvec4 deltaR;
+                        float r2;
+                        computeDelta(pos1, fvec4(posq+4*j), deltaR, r2, boxSize, invBoxSize);
+                        if (r2 < paddedCutoff2 && exclusions[i].find(j) == exclusions[i].end())
+                            neighbors.push_back(j);
+                    }
+                }
+    }
+}
+
 void CpuCustomManyParticleForce::setUseCutoff(double distance) {
     useCutoff = true;
     cutoffDistance = distance;
-    if (neighborList == NULL)
-        neighborList = new CpuNeighborList(4);
+    paddedCutoff = distance;
+    neighborsValid = false;
 }
 
 void CpuCustomManyParticleForce::setPeriodic(Vec3* periodicBoxVectors) {
@@ -23,6 +23,7 @@
  */
 
 #include <string.h>
+#include <algorithm>
 #include <sstream>
 
 #include "SimTKOpenMMUtilities.h"
@@ -32,10 +33,8 @@
 using namespace OpenMM;
 using namespace std;
 
-CpuCustomNonbondedForce::ThreadData::ThreadData(const Lepton::CompiledExpression& energyExpression, const Lepton::CompiledExpression& forceExpression,
-            const vector<string>& parameterNames, const std::vector<Lepton::CompiledExpression> energyParamDerivExpressions) :
-            energyExpression(energyExpression), forceExpression(forceExpression), energyParamDerivExpressions(energyParamDerivExpressions) {
-    map<string, double*> variableLocations;
+CpuCustomNonbondedForce::ThreadData::ThreadData(const Lepton::CompiledExpression& expression, const Lepton::CompiledExpression& energyExpression,
+            const vector<string>& parameterNames) : expression(expression), energyExpression(energyExpression) {
     variableLocations["r"] = &r;
     particleParam.resize(2*parameterNames.size());
     for (int i = 0; i < (int) parameterNames.size(); i++) {
@@ -45,23 +44,25 @@ CpuCustomNonbondedForce::ThreadData::ThreadData(const Lepton::CompiledExpression
             variableLocations[name.str()] = &particleParam[i*2+j];
         }
     }
-    energyParamDerivs.resize(energyParamDerivExpressions.size());
+    energyParamDerivs.resize(expression.getNumOutputs()-2);
+    this->expression.setVariableLocations(variableLocations);
     this->energyExpression.setVariableLocations(variableLocations);
-    this->forceExpression.setVariableLocations(variableLocations);
+    expressionSet.registerExpression(this->expression);
     expressionSet.registerExpression(this->energyExpression);
-    expressionSet.registerExpression(this->forceExpression);
-    for (auto& expression : this->energyParamDerivExpressions) {
-        expression.setVariableLocations(variableLocations);
-        expressionSet.registerExpression(expression);
-    }
 }
 
-CpuCustomNonbondedForce::CpuCustomNonbondedForce(const Lepton::CompiledExpression& energyExpression,
-            const Lepton::CompiledExpression& forceExpression, const vector<string>& parameterNames, const vector<set<int> >& exclusions,
-            const std::vector<Lepton::CompiledExpression> energyParamDerivExpressions, ThreadPool& threads) :
-            cutoff(false), useSwitch(false), periodic(false), useInteractionGroups(false), paramNames(parameterNames), exclusions(exclusions), threads(threads) {
+void CpuCustomNonbondedForce::ThreadData::setTableExpression(const Lepton::CompiledExpression& expression) {
+    tableExpression = expression;
+    tableExpression.setVariableLocations(variableLocations);
+    expressionSet.registerExpression(tableExpression);
+}
+
+CpuCustomNonbondedForce::CpuCustomNonbondedForce(const Lepton::CompiledExpression& expression, const Lepton::CompiledExpression& energyExpression,
+            const vector<string>& parameterNames,
+            const vector<set<int> >& exclusions, ThreadPool& threads) :
+            cutoff(false), useSwitch(false), periodic(false), useInteractionGroups(false), useTabulation(false), tablesValid(false), paramNames(parameterNames), exclusions(exclusions), threads(threads) {
     for (int i = 0; i < threads.getNumThreads(); i++)
-        threadData.push_back(new ThreadData(energyExpression, forceExpression, parameterNames, energyParamDerivExpressions));
+        threadData.push_back(new ThreadData(expression, energyExpression, parameterNames));
 }
 
 CpuCustomNonbondedForce::~CpuCustomNonbondedForce() {
@@ -118,6 +119,38 @@ void CpuCustomNonbondedForce::setPeriodic(Vec3* periodicBoxVectors) {
                  periodicBoxVectors[2][0] != 0.0 || periodicBoxVectors[2][1] != 0.0);
 }
 
+void CpuCustomNonbondedForce::setUseTabulation(const Lepton::CompiledExpression& expression, const vector<int>& particleType, int numTypes) {
+    tablesValid = false;
+    useTabulation = (numTypes <= MaxTabulatedTypes);
+    if (!useTabulation) {
+        table.clear();
+        return;
+    }
+    if (threadData[0]->tableExpression.getNumOutputs() == 0)
+        for (auto data : threadData)
+            data->setTableExpression(expression);
+    this->particleType = particleType;
+    this->numTypes = numTypes;
+    
+    // Record one particle of each type, from which the parameters will be taken.
+    
+    typeAtom.resize(numTypes);
+    for (int i = (int) particleType.size()-1; i >= 0; i--)
+        typeAtom[particleType[i]] = i;
+    
+    // Assign a table to each pair of types.
+    
+    tablePairs.clear();
+    pairTableOffset.resize(numTypes*numTypes);
+    for (int i = 0; i < numTypes; i++)
+        for (int j = i; j < numTypes; j++) {
+            int offset = 8*NumTableIntervals*tablePairs.size();
+            pairTableOffset[i*numTypes+j] = offset;
+            pairTableOffset[j*numTypes+i] = offset;
+            tablePairs.push_back(make_pair(i, j));
+        }
+    table.resize(8*NumTableIntervals*tablePairs.size());
+}
 
 void CpuCustomNonbondedForce::calculatePairIxn(int numberOfAtoms, float* posq, vector<Vec3>& atomCoordinates, vector<vector<double> >& atomParameters,
                                                const map<string, double>& globalParameters, vector<AlignedArray<float> >& threadForce,
@@ -133,12 +166,25 @@ void CpuCustomNonbondedForce::calculatePairIxn(int numberOfAtoms, float* posq, v
     this->includeForce = includeForce;
     this->includeEnergy = includeEnergy;
     threadEnergy.resize(threads.getNumThreads());
+    
+    // If necessary, rebuild the tables.
+    
+    if (useTabulation && (!tablesValid || tableGlobalParameters != globalParameters)) {
+        // The tables start at a fraction of the cutoff, to avoid singularities at r=0.  Any pair closer
+        // than that is evaluated directly.
+
+        tableStart = (float) (0.1*cutoffDistance);
+        tableSpacing = (float) ((cutoffDistance-tableStart)/NumTableIntervals);
+        atomicCounter = 0;
+        threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadComputeTables(threads, threadIndex); });
+        tableGlobalParameters = globalParameters;
+        tablesValid = true;
+    }
     atomicCounter = 0;
     
     // Signal the threads to start running and wait for them to finish.
     
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex); });
-    threads.waitForThreads();
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex); });
     
     // Combine the energies from all the threads.
     
@@ -192,6 +238,10 @@ void CpuCustomNonbondedForce::threadComputeForce(ThreadPool& threads, int thread
             int blockIndex = atomicCounter++;
             if (blockIndex >= neighborList->getNumBlocks())
                 break;
+            if (useTabulation) {
+                calculateBlockTabulatedIxn(blockIndex, data, forces, energy, boxSize, invBoxSize);
+                continue;
+            }
             const int blockSize = neighborList->getBlockSize();
             const int32_t* blockAtom = &neighborList->getSortedAtoms()[blockSize*blockIndex];
             const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
@@ -231,6 +281,140 @@ void CpuCustomNonbondedForce::threadComputeForce(ThreadPool& threads, int thread
     }
 }
 
+void CpuCustomNonbondedForce::threadComputeTables(ThreadPool& threads, int threadIndex) {
+    ThreadData& data = *threadData[threadIndex];
+    for (auto& param : *globalParameters)
+        data.expressionSet.setVariable(data.expressionSet.getVariableIndex(param.first), param.second);
+    int numParams = paramNames.size();
+    double h = tableSpacing;
+    vector<double> energy(NumTableIntervals+1), dEdR(NumTableIntervals+1), d2EdR2(NumTableIntervals+1);
+    while (true) {
+        int pairIndex = atomicCounter++;
+        if (pairIndex >= tablePairs.size())
+            break;
+        int atom1 = typeAtom[tablePairs[pairIndex].first];
+        int atom2 = typeAtom[tablePairs[pairIndex].second];
+        for (int j = 0; j < numParams; j++) {
+            data.particleParam[j*2] = atomParameters[atom1][j];
+            data.particleParam[j*2+1] = atomParameters[atom2][j];
+        }
+        
+        // Evaluate the energy and its derivatives at the grid points.
+        
+        for (int i = 0; i <= NumTableIntervals; i++) {
+            data.r = tableStart+i*h;
+            data.tableExpression.evaluate();
+            energy[i] = data.tableExpression.getOutputValue(0);
+            dEdR[i] = data.tableExpression.getOutputValue(1);
+            d2EdR2[i] = data.tableExpression.getOutputValue(2);
+        }
+        
+        // Store the coefficients of a cubic Hermite spline for each interval.  The first four
+        // coefficients interpolate the energy and the second four interpolate dE/dr.
+        
+        float* coeff = &table[pairTableOffset[tablePairs[pairIndex].first*numTypes+tablePairs[pairIndex].second]];
+        for (int i = 0; i < NumTableIntervals; i++) {
+            coeff[8*i] = (float) energy[i];
+            coeff[8*i+1] = (float) (h*dEdR[i]);
+            coeff[8*i+2] = (float) (3*(energy[i+1]-energy[i])-h*(2*dEdR[i]+dEdR[i+1]));
+            coeff[8*i+3] = (float) (2*(energy[i]-energy[i+1])+h*(dEdR[i]+dEdR[i+1]));
+            coeff[8*i+4] = (float) dEdR[i];
+            coeff[8*i+5] = (float) (h*d2EdR2[i]);
+            coeff[8*i+6] = (float) (3*(dEdR[i+1]-dEdR[i])-h*(2*d2EdR2[i]+d2EdR2[i+1]));
+            coeff[8*i+7] = (float) (2*(dEdR[i]-dEdR[i+1])+h*(d2EdR2[i]+d2EdR2[i+1]));
+        }
+    }
+}
+
+void CpuCustomNonbondedForce::calculateBlockTabulatedIxn(int blockIndex, ThreadData& data, float* forces, double& totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize) {
+    const int blockSize = neighborList->getBlockSize();
+    const int32_t* blockAtom = &neighborList->getSortedAtoms()[blockSize*blockIndex];
+    const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
+    const auto& exclusions = neighborList->getBlockExclusions(blockIndex);
+    const int numParams = paramNames.size();
+    const float cutoff2 = (float) (cutoffDistance*cutoffDistance);
+    const float invTableSpacing = 1.0f/tableSpacing;
+    const float invSwitchWidth = (useSwitch ? (float) (1.0/(cutoffDistance-switchingDistance)) : 0.0f);
+    const float* tableData = &table[0];
+    const int lastInterval = NumTableIntervals-1;
+    fvec4 deltaR[4];
+    float r[4], t[4], include[4], scale[4];
+    int offset[4];
+    for (int i = 0; i < (int) neighbors.size(); i++) {
+        int first = neighbors[i];
+        fvec4 posI(posq+4*first);
+        const int* typeOffset = &pairTableOffset[particleType[first]*numTypes];
+        for (int k = 0; k < blockSize; k += 4) {
+            // Find the pairs in this group that need to be computed, and locate their table entries.
+            
+            bool any = false;
+            for (int j = 0; j < 4; j++) {
+                include[j] = 0.0f;
+                r[j] = tableStart;
+                t[j] = 0.0f;
+                offset[j] = 0;
+                if ((exclusions[i] & (1<<(k+j))) != 0)
+                    continue;
+                int second = blockAtom[k+j];
+                float r2;
+                getDeltaR(posI, fvec4(posq+4*second), deltaR[j], r2, boxSize, invBoxSize);
+                if (r2 >= cutoff2)
+                    continue;
+                float dist = sqrtf(r2);
+                if (dist < tableStart) {
+                    // This pair is too close to be tabulated, so compute it directly.
+                    
+                    for (int m = 0; m < numParams; m++) {
+                        data.particleParam[m*2] = atomParameters[first][m];
+                        data.particleParam[m*2+1] = atomParameters[second][m];
+                    }
+                    calculateOneIxn(first, second, data, forces, totalEnergy, boxSize, invBoxSize);
+                    continue;
+                }
+                float x = (dist-tableStart)*invTableSpacing;
+                int index = min((int) x, lastInterval);
+                r[j] = dist;
+                t[j] = x-index;
+                offset[j] = typeOffset[particleType[second]]+8*index;
+                include[j] = 1.0f;
+                any = true;
+            }
+            if (!any)
+                continue;
+            
+            // Interpolate the energy and dE/dr for all four pairs at once.
+            
+            fvec4 e0(tableData+offset[0]), e1(tableData+offset[1]), e2(tableData+offset[2]), e3(tableData+offset[3]);
+            fvec4 f0(tableData+offset[0]+4), f1(tableData+offset[1]+4), f2(tableData+offset[2]+4), f3(tableData+offset[3]+4);
+            transpose(e0, e1, e2, e3);
+            transpose(f0, f1, f2, f3);
+            fvec4 tv(t), rv(r), mask(include);
+            fvec4 energy = e0+tv*(e1+tv*(e2+tv*e3));
+            fvec4 dEdR = f0+tv*(f1+tv*(f2+tv*f3));
+            if (useSwitch) {
+                fvec4 s = max((rv-(float) switchingDistance)*invSwitchWidth, fvec4(0.0f));
+                fvec4 switchValue = 1.0f+s*s*s*(-10.0f+s*(15.0f-s*6.0f));
+                fvec4 switchDeriv = s*s*(-30.0f+s*(60.0f-s*30.0f))*invSwitchWidth;
+                dEdR = switchValue*dEdR+energy*switchDeriv;
+                energy = energy*switchValue;
+            }
+            if (includeEnergy)
+                totalEnergy += reduceAdd(energy*mask);
+            if (includeForce) {
+                (mask*dEdR/rv).store(scale);
+                for (int j = 0; j < 4; j++) {
+                    if (include[j] == 0.0f)
+                        continue;
+                    int second = blockAtom[k+j];
+                    fvec4 result = deltaR[j]*scale[j];
+                    (fvec4(forces+4*first)+result).store(forces+4*first);
+                    (fvec4(forces+4*second)-result).store(forces+4*second);
+                }
+            }
+        }
+    }
+}
+
 void CpuCustomNonbondedForce::calculateOneIxn(int ii, int jj, ThreadData& data, 
         float* forces, double& totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize) {
     // Get deltaR, R2, and R between 2 atoms
@@ -245,12 +429,19 @@ void CpuCustomNonbondedForce::calculateOneIxn(int ii, int jj, ThreadData& data,
     float r = sqrtf(r2);
     data.r = r;
 
+    // Evaluate the energy, dE/dr, and parameter derivatives in a single pass.  If forces are not needed,
+    // use the expression that skips dE/dr.
+
+    Lepton::CompiledExpression& expression = (includeForce ? data.expression : data.energyExpression);
+    int firstParamDeriv = (includeForce ? 2 : 1);
+    expression.evaluate();
+
     // accumulate forces
 
-    double dEdR = (includeForce ? data.forceExpression.evaluate()/r : 0.0);
+    double dEdR = (includeForce ? expression.getOutputValue(1)/r : 0.0);
     double energy = 0.0;
     if (includeEnergy || (useSwitch && r > switchingDistance))
-        energy = data.energyExpression.evaluate();
+        energy = expression.getOutputValue(0);
     double switchValue = 1.0;
     if (useSwitch) {
         if (r > switchingDistance) {
@@ -261,9 +452,11 @@ void CpuCustomNonbondedForce::calculateOneIxn(int ii, int jj, ThreadData& data,
             energy *= switchValue;
         }
     }
-    fvec4 result = deltaR*dEdR;
-    (fvec4(forces+4*ii)+result).store(forces+4*ii);
-    (fvec4(forces+4*jj)-result).store(forces+4*jj);
+    if (includeForce) {
+        fvec4 result = deltaR*dEdR;
+        (fvec4(forces+4*ii)+result).store(forces+4*ii);
+        (fvec4(forces+4*jj)-result).store(forces+4*jj);
+    }
 
     // accumulate energies
 
@@ -271,8 +464,8 @@ void CpuCustomNonbondedForce::calculateOneIxn(int ii, int jj, ThreadData& data,
     
     // Accumulate energy derivatives.
 
-    for (int i = 0; i < data.energyParamDerivExpressions.size(); i++)
-        data.energyParamDerivs[i] += switchValue*data.energyParamDerivExpressions[i].evaluate();
+    for (int i = 0; i < data.energyParamDerivs.size(); i++)
+        data.energyParamDerivs[i] += switchValue*expression.getOutputValue(i+firstParamDeriv);
 }
 
 void CpuCustomNonbondedForce::getDeltaR(const fvec4& posI, const fvec4& posJ, fvec4& deltaR, float& r2, const fvec4& boxSize, const fvec4& invBoxSize) const {
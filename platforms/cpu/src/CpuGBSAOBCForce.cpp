@@ -35,7 +35,7 @@ const int CpuGBSAOBCForce::NUM_TABLE_POINTS = 4096;
 const float CpuGBSAOBCForce::TABLE_MIN = 0.25f;
 const float CpuGBSAOBCForce::TABLE_MAX = 1.5f;
 
-CpuGBSAOBCForce::CpuGBSAOBCForce() : cutoff(false), periodic(false) {
+CpuGBSAOBCForce::CpuGBSAOBCForce() : cutoff(false), periodic(false), neighborList(NULL) {
     logDX = (TABLE_MAX-TABLE_MIN)/NUM_TABLE_POINTS;
     logDXInv = 1.0f/logDX;
     logTable.resize(NUM_TABLE_POINTS+4);
@@ -45,9 +45,10 @@ CpuGBSAOBCForce::CpuGBSAOBCForce() : cutoff(false), periodic(false) {
     }
 }
 
-void CpuGBSAOBCForce::setUseCutoff(float distance) {
+void CpuGBSAOBCForce::setUseCutoff(float distance, const CpuNeighborList& neighbors) {
     cutoff = true;
     cutoffDistance = distance;
+    neighborList = &neighbors;
 }
 
 void CpuGBSAOBCForce::setPeriodic(float* periodicBoxSize) {
@@ -77,6 +78,7 @@ void CpuGBSAOBCForce::setParticleParameters(const std::vector<std::pair<float, f
     particleParams = params;
     bornRadii.resize(params.size()+3);
     obcChain.resize(params.size()+3);
+    scaledBornForces.resize(params.size()+3);
     for (int i = bornRadii.size()-3; i < bornRadii.size(); i++) {
         bornRadii[i] = 0;
         obcChain[i] = 0;
@@ -94,21 +96,53 @@ void CpuGBSAOBCForce::computeForce(const AlignedArray<float>& posq, vector<Align
     threadBornForces.resize(numThreads);
     for (int i = 0; i < numThreads; i++)
         threadBornForces[i].resize(particleParams.size()+3);
-    
-    // Signal the threads to start running and wait for them to finish.
-    
-    atomicCounter = 0;
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex); });
-    threads.waitForThreads(); // Compute Born radii
-    atomicCounter = 0;
-    threads.resumeThreads();
-    threads.waitForThreads(); // Compute surface area term
-    atomicCounter = 0;
-    threads.resumeThreads();
-    threads.waitForThreads(); // First loop
-    atomicCounter = 0;
-    threads.resumeThreads();
-    threads.waitForThreads(); // Second loop
+    if (cutoff) {
+        // Record where each atom appears in the neighbor list, so the threads can tell which pairs
+        // within a block have already been visited.
+
+        int numParticles = particleParams.size();
+        const vector<int32_t>& sortedAtoms = neighborList->getSortedAtoms();
+        atomSortedIndex.resize(numParticles);
+        for (int i = 0; i < numParticles; i++)
+            atomSortedIndex[sortedAtoms[i]] = i;
+        threadBornSums.resize(numThreads);
+        for (int i = 0; i < numThreads; i++)
+            threadBornSums[i].resize(particleParams.size()+3);
+
+        // Signal the threads to start running and wait for them to finish.
+
+        atomicCounter = 0;
+        threads.execute([&] (ThreadPool& threads, int threadIndex) { threadComputeNeighborListForce(threads, threadIndex); });
+        threads.waitForThreads(); // Accumulate Born radius sums
+        atomicCounter = 0;
+        threads.resumeThreads();
+        threads.waitForThreads(); // Compute Born radii and single atom terms
+        atomicCounter = 0;
+        threads.resumeThreads();
+        threads.waitForThreads(); // First loop
+        atomicCounter = 0;
+        threads.resumeThreads();
+        threads.waitForThreads(); // Sum Born forces
+        atomicCounter = 0;
+        threads.resumeThreads();
+        threads.waitForThreads(); // Second loop
+    }
+    else {
+        // Signal the threads to start running and wait for them to finish.
+
+        atomicCounter = 0;
+        threads.execute([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex); });
+        threads.waitForThreads(); // Compute Born radii
+        atomicCounter = 0;
+        threads.resumeThreads();
+        threads.waitForThreads(); // Compute surface area term
+        atomicCounter = 0;
+        threads.resumeThreads();
+        threads.waitForThreads(); // First loop
+        atomicCounter = 0;
+        threads.resumeThreads();
+        threads.waitForThreads(); // Second loop
+    }
     
     // Combine the energies from all the threads.
     
@@ -165,8 +199,6 @@ void CpuGBSAOBCForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
             fvec4 dx, dy, dz, r2;
             getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
             ivec4 include = mask & (blockAtomIndex != ivec4(atomJ));
-            if (cutoff)
-                include = include & (r2 < cutoffDistance*cutoffDistance);
             if (!any(include))
                 continue;
             fvec4 r = sqrt(r2);
@@ -267,8 +299,6 @@ void CpuGBSAOBCForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
             fvec4 dx, dy, dz, r2;
             getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
             ivec4 include = mask & (blockAtomIndex <= ivec4(atomJ));
-            if (cutoff)
-                include = include & (r2 < cutoffDistance*cutoffDistance);
             if (!any(include))
                 continue;
             fvec4 r = sqrt(r2);
@@ -296,8 +326,6 @@ void CpuGBSAOBCForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
             atomForce[2] += dot4(fz, one);
             ivec4 atomJMask = include & (blockAtomIndex != ivec4(atomJ));
             fvec4 termEnergy = blend(0.0f, Gpol, include);
-            if (cutoff)
-                termEnergy -= blend(0.0f, partialChargeI*posJ[3]/cutoffDistance, atomJMask);
             termEnergy *= blend(0.5f, 1.0f, atomJMask);
             energy += dot4(termEnergy, one);
             bornForces[atomJ] += dot4(blend(0.0f, dGpol_dalpha2_ij, atomJMask), radii);
@@ -351,8 +379,6 @@ void CpuGBSAOBCForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
             fvec4 dx, dy, dz, r2;
             getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
             ivec4 include = mask & (blockAtomIndex != ivec4(atomJ));
-            if (cutoff)
-                include = include & (r2 < cutoffDistance*cutoffDistance);
             if (!any(include))
                 continue;
             fvec4 r = sqrt(r2);
@@ -392,6 +418,320 @@ void CpuGBSAOBCForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
     threadEnergy[threadIndex] = energy;
 }
 
+void CpuGBSAOBCForce::threadComputeNeighborListForce(ThreadPool& threads, int threadIndex) {
+    int numParticles = particleParams.size();
+    int numThreads = threads.getNumThreads();
+    const float dielectricOffset = 0.009;
+    const float alphaObc = 1.0f;
+    const float betaObc = 0.8f;
+    const float gammaObc = 4.85f;
+    const float cutoff2 = cutoffDistance*cutoffDistance;
+    fvec4 boxSize(periodicBoxSize[0], periodicBoxSize[1], periodicBoxSize[2], 0);
+    fvec4 invBoxSize((1/periodicBoxSize[0]), (1/periodicBoxSize[1]), (1/periodicBoxSize[2]), 0);
+    const int blockSize = neighborList->getBlockSize();
+    const int numBlocks = neighborList->getNumBlocks();
+    const vector<int32_t>& sortedAtoms = neighborList->getSortedAtoms();
+    fvec4 one(1.0f);
+
+    // Each pair appears only once in the neighbor list, so every interaction is computed in both
+    // directions at once.  Blocks are processed four atoms at a time.  An atom whose neighbors come
+    // from its own block only pairs with the atoms that precede it, and padding at the end of the
+    // last block is skipped.  The neighbor list's exclusion flags are ignored, since excluded pairs
+    // still contribute to the Born radii and the polarization energy.
+
+    // Accumulate the Born radius sums.
+
+    AlignedArray<float>& bornSums = threadBornSums[threadIndex];
+    for (int i = 0; i < numParticles; i++)
+        bornSums[i] = 0.0f;
+    while (true) {
+        int blockIndex = atomicCounter++;
+        if (blockIndex >= numBlocks)
+            break;
+        const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
+        int numNeighbors = neighbors.size();
+        ivec4 blockStart(blockSize*blockIndex);
+        for (int subBlock = 0; subBlock < blockSize; subBlock += 4) {
+            int firstIndex = blockSize*blockIndex+subBlock;
+            ivec4 sortedIndex(firstIndex, firstIndex+1, firstIndex+2, firstIndex+3);
+            ivec4 valid = (sortedIndex < ivec4(numParticles));
+            if (!any(valid))
+                continue;
+            const int32_t* blockAtom = &sortedAtoms[firstIndex];
+            float atomRadius[4], atomScaledRadius[4], atomx[4], atomy[4], atomz[4];
+            for (int i = 0; i < 4; i++) {
+                atomRadius[i] = particleParams[blockAtom[i]].first;
+                atomScaledRadius[i] = particleParams[blockAtom[i]].second;
+                atomx[i] = posq[4*blockAtom[i]];
+                atomy[i] = posq[4*blockAtom[i]+1];
+                atomz[i] = posq[4*blockAtom[i]+2];
+            }
+            fvec4 offsetRadiusI(atomRadius);
+            fvec4 scaledRadiusI(atomScaledRadius);
+            fvec4 x(atomx);
+            fvec4 y(atomy);
+            fvec4 z(atomz);
+            fvec4 blockSum(0.0f);
+            for (int k = 0; k < numNeighbors; k++) {
+                int atomJ = neighbors[k];
+                ivec4 sortedJ(atomSortedIndex[atomJ]);
+                fvec4 posJ(posq+4*atomJ);
+                fvec4 dx, dy, dz, r2;
+                getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
+                ivec4 include = valid & ((sortedJ < blockStart) | (sortedIndex < sortedJ));
+                include = include & (r2 < cutoff2);
+                if (!any(include))
+                    continue;
+                fvec4 r = sqrt(r2);
+                blockSum += computeBornSumTerm(r, offsetRadiusI, particleParams[atomJ].second, include);
+                bornSums[atomJ] += dot4(computeBornSumTerm(r, particleParams[atomJ].first, scaledRadiusI, include), one);
+            }
+            for (int i = 0; i < 4; i++)
+                if (valid[i])
+                    bornSums[blockAtom[i]] += blockSum[i];
+        }
+    }
+    threads.syncThreads();
+
+    // Compute the Born radii, the ACE surface area term, and the self interaction of each atom.
+
+    const float probeRadius = 0.14f;
+    double energy = 0.0;
+    float preFactor;
+    if (soluteDielectric != 0.0f && solventDielectric != 0.0f)
+        preFactor = ONE_4PI_EPS0*((1.0f/solventDielectric) - (1.0f/soluteDielectric));
+    else
+        preFactor = 0.0f;
+    AlignedArray<float>& bornForces = threadBornForces[threadIndex];
+    for (int i = 0; i < numParticles; i++)
+        bornForces[i] = 0.0f;
+    while (true) {
+        int atomI = atomicCounter++;
+        if (atomI >= numParticles)
+            break;
+        float sum = 0.0f;
+        for (int i = 0; i < numThreads; i++)
+            sum += threadBornSums[i][atomI];
+        float offsetRadius = particleParams[atomI].first;
+        sum *= 0.5f*offsetRadius;
+        float sum2 = sum*sum;
+        float sum3 = sum*sum2;
+        float tanhSum = tanh(alphaObc*sum - betaObc*sum2 + gammaObc*sum3);
+        float radiusI = offsetRadius + dielectricOffset;
+        float bornRadius = 1.0f/(1.0f/offsetRadius - tanhSum/radiusI);
+        bornRadii[atomI] = bornRadius;
+        obcChain[atomI] = offsetRadius*(alphaObc - 2.0f*betaObc*sum + 3.0f*gammaObc*sum2);
+        obcChain[atomI] = (1.0f - tanhSum*tanhSum)*obcChain[atomI]/radiusI;
+        if (bornRadius > 0) {
+            float r = radiusI + probeRadius;
+            float ratio6 = powf(radiusI/bornRadius, 6.0f);
+            float saTerm = surfaceAreaFactor*r*r*ratio6;
+            energy += saTerm;
+            bornForces[atomI] = -6.0f*saTerm/bornRadius;
+        }
+        float charge = posq[4*atomI+3];
+        float Gpol = preFactor*charge*charge/bornRadius;
+        energy += 0.5f*Gpol;
+        bornForces[atomI] -= 0.5f*Gpol/bornRadius;
+    }
+    threads.syncThreads();
+
+    // First loop of Born energy computation.
+
+    float* forces = &(*threadForce)[threadIndex][0];
+    while (true) {
+        int blockIndex = atomicCounter++;
+        if (blockIndex >= numBlocks)
+            break;
+        const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
+        int numNeighbors = neighbors.size();
+        ivec4 blockStart(blockSize*blockIndex);
+        for (int subBlock = 0; subBlock < blockSize; subBlock += 4) {
+            int firstIndex = blockSize*blockIndex+subBlock;
+            ivec4 sortedIndex(firstIndex, firstIndex+1, firstIndex+2, firstIndex+3);
+            ivec4 valid = (sortedIndex < ivec4(numParticles));
+            if (!any(valid))
+                continue;
+            const int32_t* blockAtom = &sortedAtoms[firstIndex];
+            float atomCharge[4], atomBornRadius[4], atomx[4], atomy[4], atomz[4];
+            for (int i = 0; i < 4; i++) {
+                atomCharge[i] = preFactor*posq[4*blockAtom[i]+3];
+                atomBornRadius[i] = bornRadii[blockAtom[i]];
+                atomx[i] = posq[4*blockAtom[i]];
+                atomy[i] = posq[4*blockAtom[i]+1];
+                atomz[i] = posq[4*blockAtom[i]+2];
+            }
+            fvec4 partialChargeI(atomCharge);
+            fvec4 radii(atomBornRadius);
+            fvec4 x(atomx);
+            fvec4 y(atomy);
+            fvec4 z(atomz);
+            fvec4 blockAtomForceX(0.0f), blockAtomForceY(0.0f), blockAtomForceZ(0.0f), blockAtomBornForce(0.0f);
+            for (int k = 0; k < numNeighbors; k++) {
+                int atomJ = neighbors[k];
+                ivec4 sortedJ(atomSortedIndex[atomJ]);
+                fvec4 posJ(posq+4*atomJ);
+                fvec4 dx, dy, dz, r2;
+                getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
+                ivec4 include = valid & ((sortedJ < blockStart) | (sortedIndex < sortedJ));
+                include = include & (r2 < cutoff2);
+                if (!any(include))
+                    continue;
+                fvec4 alpha2_ij = radii*bornRadii[atomJ];
+                fvec4 D_ij = r2/(4.0f*alpha2_ij);
+                fvec4 expTerm = exp(-D_ij);
+                fvec4 denominator2 = r2 + alpha2_ij*expTerm;
+                fvec4 denominator = sqrt(denominator2);
+                fvec4 Gpol = (partialChargeI*posJ[3])/denominator;
+                fvec4 dGpol_dr = -Gpol*(1.0f - 0.25f*expTerm)/denominator2;
+                fvec4 dGpol_dalpha2_ij = -0.5f*Gpol*expTerm*(1.0f + D_ij)/denominator2;
+                dGpol_dr = blend(0.0f, dGpol_dr, include);
+                dGpol_dalpha2_ij = blend(0.0f, dGpol_dalpha2_ij, include);
+                fvec4 fx = dx*dGpol_dr;
+                fvec4 fy = dy*dGpol_dr;
+                fvec4 fz = dz*dGpol_dr;
+                blockAtomForceX -= fx;
+                blockAtomForceY -= fy;
+                blockAtomForceZ -= fz;
+                blockAtomBornForce += dGpol_dalpha2_ij*bornRadii[atomJ];
+                float* atomForce = forces+4*atomJ;
+                atomForce[0] += dot4(fx, one);
+                atomForce[1] += dot4(fy, one);
+                atomForce[2] += dot4(fz, one);
+                fvec4 termEnergy = blend(0.0f, Gpol-partialChargeI*posJ[3]/cutoffDistance, include);
+                energy += dot4(termEnergy, one);
+                bornForces[atomJ] += dot4(dGpol_dalpha2_ij, radii);
+            }
+            fvec4 f[4] = {blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f};
+            transpose(f[0], f[1], f[2], f[3]);
+            for (int i = 0; i < 4; i++) {
+                if (valid[i]) {
+                    int atomIndex = blockAtom[i];
+                    (fvec4(forces+4*atomIndex)+f[i]).store(forces+4*atomIndex);
+                    bornForces[atomIndex] += blockAtomBornForce[i];
+                }
+            }
+        }
+    }
+    threads.syncThreads();
+
+    // Combine the Born forces from all the threads.
+
+    while (true) {
+        int atomI = atomicCounter++;
+        if (atomI >= numParticles)
+            break;
+        float bornForce = 0.0f;
+        for (int i = 0; i < numThreads; i++)
+            bornForce += threadBornForces[i][atomI];
+        scaledBornForces[atomI] = bornForce*bornRadii[atomI]*bornRadii[atomI]*obcChain[atomI];
+    }
+    threads.syncThreads();
+
+    // Second loop of Born energy computation.
+
+    while (true) {
+        int blockIndex = atomicCounter++;
+        if (blockIndex >= numBlocks)
+            break;
+        const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
+        int numNeighbors = neighbors.size();
+        ivec4 blockStart(blockSize*blockIndex);
+        for (int subBlock = 0; subBlock < blockSize; subBlock += 4) {
+            int firstIndex = blockSize*blockIndex+subBlock;
+            ivec4 sortedIndex(firstIndex, firstIndex+1, firstIndex+2, firstIndex+3);
+            ivec4 valid = (sortedIndex < ivec4(numParticles));
+            if (!any(valid))
+                continue;
+            const int32_t* blockAtom = &sortedAtoms[firstIndex];
+            float atomRadius[4], atomScaledRadius[4], atomBornForce[4], atomx[4], atomy[4], atomz[4];
+            for (int i = 0; i < 4; i++) {
+                atomRadius[i] = particleParams[blockAtom[i]].first;
+                atomScaledRadius[i] = particleParams[blockAtom[i]].second;
+                atomBornForce[i] = scaledBornForces[blockAtom[i]];
+                atomx[i] = posq[4*blockAtom[i]];
+                atomy[i] = posq[4*blockAtom[i]+1];
+                atomz[i] = posq[4*blockAtom[i]+2];
+            }
+            fvec4 offsetRadiusI(atomRadius);
+            fvec4 scaledRadiusI(atomScaledRadius);
+            fvec4 bornForce(atomBornForce);
+            fvec4 x(atomx);
+            fvec4 y(atomy);
+            fvec4 z(atomz);
+            fvec4 blockAtomForceX(0.0f), blockAtomForceY(0.0f), blockAtomForceZ(0.0f);
+            for (int k = 0; k < numNeighbors; k++) {
+                int atomJ = neighbors[k];
+                ivec4 sortedJ(atomSortedIndex[atomJ]);
+                fvec4 posJ(posq+4*atomJ);
+                fvec4 dx, dy, dz, r2;
+                getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
+                ivec4 include = valid & ((sortedJ < blockStart) | (sortedIndex < sortedJ));
+                include = include & (r2 < cutoff2);
+                if (!any(include))
+                    continue;
+                fvec4 r = sqrt(r2);
+                fvec4 de = bornForce*computeBornSumDerivative(r, offsetRadiusI, particleParams[atomJ].second, include);
+                de += scaledBornForces[atomJ]*computeBornSumDerivative(r, particleParams[atomJ].first, scaledRadiusI, include);
+                fvec4 fx = dx*de;
+                fvec4 fy = dy*de;
+                fvec4 fz = dz*de;
+                blockAtomForceX += fx;
+                blockAtomForceY += fy;
+                blockAtomForceZ += fz;
+                float* atomForce = forces+4*atomJ;
+                atomForce[0] -= dot4(fx, one);
+                atomForce[1] -= dot4(fy, one);
+                atomForce[2] -= dot4(fz, one);
+            }
+            fvec4 f[4] = {blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f};
+            transpose(f[0], f[1], f[2], f[3]);
+            for (int i = 0; i < 4; i++) {
+                if (valid[i]) {
+                    int atomIndex = blockAtom[i];
+                    (fvec4(forces+4*atomIndex)+f[i]).store(forces+4*atomIndex);
+                }
+            }
+        }
+    }
+    threadEnergy[threadIndex] = energy;
+}
+
+fvec4 CpuGBSAOBCForce::computeBornSumTerm(const fvec4& r, const fvec4& offsetRadius, const fvec4& scaledRadius, ivec4 include) {
+    fvec4 rScaledRadius = r + scaledRadius;
+    include = include & (offsetRadius < rScaledRadius);
+    fvec4 l_ij = 1.0f/max(offsetRadius, abs(r-scaledRadius));
+    fvec4 u_ij = 1.0f/rScaledRadius;
+    fvec4 l_ij2 = l_ij*l_ij;
+    fvec4 u_ij2 = u_ij*u_ij;
+    fvec4 rInverse = 1.0f/r;
+    fvec4 logRatio = fastLog(u_ij/l_ij);
+    fvec4 term = l_ij - u_ij + 0.25f*r*(u_ij2 - l_ij2) + (0.5f*rInverse*logRatio) + (0.25f*scaledRadius*scaledRadius*rInverse)*(l_ij2 - u_ij2);
+    float result[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int j = 0; j < 4; j++) {
+        if (include[j]) {
+            result[j] = term[j];
+            if (offsetRadius[j] < scaledRadius[j]-r[j])
+                result[j] += 2.0f*(1.0f/offsetRadius[j]-l_ij[j]);
+        }
+    }
+    return fvec4(result);
+}
+
+fvec4 CpuGBSAOBCForce::computeBornSumDerivative(const fvec4& r, const fvec4& offsetRadius, const fvec4& scaledRadius, ivec4 include) {
+    fvec4 rScaledRadius = r + scaledRadius;
+    include = include & (offsetRadius < rScaledRadius);
+    fvec4 l_ij = 1.0f/max(offsetRadius, abs(r-scaledRadius));
+    fvec4 u_ij = 1.0f/rScaledRadius;
+    fvec4 l_ij2 = l_ij*l_ij;
+    fvec4 u_ij2 = u_ij*u_ij;
+    fvec4 rInverse = 1.0f/r;
+    fvec4 r2Inverse = rInverse*rInverse;
+    fvec4 logRatio = fastLog(u_ij/l_ij);
+    fvec4 t3 = 0.125f*(1.0f + scaledRadius*scaledRadius*r2Inverse)*(l_ij2 - u_ij2) + 0.25f*logRatio*r2Inverse;
+    return blend(0.0f, t3*rInverse, include);
+}
+
 void CpuGBSAOBCForce::getDeltaR(const fvec4& posI, const fvec4& x, const fvec4& y, const fvec4& z, fvec4& dx, fvec4& dy, fvec4& dz, fvec4& r2, bool periodic, const fvec4& boxSize, const fvec4& invBoxSize) const {
     dx = x-posI[0];
     dy = y-posI[1];
@@ -119,16 +119,18 @@ double CpuGayBerneForce::calculateForce(const vector<Vec3>& positions, std::vect
     this->boxVectors = boxVectors;
     threadEnergy.resize(numThreads);
     threadTorque.resize(numThreads);
-    atomicCounter = 0;
+    CpuNeighborList* neighborList = data.neighborList;
+    workQueue.reset(threads, neighborList == NULL ? (int) particles.size() : neighborList->getNumBlocks());
     
     // Signal the threads to compute the pairwise interactions.
     
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex, data.neighborList); });
+    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadComputeForce(threads, threadIndex, neighborList); });
     threads.waitForThreads();
     
     // Signal the threads to compute exceptions.
     
-    atomicCounter = 0;
+    int numExceptions = exceptions.size();
+    workQueue.reset(threads, numExceptions, max(1, numExceptions/(10*numThreads)));
     threads.resumeThreads();
     threads.waitForThreads();
     
@@ -146,7 +148,6 @@ double CpuGayBerneForce::calculateForce(const vector<Vec3>& positions, std::vect
 
 void CpuGayBerneForce::threadComputeForce(ThreadPool& threads, int threadIndex, CpuNeighborList* neighborList) {
     int numParticles = particles.size();
-    int numThreads = threads.getNumThreads();
     threadEnergy[threadIndex] = 0;
     float* forces = &(*threadForce)[threadIndex][0];
     vector<Vec3>& torques = threadTorque[threadIndex];
@@ -158,10 +159,8 @@ void CpuGayBerneForce::threadComputeForce(ThreadPool& threads, int threadIndex,
     // Compute this thread's subset of interactions.
     
     if (neighborList == NULL) {
-        while (true) {
-            int i = atomicCounter++;
-            if (i >= numParticles)
-                break;
+        int i;
+        while (workQueue.getNextItem(threadIndex, i)) {
             if (particles[i].sqrtEpsilon == 0.0f)
                 continue;
             for (int j = 0; j < i; j++) {
@@ -176,10 +175,8 @@ void CpuGayBerneForce::threadComputeForce(ThreadPool& threads, int threadIndex,
         }
     }
     else {
-        while (true) {
-            int blockIndex = atomicCounter++;
-            if (blockIndex >= neighborList->getNumBlocks())
-                break;
+        int blockIndex;
+        while (workQueue.getNextItem(threadIndex, blockIndex)) {
             const int blockSize = neighborList->getBlockSize();
             const int32_t* blockAtom = &neighborList->getSortedAtoms()[blockSize*blockIndex];
             const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
@@ -205,13 +202,8 @@ void CpuGayBerneForce::threadComputeForce(ThreadPool& threads, int threadIndex,
     // Compute exceptions.
 
     threads.syncThreads();
-    int numExceptions = exceptions.size();
-    const int groupSize = max(1, numExceptions/(10*numThreads));
-    while (true) {
-        int start = atomicCounter.fetch_add(groupSize);
-        if (start >= numExceptions)
-            break;
-        int end = min(start+groupSize, numExceptions);
+    int start, end;
+    while (workQueue.getNextRange(threadIndex, start, end)) {
         for (int i = start; i < end; i++) {
             ExceptionInfo& e = exceptions[i];
             energy += computeOneInteraction(e.particle1, e.particle2, e.sigma, e.epsilon, positions, forces, torques, boxVectors);
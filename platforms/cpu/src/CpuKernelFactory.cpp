@@ -39,6 +39,10 @@ using namespace OpenMM;
 
 KernelImpl* CpuKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
     CpuPlatform::PlatformData& data = CpuPlatform::getPlatformData(context);
+    if (name == UpdateStateDataKernel::Name()) {
+        ReferencePlatform::PlatformData& referenceData = *static_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+        return new CpuUpdateStateDataKernel(name, platform, referenceData, data);
+    }
     if (name == CalcForcesAndEnergyKernel::Name())
         return new CpuCalcForcesAndEnergyKernel(name, platform, data, context);
     if (name == CalcHarmonicAngleForceKernel::Name())
@@ -53,10 +57,20 @@ KernelImpl* CpuKernelFactory::createKernelImpl(std::string name, const Platform&
         return new CpuCalcCustomNonbondedForceKernel(name, platform, data);
     if (name == CalcCustomManyParticleForceKernel::Name())
         return new CpuCalcCustomManyParticleForceKernel(name, platform, data);
+    if (name == CalcCustomExternalForceKernel::Name())
+        return new CpuCalcCustomExternalForceKernel(name, platform, data);
+    if (name == CalcCustomHbondForceKernel::Name())
+        return new CpuCalcCustomHbondForceKernel(name, platform, data);
+    if (name == CalcCustomCompoundBondForceKernel::Name())
+        return new CpuCalcCustomCompoundBondForceKernel(name, platform, data);
+    if (name == CalcCustomCentroidBondForceKernel::Name())
+        return new CpuCalcCustomCentroidBondForceKernel(name, platform, data);
     if (name == CalcGBSAOBCForceKernel::Name())
         return new CpuCalcGBSAOBCForceKernel(name, platform, data);
     if (name == CalcCustomGBForceKernel::Name())
         return new CpuCalcCustomGBForceKernel(name, platform, data);
+    if (name == CalcRMSDForceKernel::Name())
+        return new CpuCalcRMSDForceKernel(name, platform, data);
     if (name == CalcGayBerneForceKernel::Name())
         return new CpuCalcGayBerneForceKernel(name, platform, data);
     if (name == IntegrateLangevinStepKernel::Name())
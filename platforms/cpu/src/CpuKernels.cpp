@@ -43,6 +43,8 @@
 #include "openmm/OpenMMException.h"
 #include "openmm/Vec3.h"
 #include "openmm/internal/ContextImpl.h"
+#include "openmm/internal/CustomCentroidBondForceImpl.h"
+#include "openmm/internal/CustomCompoundBondForceImpl.h"
 #include "openmm/internal/CustomNonbondedForceImpl.h"
 #include "openmm/internal/NonbondedForceImpl.h"
 #include "openmm/internal/vectorize.h"
@@ -50,6 +52,7 @@
 #include "lepton/CustomFunction.h"
 #include "lepton/Operation.h"
 #include "lepton/Parser.h"
+#include <algorithm>
 #include <iostream>
 #include "lepton/ParsedExpression.h"
 
@@ -102,6 +105,31 @@ static void validateVariables(const Lepton::ExpressionTreeNode& node, const set<
         validateVariables(child, variables);
 }
 
+/**
+ * Determine whether an expression is smooth enough to be accurately interpolated from a cubic spline,
+ * and can be differentiated twice.
+ */
+static bool isSmoothExpression(const Lepton::ExpressionTreeNode& node) {
+    switch (node.getOperation().getId()) {
+        case Lepton::Operation::CUSTOM:
+        case Lepton::Operation::STEP:
+        case Lepton::Operation::DELTA:
+        case Lepton::Operation::SELECT:
+        case Lepton::Operation::FLOOR:
+        case Lepton::Operation::CEIL:
+        case Lepton::Operation::MIN:
+        case Lepton::Operation::MAX:
+        case Lepton::Operation::ABS:
+            return false;
+        default:
+            break;
+    }
+    for (auto& child : node.getChildren())
+        if (!isSmoothExpression(child))
+            return false;
+    return true;
+}
+
 /**
  * Compute the kinetic energy of the system, possibly shifting the velocities in time to account
  * for a leapfrog integrator.
@@ -151,6 +179,16 @@ static void copyChargesToPosq(ContextImpl& context, const vector<float>& charges
         posq[4*i+3] = charges[i];
 }
 
+void CpuUpdateStateDataKernel::createCheckpoint(ContextImpl& context, ostream& stream) {
+    ReferenceUpdateStateDataKernel::createCheckpoint(context, stream);
+    data.random.createCheckpoint(stream);
+}
+
+void CpuUpdateStateDataKernel::loadCheckpoint(ContextImpl& context, istream& stream) {
+    ReferenceUpdateStateDataKernel::loadCheckpoint(context, stream);
+    data.random.loadCheckpoint(stream, data.threads.getNumThreads());
+}
+
 CpuCalcForcesAndEnergyKernel::CpuCalcForcesAndEnergyKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data, ContextImpl& context) :
         CalcForcesAndEnergyKernel(name, platform), data(data) {
     // Create a Reference platform version of this kernel.
@@ -171,7 +209,7 @@ void CpuCalcForcesAndEnergyKernel::beginComputation(ContextImpl& context, bool i
 
     int numParticles = context.getSystem().getNumParticles();
     bool positionsValid = true;
-    data.threads.execute([&] (ThreadPool& threads, int threadIndex) {
+    data.threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
         // Convert the positions to single precision and apply periodic boundary conditions
 
         AlignedArray<float>& posq = data.posq;
@@ -224,8 +262,9 @@ void CpuCalcForcesAndEnergyKernel::beginComputation(ContextImpl& context, bool i
         fvec4 zero(0.0f);
         for (int j = 0; j < numParticles; j++)
             zero.store(&data.threadForce[threadIndex][j*4]);
+        if (data.deterministicForces)
+            fill(data.threadFixedForce[threadIndex].begin(), data.threadFixedForce[threadIndex].end(), 0);
     });
-    data.threads.waitForThreads();
     if (!positionsValid)
         throw OpenMMException("Particle coordinate is nan");
 
@@ -281,7 +320,7 @@ void CpuCalcForcesAndEnergyKernel::beginComputation(ContextImpl& context, bool i
 double CpuCalcForcesAndEnergyKernel::finishComputation(ContextImpl& context, bool includeForce, bool includeEnergy, int groups, bool& valid) {
     // Sum the forces from all the threads.
     
-    data.threads.execute([&] (ThreadPool& threads, int threadIndex) {
+    data.threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
         // Sum the contributions to forces that have been calculated by different threads.
         
         int numParticles = context.getSystem().getNumParticles();
@@ -297,8 +336,17 @@ double CpuCalcForcesAndEnergyKernel::finishComputation(ContextImpl& context, boo
             forceData[i][1] += f[1];
             forceData[i][2] += f[2];
         }
+        if (data.deterministicForces) {
+            for (int i = start; i < end; i++) {
+                long long fixed[3] = {0, 0, 0};
+                for (int j = 0; j < numThreads; j++)
+                    for (int k = 0; k < 3; k++)
+                        fixed[k] += data.threadFixedForce[j][3*i+k];
+                for (int k = 0; k < 3; k++)
+                    forceData[i][k] += fixed[k]/CpuPlatform::PlatformData::FIXED_POINT_SCALE;
+            }
+        }
     });
-    data.threads.waitForThreads();
     return referenceKernel.getAs<ReferenceCalcForcesAndEnergyKernel>().finishComputation(context, includeForce, includeEnergy, groups, valid);
 }
 
@@ -316,7 +364,7 @@ void CpuCalcHarmonicAngleForceKernel::initialize(const System& system, const Har
         angleParamArray[i][0] = angle;
         angleParamArray[i][1] = k;
     }
-    bondForce.initialize(system.getNumParticles(), numAngles, 3, angleIndexArray, data.threads);
+    bondForce.initialize(system.getNumParticles(), numAngles, 3, angleIndexArray, data.threads, data.deterministicForces);
     usePeriodic = force.usesPeriodicBoundaryConditions();
 }
 
@@ -364,7 +412,7 @@ void CpuCalcPeriodicTorsionForceKernel::initialize(const System& system, const P
         torsionParamArray[i][1] = phase;
         torsionParamArray[i][2] = periodicity;
     }
-    bondForce.initialize(system.getNumParticles(), numTorsions, 4, torsionIndexArray, data.threads);
+    bondForce.initialize(system.getNumParticles(), numTorsions, 4, torsionIndexArray, data.threads, data.deterministicForces);
     usePeriodic = force.usesPeriodicBoundaryConditions();
 }
 
@@ -416,7 +464,7 @@ void CpuCalcRBTorsionForceKernel::initialize(const System& system, const RBTorsi
         torsionParamArray[i][4] = c4;
         torsionParamArray[i][5] = c5;
     }
-    bondForce.initialize(system.getNumParticles(), numTorsions, 4, torsionIndexArray, data.threads);
+    bondForce.initialize(system.getNumParticles(), numTorsions, 4, torsionIndexArray, data.threads, data.deterministicForces);
     usePeriodic = force.usesPeriodicBoundaryConditions();
 }
 
@@ -535,7 +583,7 @@ void CpuCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
         bonded14IndexArray[i][0] = particle1;
         bonded14IndexArray[i][1] = particle2;
     }
-    bondForce.initialize(system.getNumParticles(), num14, 2, bonded14IndexArray, data.threads);
+    bondForce.initialize(system.getNumParticles(), num14, 2, bonded14IndexArray, data.threads, data.deterministicForces);
     
     // Record information about parameter offsets.
     
@@ -678,23 +726,25 @@ double CpuCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeFo
         nonbonded->setUsePME(ewaldAlpha, gridSize);
         nonbonded->setUseLJPME(ewaldDispersionAlpha, dispersionGridSize);
     }
+    if (data.deterministicForces)
+        nonbonded->setFixedPointForces(&data.threadFixedForce, CpuPlatform::PlatformData::FIXED_POINT_SCALE);
     double nonbondedEnergy = 0;
     if (includeDirect)
-        nonbonded->calculateDirectIxn(numParticles, &posq[0], posData, particleParams, C6params, exclusions, data.threadForce, includeEnergy ? &nonbondedEnergy : NULL, data.threads);
+        nonbonded->calculateDirectIxn(numParticles, &posq[0], posData, particleParams, C6params, exclusions, data.threadForce, includeEnergy ? &nonbondedEnergy : NULL, data.threads, includeForces);
     if (includeReciprocal) {
         if (useOptimizedPme) {
             PmeIO io(&posq[0], &data.threadForce[0][0], numParticles);
             Vec3 periodicBoxVectors[3] = {boxVectors[0], boxVectors[1], boxVectors[2]};
-            optimizedPme.getAs<CalcPmeReciprocalForceKernel>().beginComputation(io, periodicBoxVectors, includeEnergy);
+            optimizedPme.getAs<CalcPmeReciprocalForceKernel>().beginComputation(io, periodicBoxVectors, includeEnergy, includeForces);
             nonbondedEnergy += optimizedPme.getAs<CalcPmeReciprocalForceKernel>().finishComputation(io);
             if (nonbondedMethod == LJPME) {
                 copyChargesToPosq(context, C6params, ljPosqIndex);
-                optimizedDispersionPme.getAs<CalcDispersionPmeReciprocalForceKernel>().beginComputation(io, periodicBoxVectors, includeEnergy);
+                optimizedDispersionPme.getAs<CalcDispersionPmeReciprocalForceKernel>().beginComputation(io, periodicBoxVectors, includeEnergy, includeForces);
                 nonbondedEnergy += optimizedDispersionPme.getAs<CalcDispersionPmeReciprocalForceKernel>().finishComputation(io);
             }
         }
         else
-            nonbonded->calculateReciprocalIxn(numParticles, &posq[0], posData, particleParams, C6params, exclusions, forceData, includeEnergy ? &nonbondedEnergy : NULL);
+            nonbonded->calculateReciprocalIxn(numParticles, &posq[0], posData, particleParams, C6params, exclusions, forceData, includeEnergy ? &nonbondedEnergy : NULL, data.threads, includeForces);
     }
     energy += nonbondedEnergy;
     if (includeDirect) {
@@ -811,6 +861,7 @@ void CpuCalcNonbondedForceKernel::computeParameters(ContextImpl& context, bool o
             C6params[i] = 8.0*pow(particleParams[i].first, 3.0) * particleParams[i].second;
             sumSquaredCharges += charge*charge;
         }
+        nonbonded->setParametersChanged();
         if (nonbondedMethod == Ewald || nonbondedMethod == PME || nonbondedMethod == LJPME) {
             ewaldSelfEnergy = -ONE_4PI_EPS0*ewaldAlpha*sumSquaredCharges/sqrt(M_PI);
             if (nonbondedMethod == LJPME)
@@ -844,7 +895,7 @@ void CpuCalcNonbondedForceKernel::computeParameters(ContextImpl& context, bool o
 }
 
 CpuCalcCustomNonbondedForceKernel::CpuCalcCustomNonbondedForceKernel(string name, const Platform& platform, CpuPlatform::PlatformData& data) :
-            CalcCustomNonbondedForceKernel(name, platform), data(data), forceCopy(NULL), nonbonded(NULL) {
+            CalcCustomNonbondedForceKernel(name, platform), data(data), forceCopy(NULL), nonbonded(NULL), useTabulation(false) {
 }
 
 CpuCalcCustomNonbondedForceKernel::~CpuCalcCustomNonbondedForceKernel() {
@@ -889,22 +940,40 @@ void CpuCalcCustomNonbondedForceKernel::initialize(const System& system, const C
     for (int i = 0; i < force.getNumFunctions(); i++)
         functions[force.getTabulatedFunctionName(i)] = createReferenceTabulatedFunction(force.getTabulatedFunction(i));
 
-    // Parse the various expressions used to calculate the force.
+    // Parse the various expressions used to calculate the force.  They are compiled together so
+    // subexpressions shared by the energy and its derivatives only get computed once per pair.
 
     Lepton::ParsedExpression expression = Lepton::Parser::parse(force.getEnergyFunction(), functions).optimize();
-    Lepton::CompiledExpression energyExpression = expression.createCompiledExpression();
-    Lepton::CompiledExpression forceExpression = expression.differentiate("r").createCompiledExpression();
+    vector<Lepton::ParsedExpression> outputExpressions;
+    outputExpressions.push_back(expression);
+    outputExpressions.push_back(expression.differentiate("r").optimize());
     for (int i = 0; i < numParameters; i++)
         parameterNames.push_back(force.getPerParticleParameterName(i));
     for (int i = 0; i < force.getNumGlobalParameters(); i++) {
         globalParameterNames.push_back(force.getGlobalParameterName(i));
         globalParamValues[force.getGlobalParameterName(i)] = force.getGlobalParameterDefaultValue(i);
     }
-    std::vector<Lepton::CompiledExpression> energyParamDerivExpressions;
     for (int i = 0; i < force.getNumEnergyParameterDerivatives(); i++) {
         string param = force.getEnergyParameterDerivativeName(i);
         energyParamDerivNames.push_back(param);
-        energyParamDerivExpressions.push_back(expression.differentiate(param).createCompiledExpression());
+        outputExpressions.push_back(expression.differentiate(param).optimize());
+    }
+    Lepton::CompiledExpression compiledExpression(outputExpressions);
+    vector<Lepton::ParsedExpression> energyOutputExpressions = outputExpressions;
+    energyOutputExpressions.erase(energyOutputExpressions.begin()+1);
+    Lepton::CompiledExpression compiledEnergyExpression(energyOutputExpressions);
+    
+    // If requested, see whether the force can be computed from tables.  That requires a cutoff and an energy
+    // that is a smooth function of r.
+    
+    useTabulation = (data.tabulateCustomNonbonded && nonbondedMethod != NoCutoff && force.getNumInteractionGroups() == 0 &&
+            force.getNumEnergyParameterDerivatives() == 0 && isSmoothExpression(expression.getRootNode()));
+    if (useTabulation) {
+        vector<Lepton::ParsedExpression> tableExpressions;
+        tableExpressions.push_back(expression);
+        tableExpressions.push_back(outputExpressions[1]);
+        tableExpressions.push_back(outputExpressions[1].differentiate("r").optimize());
+        tabulatedExpression = Lepton::CompiledExpression(tableExpressions);
     }
     set<string> variables;
     variables.insert("r");
@@ -924,6 +993,7 @@ void CpuCalcCustomNonbondedForceKernel::initialize(const System& system, const C
     
     if (force.getNonbondedMethod() == CustomNonbondedForce::CutoffPeriodic && force.getUseLongRangeCorrection()) {
         forceCopy = new CustomNonbondedForce(force);
+        CustomNonbondedForceImpl::prepareLongRangeCorrection(force, longRangeCorrectionData);
         hasInitializedLongRangeCorrection = false;
     }
     else {
@@ -939,9 +1009,28 @@ void CpuCalcCustomNonbondedForceKernel::initialize(const System& system, const C
         interactionGroups.push_back(make_pair(set1, set2));
     }
     data.isPeriodic |= (nonbondedMethod == CutoffPeriodic);
-    nonbonded = new CpuCustomNonbondedForce(energyExpression, forceExpression, parameterNames, exclusions, energyParamDerivExpressions, data.threads);
+    nonbonded = new CpuCustomNonbondedForce(compiledExpression, compiledEnergyExpression, parameterNames, exclusions, data.threads);
     if (interactionGroups.size() > 0)
         nonbonded->setInteractionGroups(interactionGroups);
+    if (useTabulation)
+        updateTabulation();
+}
+
+void CpuCalcCustomNonbondedForceKernel::updateTabulation() {
+    // Identify the particle types, defined by their parameters.
+
+    vector<int> particleType(numParticles);
+    map<vector<double>, int> typeIndex;
+    for (int i = 0; i < numParticles; i++) {
+        auto entry = typeIndex.find(particleParamArray[i]);
+        if (entry == typeIndex.end()) {
+            particleType[i] = typeIndex.size();
+            typeIndex[particleParamArray[i]] = particleType[i];
+        }
+        else
+            particleType[i] = entry->second;
+    }
+    nonbonded->setUseTabulation(tabulatedExpression, particleType, typeIndex.size());
 }
 
 double CpuCalcCustomNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
@@ -976,7 +1065,7 @@ double CpuCalcCustomNonbondedForceKernel::execute(ContextImpl& context, bool inc
     // Add in the long range correction.
     
     if (!hasInitializedLongRangeCorrection || (globalParamsChanged && forceCopy != NULL)) {
-        CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, context.getOwner(), longRangeCoefficient, longRangeCoefficientDerivs);
+        CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, longRangeCorrectionData, context.getOwner(), longRangeCoefficient, longRangeCoefficientDerivs, &data.threads);
         hasInitializedLongRangeCorrection = true;
     }
     double volume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
@@ -1001,10 +1090,14 @@ void CpuCalcCustomNonbondedForceKernel::copyParametersToContext(ContextImpl& con
             particleParamArray[i][j] = parameters[j];
     }
     
+    if (useTabulation)
+        updateTabulation();
+    
     // If necessary, recompute the long range correction.
     
     if (forceCopy != NULL) {
-        CustomNonbondedForceImpl::calcLongRangeCorrection(force, context.getOwner(), longRangeCoefficient, longRangeCoefficientDerivs);
+        CustomNonbondedForceImpl::prepareLongRangeCorrection(force, longRangeCorrectionData);
+        CustomNonbondedForceImpl::calcLongRangeCorrection(force, longRangeCorrectionData, context.getOwner(), longRangeCoefficient, longRangeCoefficientDerivs, &data.threads);
         hasInitializedLongRangeCorrection = true;
         *forceCopy = force;
     }
@@ -1029,8 +1122,13 @@ void CpuCalcGBSAOBCForceKernel::initialize(const System& system, const GBSAOBCFo
     obc.setSolventDielectric((float) force.getSolventDielectric());
     obc.setSoluteDielectric((float) force.getSoluteDielectric());
     obc.setSurfaceAreaEnergy((float) force.getSurfaceAreaEnergy());
-    if (force.getNonbondedMethod() != GBSAOBCForce::NoCutoff)
-        obc.setUseCutoff((float) force.getCutoffDistance());
+    if (force.getNonbondedMethod() != GBSAOBCForce::NoCutoff) {
+        // Use the platform's neighbor list, so it can be shared with other forces such as NonbondedForce.
+
+        double cutoff = force.getCutoffDistance();
+        data.requestNeighborList(cutoff, 0.25*cutoff, false, vector<set<int> >(numParticles));
+        obc.setUseCutoff((float) cutoff, *data.neighborList);
+    }
     data.isPeriodic |= (force.getNonbondedMethod() == GBSAOBCForce::CutoffPeriodic);
 }
 
@@ -1302,6 +1400,464 @@ void CpuCalcCustomManyParticleForceKernel::copyParametersToContext(ContextImpl&
     }
 }
 
+CpuCalcCustomExternalForceKernel::~CpuCalcCustomExternalForceKernel() {
+    if (ixn != NULL)
+        delete ixn;
+}
+
+void CpuCalcCustomExternalForceKernel::initialize(const System& system, const CustomExternalForce& force) {
+    numParticles = force.getNumParticles();
+    int numParameters = force.getNumPerParticleParameters();
+
+    // Parse the expression used to calculate the force.  The energy and its gradient are compiled
+    // together so subexpressions they share only get computed once per particle.
+
+    map<string, Lepton::CustomFunction*> functions;
+    ReferenceCalcCustomExternalForceKernel::PeriodicDistanceFunction periodicDistance(&boxVectors);
+    functions["periodicdistance"] = &periodicDistance;
+    Lepton::ParsedExpression expression = Lepton::Parser::parse(force.getEnergyFunction(), functions).optimize();
+    vector<Lepton::ParsedExpression> outputExpressions;
+    outputExpressions.push_back(expression);
+    outputExpressions.push_back(expression.differentiate("x").optimize());
+    outputExpressions.push_back(expression.differentiate("y").optimize());
+    outputExpressions.push_back(expression.differentiate("z").optimize());
+    Lepton::CompiledExpression compiledExpression(outputExpressions);
+    vector<string> parameterNames;
+    for (int i = 0; i < numParameters; i++)
+        parameterNames.push_back(force.getPerParticleParameterName(i));
+    for (int i = 0; i < force.getNumGlobalParameters(); i++)
+        globalParameterNames.push_back(force.getGlobalParameterName(i));
+    set<string> variables;
+    variables.insert("x");
+    variables.insert("y");
+    variables.insert("z");
+    variables.insert(parameterNames.begin(), parameterNames.end());
+    variables.insert(globalParameterNames.begin(), globalParameterNames.end());
+    validateVariables(expression.getRootNode(), variables);
+
+    // Build the arrays.
+
+    vector<int> particles(numParticles);
+    vector<vector<double> > particleParamArray(numParticles);
+    for (int i = 0; i < numParticles; ++i)
+        force.getParticleParameters(i, particles[i], particleParamArray[i]);
+    ixn = new CpuCustomExternalForce(compiledExpression, parameterNames, particles, data.threads);
+    for (int i = 0; i < numParticles; ++i)
+        ixn->setParticleParameters(i, particleParamArray[i]);
+}
+
+double CpuCalcCustomExternalForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    vector<Vec3>& posData = extractPositions(context);
+    boxVectors = extractBoxVectors(context);
+    map<string, double> globalParameters;
+    for (auto& name : globalParameterNames)
+        globalParameters[name] = context.getParameter(name);
+    double energy = 0;
+    ixn->calculateIxn(posData, globalParameters, data.threadForce, includeForces, includeEnergy, energy);
+    return energy;
+}
+
+void CpuCalcCustomExternalForceKernel::copyParametersToContext(ContextImpl& context, const CustomExternalForce& force) {
+    if (numParticles != force.getNumParticles())
+        throw OpenMMException("updateParametersInContext: The number of particles has changed");
+
+    // Record the values.
+
+    const vector<int>& particles = ixn->getParticles();
+    for (int i = 0; i < numParticles; ++i) {
+        int particle;
+        vector<double> parameters;
+        force.getParticleParameters(i, particle, parameters);
+        if (particle != particles[i])
+            throw OpenMMException("updateParametersInContext: A particle index has changed");
+        ixn->setParticleParameters(i, parameters);
+    }
+}
+
+CpuCalcCustomHbondForceKernel::~CpuCalcCustomHbondForceKernel() {
+    if (ixn != NULL)
+        delete ixn;
+}
+
+void CpuCalcCustomHbondForceKernel::initialize(const System& system, const CustomHbondForce& force) {
+
+    // Build the arrays.
+
+    numDonors = force.getNumDonors();
+    numAcceptors = force.getNumAcceptors();
+    donorParamArray.resize(numDonors);
+    acceptorParamArray.resize(numAcceptors);
+    for (int i = 0; i < numDonors; i++) {
+        int d1, d2, d3;
+        force.getDonorParameters(i, d1, d2, d3, donorParamArray[i]);
+    }
+    for (int i = 0; i < numAcceptors; i++) {
+        int a1, a2, a3;
+        force.getAcceptorParameters(i, a1, a2, a3, acceptorParamArray[i]);
+    }
+    for (int i = 0; i < force.getNumGlobalParameters(); i++)
+        globalParameterNames.push_back(force.getGlobalParameterName(i));
+    ixn = new CpuCustomHbondForce(force, data.threads);
+    nonbondedMethod = CalcCustomHbondForceKernel::NonbondedMethod(force.getNonbondedMethod());
+    cutoffDistance = force.getCutoffDistance();
+    data.isPeriodic |= (nonbondedMethod == CutoffPeriodic);
+}
+
+double CpuCalcCustomHbondForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    map<string, double> globalParameters;
+    for (auto& name : globalParameterNames)
+        globalParameters[name] = context.getParameter(name);
+    if (nonbondedMethod == CutoffPeriodic) {
+        Vec3* boxVectors = extractBoxVectors(context);
+        double minAllowedSize = 2*cutoffDistance;
+        if (boxVectors[0][0] < minAllowedSize || boxVectors[1][1] < minAllowedSize || boxVectors[2][2] < minAllowedSize)
+            throw OpenMMException("The periodic box size has decreased to less than twice the nonbonded cutoff.");
+        ixn->setPeriodic(boxVectors);
+    }
+    double energy = 0;
+    ixn->calculateIxn(data.posq, donorParamArray, acceptorParamArray, globalParameters, data.threadForce, includeForces, includeEnergy, energy);
+    return energy;
+}
+
+void CpuCalcCustomHbondForceKernel::copyParametersToContext(ContextImpl& context, const CustomHbondForce& force) {
+    if (numDonors != force.getNumDonors())
+        throw OpenMMException("updateParametersInContext: The number of donors has changed");
+    if (numAcceptors != force.getNumAcceptors())
+        throw OpenMMException("updateParametersInContext: The number of acceptors has changed");
+
+    // Record the values.
+
+    vector<double> parameters;
+    const vector<vector<int> >& donorAtoms = ixn->getDonorAtoms();
+    for (int i = 0; i < numDonors; i++) {
+        int d1, d2, d3;
+        force.getDonorParameters(i, d1, d2, d3, parameters);
+        if (d1 != donorAtoms[i][0] || d2 != donorAtoms[i][1] || d3 != donorAtoms[i][2])
+            throw OpenMMException("updateParametersInContext: The set of particles in a donor group has changed");
+        donorParamArray[i] = parameters;
+    }
+    const vector<vector<int> >& acceptorAtoms = ixn->getAcceptorAtoms();
+    for (int i = 0; i < numAcceptors; i++) {
+        int a1, a2, a3;
+        force.getAcceptorParameters(i, a1, a2, a3, parameters);
+        if (a1 != acceptorAtoms[i][0] || a2 != acceptorAtoms[i][1] || a3 != acceptorAtoms[i][2])
+            throw OpenMMException("updateParametersInContext: The set of particles in an acceptor group has changed");
+        acceptorParamArray[i] = parameters;
+    }
+}
+
+CpuCalcCustomCompoundBondForceKernel::~CpuCalcCustomCompoundBondForceKernel() {
+    for (auto ixn : threadIxn)
+        delete ixn;
+}
+
+void CpuCalcCustomCompoundBondForceKernel::initialize(const System& system, const CustomCompoundBondForce& force) {
+    usePeriodic = force.usesPeriodicBoundaryConditions();
+
+    // Build the arrays.
+
+    numBonds = force.getNumBonds();
+    bondAtoms.resize(numBonds);
+    int numBondParameters = force.getNumPerBondParameters();
+    bondParamArray.resize(numBonds);
+    for (int i = 0; i < numBonds; ++i)
+        force.getBondParameters(i, bondAtoms[i], bondParamArray[i]);
+    bondForce.initialize(system.getNumParticles(), numBonds, force.getNumParticlesPerBond(), bondAtoms, data.threads, data.deterministicForces);
+
+    // Create custom functions for the tabulated functions.
+
+    map<string, Lepton::CustomFunction*> functions;
+    for (int i = 0; i < force.getNumFunctions(); i++)
+        functions[force.getTabulatedFunctionName(i)] = createReferenceTabulatedFunction(force.getTabulatedFunction(i));
+
+    // Parse the expression and create the objects used to calculate the interaction.  Each thread
+    // needs its own copy, since they store intermediate values.
+
+    map<string, vector<int> > distances;
+    map<string, vector<int> > angles;
+    map<string, vector<int> > dihedrals;
+    Lepton::ParsedExpression energyExpression = CustomCompoundBondForceImpl::prepareExpression(force, functions, distances, angles, dihedrals);
+    vector<string> bondParameterNames;
+    for (int i = 0; i < numBondParameters; i++)
+        bondParameterNames.push_back(force.getPerBondParameterName(i));
+    for (int i = 0; i < force.getNumGlobalParameters(); i++)
+        globalParameterNames.push_back(force.getGlobalParameterName(i));
+    vector<Lepton::CompiledExpression> energyParamDerivExpressions;
+    for (int i = 0; i < force.getNumEnergyParameterDerivatives(); i++) {
+        string param = force.getEnergyParameterDerivativeName(i);
+        energyParamDerivNames.push_back(param);
+        energyParamDerivExpressions.push_back(energyExpression.differentiate(param).createCompiledExpression());
+    }
+    int numThreads = data.threads.getNumThreads();
+    for (int i = 0; i < numThreads; i++)
+        threadIxn.push_back(new ReferenceCustomCompoundBondIxn(force.getNumParticlesPerBond(), bondAtoms, energyExpression, bondParameterNames, distances, angles, dihedrals, energyParamDerivExpressions));
+    threadEnergyParamDerivs.resize(numThreads, vector<double>(energyParamDerivNames.size()));
+
+    // Delete the custom functions.
+
+    for (auto& function : functions)
+        delete function.second;
+}
+
+double CpuCalcCustomCompoundBondForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    vector<Vec3>& posData = extractPositions(context);
+    vector<Vec3>& forceData = extractForces(context);
+    map<string, double> globalParameters;
+    for (auto& name : globalParameterNames)
+        globalParameters[name] = context.getParameter(name);
+    for (auto ixn : threadIxn) {
+        ixn->setGlobalParameters(globalParameters);
+        if (usePeriodic)
+            ixn->setPeriodic(extractBoxVectors(context));
+    }
+    for (auto& derivs : threadEnergyParamDerivs)
+        fill(derivs.begin(), derivs.end(), 0.0);
+    double energy = 0;
+    vector<ReferenceBondIxn*> bondIxn(threadIxn.begin(), threadIxn.end());
+    bondForce.calculateForce(posData, bondParamArray, forceData, includeEnergy ? &energy : NULL, bondIxn, threadEnergyParamDerivs);
+    map<string, double>& energyParamDerivs = extractEnergyParameterDerivatives(context);
+    for (auto& derivs : threadEnergyParamDerivs)
+        for (int i = 0; i < energyParamDerivNames.size(); i++)
+            energyParamDerivs[energyParamDerivNames[i]] += derivs[i];
+    return energy;
+}
+
+void CpuCalcCustomCompoundBondForceKernel::copyParametersToContext(ContextImpl& context, const CustomCompoundBondForce& force) {
+    if (numBonds != force.getNumBonds())
+        throw OpenMMException("updateParametersInContext: The number of bonds has changed");
+
+    // Record the values.
+
+    int numParameters = force.getNumPerBondParameters();
+    vector<int> particles;
+    vector<double> params;
+    for (int i = 0; i < numBonds; ++i) {
+        force.getBondParameters(i, particles, params);
+        for (int j = 0; j < particles.size(); j++)
+            if (particles[j] != bondAtoms[i][j])
+                throw OpenMMException("updateParametersInContext: The set of particles in a bond has changed");
+        for (int j = 0; j < numParameters; j++)
+            bondParamArray[i][j] = params[j];
+    }
+}
+
+CpuCalcCustomCentroidBondForceKernel::~CpuCalcCustomCentroidBondForceKernel() {
+    for (auto ixn : threadIxn)
+        delete ixn;
+}
+
+void CpuCalcCustomCentroidBondForceKernel::initialize(const System& system, const CustomCentroidBondForce& force) {
+    usePeriodic = force.usesPeriodicBoundaryConditions();
+
+    // Build the arrays.
+
+    numGroups = force.getNumGroups();
+    vector<vector<int> > atomsInGroup(numGroups);
+    vector<double> ignored;
+    for (int i = 0; i < numGroups; i++)
+        force.getGroupParameters(i, atomsInGroup[i], ignored);
+    vector<vector<double> > normalizedWeights;
+    CustomCentroidBondForceImpl::computeNormalizedWeights(force, system, normalizedWeights);
+    numBonds = force.getNumBonds();
+    bondGroups.resize(numBonds);
+    int numBondParameters = force.getNumPerBondParameters();
+    bondParamArray.resize(numBonds);
+    for (int i = 0; i < numBonds; ++i)
+        force.getBondParameters(i, bondGroups[i], bondParamArray[i]);
+    bondForce.initialize(numGroups, numBonds, force.getNumGroupsPerBond(), bondGroups, data.threads, data.deterministicForces);
+
+    // Flatten the group definitions so centers can be computed by dividing the atoms evenly between
+    // threads, and build the inverse mapping so forces can be applied to atoms without conflicts.
+
+    int numAtoms = system.getNumParticles();
+    vector<vector<pair<int, double> > > groupsForAtom(numAtoms);
+    groupStart.push_back(0);
+    for (int i = 0; i < numGroups; i++) {
+        for (int j = 0; j < atomsInGroup[i].size(); j++) {
+            groupAtoms.push_back(atomsInGroup[i][j]);
+            groupWeights.push_back(normalizedWeights[i][j]);
+            groupsForAtom[atomsInGroup[i][j]].push_back(make_pair(i, normalizedWeights[i][j]));
+        }
+        groupStart.push_back(groupAtoms.size());
+    }
+    atomStart.push_back(0);
+    for (int i = 0; i < numAtoms; i++) {
+        if (groupsForAtom[i].size() == 0)
+            continue;
+        forceAtoms.push_back(i);
+        for (auto& group : groupsForAtom[i]) {
+            atomGroups.push_back(group.first);
+            atomWeights.push_back(group.second);
+        }
+        atomStart.push_back(atomGroups.size());
+    }
+    groupCenters.resize(numGroups);
+    groupForces.resize(numGroups);
+    threadPartialCenters.resize(data.threads.getNumThreads());
+
+    // Create custom functions for the tabulated functions.
+
+    map<string, Lepton::CustomFunction*> functions;
+    for (int i = 0; i < force.getNumFunctions(); i++)
+        functions[force.getTabulatedFunctionName(i)] = createReferenceTabulatedFunction(force.getTabulatedFunction(i));
+
+    // Parse the expression and create the objects used to calculate the interaction.  Each thread
+    // needs its own copy, since they store intermediate values.
+
+    map<string, vector<int> > distances;
+    map<string, vector<int> > angles;
+    map<string, vector<int> > dihedrals;
+    Lepton::ParsedExpression energyExpression = CustomCentroidBondForceImpl::prepareExpression(force, functions, distances, angles, dihedrals);
+    vector<string> bondParameterNames;
+    for (int i = 0; i < numBondParameters; i++)
+        bondParameterNames.push_back(force.getPerBondParameterName(i));
+    for (int i = 0; i < force.getNumGlobalParameters(); i++)
+        globalParameterNames.push_back(force.getGlobalParameterName(i));
+    vector<Lepton::CompiledExpression> energyParamDerivExpressions;
+    for (int i = 0; i < force.getNumEnergyParameterDerivatives(); i++) {
+        string param = force.getEnergyParameterDerivativeName(i);
+        energyParamDerivNames.push_back(param);
+        energyParamDerivExpressions.push_back(energyExpression.differentiate(param).createCompiledExpression());
+    }
+    int numThreads = data.threads.getNumThreads();
+    for (int i = 0; i < numThreads; i++)
+        threadIxn.push_back(new ReferenceCustomCentroidBondIxn(force.getNumGroupsPerBond(), atomsInGroup, normalizedWeights, bondGroups, energyExpression, bondParameterNames, distances, angles, dihedrals, energyParamDerivExpressions));
+    threadEnergyParamDerivs.resize(numThreads, vector<double>(energyParamDerivNames.size()));
+
+    // Delete the custom functions.
+
+    for (auto& function : functions)
+        delete function.second;
+}
+
+void CpuCalcCustomCentroidBondForceKernel::computeGroupCenters(vector<Vec3>& atomCoordinates) {
+    // Each thread processes a contiguous range of atoms.  Groups that lie entirely inside the range are
+    // written directly.  Groups that cross a boundary are recorded as partial sums and combined afterward.
+
+    int numThreads = data.threads.getNumThreads();
+    int numEntries = groupAtoms.size();
+    data.threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+        vector<pair<int, Vec3> >& partial = threadPartialCenters[threadIndex];
+        partial.clear();
+        int start = (int) (((long long) numEntries*threadIndex)/numThreads);
+        int end = (int) (((long long) numEntries*(threadIndex+1))/numThreads);
+        if (start == end)
+            return;
+        int group = upper_bound(groupStart.begin(), groupStart.end(), start)-groupStart.begin()-1;
+        for (; group < numGroups && groupStart[group] < end; group++) {
+            int first = max(start, groupStart[group]);
+            int last = min(end, groupStart[group+1]);
+            Vec3 center;
+            for (int i = first; i < last; i++)
+                center += atomCoordinates[groupAtoms[i]]*groupWeights[i];
+            if (first == groupStart[group] && last == groupStart[group+1])
+                groupCenters[group] = center;
+            else
+                partial.push_back(make_pair(group, center));
+        }
+    });
+    for (auto& partial : threadPartialCenters)
+        for (auto& p : partial)
+            groupCenters[p.first] = Vec3();
+    for (auto& partial : threadPartialCenters)
+        for (auto& p : partial)
+            groupCenters[p.first] += p.second;
+}
+
+void CpuCalcCustomCentroidBondForceKernel::applyGroupForces(vector<Vec3>& forces) {
+    // Each atom is processed by exactly one thread, so no synchronization is needed.
+
+    int numThreads = data.threads.getNumThreads();
+    int numForceAtoms = forceAtoms.size();
+    data.threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+        int start = (int) (((long long) numForceAtoms*threadIndex)/numThreads);
+        int end = (int) (((long long) numForceAtoms*(threadIndex+1))/numThreads);
+        for (int i = start; i < end; i++) {
+            Vec3 f;
+            for (int j = atomStart[i]; j < atomStart[i+1]; j++)
+                f += groupForces[atomGroups[j]]*atomWeights[j];
+            forces[forceAtoms[i]] += f;
+        }
+    });
+}
+
+double CpuCalcCustomCentroidBondForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    vector<Vec3>& posData = extractPositions(context);
+    vector<Vec3>& forceData = extractForces(context);
+    map<string, double> globalParameters;
+    for (auto& name : globalParameterNames)
+        globalParameters[name] = context.getParameter(name);
+    for (auto ixn : threadIxn) {
+        ixn->setGlobalParameters(globalParameters);
+        if (usePeriodic)
+            ixn->setPeriodic(extractBoxVectors(context));
+    }
+    for (auto& derivs : threadEnergyParamDerivs)
+        fill(derivs.begin(), derivs.end(), 0.0);
+
+    // Compute the group centers, the forces on the groups, and then the forces on the atoms.
+
+    computeGroupCenters(posData);
+    fill(groupForces.begin(), groupForces.end(), Vec3());
+    double energy = 0;
+    vector<ReferenceBondIxn*> bondIxn(threadIxn.begin(), threadIxn.end());
+    bondForce.calculateForce(groupCenters, bondParamArray, groupForces, includeEnergy ? &energy : NULL, bondIxn, threadEnergyParamDerivs);
+    applyGroupForces(forceData);
+    map<string, double>& energyParamDerivs = extractEnergyParameterDerivatives(context);
+    for (auto& derivs : threadEnergyParamDerivs)
+        for (int i = 0; i < energyParamDerivNames.size(); i++)
+            energyParamDerivs[energyParamDerivNames[i]] += derivs[i];
+    return energy;
+}
+
+void CpuCalcCustomCentroidBondForceKernel::copyParametersToContext(ContextImpl& context, const CustomCentroidBondForce& force) {
+    if (numBonds != force.getNumBonds())
+        throw OpenMMException("updateParametersInContext: The number of bonds has changed");
+
+    // Record the values.
+
+    int numParameters = force.getNumPerBondParameters();
+    vector<int> groups;
+    vector<double> params;
+    for (int i = 0; i < numBonds; ++i) {
+        force.getBondParameters(i, groups, params);
+        for (int j = 0; j < groups.size(); j++)
+            if (groups[j] != bondGroups[i][j])
+                throw OpenMMException("updateParametersInContext: The set of groups in a bond has changed");
+        for (int j = 0; j < numParameters; j++)
+            bondParamArray[i][j] = params[j];
+    }
+}
+
+CpuCalcRMSDForceKernel::~CpuCalcRMSDForceKernel() {
+    if (ixn != NULL)
+        delete ixn;
+}
+
+void CpuCalcRMSDForceKernel::initialize(const System& system, const RMSDForce& force) {
+    numParticles = system.getNumParticles();
+    numReferencePositions = force.getReferencePositions().size();
+    ixn = new CpuRMSDForce(force.getReferencePositions(), getParticles(force), data.threads);
+}
+
+vector<int> CpuCalcRMSDForceKernel::getParticles(const RMSDForce& force) const {
+    vector<int> particles = force.getParticles();
+    if (particles.size() == 0)
+        for (int i = 0; i < numParticles; i++)
+            particles.push_back(i);
+    return particles;
+}
+
+double CpuCalcRMSDForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    return ixn->calculateIxn(extractPositions(context), data.threadForce, includeForces);
+}
+
+void CpuCalcRMSDForceKernel::copyParametersToContext(ContextImpl& context, const RMSDForce& force) {
+    if (numReferencePositions != force.getReferencePositions().size())
+        throw OpenMMException("updateParametersInContext: The number of reference positions has changed");
+    ixn->setParameters(force.getReferencePositions(), getParticles(force));
+}
+
 CpuCalcGayBerneForceKernel::~CpuCalcGayBerneForceKernel() {
     if (ixn != NULL)
         delete ixn;
@@ -31,6 +31,7 @@ using namespace std;
 
 CpuLangevinDynamics::CpuLangevinDynamics(int numberOfAtoms, double deltaT, double friction, double temperature, ThreadPool& threads, CpuRandom& random) : 
            ReferenceStochasticDynamics(numberOfAtoms, deltaT, friction, temperature), threads(threads), random(random) {
+    threadNoise.resize(threads.getNumThreads());
 }
 
 CpuLangevinDynamics::~CpuLangevinDynamics() {
@@ -49,8 +50,7 @@ void CpuLangevinDynamics::updatePart1(int numberOfAtoms, vector<Vec3>& atomCoord
     
     // Signal the threads to start running and wait for them to finish.
     
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadUpdate1(threadIndex); });
-    threads.waitForThreads();
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadUpdate1(threadIndex); });
 }
 
 void CpuLangevinDynamics::updatePart2(int numberOfAtoms, vector<Vec3>& atomCoordinates, vector<Vec3>& velocities,
@@ -66,8 +66,7 @@ void CpuLangevinDynamics::updatePart2(int numberOfAtoms, vector<Vec3>& atomCoord
     
     // Signal the threads to start running and wait for them to finish.
     
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadUpdate2(threadIndex); });
-    threads.waitForThreads();
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadUpdate2(threadIndex); });
 }
 
 void CpuLangevinDynamics::updatePart3(int numberOfAtoms, vector<Vec3>& atomCoordinates, vector<Vec3>& velocities,
@@ -82,8 +81,7 @@ void CpuLangevinDynamics::updatePart3(int numberOfAtoms, vector<Vec3>& atomCoord
     
     // Signal the threads to start running and wait for them to finish.
     
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadUpdate3(threadIndex); });
-    threads.waitForThreads();
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadUpdate3(threadIndex); });
 }
 
 void CpuLangevinDynamics::threadUpdate1(int threadIndex) {
@@ -95,11 +93,15 @@ void CpuLangevinDynamics::threadUpdate1(int threadIndex) {
     const double noisescale = sqrt(kT*(1-vscale*vscale));
     int start = threadIndex*numberOfAtoms/threads.getNumThreads();
     int end = (threadIndex+1)*numberOfAtoms/threads.getNumThreads();
+    vector<float>& noiseValues = threadNoise[threadIndex];
+    noiseValues.resize(3*(end-start));
+    random.getGaussianRandoms(threadIndex, noiseValues.data(), noiseValues.size());
 
     for (int i = start; i < end; i++) {
         if (inverseMasses[i] != 0.0) {
             double sqrtInvMass = sqrt(inverseMasses[i]);
-            Vec3 noise(random.getGaussianRandom(threadIndex), random.getGaussianRandom(threadIndex), random.getGaussianRandom(threadIndex));
+            const float* n = &noiseValues[3*(i-start)];
+            Vec3 noise(n[0], n[1], n[2]);
             velocities[i]  = velocities[i]*vscale + forces[i]*(fscale*inverseMasses[i]) + noise*(noisescale*sqrtInvMass);
         }
    }
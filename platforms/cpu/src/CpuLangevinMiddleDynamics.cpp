@@ -24,15 +24,120 @@
 
 #include "SimTKOpenMMUtilities.h"
 #include "CpuLangevinMiddleDynamics.h"
+#include "CpuSETTLE.h"
+#include "ReferenceConstraints.h"
+#include "ReferencePlatform.h"
+#include "ReferenceVirtualSites.h"
+#include "openmm/internal/ContextImpl.h"
+#include <algorithm>
 
 using namespace OpenMM;
 using namespace std;
 
 CpuLangevinMiddleDynamics::CpuLangevinMiddleDynamics(int numberOfAtoms, double deltaT, double friction, double temperature, ThreadPool& threads, CpuRandom& random) : 
-           ReferenceLangevinMiddleDynamics(numberOfAtoms, deltaT, friction, temperature), threads(threads), random(random) {
+           ReferenceLangevinMiddleDynamics(numberOfAtoms, deltaT, friction, temperature), threads(threads), random(random), hasInitializedFusedStep(false) {
+    threadNoise.resize(threads.getNumThreads());
 }
 
 CpuLangevinMiddleDynamics::~CpuLangevinMiddleDynamics() {
+    for (auto settle : threadSettle)
+        if (settle != NULL)
+            delete settle;
+}
+
+void CpuLangevinMiddleDynamics::initializeFusedStep(ContextImpl& context) {
+    // The fused step can only be used if every constraint is part of a SETTLE cluster.
+
+    hasInitializedFusedStep = true;
+    useFusedStep = false;
+    CpuSETTLE* settle = NULL;
+    ReferenceConstraintAlgorithm* algorithm = getReferenceConstraintAlgorithm();
+    if (algorithm != NULL) {
+        ReferenceConstraints* constraints = dynamic_cast<ReferenceConstraints*>(algorithm);
+        if (constraints == NULL || constraints->ccma != NULL)
+            return;
+        if (constraints->settle != NULL) {
+            settle = dynamic_cast<CpuSETTLE*>(constraints->settle);
+            if (settle == NULL)
+                return;
+        }
+    }
+    useFusedStep = true;
+    const System& system = context.getSystem();
+    int numAtoms = system.getNumParticles();
+    int numThreads = threads.getNumThreads();
+    vector<int> atom1, atom2, atom3;
+    vector<double> distance1, distance2;
+    if (settle != NULL)
+        settle->getClusterParameters(atom1, atom2, atom3, distance1, distance2);
+    int numClusters = atom1.size();
+
+    // Find the atoms a thread's range is allowed to start at: those for which no cluster contains atoms on both sides.
+
+    vector<int> spanningClusters(numAtoms+2, 0);
+    for (int i = 0; i < numClusters; i++) {
+        int first = min(atom1[i], min(atom2[i], atom3[i]));
+        int last = max(atom1[i], max(atom2[i], atom3[i]));
+        spanningClusters[first+1]++;
+        spanningClusters[last+1]--;
+    }
+    for (int i = 1; i <= numAtoms; i++)
+        spanningClusters[i] += spanningClusters[i-1];
+    threadAtomStart.resize(numThreads+1);
+    threadAtomStart[0] = 0;
+    for (int i = 1; i < numThreads; i++) {
+        int start = max(threadAtomStart[i-1], (int) ((long long) i*numAtoms/numThreads));
+        while (spanningClusters[start] != 0)
+            start++;
+        threadAtomStart[i] = start;
+    }
+    threadAtomStart[numThreads] = numAtoms;
+
+    // Give each thread the clusters whose atoms it owns.
+
+    vector<vector<int> > threadAtom1(numThreads), threadAtom2(numThreads), threadAtom3(numThreads);
+    vector<vector<double> > threadDistance1(numThreads), threadDistance2(numThreads);
+    for (int i = 0; i < numClusters; i++) {
+        int thread = upper_bound(threadAtomStart.begin(), threadAtomStart.end(), atom1[i])-threadAtomStart.begin()-1;
+        threadAtom1[thread].push_back(atom1[i]);
+        threadAtom2[thread].push_back(atom2[i]);
+        threadAtom3[thread].push_back(atom3[i]);
+        threadDistance1[thread].push_back(distance1[i]);
+        threadDistance2[thread].push_back(distance2[i]);
+    }
+    vector<double> masses(numAtoms);
+    for (int i = 0; i < numAtoms; i++)
+        masses[i] = system.getParticleMass(i);
+    threadSettle.resize(numThreads, NULL);
+    for (int i = 0; i < numThreads; i++)
+        if (threadAtom1[i].size() > 0)
+            threadSettle[i] = new ReferenceSETTLEAlgorithm(threadAtom1[i], threadAtom2[i], threadAtom3[i], threadDistance1[i], threadDistance2[i], masses);
+}
+
+void CpuLangevinMiddleDynamics::update(ContextImpl& context, vector<Vec3>& atomCoordinates, vector<Vec3>& velocities, vector<double>& masses, double tolerance) {
+    if (!hasInitializedFusedStep)
+        initializeFusedStep(context);
+    if (!useFusedStep) {
+        ReferenceLangevinMiddleDynamics::update(context, atomCoordinates, velocities, masses, tolerance);
+        return;
+    }
+    int numberOfAtoms = context.getSystem().getNumParticles();
+    if (getTimeStep() == 0) {
+        // Invert masses
+
+        vector<double>& inverseMasses = ReferenceLangevinMiddleDynamics::inverseMasses;
+        for (int i = 0; i < numberOfAtoms; i++) {
+            if (masses[i] == 0.0)
+                inverseMasses[i] = 0.0;
+            else
+                inverseMasses[i] = 1.0/masses[i];
+        }
+    }
+    ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    vector<Vec3>& forces = *data->forces;
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadUpdateFused(threadIndex, atomCoordinates, velocities, forces, tolerance); });
+    ReferenceVirtualSites::computePositions(context.getSystem(), atomCoordinates);
+    incrementTimeStep();
 }
 
 void CpuLangevinMiddleDynamics::updatePart1(int numberOfAtoms, vector<Vec3>& velocities, vector<Vec3>& forces, vector<double>& inverseMasses) {
@@ -45,8 +150,7 @@ void CpuLangevinMiddleDynamics::updatePart1(int numberOfAtoms, vector<Vec3>& vel
     
     // Signal the threads to start running and wait for them to finish.
     
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadUpdate1(threadIndex); });
-    threads.waitForThreads();
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadUpdate1(threadIndex); });
 }
 
 void CpuLangevinMiddleDynamics::updatePart2(int numberOfAtoms, vector<Vec3>& atomCoordinates, vector<Vec3>& velocities,
@@ -61,8 +165,7 @@ void CpuLangevinMiddleDynamics::updatePart2(int numberOfAtoms, vector<Vec3>& ato
     
     // Signal the threads to start running and wait for them to finish.
     
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadUpdate2(threadIndex); });
-    threads.waitForThreads();
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadUpdate2(threadIndex); });
 }
 
 void CpuLangevinMiddleDynamics::updatePart3(ContextImpl& context, int numberOfAtoms, vector<Vec3>& atomCoordinates, vector<Vec3>& velocities,
@@ -77,8 +180,7 @@ void CpuLangevinMiddleDynamics::updatePart3(ContextImpl& context, int numberOfAt
     
     // Signal the threads to start running and wait for them to finish.
     
-    threads.execute([&] (ThreadPool& threads, int threadIndex) { threadUpdate3(threadIndex); });
-    threads.waitForThreads();
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadUpdate3(threadIndex); });
 }
 
 void CpuLangevinMiddleDynamics::threadUpdate1(int threadIndex) {
@@ -98,11 +200,15 @@ void CpuLangevinMiddleDynamics::threadUpdate2(int threadIndex) {
     const double noisescale = sqrt(1-vscale*vscale);
     int start = threadIndex*numberOfAtoms/threads.getNumThreads();
     int end = (threadIndex+1)*numberOfAtoms/threads.getNumThreads();
+    vector<float>& noiseValues = threadNoise[threadIndex];
+    noiseValues.resize(3*(end-start));
+    random.getGaussianRandoms(threadIndex, noiseValues.data(), noiseValues.size());
 
     for (int i = start; i < end; i++) {
         if (inverseMasses[i] != 0.0) {
             xPrime[i] = atomCoordinates[i] + velocities[i]*halfdt;
-            Vec3 noise(random.getGaussianRandom(threadIndex), random.getGaussianRandom(threadIndex), random.getGaussianRandom(threadIndex));
+            const float* n = &noiseValues[3*(i-start)];
+            Vec3 noise(n[0], n[1], n[2]);
             velocities[i] = vscale*velocities[i] + noisescale*sqrt(kT*inverseMasses[i])*noise;
             xPrime[i] = xPrime[i] + velocities[i]*halfdt;
             oldx[i] = xPrime[i];
@@ -120,3 +226,47 @@ void CpuLangevinMiddleDynamics::threadUpdate3(int threadIndex) {
             atomCoordinates[i] = xPrime[i];
         }
 }
+
+void CpuLangevinMiddleDynamics::threadUpdateFused(int threadIndex, vector<Vec3>& atomCoordinates, vector<Vec3>& velocities, vector<Vec3>& forces, double tolerance) {
+    const double dt = getDeltaT();
+    const double halfdt = 0.5*dt;
+    const double kT = BOLTZ*getTemperature();
+    const double vscale = exp(-dt*getFriction());
+    const double noisescale = sqrt(1-vscale*vscale);
+    int start = threadAtomStart[threadIndex];
+    int end = threadAtomStart[threadIndex+1];
+    ReferenceSETTLEAlgorithm* settle = threadSettle[threadIndex];
+    vector<double>& inverseMasses = ReferenceLangevinMiddleDynamics::inverseMasses;
+    vector<Vec3>& xPrime = ReferenceLangevinMiddleDynamics::xPrime;
+
+    // Every constraint involving this thread's atoms is applied by its own SETTLE object, so none of these
+    // stages needs to wait for other threads.
+
+    for (int i = start; i < end; i++)
+        if (inverseMasses[i] != 0.0)
+            velocities[i] += (dt*inverseMasses[i])*forces[i];
+    if (settle != NULL)
+        settle->applyToVelocities(atomCoordinates, velocities, inverseMasses, tolerance);
+    vector<float>& noiseValues = threadNoise[threadIndex];
+    noiseValues.resize(3*(end-start));
+    random.getGaussianRandoms(threadIndex, noiseValues.data(), noiseValues.size());
+    for (int i = start; i < end; i++) {
+        if (inverseMasses[i] != 0.0) {
+            const float* n = &noiseValues[3*(i-start)];
+            Vec3 noise(n[0], n[1], n[2]);
+            Vec3 v = velocities[i];
+            Vec3 x = atomCoordinates[i] + v*halfdt;
+            v = vscale*v + noisescale*sqrt(kT*inverseMasses[i])*noise;
+            velocities[i] = v;
+            xPrime[i] = x + v*halfdt;
+            oldx[i] = xPrime[i];
+        }
+    }
+    if (settle != NULL)
+        settle->apply(atomCoordinates, xPrime, inverseMasses, tolerance);
+    for (int i = start; i < end; i++)
+        if (inverseMasses[i] != 0.0) {
+            velocities[i] += (xPrime[i]-oldx[i])/dt;
+            atomCoordinates[i] = xPrime[i];
+        }
+}
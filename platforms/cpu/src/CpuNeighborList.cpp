@@ -164,8 +164,9 @@ public:
         return VoxelIndex(y, z);
     }
         
-    void getNeighbors(vector<int>& neighbors, int blockIndex, const fvec4& blockCenter, const fvec4& blockWidth, const vector<int>& sortedAtoms, vector<CpuNeighborList::BlockExclusionMask>& exclusions, float maxDistance, const vector<int>& blockAtoms, const vector<float>& blockAtomX, const vector<float>& blockAtomY, const vector<float>& blockAtomZ, const vector<float>& sortedPositions, const vector<VoxelIndex>& atomVoxelIndex) const {
+    void getNeighbors(vector<int>& neighbors, vector<int>& sortedNeighbors, int blockIndex, const fvec4& blockCenter, const fvec4& blockWidth, const vector<int>& sortedAtoms, vector<CpuNeighborList::BlockExclusionMask>& exclusions, float maxDistance, const vector<int>& blockAtoms, const vector<float>& blockAtomX, const vector<float>& blockAtomY, const vector<float>& blockAtomZ, const vector<float>& sortedPositions, const vector<VoxelIndex>& atomVoxelIndex) const {
         neighbors.resize(0);
+        sortedNeighbors.resize(0);
         exclusions.resize(0);
         fvec4 boxSize(periodicBoxSize[0], periodicBoxSize[1], periodicBoxSize[2], 0);
         fvec4 invBoxSize(recipBoxSize[0], recipBoxSize[1], recipBoxSize[2], 0);
@@ -385,6 +386,7 @@ public:
                         // Add this atom to the list of neighbors.
                         
                         neighbors.push_back(sortedAtoms[sortedIndex]);
+                        sortedNeighbors.push_back(sortedIndex);
                         if (sortedIndex < blockSize*blockIndex)
                             exclusions.push_back(0);
                         else {
@@ -409,13 +411,15 @@ private:
     vector<vector<vector<pair<float, int> > > > bins;
 };
 
-CpuNeighborList::CpuNeighborList(int blockSize) : blockSize(blockSize) {
+CpuNeighborList::CpuNeighborList(int blockSize) : blockSize(blockSize), numBuilds(0) {
 }
 
 void CpuNeighborList::computeNeighborList(int numAtoms, const AlignedArray<float>& atomLocations, const vector<set<int> >& exclusions,
             const Vec3* periodicBoxVectors, bool usePeriodic, float maxDistance, ThreadPool& threads) {
     int numBlocks = (numAtoms+blockSize-1)/blockSize;
+    numBuilds++;
     blockNeighbors.resize(numBlocks);
+    blockSortedNeighbors.resize(numBlocks);
     blockExclusions.resize(numBlocks);
     sortedAtoms.resize(numAtoms);
     sortedPositions.resize(4*numAtoms);
@@ -476,7 +480,7 @@ void CpuNeighborList::computeNeighborList(int numAtoms, const AlignedArray<float
 
     // Signal the threads to start running and wait for them to finish.
     
-    atomicCounter = 0;
+    workQueue.reset(threads, numBlocks);
     threads.resumeThreads();
     threads.waitForThreads();
     
@@ -509,6 +513,14 @@ const std::vector<int>& CpuNeighborList::getBlockNeighbors(int blockIndex) const
     return blockNeighbors[blockIndex];
 }
 
+const std::vector<int>& CpuNeighborList::getBlockSortedNeighbors(int blockIndex) const {
+    return blockSortedNeighbors[blockIndex];
+}
+
+int CpuNeighborList::getNumBuilds() const {
+    return numBuilds;
+}
+
 const std::vector<CpuNeighborList::BlockExclusionMask>& CpuNeighborList::getBlockExclusions(int blockIndex) const {
     return blockExclusions[blockIndex];
     
@@ -537,11 +549,8 @@ void CpuNeighborList::threadComputeNeighborList(ThreadPool& threads, int threadI
     vector<int> blockAtoms;
     vector<float> blockAtomX(blockSize), blockAtomY(blockSize), blockAtomZ(blockSize);
     vector<VoxelIndex> atomVoxelIndex;
-    while (true) {
-        int i = atomicCounter++;
-        if (i >= numBlocks)
-            break;
-
+    int i;
+    while (workQueue.getNextItem(threadIndex, i)) {
         // Find the atoms in this block and compute their bounding box.
         
         int firstIndex = blockSize*i;
@@ -569,7 +578,7 @@ void CpuNeighborList::threadComputeNeighborList(ThreadPool& threads, int threadI
             blockAtomY[j] = 1e10;
             blockAtomZ[j] = 1e10;
         }
-        voxels->getNeighbors(blockNeighbors[i], i, (maxPos+minPos)*0.5f, (maxPos-minPos)*0.5f, sortedAtoms, blockExclusions[i], maxDistance, blockAtoms, blockAtomX, blockAtomY, blockAtomZ, sortedPositions, atomVoxelIndex);
+        voxels->getNeighbors(blockNeighbors[i], blockSortedNeighbors[i], i, (maxPos+minPos)*0.5f, (maxPos-minPos)*0.5f, sortedAtoms, blockExclusions[i], maxDistance, blockAtoms, blockAtomX, blockAtomY, blockAtomZ, sortedPositions, atomVoxelIndex);
 
         // Record the exclusions for this block.
 
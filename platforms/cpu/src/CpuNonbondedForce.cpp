@@ -22,7 +22,6 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include <complex>
 
 #include "SimTKOpenMMUtilities.h"
 #include "CpuNonbondedForce.h"
@@ -48,7 +47,8 @@ const int CpuNonbondedForce::NUM_TABLE_POINTS = 2048;
    --------------------------------------------------------------------------------------- */
 
 CpuNonbondedForce::CpuNonbondedForce() : cutoff(false), useSwitch(false), periodic(false), periodicExceptions(false), ewald(false), pme(false), ljpme(false), tableIsValid(false), expTableIsValid(false),
-    cutoffDistance(0.0f), alphaDispersionEwald(0.0f), alphaEwald(0.0f) {
+    cutoffDistance(0.0f), alphaDispersionEwald(0.0f), alphaEwald(0.0f), sortedNeighborListBuild(0), sortedParametersValid(false),
+    threadFixedForce(NULL), fixedPointScale(0.0) {
 }
 
 CpuNonbondedForce::~CpuNonbondedForce() {
@@ -206,6 +206,15 @@ void CpuNonbondedForce::setPeriodicExceptions(bool periodic) {
     periodicExceptions = periodic;
 }
 
+void CpuNonbondedForce::setFixedPointForces(vector<vector<long long> >* threadFixedForce, double scale) {
+    this->threadFixedForce = threadFixedForce;
+    fixedPointScale = scale;
+}
+
+void CpuNonbondedForce::setParametersChanged() {
+    sortedParametersValid = false;
+}
+
 void CpuNonbondedForce::tabulateEwaldScaleFactor() {
     if (tableIsValid)
         return;
@@ -245,9 +254,7 @@ void CpuNonbondedForce::tabulateExpTerms() {
 
 void CpuNonbondedForce::calculateReciprocalIxn(int numberOfAtoms, float* posq, const vector<Vec3>& atomCoordinates,
                                                const vector<pair<float, float> >& atomParameters, const vector<float> &C6params, const vector<set<int> >& exclusions,
-                                               vector<Vec3>& forces, double* totalEnergy) const {
-    typedef std::complex<float> d_complex;
-
+                                               vector<Vec3>& forces, double* totalEnergy, ThreadPool& threads, bool includeForces) const {
     static const float epsilon     =  1.0;
 
     int kmax                       = (ewald ? max(numRx, max(numRy,numRz)) : 0);
@@ -299,87 +306,164 @@ void CpuNonbondedForce::calculateReciprocalIxn(int numberOfAtoms, float* posq, c
 
         float recipBoxSize[3] = {(float) (TWO_PI/periodicBoxVectors[0][0]), (float) (TWO_PI/periodicBoxVectors[1][1]), (float) (TWO_PI/periodicBoxVectors[2][2])};
 
+        // Enumerate the k-vectors.  Each task is one (rx, ry) pair and loops over all values of rz,
+        // so the product of the x and y tables is only computed once per task.
+
+        vector<int> taskRx, taskRy, taskFirstK;
+        int numK = 0;
+        for (int rx = 0; rx < numRx; rx++)
+            for (int ry = (rx == 0 ? 0 : 1-numRy); ry < numRy; ry++) {
+                taskRx.push_back(rx);
+                taskRy.push_back(ry);
+                taskFirstK.push_back(numK);
+                numK += numRz-(rx == 0 && ry == 0 ? 1 : 1-numRz);
+            }
+        int numTasks = taskRx.size();
+        vector<float> structureReal(numK), structureImag(numK), kScale(numK);
 
-        // setup K-vectors
-
-#define EIR(x, y, z) eir[(x)*numberOfAtoms*3+(y)*3+z]
-        vector<d_complex> eir(kmax*numberOfAtoms*3);
-        vector<d_complex> tab_xy(numberOfAtoms);
-        vector<d_complex> tab_qxyz(numberOfAtoms);
-
-        for (int i = 0; (i < numberOfAtoms); i++) {
-            float* pos = posq+4*i;
-            for (int m = 0; (m < 3); m++)
-                EIR(0, i, m) = d_complex(1,0);
-
-            for (int m=0; (m<3); m++)
-                EIR(1, i, m) = d_complex(cos(pos[m]*recipBoxSize[m]),
-                                         sin(pos[m]*recipBoxSize[m]));
-
-            for (int j=2; (j<kmax); j++)
-                for (int m=0; (m<3); m++)
-                    EIR(j, i, m) = EIR(j-1, i, m) * EIR(1, i, m);
-        }
-
-        // calculate reciprocal space energy and forces
-
-        int lowry = 0;
-        int lowrz = 1;
+        // The tables of exp(i*k*x) store real and imaginary parts separately, with atoms contiguous,
+        // so everything can be computed for four atoms at a time.  Padding atoms have zero charge.
 
-        for (int rx = 0; rx < numRx; rx++) {
-            float kx = rx * recipBoxSize[0];
-            for (int ry = lowry; ry < numRy; ry++) {
-                float ky = ry * recipBoxSize[1];
-                if (ry >= 0) {
-                    for (int n = 0; n < numberOfAtoms; n++)
-                        tab_xy[n] = EIR(rx, n, 0) * EIR(ry, n, 1);
-                }
-                else {
-                    for (int n = 0; n < numberOfAtoms; n++)
-                        tab_xy[n]= EIR(rx, n, 0) * conj (EIR(-ry, n, 1));
-                }
-                for (int rz = lowrz; rz < numRz; rz++) {
-                    if (rz >= 0) {
-                        for (int n = 0; n < numberOfAtoms; n++)
-                            tab_qxyz[n] = posq[4*n+3] * (tab_xy[n] * EIR(rz, n, 2));
+        int paddedNumAtoms = 4*((numberOfAtoms+3)/4);
+        AlignedArray<float> eirReal(kmax*3*paddedNumAtoms), eirImag(kmax*3*paddedNumAtoms), charges(paddedNumAtoms);
+        auto eirIndex = [&] (int k, int axis) { return (k*3+axis)*paddedNumAtoms; };
+        int numThreads = threads.getNumThreads();
+        atomic<int> counter(0);
+        threads.execute([&] (ThreadPool& threads, int threadIndex) {
+            // Build the tables, giving each thread a contiguous range of atoms.
+
+            int numGroups = paddedNumAtoms/4;
+            int start = 4*(numGroups*threadIndex/numThreads);
+            int end = 4*(numGroups*(threadIndex+1)/numThreads);
+            for (int i = start; i < end; i += 4) {
+                for (int j = 0; j < 4; j++)
+                    charges[i+j] = (i+j < numberOfAtoms ? posq[4*(i+j)+3] : 0.0f);
+                for (int m = 0; m < 3; m++) {
+                    float c[4], s[4];
+                    for (int j = 0; j < 4; j++) {
+                        float angle = (i+j < numberOfAtoms ? posq[4*(i+j)+m]*recipBoxSize[m] : 0.0f);
+                        c[j] = cos(angle);
+                        s[j] = sin(angle);
                     }
-                    else {
-                        for (int n = 0; n < numberOfAtoms; n++)
-                            tab_qxyz[n] = posq[4*n+3] * (tab_xy[n] * conj(EIR(-rz, n, 2)));
+                    fvec4 re1(c), im1(s);
+                    fvec4 re(1.0f), im(0.0f);
+                    for (int k = 0; k < kmax; k++) {
+                        re.store(&eirReal[eirIndex(k, m)+i]);
+                        im.store(&eirImag[eirIndex(k, m)+i]);
+                        fvec4 nextRe = re*re1 - im*im1;
+                        im = re*im1 + im*re1;
+                        re = nextRe;
                     }
-                    float cs = 0.0f;
-                    float ss = 0.0f;
-
-                    for (int n = 0; n < numberOfAtoms; n++) {
-                        cs += tab_qxyz[n].real();
-                        ss += tab_qxyz[n].imag();
+                }
+            }
+            threads.syncThreads();
+
+            // Compute the structure factor for each k-vector.
+
+            AlignedArray<float> xyReal(paddedNumAtoms), xyImag(paddedNumAtoms);
+            while (true) {
+                int task = counter++;
+                if (task >= numTasks)
+                    break;
+                int rx = taskRx[task];
+                int ry = taskRy[task];
+                const float* xReal = &eirReal[eirIndex(rx, 0)];
+                const float* xImag = &eirImag[eirIndex(rx, 0)];
+                const float* yReal = &eirReal[eirIndex(abs(ry), 1)];
+                const float* yImag = &eirImag[eirIndex(abs(ry), 1)];
+                float ySign = (ry < 0 ? -1.0f : 1.0f);
+                for (int i = 0; i < paddedNumAtoms; i += 4) {
+                    fvec4 ar(xReal+i), ai(xImag+i), br(yReal+i);
+                    fvec4 bi = ySign*fvec4(yImag+i);
+                    (ar*br - ai*bi).store(&xyReal[i]);
+                    (ar*bi + ai*br).store(&xyImag[i]);
+                }
+                float kx = rx * recipBoxSize[0];
+                float ky = ry * recipBoxSize[1];
+                int k = taskFirstK[task];
+                for (int rz = (rx == 0 && ry == 0 ? 1 : 1-numRz); rz < numRz; rz++, k++) {
+                    const float* zReal = &eirReal[eirIndex(abs(rz), 2)];
+                    const float* zImag = &eirImag[eirIndex(abs(rz), 2)];
+                    float zSign = (rz < 0 ? -1.0f : 1.0f);
+                    fvec4 cs(0.0f), ss(0.0f);
+                    for (int i = 0; i < paddedNumAtoms; i += 4) {
+                        fvec4 ar(&xyReal[i]), ai(&xyImag[i]), br(zReal+i);
+                        fvec4 bi = zSign*fvec4(zImag+i);
+                        fvec4 q(&charges[i]);
+                        cs += q*(ar*br - ai*bi);
+                        ss += q*(ar*bi + ai*br);
                     }
-
+                    structureReal[k] = reduceAdd(cs);
+                    structureImag[k] = reduceAdd(ss);
                     float kz = rz * recipBoxSize[2];
                     float k2 = kx * kx + ky * ky + kz * kz;
-                    float ak = exp(k2*factorEwald) / k2;
-
-                    for (int n = 0; n < numberOfAtoms; n++) {
-                        float force = ak * (cs * tab_qxyz[n].imag() - ss * tab_qxyz[n].real());
-                        forces[n][0] += 2 * recipCoeff * force * kx;
-                        forces[n][1] += 2 * recipCoeff * force * ky;
-                        forces[n][2] += 2 * recipCoeff * force * kz;
+                    kScale[k] = exp(k2*factorEwald) / k2;
+                }
+            }
+            if (!includeForces)
+                return;
+            threads.syncThreads();
+
+            // Compute the forces.  Each thread handles the same atoms it built tables for.
+
+            for (int i = start; i < end; i += 4) {
+                fvec4 q(&charges[i]);
+                fvec4 fx(0.0f), fy(0.0f), fz(0.0f);
+                for (int task = 0; task < numTasks; task++) {
+                    int rx = taskRx[task];
+                    int ry = taskRy[task];
+                    fvec4 ar(&eirReal[eirIndex(rx, 0)+i]), ai(&eirImag[eirIndex(rx, 0)+i]), br(&eirReal[eirIndex(abs(ry), 1)+i]);
+                    fvec4 bi = (ry < 0 ? -1.0f : 1.0f)*fvec4(&eirImag[eirIndex(abs(ry), 1)+i]);
+                    fvec4 xyr = ar*br - ai*bi;
+                    fvec4 xyi = ar*bi + ai*br;
+                    float kx = rx * recipBoxSize[0];
+                    float ky = ry * recipBoxSize[1];
+                    int k = taskFirstK[task];
+                    for (int rz = (rx == 0 && ry == 0 ? 1 : 1-numRz); rz < numRz; rz++, k++) {
+                        fvec4 zr(&eirReal[eirIndex(abs(rz), 2)+i]);
+                        fvec4 zi = (rz < 0 ? -1.0f : 1.0f)*fvec4(&eirImag[eirIndex(abs(rz), 2)+i]);
+                        fvec4 qReal = q*(xyr*zr - xyi*zi);
+                        fvec4 qImag = q*(xyr*zi + xyi*zr);
+                        fvec4 force = kScale[k]*(structureReal[k]*qImag - structureImag[k]*qReal);
+                        float kz = rz * recipBoxSize[2];
+                        fx += force*kx;
+                        fy += force*ky;
+                        fz += force*kz;
                     }
-
-                    if (totalEnergy)
-                        *totalEnergy += recipCoeff * ak * (cs * cs + ss * ss);
-
-                    lowrz = 1 - numRz;
                 }
-                lowry = 1 - numRy;
+                for (int j = 0; j < 4 && i+j < numberOfAtoms; j++) {
+                    forces[i+j][0] += 2 * recipCoeff * fx[j];
+                    forces[i+j][1] += 2 * recipCoeff * fy[j];
+                    forces[i+j][2] += 2 * recipCoeff * fz[j];
+                }
             }
+        });
+        threads.waitForThreads();
+        threads.resumeThreads();
+        threads.waitForThreads();
+        if (includeForces) {
+            threads.resumeThreads();
+            threads.waitForThreads();
+        }
+
+        // calculate reciprocal space energy
+
+        if (totalEnergy) {
+            double energy = 0.0;
+            for (int k = 0; k < numK; k++)
+                energy += kScale[k] * (structureReal[k] * structureReal[k] + structureImag[k] * structureImag[k]);
+            *totalEnergy += recipCoeff * energy;
         }
     }
 }
 
 
 void CpuNonbondedForce::calculateDirectIxn(int numberOfAtoms, float* posq, const vector<Vec3>& atomCoordinates, const vector<pair<float, float> >& atomParameters,
-                                           const vector<float>& C6params, const vector<set<int> >& exclusions, vector<AlignedArray<float> >& threadForce, double* totalEnergy, ThreadPool& threads) {
+                                           const vector<float>& C6params, const vector<set<int> >& exclusions, vector<AlignedArray<float> >& threadForce, double* totalEnergy, ThreadPool& threads,
+                                           bool includeForces) {
+    if (!includeForces && totalEnergy == NULL)
+        return;
+
     // Record the parameters for the threads.
     
     this->numberOfAtoms = numberOfAtoms;
@@ -390,8 +474,47 @@ void CpuNonbondedForce::calculateDirectIxn(int numberOfAtoms, float* posq, const
     this->exclusions = &exclusions[0];
     this->threadForce = &threadForce;
     includeEnergy = (totalEnergy != NULL);
+    this->includeForces = includeForces;
     threadEnergy.resize(threads.getNumThreads());
-    atomicCounter = 0;
+    if (threadFixedForce != NULL && totalEnergy != NULL) {
+        blockEnergy.resize(cutoff ? neighborList->getNumBlocks() : numberOfAtoms);
+        exclusionEnergy.resize(numberOfAtoms);
+        fill(exclusionEnergy.begin(), exclusionEnergy.end(), 0.0);
+    }
+    if (threadFixedForce != NULL && includeForces && threadScratchForce.size() != threads.getNumThreads())
+        threadScratchForce.resize(threads.getNumThreads());
+    if (cutoff) {
+        // Copy the positions into sorted order.  If the neighbor list has been rebuilt or the parameters
+        // have changed, copy the parameters as well.
+
+        const vector<int32_t>& sortedAtoms = neighborList->getSortedAtoms();
+        int numSorted = sortedAtoms.size();
+        bool sortParameters = (!sortedParametersValid || sortedNeighborListBuild != neighborList->getNumBuilds());
+        sortedPosq.resize(4*numSorted);
+        if (sortParameters) {
+            sortedSigma.resize(numSorted);
+            sortedEpsilon.resize(numSorted);
+            if (ljpme)
+                sortedC6params.resize(numSorted);
+        }
+        threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+            int start = threadIndex*numSorted/threads.getNumThreads();
+            int end = (threadIndex+1)*numSorted/threads.getNumThreads();
+            for (int i = start; i < end; i++)
+                fvec4(posq+4*sortedAtoms[i]).store(&sortedPosq[4*i]);
+            if (sortParameters)
+                for (int i = start; i < end; i++) {
+                    int atom = sortedAtoms[i];
+                    sortedSigma[i] = atomParameters[atom].first;
+                    sortedEpsilon[i] = atomParameters[atom].second;
+                    if (ljpme)
+                        sortedC6params[i] = C6params[atom];
+                }
+        });
+        sortedNeighborListBuild = neighborList->getNumBuilds();
+        sortedParametersValid = true;
+    }
+    workQueue.reset(threads, cutoff ? neighborList->getNumBlocks() : numberOfAtoms);
     
     // Signal the threads to start running and wait for them to finish.
     
@@ -401,7 +524,7 @@ void CpuNonbondedForce::calculateDirectIxn(int numberOfAtoms, float* posq, const
     // Signal the threads to subtract the exclusions.
     
     if (ewald || pme) {
-        atomicCounter = 0;
+        workQueue.reset(threads, numberOfAtoms, max(1, numberOfAtoms/(10*threads.getNumThreads())));
         threads.resumeThreads();
         threads.waitForThreads();
     }
@@ -411,8 +534,17 @@ void CpuNonbondedForce::calculateDirectIxn(int numberOfAtoms, float* posq, const
     if (totalEnergy != NULL) {
         double directEnergy = 0;
         int numThreads = threads.getNumThreads();
-        for (int i = 0; i < numThreads; i++)
-            directEnergy += threadEnergy[i];
+        if (threadFixedForce != NULL) {
+            for (double energy : blockEnergy)
+                directEnergy += energy;
+            if (ewald || pme || ljpme)
+                for (double energy : exclusionEnergy)
+                    directEnergy += energy;
+        }
+        else {
+            for (int i = 0; i < numThreads; i++)
+                directEnergy += threadEnergy[i];
+        }
         *totalEnergy += directEnergy;
     }
 }
@@ -424,26 +556,60 @@ void CpuNonbondedForce::threadComputeDirect(ThreadPool& threads, int threadIndex
     threadEnergy[threadIndex] = 0;
     double* energyPtr = (includeEnergy ? &threadEnergy[threadIndex] : NULL);
     float* forces = &(*threadForce)[threadIndex][0];
+
+    // In fixed point mode, each block or atom is computed in single precision starting from zero, then its
+    // forces are converted and added to the fixed point arrays and its energy is recorded separately, so the
+    // result does not depend on the order of work.
+
+    bool fixedPoint = (threadFixedForce != NULL);
+    long long* fixedForces = (fixedPoint && includeForces ? &(*threadFixedForce)[threadIndex][0] : NULL);
+    double itemEnergy = 0;
+    double* itemEnergyPtr = (fixedPoint && includeEnergy ? &itemEnergy : energyPtr);
     fvec4 boxSize(periodicBoxVectors[0][0], periodicBoxVectors[1][1], periodicBoxVectors[2][2], 0);
     fvec4 invBoxSize(recipBoxSize[0], recipBoxSize[1], recipBoxSize[2], 0);
-    if (ewald || pme || ljpme) {
+    float* atomForces = forces;
+    if (fixedPoint && includeForces) {
+        threadScratchForce[threadIndex].resize(4*numberOfAtoms);
+        atomForces = &threadScratchForce[threadIndex][0];
+        fill(atomForces, atomForces+4*numberOfAtoms, 0.0f);
+    }
+    if (cutoff) {
         // Compute the interactions from the neighbor list.
-        while (true) {
-            int nextBlock = atomicCounter++;
-            if (nextBlock >= neighborList->getNumBlocks())
-                break;
-            calculateBlockEwaldIxn(nextBlock, forces, energyPtr, boxSize, invBoxSize);
-        }
 
+        const vector<int32_t>& sortedAtoms = neighborList->getSortedAtoms();
+        int blockSize = neighborList->getBlockSize();
+        int nextBlock;
+        while (workQueue.getNextItem(threadIndex, nextBlock)) {
+            if (ewald || pme || ljpme)
+                calculateBlockEwaldIxn(nextBlock, atomForces, itemEnergyPtr, boxSize, invBoxSize);
+            else
+                calculateBlockIxn(nextBlock, atomForces, itemEnergyPtr, boxSize, invBoxSize);
+            if (fixedPoint) {
+                if (includeEnergy)
+                    blockEnergy[nextBlock] = itemEnergy;
+                itemEnergy = 0;
+                if (includeForces) {
+                    int end = min((nextBlock+1)*blockSize, numberOfAtoms);
+                    for (int i = nextBlock*blockSize; i < end; i++)
+                        flushFixedPointForce(atomForces, sortedAtoms[i], sortedAtoms[i], fixedForces);
+                    for (int atom : neighborList->getBlockNeighbors(nextBlock))
+                        flushFixedPointForce(atomForces, atom, atom, fixedForces);
+                }
+            }
+        }
+    }
+    if (ewald || pme || ljpme) {
         // Now subtract off the exclusions, since they were implicitly included in the reciprocal space sum.
 
         threads.syncThreads();
-        const int groupSize = max(1, numberOfAtoms/(10*numThreads));
-        while (true) {
-            int start = atomicCounter.fetch_add(groupSize);
-            if (start >= numberOfAtoms)
-                break;
-            int end = min(start+groupSize, numberOfAtoms);
+        auto addEnergy = [&] (int atom, double energy) {
+            if (fixedPoint)
+                exclusionEnergy[atom] += energy;
+            else
+                threadEnergy[threadIndex] += energy;
+        };
+        int start, end;
+        while (workQueue.getNextRange(threadIndex, start, end)) {
             for (int i = start; i < end; i++) {
                 fvec4 posI((float) atomCoordinates[i][0], (float) atomCoordinates[i][1], (float) atomCoordinates[i][2], 0.0f);
                 float scaledChargeI = (float) (ONE_4PI_EPS0*posq[4*i+3]);
@@ -460,52 +626,52 @@ void CpuNonbondedForce::threadComputeDirect(ThreadPool& threads, int threadIndex
                         if (erfAlphaR > 1e-6f) {
                             float inverseR = 1/r;
                             float chargeProdOverR = scaledChargeI*posq[4*j+3]*inverseR;
-                            float dEdR = chargeProdOverR*inverseR*inverseR;
-                            dEdR = dEdR * (erfAlphaR-TWO_OVER_SQRT_PI*alphaR*(float)exp(-alphaR*alphaR));
-                            fvec4 result = deltaR*dEdR;
-                            (fvec4(forces+4*i)-result).store(forces+4*i);
-                            (fvec4(forces+4*j)+result).store(forces+4*j);
+                            if (includeForces) {
+                                float dEdR = chargeProdOverR*inverseR*inverseR;
+                                dEdR = dEdR * (erfAlphaR-TWO_OVER_SQRT_PI*alphaR*(float)exp(-alphaR*alphaR));
+                                fvec4 result = deltaR*dEdR;
+                                addAtomForce(i, fvec4(0.0f)-result, forces, fixedForces);
+                                addAtomForce(j, result, forces, fixedForces);
+                            }
                             if (includeEnergy)
-                                threadEnergy[threadIndex] -= chargeProdOverR*erfAlphaR;
+                                addEnergy(i, -chargeProdOverR*erfAlphaR);
                         }
                         else if (includeEnergy)
-                            threadEnergy[threadIndex] -= alphaEwald*TWO_OVER_SQRT_PI*scaledChargeI*posq[4*j+3];
+                            addEnergy(i, -alphaEwald*TWO_OVER_SQRT_PI*scaledChargeI*posq[4*j+3]);
                         if (ljpme) {
                             float C6ij = C6params[i]*C6params[j];
                             float inverseR2 = 1.0f/r2;
                             float emult = C6ij*inverseR2*inverseR2*inverseR2*exptermsApprox(r);
                             if(includeEnergy)
-                                threadEnergy[threadIndex] += emult;
-                            float dEdR = -6.0f*C6ij*inverseR2*inverseR2*inverseR2*inverseR2*dExptermsApprox(r);
-                            fvec4 result = deltaR*dEdR;
-                            (fvec4(forces+4*i)-result).store(forces+4*i);
-                            (fvec4(forces+4*j)+result).store(forces+4*j);
+                                addEnergy(i, emult);
+                            if (includeForces) {
+                                float dEdR = -6.0f*C6ij*inverseR2*inverseR2*inverseR2*inverseR2*dExptermsApprox(r);
+                                fvec4 result = deltaR*dEdR;
+                                addAtomForce(i, fvec4(0.0f)-result, forces, fixedForces);
+                                addAtomForce(j, result, forces, fixedForces);
+                            }
                         }
                     }
                 }
             }
         }
     }
-    else if (cutoff) {
-        // Compute the interactions from the neighbor list.
-
-        while (true) {
-            int nextBlock = atomicCounter++;
-            if (nextBlock >= neighborList->getNumBlocks())
-                break;
-            calculateBlockIxn(nextBlock, forces, energyPtr, boxSize, invBoxSize);
-        }
-    }
-    else {
+    else if (!cutoff) {
         // Loop over all atom pairs
 
-        while (true) {
-            int i = atomicCounter++;
-            if (i >= numberOfAtoms)
-                break;
+        int i;
+        while (workQueue.getNextItem(threadIndex, i)) {
             for (int j = i+1; j < numberOfAtoms; j++)
                 if (exclusions[j].find(i) == exclusions[j].end())
-                    calculateOneIxn(i, j, forces, energyPtr, boxSize, invBoxSize);
+                    calculateOneIxn(i, j, atomForces, itemEnergyPtr, boxSize, invBoxSize);
+            if (fixedPoint) {
+                if (includeEnergy)
+                    blockEnergy[i] = itemEnergy;
+                itemEnergy = 0;
+                if (includeForces)
+                    for (int j = i; j < numberOfAtoms; j++)
+                        flushFixedPointForce(atomForces, j, j, fixedForces);
+            }
         }
     }
 }
@@ -559,6 +725,8 @@ void CpuNonbondedForce::calculateOneIxn(int ii, int jj, float* forces, double* t
 
     // accumulate forces
 
+    if (!includeForces)
+        return;
     fvec4 result = deltaR*dEdR;
     (fvec4(forces+4*ii)+result).store(forces+4*ii);
     (fvec4(forces+4*jj)-result).store(forces+4*jj);
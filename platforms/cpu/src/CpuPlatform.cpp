@@ -38,8 +38,12 @@
 #include "openmm/internal/hardware.h"
 #include "openmm/internal/vectorize.h"
 #include <algorithm>
+#include <fstream>
 #include <sstream>
 #include <stdlib.h>
+#ifdef __linux__
+    #include <sched.h>
+#endif
 
 using namespace OpenMM;
 using namespace std;
@@ -63,6 +67,7 @@ map<const ContextImpl*, CpuPlatform::PlatformData*> CpuPlatform::contextData;
 CpuPlatform::CpuPlatform() {
     deprecatedPropertyReplacements["CpuThreads"] = CpuThreads();
     CpuKernelFactory* factory = new CpuKernelFactory();
+    registerKernelFactory(UpdateStateDataKernel::Name(), factory);
     registerKernelFactory(CalcForcesAndEnergyKernel::Name(), factory);
     registerKernelFactory(CalcHarmonicAngleForceKernel::Name(), factory);
     registerKernelFactory(CalcPeriodicTorsionForceKernel::Name(), factory);
@@ -70,13 +75,22 @@ CpuPlatform::CpuPlatform() {
     registerKernelFactory(CalcNonbondedForceKernel::Name(), factory);
     registerKernelFactory(CalcCustomNonbondedForceKernel::Name(), factory);
     registerKernelFactory(CalcCustomManyParticleForceKernel::Name(), factory);
+    registerKernelFactory(CalcCustomExternalForceKernel::Name(), factory);
+    registerKernelFactory(CalcCustomHbondForceKernel::Name(), factory);
+    registerKernelFactory(CalcCustomCompoundBondForceKernel::Name(), factory);
+    registerKernelFactory(CalcCustomCentroidBondForceKernel::Name(), factory);
     registerKernelFactory(CalcGBSAOBCForceKernel::Name(), factory);
     registerKernelFactory(CalcCustomGBForceKernel::Name(), factory);
+    registerKernelFactory(CalcRMSDForceKernel::Name(), factory);
     registerKernelFactory(CalcGayBerneForceKernel::Name(), factory);
     registerKernelFactory(IntegrateLangevinStepKernel::Name(), factory);
     registerKernelFactory(IntegrateLangevinMiddleStepKernel::Name(), factory);
     platformProperties.push_back(CpuThreads());
     platformProperties.push_back(CpuDeterministicForces());
+    platformProperties.push_back(CpuTabulateCustomNonbonded());
+    platformProperties.push_back(CpuSpinWait());
+    platformProperties.push_back(CpuThreadAffinity());
+    platformProperties.push_back(CpuSharedThreadPool());
     int threads = getNumProcessors();
     char* threadsEnv = getenv("OPENMM_CPU_THREADS");
     if (threadsEnv != NULL)
@@ -85,6 +99,10 @@ CpuPlatform::CpuPlatform() {
     defaultThreads << threads;
     setPropertyDefaultValue(CpuThreads(), defaultThreads.str());
     setPropertyDefaultValue(CpuDeterministicForces(), "false");
+    setPropertyDefaultValue(CpuTabulateCustomNonbonded(), "false");
+    setPropertyDefaultValue(CpuSpinWait(), "false");
+    setPropertyDefaultValue(CpuThreadAffinity(), "none");
+    setPropertyDefaultValue(CpuSharedThreadPool(), "false");
 }
 
 const string& CpuPlatform::getPropertyValue(const Context& context, const string& property) const {
@@ -111,17 +129,149 @@ bool CpuPlatform::isProcessorSupported() {
     return isVec4Supported();
 }
 
+/**
+ * Read an integer from a file in the sysfs CPU topology directory, or return a default value if it is not available.
+ */
+static int readTopologyValue(int cpu, const string& name, int defaultValue) {
+    stringstream path;
+    path << "/sys/devices/system/cpu/cpu" << cpu << "/topology/" << name;
+    ifstream file(path.str());
+    int value;
+    if (file >> value)
+        return value;
+    return defaultValue;
+}
+
+/**
+ * Select the cores to bind threads to, based on the value of the ThreadAffinity property.  An empty
+ * list means threads should not be bound.
+ */
+static vector<int> selectThreadCores(const string& affinity) {
+    vector<int> cores;
+    if (affinity == "none" || affinity == "")
+        return cores;
+    if (affinity == "compact" || affinity == "scatter") {
+#ifdef __linux__
+        // Identify the socket and physical core of every logical processor this process may run on.
+        // Hyperthreads sharing a physical core are numbered by their rank within it.
+
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return cores;
+        vector<int> cpus, package, core;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+                package.push_back(readTopologyValue(cpu, "physical_package_id", 0));
+                core.push_back(readTopologyValue(cpu, "core_id", cpu));
+            }
+        int numCpus = cpus.size();
+        vector<int> smtRank(numCpus, 0), coreRank(numCpus, 0);
+        for (int i = 0; i < numCpus; i++)
+            for (int j = 0; j < i; j++)
+                if (package[j] == package[i] && core[j] == core[i])
+                    smtRank[i]++;
+        for (int i = 0; i < numCpus; i++)
+            for (int j = 0; j < numCpus; j++)
+                if (package[j] == package[i] && core[j] < core[i] && smtRank[j] == 0)
+                    coreRank[i]++;
+
+        // Compact fills every physical core of a socket, then their second hyperthreads, before moving to
+        // the next socket.  Scatter assigns consecutive threads to different sockets.
+
+        vector<vector<int> > keys(numCpus);
+        for (int i = 0; i < numCpus; i++) {
+            if (affinity == "compact")
+                keys[i] = {package[i], smtRank[i], coreRank[i], cpus[i]};
+            else
+                keys[i] = {smtRank[i], coreRank[i], package[i], cpus[i]};
+        }
+        sort(keys.begin(), keys.end());
+        for (auto& key : keys)
+            cores.push_back(key[3]);
+#endif
+        return cores;
+    }
+
+    // Parse an explicit list of cores and ranges of cores.
+
+    stringstream list(affinity);
+    string item;
+    while (getline(list, item, ',')) {
+        int first, last;
+        char separator;
+        stringstream itemStream(item);
+        bool valid = !(itemStream >> first).fail();
+        if (valid && !(itemStream >> ws).eof())
+            valid = (!(itemStream >> separator >> last).fail() && separator == '-' && (itemStream >> ws).eof());
+        else
+            last = first;
+        if (!valid || first < 0 || last < first)
+            throw OpenMMException("Illegal value for ThreadAffinity: "+affinity);
+        for (int i = first; i <= last; i++)
+            cores.push_back(i);
+    }
+    if (cores.size() == 0)
+        throw OpenMMException("Illegal value for ThreadAffinity: "+affinity);
+    return cores;
+}
+
+/**
+ * Create the ThreadPool for a context.  If shared is true, all contexts that request the same settings use a
+ * single pool, which is deleted when the last of them is destroyed.
+ */
+static shared_ptr<ThreadPool> createThreadPool(int numThreads, bool spinWait, const string& affinity, bool shared) {
+    vector<int> threadCores = selectThreadCores(affinity);
+    if (shared)
+        return ThreadPool::getSharedThreadPool(numThreads, spinWait, threadCores);
+    shared_ptr<ThreadPool> threads = make_shared<ThreadPool>(numThreads, spinWait);
+    threads->setThreadAffinity(threadCores);
+    return threads;
+}
+
 void CpuPlatform::contextCreated(ContextImpl& context, const map<string, string>& properties) const {
+    createPlatformData(context, properties, NULL);
+}
+
+void CpuPlatform::linkedContextCreated(ContextImpl& context, ContextImpl& originalContext) const {
+    // A linked context is only used while the original one is between parallel operations, so it can use
+    // the same threads instead of creating its own.
+
+    map<string, string> properties;
+    for (auto& name : getPropertyNames())
+        properties[name] = getPropertyValue(originalContext.getOwner(), name);
+    createPlatformData(context, properties, getPlatformData(originalContext).threadPool);
+}
+
+void CpuPlatform::createPlatformData(ContextImpl& context, const map<string, string>& properties, shared_ptr<ThreadPool> threads) const {
     ReferencePlatform::contextCreated(context, properties);
     const string& threadsPropValue = (properties.find(CpuThreads()) == properties.end() ?
             getPropertyDefaultValue(CpuThreads()) : properties.find(CpuThreads())->second);
     string deterministicForcesValue = (properties.find(CpuDeterministicForces()) == properties.end() ?
             getPropertyDefaultValue(CpuDeterministicForces()) : properties.find(CpuDeterministicForces())->second);
+    string tabulateValue = (properties.find(CpuTabulateCustomNonbonded()) == properties.end() ?
+            getPropertyDefaultValue(CpuTabulateCustomNonbonded()) : properties.find(CpuTabulateCustomNonbonded())->second);
+    string spinWaitValue = (properties.find(CpuSpinWait()) == properties.end() ?
+            getPropertyDefaultValue(CpuSpinWait()) : properties.find(CpuSpinWait())->second);
+    string affinityValue = (properties.find(CpuThreadAffinity()) == properties.end() ?
+            getPropertyDefaultValue(CpuThreadAffinity()) : properties.find(CpuThreadAffinity())->second);
+    string sharedValue = (properties.find(CpuSharedThreadPool()) == properties.end() ?
+            getPropertyDefaultValue(CpuSharedThreadPool()) : properties.find(CpuSharedThreadPool())->second);
     int numThreads;
     stringstream(threadsPropValue) >> numThreads;
     transform(deterministicForcesValue.begin(), deterministicForcesValue.end(), deterministicForcesValue.begin(), ::tolower);
     bool deterministicForces = (deterministicForcesValue == "true");
-    PlatformData* data = new PlatformData(context.getSystem().getNumParticles(), numThreads, deterministicForces);
+    transform(tabulateValue.begin(), tabulateValue.end(), tabulateValue.begin(), ::tolower);
+    bool tabulateCustomNonbonded = (tabulateValue == "true");
+    transform(spinWaitValue.begin(), spinWaitValue.end(), spinWaitValue.begin(), ::tolower);
+    bool spinWait = (spinWaitValue == "true");
+    transform(affinityValue.begin(), affinityValue.end(), affinityValue.begin(), ::tolower);
+    transform(sharedValue.begin(), sharedValue.end(), sharedValue.begin(), ::tolower);
+    bool sharedThreadPool = (sharedValue == "true");
+    if (threads == NULL)
+        threads = createThreadPool(numThreads, spinWait, affinityValue, sharedThreadPool);
+    PlatformData* data = new PlatformData(context.getSystem().getNumParticles(), threads, deterministicForces, tabulateCustomNonbonded,
+            affinityValue, sharedThreadPool);
     contextData[&context] = data;
     ReferenceConstraints& constraints = *(ReferenceConstraints*) reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData())->constraints;
     if (constraints.settle != NULL) {
@@ -147,17 +297,36 @@ const CpuPlatform::PlatformData& CpuPlatform::getPlatformData(const ContextImpl&
     return *contextData[&context];
 }
 
-CpuPlatform::PlatformData::PlatformData(int numParticles, int numThreads, bool deterministicForces) : posq(4*numParticles), threads(numThreads),
-        deterministicForces(deterministicForces), neighborList(NULL), cutoff(0.0), paddedCutoff(0.0), anyExclusions(false), currentPosqIndex(-1), nextPosqIndex(0) {
-    numThreads = threads.getNumThreads();
+const double CpuPlatform::PlatformData::FIXED_POINT_SCALE = (double) 0x100000000;
+
+CpuPlatform::PlatformData::PlatformData(int numParticles, shared_ptr<ThreadPool> threadPool, bool deterministicForces, bool tabulateCustomNonbonded,
+            const string& threadAffinity, bool sharedThreadPool) : posq(4*numParticles), threadPool(threadPool), threads(*threadPool),
+        deterministicForces(deterministicForces), tabulateCustomNonbonded(tabulateCustomNonbonded), neighborList(NULL), cutoff(0.0), paddedCutoff(0.0), anyExclusions(false), currentPosqIndex(-1), nextPosqIndex(0) {
+    int numThreads = threads.getNumThreads();
+
+    // Have each thread allocate and clear its own force buffer, so the memory is placed close to the
+    // core that will use it.
+
     threadForce.resize(numThreads);
-    for (int i = 0; i < numThreads; i++)
-        threadForce[i].resize(4*numParticles);
+    if (deterministicForces)
+        threadFixedForce.resize(numThreads);
+    threads.execute([&] (ThreadPool& threads, int threadIndex) {
+        AlignedArray<float>& force = threadForce[threadIndex];
+        force.resize(4*numParticles);
+        fill(&force[0], &force[0]+force.size(), 0.0f);
+        if (deterministicForces)
+            threadFixedForce[threadIndex].resize(3*numParticles, 0);
+    });
+    threads.waitForThreads();
     isPeriodic = false;
     stringstream threadsProperty;
     threadsProperty << numThreads;
     propertyValues[CpuThreads()] = threadsProperty.str();
     propertyValues[CpuDeterministicForces()] = deterministicForces ? "true" : "false";
+    propertyValues[CpuTabulateCustomNonbonded()] = tabulateCustomNonbonded ? "true" : "false";
+    propertyValues[CpuSpinWait()] = threads.getSpinWait() ? "true" : "false";
+    propertyValues[CpuThreadAffinity()] = threadAffinity;
+    propertyValues[CpuSharedThreadPool()] = sharedThreadPool ? "true" : "false";
 }
 
 CpuPlatform::PlatformData::~PlatformData() {
@@ -191,4 +360,4 @@ void CpuPlatform::PlatformData::requestNeighborList(double cutoffDistance, doubl
 
 int CpuPlatform::PlatformData::requestPosqIndex() {
     return nextPosqIndex++;
-}
\ No newline at end of file
+}
@@ -0,0 +1,196 @@
+
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Peter Eastman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "CpuRMSDForce.h"
+#include "jama_eig.h"
+
+using namespace OpenMM;
+using namespace std;
+
+CpuRMSDForce::CpuRMSDForce(const vector<Vec3>& referencePos, const vector<int>& particles, ThreadPool& threads) : threads(threads) {
+    threadSums.resize(NumSums*threads.getNumThreads());
+    setParameters(referencePos, particles);
+}
+
+void CpuRMSDForce::setParameters(const vector<Vec3>& referencePos, const vector<int>& particles) {
+    this->particles = particles;
+
+    // Center the reference positions and store them contiguously in the order particles are processed.
+
+    int numParticles = particles.size();
+    Vec3 refCenter;
+    for (int i : particles)
+        refCenter += referencePos[i];
+    refCenter /= numParticles;
+    this->referencePos.resize(3*numParticles);
+    sumRefSquared = 0.0;
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 p = referencePos[particles[i]]-refCenter;
+        for (int j = 0; j < 3; j++)
+            this->referencePos[3*i+j] = p[j];
+        sumRefSquared += p.dot(p);
+    }
+}
+
+double CpuRMSDForce::calculateIxn(vector<Vec3>& atomCoordinates, vector<AlignedArray<float> >& threadForce, bool includeForces) {
+    // Compute the RMSD and its gradient using the algorithm described in Coutsias et al,
+    // "Using quaternions to calculate RMSD" (doi: 10.1002/jcc.20110).  Because the reference
+    // positions are centered, the correlation matrix can be accumulated from uncentered positions
+    // in the same pass that computes the centroid.  Positions are taken relative to the first
+    // particle rather than the origin, so the sums do not lose precision to cancellation when the
+    // particles are far from the origin.
+
+    this->atomCoordinates = &atomCoordinates;
+    origin = (particles.size() > 0 ? atomCoordinates[particles[0]] : Vec3());
+    this->threadForce = &threadForce;
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadComputeSums(threadIndex); });
+    double sums[NumSums] = {0};
+    for (int i = 0; i < threads.getNumThreads(); i++)
+        for (int j = 0; j < NumSums; j++)
+            sums[j] += threadSums[NumSums*i+j];
+    int numParticles = particles.size();
+    Vec3 offset = Vec3(sums[0], sums[1], sums[2])/numParticles;
+    center = origin+offset;
+    double R[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            R[i][j] = sums[3+3*i+j];
+
+    // Compute the F matrix.
+
+    Array2D<double> F(4, 4);
+    F[0][0] =  R[0][0] + R[1][1] + R[2][2];
+    F[1][0] =  R[1][2] - R[2][1];
+    F[2][0] =  R[2][0] - R[0][2];
+    F[3][0] =  R[0][1] - R[1][0];
+
+    F[0][1] =  R[1][2] - R[2][1];
+    F[1][1] =  R[0][0] - R[1][1] - R[2][2];
+    F[2][1] =  R[0][1] + R[1][0];
+    F[3][1] =  R[0][2] + R[2][0];
+
+    F[0][2] =  R[2][0] - R[0][2];
+    F[1][2] =  R[0][1] + R[1][0];
+    F[2][2] = -R[0][0] + R[1][1] - R[2][2];
+    F[3][2] =  R[1][2] + R[2][1];
+
+    F[0][3] =  R[0][1] - R[1][0];
+    F[1][3] =  R[0][2] + R[2][0];
+    F[2][3] =  R[1][2] + R[2][1];
+    F[3][3] = -R[0][0] - R[1][1] + R[2][2];
+
+    // Find the maximum eigenvalue and eigenvector.
+
+    JAMA::Eigenvalue<double> eigen(F);
+    Array1D<double> values;
+    eigen.getRealEigenvalues(values);
+    Array2D<double> vectors;
+    eigen.getV(vectors);
+
+    // Compute the RMSD.
+
+    double sumPosSquared = sums[12]-numParticles*offset.dot(offset);
+    double msd = (sumPosSquared+sumRefSquared-2*values[3])/numParticles;
+    if (msd < 1e-20) {
+        // The particles are perfectly aligned, so all the forces should be zero.
+        // Numerical error can lead to NaNs, so just return 0 now.
+        return 0.0;
+    }
+    double rmsd = sqrt(msd);
+    if (!includeForces)
+        return rmsd;
+
+    // Compute the rotation matrix.
+
+    double q[] = {vectors[0][3], vectors[1][3], vectors[2][3], vectors[3][3]};
+    double q00 = q[0]*q[0], q01 = q[0]*q[1], q02 = q[0]*q[2], q03 = q[0]*q[3];
+    double q11 = q[1]*q[1], q12 = q[1]*q[2], q13 = q[1]*q[3];
+    double q22 = q[2]*q[2], q23 = q[2]*q[3];
+    double q33 = q[3]*q[3];
+    U[0][0] = q00+q11-q22-q33;
+    U[0][1] = 2*(q12-q03);
+    U[0][2] = 2*(q13+q02);
+    U[1][0] = 2*(q12+q03);
+    U[1][1] = q00-q11+q22-q33;
+    U[1][2] = 2*(q23-q01);
+    U[2][0] = 2*(q13-q02);
+    U[2][1] = 2*(q23+q01);
+    U[2][2] = q00-q11-q22+q33;
+
+    // Rotate the reference positions and compute the forces.
+
+    forceScale = 1.0/(rmsd*numParticles);
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) { threadApplyForces(threadIndex); });
+    return rmsd;
+}
+
+void CpuRMSDForce::threadComputeSums(int threadIndex) {
+    int numThreads = threads.getNumThreads();
+    int numParticles = particles.size();
+    int start = (int) (((long long) numParticles*threadIndex)/numThreads);
+    int end = (int) (((long long) numParticles*(threadIndex+1))/numThreads);
+    vector<Vec3>& pos = *atomCoordinates;
+    const double* ref = referencePos.data();
+    double sums[NumSums] = {0};
+    for (int i = start; i < end; i++) {
+        Vec3 p = pos[particles[i]]-origin;
+        const double* r = &ref[3*i];
+        sums[0] += p[0];
+        sums[1] += p[1];
+        sums[2] += p[2];
+        sums[3] += p[0]*r[0];
+        sums[4] += p[0]*r[1];
+        sums[5] += p[0]*r[2];
+        sums[6] += p[1]*r[0];
+        sums[7] += p[1]*r[1];
+        sums[8] += p[1]*r[2];
+        sums[9] += p[2]*r[0];
+        sums[10] += p[2]*r[1];
+        sums[11] += p[2]*r[2];
+        sums[12] += p.dot(p);
+    }
+    for (int i = 0; i < NumSums; i++)
+        threadSums[NumSums*threadIndex+i] = sums[i];
+}
+
+void CpuRMSDForce::threadApplyForces(int threadIndex) {
+    int numThreads = threads.getNumThreads();
+    int numParticles = particles.size();
+    int start = (int) (((long long) numParticles*threadIndex)/numThreads);
+    int end = (int) (((long long) numParticles*(threadIndex+1))/numThreads);
+    vector<Vec3>& pos = *atomCoordinates;
+    const double* ref = referencePos.data();
+    float* forces = &(*threadForce)[threadIndex][0];
+    for (int i = start; i < end; i++) {
+        const double* r = &ref[3*i];
+        Vec3 rotatedRef(U[0][0]*r[0] + U[1][0]*r[1] + U[2][0]*r[2],
+                        U[0][1]*r[0] + U[1][1]*r[1] + U[2][1]*r[2],
+                        U[0][2]*r[0] + U[1][2]*r[1] + U[2][2]*r[2]);
+        Vec3 f = (pos[particles[i]]-center-rotatedRef)*forceScale;
+        int index = 4*particles[i];
+        forces[index] -= (float) f[0];
+        forces[index+1] -= (float) f[1];
+        forces[index+2] -= (float) f[2];
+    }
+}
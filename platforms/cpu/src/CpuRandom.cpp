@@ -24,12 +24,21 @@
 
 #include "CpuRandom.h"
 #include "openmm/internal/OSRngSeed.h"
+#include "openmm/internal/vectorize.h"
 #include "openmm/OpenMMException.h"
 #include <cmath>
+#include <cstring>
+#include <iostream>
 
 using namespace std;
 using namespace OpenMM;
 
+/**
+ * This marks the start of the random number generator state in a checkpoint.  Checkpoints written before
+ * the state was saved do not contain it.
+ */
+static const char CHECKPOINT_TAG[] = "OpenMM CpuRandom v1";
+
 CpuRandom::CpuRandom() : hasInitialized(false) {
 }
 
@@ -84,6 +93,106 @@ float CpuRandom::getGaussianRandom(int threadIndex) {
     return x*multiplier;
 }
 
+void CpuRandom::getGaussianRandoms(int threadIndex, float* values, int count) {
+    OpenMM_SFMT::SFMT& sfmt = *threadRandom[threadIndex];
+    int numGenerated = 0;
+    if (count > 0 && nextGaussianIsValid[threadIndex]) {
+        values[numGenerated++] = nextGaussian[threadIndex];
+        nextGaussianIsValid[threadIndex] = false;
+    }
+
+    // Use the polar form of the Box-Muller transformation, processing four pairs of uniform values at once.
+    // The top 24 bits of each random integer are converted exactly to a float in [-1, 1).
+
+    const float scale = 2.0f/(1<<24);
+    while (numGenerated < count) {
+        float u[8];
+        for (int i = 0; i < 8; i++)
+            u[i] = (float) (gen_rand32(sfmt)>>8);
+        fvec4 x = fvec4(u)*scale-1.0f;
+        fvec4 y = fvec4(u+4)*scale-1.0f;
+        fvec4 r2 = x*x + y*y;
+        fvec4 multiplier = sqrt((-2.0f*log(r2))/r2);
+        float gx[4], gy[4], r2Values[4];
+        (x*multiplier).store(gx);
+        (y*multiplier).store(gy);
+        r2.store(r2Values);
+        for (int i = 0; i < 4 && numGenerated < count; i++) {
+            if (r2Values[i] >= 1.0f || r2Values[i] == 0.0f)
+                continue;
+            values[numGenerated++] = gx[i];
+            if (numGenerated < count)
+                values[numGenerated++] = gy[i];
+            else {
+                nextGaussian[threadIndex] = gy[i];
+                nextGaussianIsValid[threadIndex] = true;
+            }
+        }
+    }
+}
+
 float CpuRandom::getUniformRandom(int threadIndex) {
     return genrand_real2(*threadRandom[threadIndex]);
 }
+
+void CpuRandom::createCheckpoint(ostream& stream) const {
+    stream.write(CHECKPOINT_TAG, sizeof(CHECKPOINT_TAG));
+    stream.write((char*) &hasInitialized, sizeof(bool));
+    if (!hasInitialized)
+        return;
+    int numThreads = threadRandom.size();
+    stream.write((char*) &randomSeed, sizeof(int));
+    stream.write((char*) &numThreads, sizeof(int));
+    stream.write((char*) nextGaussian.data(), numThreads*sizeof(float));
+    stream.write((char*) nextGaussianIsValid.data(), numThreads*sizeof(int));
+    for (auto random : threadRandom)
+        random->createCheckpoint(stream);
+}
+
+void CpuRandom::loadCheckpoint(istream& stream, int numThreads) {
+    // If the tag is missing, the checkpoint was written before the random number generators were saved,
+    // and what follows is the integrator's state.  In that case keep the current generators.  Usually the
+    // first byte is enough to tell, so nothing needs to be put back.  Only if it matches the tag but the
+    // rest does not must the stream be rewound, which requires it to be seekable.
+
+    if (stream.peek() != CHECKPOINT_TAG[0]) {
+        // Reaching the end of the stream is not an error, but any earlier failure must still be reported.
+
+        stream.clear(stream.rdstate() & ~ios_base::eofbit);
+        return;
+    }
+    streampos start = stream.tellg();
+    char tag[sizeof(CHECKPOINT_TAG)];
+    stream.read(tag, sizeof(tag));
+    if (!stream || memcmp(tag, CHECKPOINT_TAG, sizeof(tag)) != 0) {
+        stream.clear();
+        if (start == streampos(-1) || !stream.seekg(start))
+            throw OpenMMException("loadCheckpoint: Checkpoint does not contain the random number generator state");
+        return;
+    }
+    bool initialized = false;
+    stream.read((char*) &initialized, sizeof(bool));
+    if (!initialized)
+        return;
+    int seed, savedThreads;
+    stream.read((char*) &seed, sizeof(int));
+    stream.read((char*) &savedThreads, sizeof(int));
+    if (!hasInitialized)
+        initialize(seed, numThreads);
+    if (savedThreads != (int) threadRandom.size()) {
+        // The checkpoint was created with a different number of threads, so its random number streams
+        // cannot be reproduced.  Skip over them and keep the current state.
+
+        vector<char> values(savedThreads*(sizeof(float)+sizeof(int)));
+        stream.read(values.data(), values.size());
+        OpenMM_SFMT::SFMT sfmt;
+        for (int i = 0; i < savedThreads; i++)
+            sfmt.loadCheckpoint(stream);
+        return;
+    }
+    randomSeed = seed;
+    stream.read((char*) nextGaussian.data(), savedThreads*sizeof(float));
+    stream.read((char*) nextGaussianIsValid.data(), savedThreads*sizeof(int));
+    for (auto random : threadRandom)
+        random->loadCheckpoint(stream);
+}
@@ -30,7 +30,6 @@
  * -------------------------------------------------------------------------- */
 
 #include "CpuSETTLE.h"
-#include <atomic>
 
 using namespace OpenMM;
 using namespace std;
@@ -61,29 +60,41 @@ CpuSETTLE::~CpuSETTLE() {
 }
 
 void CpuSETTLE::apply(vector<OpenMM::Vec3>& atomCoordinates, vector<OpenMM::Vec3>& atomCoordinatesP, vector<double>& inverseMasses, double tolerance) {
-    atomic<int> atomicCounter;
-    atomicCounter = 0;
-    threads.execute([&] (ThreadPool& threads, int threadIndex) {
-        while (true) {
-            int index = atomicCounter++;
-            if (index >= threadSettle.size())
-                break;
+    workQueue.reset(threads, threadSettle.size());
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+        int index;
+        while (workQueue.getNextItem(threadIndex, index)) {
             threadSettle[index]->apply(atomCoordinates, atomCoordinatesP, inverseMasses, tolerance);
         }
     });
-    threads.waitForThreads();
 }
 
 void CpuSETTLE::applyToVelocities(vector<OpenMM::Vec3>& atomCoordinates, vector<OpenMM::Vec3>& velocities, vector<double>& inverseMasses, double tolerance) {
-    atomic<int> atomicCounter;
-    atomicCounter = 0;
-    threads.execute([&] (ThreadPool& threads, int threadIndex) {
-        while (true) {
-            int index = atomicCounter++;
-            if (index >= threadSettle.size())
-                break;
+    workQueue.reset(threads, threadSettle.size());
+    threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+        int index;
+        while (workQueue.getNextItem(threadIndex, index)) {
             threadSettle[index]->applyToVelocities(atomCoordinates, velocities, inverseMasses, tolerance);
         }
     });
-    threads.waitForThreads();
+}
+
+void CpuSETTLE::getClusterParameters(vector<int>& atom1, vector<int>& atom2, vector<int>& atom3, vector<double>& distance1, vector<double>& distance2) const {
+    atom1.clear();
+    atom2.clear();
+    atom3.clear();
+    distance1.clear();
+    distance2.clear();
+    for (auto settle : threadSettle) {
+        for (int i = 0; i < settle->getNumClusters(); i++) {
+            int a1, a2, a3;
+            double d1, d2;
+            settle->getClusterParameters(i, a1, a2, a3, d1, d2);
+            atom1.push_back(a1);
+            atom2.push_back(a2);
+            atom3.push_back(a3);
+            distance1.push_back(d1);
+            distance2.push_back(d2);
+        }
+    }
 }
@@ -33,11 +33,60 @@
   #define _USE_MATH_DEFINES // Needed to get M_PI
 #endif
 #include "CpuPlatform.h"
+#include "openmm/Context.h"
+#include "openmm/State.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/internal/AssertionUtilities.h"
 #include <cstdlib>
 #include <iostream>
+#include <map>
+#include <string>
+#include <vector>
 
 OpenMM::CpuPlatform platform;
 
+/**
+ * Compute the energy and forces of a System with both the CPU and Reference platforms, and check that they agree.
+ * If changedParameters is not empty, the global parameters it lists are then set to new values in both Contexts
+ * and the results are compared again.
+ *
+ * @param system             the System to compute
+ * @param positions          the particle positions
+ * @param energyTol          the tolerance for the energy and its parameter derivatives
+ * @param forceTol           the tolerance for the forces
+ * @param derivatives        the names of energy parameter derivatives to compare
+ * @param changedParameters  new values for global parameters to compare a second time with
+ */
+void compareToReference(const OpenMM::System& system, const std::vector<OpenMM::Vec3>& positions, double energyTol, double forceTol,
+        const std::vector<std::string>& derivatives=std::vector<std::string>(),
+        const std::map<std::string, double>& changedParameters=std::map<std::string, double>()) {
+    using namespace OpenMM;
+    VerletIntegrator integrator1(0.001);
+    VerletIntegrator integrator2(0.001);
+    Context context1(system, integrator1, Platform::getPlatformByName("Reference"));
+    Context context2(system, integrator2, platform);
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    int types = State::Forces | State::Energy;
+    if (derivatives.size() > 0)
+        types |= State::ParameterDerivatives;
+    int numEvaluations = (changedParameters.size() > 0 ? 2 : 1);
+    for (int evaluation = 0; evaluation < numEvaluations; evaluation++) {
+        State state1 = context1.getState(types);
+        State state2 = context2.getState(types);
+        ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), energyTol);
+        for (auto& name : derivatives)
+            ASSERT_EQUAL_TOL(state1.getEnergyParameterDerivatives().at(name), state2.getEnergyParameterDerivatives().at(name), energyTol);
+        for (int i = 0; i < system.getNumParticles(); i++)
+            ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], forceTol);
+        for (auto& param : changedParameters) {
+            context1.setParameter(param.first, param.second);
+            context2.setParameter(param.first, param.second);
+        }
+    }
+}
+
 void initializeTests(int argc, char* argv[]) {
     if (!OpenMM::CpuPlatform::isProcessorSupported()) {
         std::cout << "CPU is not supported.  Exiting." << std::endl;
@@ -31,6 +31,9 @@
 
 #include "CpuTests.h"
 #include "TestCheckpoints.h"
+#include "openmm/CustomIntegrator.h"
+#include <sstream>
+#include <string>
 
 void testCheckpoint() {
     const int numParticles = 100;
@@ -103,6 +106,65 @@ void testCheckpoint() {
     compareStates(s1, s5);
 }
 
+/**
+ * A stream buffer that cannot be repositioned, like a pipe or socket.
+ */
+class NonSeekableBuffer : public stringbuf {
+public:
+    NonSeekableBuffer(const string& data) : stringbuf(data, ios_base::in | ios_base::binary) {
+    }
+protected:
+    pos_type seekoff(off_type off, ios_base::seekdir dir, ios_base::openmode which) {
+        return pos_type(off_type(-1));
+    }
+    pos_type seekpos(pos_type pos, ios_base::openmode which) {
+        return pos_type(off_type(-1));
+    }
+};
+
+void testCheckpointWithoutRandomState(bool seekable) {
+    // Checkpoints written before the random number generators were saved go straight from the particle
+    // data to the integrator's own state.  Make sure they still load correctly.
+
+    System system;
+    system.addParticle(1.0);
+    system.addParticle(1.0);
+    CustomIntegrator integrator(0.001);
+    integrator.addGlobalVariable("a", 0.0);
+    integrator.addComputeGlobal("a", "a+1");
+    Context context(system, integrator, platform);
+    vector<Vec3> positions = {Vec3(0, 0, 0), Vec3(1, 0, 0)};
+    context.setPositions(positions);
+    integrator.step(5);
+    stringstream stream(ios_base::out | ios_base::in | ios_base::binary);
+    context.createCheckpoint(stream);
+
+    // This integrator does not use the generators, so they are saved as the tag followed by a single flag.
+    // Remove them to produce the old layout.
+
+    string checkpoint = stream.str();
+    const string tag("OpenMM CpuRandom v1", sizeof("OpenMM CpuRandom v1"));
+    size_t tagPosition = checkpoint.find(tag);
+    ASSERT(tagPosition != string::npos);
+    checkpoint.erase(tagPosition, tag.size()+sizeof(bool));
+    stringstream oldStream(checkpoint, ios_base::out | ios_base::in | ios_base::binary);
+    NonSeekableBuffer buffer(checkpoint);
+    istream nonSeekableStream(&buffer);
+    CustomIntegrator integrator2(0.001);
+    integrator2.addGlobalVariable("a", 0.0);
+    integrator2.addComputeGlobal("a", "a+1");
+    Context context2(system, integrator2, platform);
+    if (seekable)
+        context2.loadCheckpoint(oldStream);
+    else
+        context2.loadCheckpoint(nonSeekableStream);
+    ASSERT_EQUAL(5.0, integrator2.getGlobalVariable(0));
+    State state = context2.getState(State::Positions);
+    ASSERT_EQUAL_VEC(positions[1], state.getPositions()[1], 0.0);
+}
+
 void runPlatformTests() {
     testCheckpoint();
+    testCheckpointWithoutRandomState(true);
+    testCheckpointWithoutRandomState(false);
 }
@@ -0,0 +1,78 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "CpuTests.h"
+#include "TestCustomCentroidBondForce.h"
+
+void testLargeSystem(bool periodic) {
+    // Create a mix of small groups and a few large ones that span several threads' share of atoms,
+    // with some atoms belonging to more than one group, and compare to the Reference platform.
+
+    int numParticles = 600;
+    double boxSize = 5.0;
+    System system;
+    for (int i = 0; i < numParticles; i++)
+        system.addParticle(1.0+0.5*(i%3));
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    CustomCentroidBondForce* force = new CustomCentroidBondForce(3, "k*(distance(g1,g2)-r0)^2 + scale*(angle(g1,g2,g3)-theta0)^2");
+    force->addPerBondParameter("r0");
+    force->addPerBondParameter("theta0");
+    force->addGlobalParameter("k", 2.0);
+    force->addGlobalParameter("scale", 0.8);
+    force->addEnergyParameterDerivative("scale");
+    force->setUsesPeriodicBoundaryConditions(periodic);
+    for (int i = 0; i < numParticles; i += 4)
+        force->addGroup({i, i+1, i+2, i+3});
+    vector<int> large1, large2;
+    for (int i = 0; i < 250; i++) {
+        large1.push_back(i);
+        large2.push_back(numParticles-1-i);
+    }
+    int firstLarge = force->addGroup(large1);
+    force->addGroup(large2);
+    for (int i = 0; i < firstLarge-2; i++)
+        force->addBond({i, i+1, i+2}, {0.5+0.01*(i%4), 1.9+0.05*(i%3)});
+    for (int i = 0; i < firstLarge; i += 10)
+        force->addBond({firstLarge, i, firstLarge+1}, {1.0, 2.0});
+    system.addForce(force);
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++)
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    compareToReference(system, positions, TOL, TOL, {"scale"});
+}
+
+void runPlatformTests() {
+    testLargeSystem(false);
+    testLargeSystem(true);
+}
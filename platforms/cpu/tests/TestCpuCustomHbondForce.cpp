@@ -0,0 +1,83 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "CpuTests.h"
+#include "TestCustomHbondForce.h"
+
+void testLargeSystem(CustomHbondForce::NonbondedMethod method, bool triclinic) {
+    // Create a box of three-atom molecules, each of which is both a donor and an acceptor,
+    // and compare to the Reference platform.
+
+    int gridSize = 6;
+    double spacing = 0.5;
+    double boxSize = gridSize*spacing;
+    System system;
+    CustomHbondForce* force = new CustomHbondForce("k*exp(-(distance(d1,a1)-r0)^2/0.05)*(1+cos(angle(a1,d1,d2)-theta0))*(1+0.3*cos(2*dihedral(a2,a1,d1,d2)-chi0))");
+    force->addPerDonorParameter("r0");
+    force->addPerDonorParameter("theta0");
+    force->addPerAcceptorParameter("chi0");
+    force->addGlobalParameter("k", 1.5);
+    force->setNonbondedMethod(method);
+    force->setCutoffDistance(0.9);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                int first = system.getNumParticles();
+                Vec3 center = Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.1;
+                for (int m = 0; m < 3; m++) {
+                    system.addParticle(1.0);
+                    positions.push_back(center+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.15);
+                }
+                int index = force->getNumDonors();
+                force->addDonor(first, first+1, -1, {0.3+0.01*(index%5), 1.8+0.1*(index%3)});
+                force->addAcceptor(first+2, first, first+1, {0.1*(index%7)});
+                force->addExclusion(index, index);
+            }
+    if (triclinic)
+        system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0.2*boxSize, boxSize, 0), Vec3(-0.3*boxSize, 0.1*boxSize, boxSize));
+    else
+        system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    system.addForce(force);
+
+    // Forces are computed in single precision, which loses accuracy for nearly linear dihedrals.
+
+    compareToReference(system, positions, 1e-4, 2e-3);
+}
+
+void runPlatformTests() {
+    testLargeSystem(CustomHbondForce::NoCutoff, false);
+    testLargeSystem(CustomHbondForce::CutoffNonPeriodic, false);
+    testLargeSystem(CustomHbondForce::CutoffPeriodic, false);
+    testLargeSystem(CustomHbondForce::CutoffPeriodic, true);
+}
@@ -32,5 +32,60 @@
 #include "CpuTests.h"
 #include "TestCustomManyParticleForce.h"
 
+void testNeighborListUpdates(CustomManyParticleForce::PermutationMode mode, CustomManyParticleForce::NonbondedMethod method, bool triclinic) {
+    // Move particles by varying amounts, so the neighbor list sometimes can be reused and sometimes
+    // must be rebuilt, and compare to the Reference platform.
+
+    int gridSize = 5;
+    int numParticles = gridSize*gridSize*gridSize;
+    double boxSize = 1.5;
+    double spacing = boxSize/gridSize;
+    CustomManyParticleForce* force = new CustomManyParticleForce(3,
+        "(cos(theta1)+1/3)^2*exp(0.1/(r12-0.5))*exp(0.1/(r13-0.5));"
+        "r12 = distance(p1,p2); r13 = distance(p1,p3); theta1 = angle(p3,p1,p2)");
+    force->setPermutationMode(mode);
+    force->setNonbondedMethod(method);
+    force->setCutoffDistance(0.45);
+    vector<double> params;
+    vector<Vec3> positions;
+    System system;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                force->addParticle(params);
+                positions.push_back(Vec3((i+0.4*genrand_real2(sfmt))*spacing, (j+0.4*genrand_real2(sfmt))*spacing, (k+0.4*genrand_real2(sfmt))*spacing));
+                system.addParticle(1.0);
+            }
+    for (int i = 0; i < numParticles-1; i += 10)
+        force->addExclusion(i, i+1);
+    if (triclinic)
+        system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0.2*boxSize, boxSize, 0), Vec3(-0.3*boxSize, 0.1*boxSize, boxSize));
+    else
+        system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    system.addForce(force);
+    VerletIntegrator integrator1(0.001);
+    VerletIntegrator integrator2(0.001);
+    Context context1(system, integrator1, Platform::getPlatformByName("Reference"));
+    Context context2(system, integrator2, platform);
+    for (int iteration = 0; iteration < 4; iteration++) {
+        double step = (iteration%2 == 1 ? 0.05 : 0.005);
+        for (auto& pos : positions)
+            pos += Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*step;
+        context1.setPositions(positions);
+        context2.setPositions(positions);
+        State state1 = context1.getState(State::Forces | State::Energy);
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-4);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+    }
+}
+
 void runPlatformTests() {
+    testNeighborListUpdates(CustomManyParticleForce::SinglePermutation, CustomManyParticleForce::CutoffNonPeriodic, false);
+    testNeighborListUpdates(CustomManyParticleForce::SinglePermutation, CustomManyParticleForce::CutoffPeriodic, false);
+    testNeighborListUpdates(CustomManyParticleForce::UniqueCentralParticle, CustomManyParticleForce::CutoffPeriodic, false);
+    testNeighborListUpdates(CustomManyParticleForce::UniqueCentralParticle, CustomManyParticleForce::CutoffPeriodic, true);
 }
@@ -32,5 +32,122 @@
 #include "CpuTests.h"
 #include "TestCustomNonbondedForce.h"
 
+void testTabulation() {
+    // Create a box of particles with three types.
+
+    const int gridSize = 7;
+    const double spacing = 0.4;
+    const double boxSize = gridSize*spacing;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    CustomNonbondedForce* nonbonded = new CustomNonbondedForce("scale*4*eps*((sigma/r)^12-(sigma/r)^6)+q1*q2/r; sigma=0.5*(sigma1+sigma2); eps=sqrt(eps1*eps2)");
+    nonbonded->addPerParticleParameter("q");
+    nonbonded->addPerParticleParameter("sigma");
+    nonbonded->addPerParticleParameter("eps");
+    nonbonded->addGlobalParameter("scale", 1.0);
+    nonbonded->setNonbondedMethod(CustomNonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setUseSwitchingFunction(true);
+    nonbonded->setSwitchingDistance(0.8);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                int type = system.getNumParticles()%3;
+                system.addParticle(1.0);
+                nonbonded->addParticle({0.2*(type-1), 0.3+0.02*type, 0.5+0.3*type});
+                positions.push_back(Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.1);
+            }
+    system.addForce(nonbonded);
+
+    // Compare a Context that uses tables to one that evaluates the expression directly.
+
+    map<string, string> properties;
+    properties[CpuPlatform::CpuTabulateCustomNonbonded()] = "true";
+    VerletIntegrator integrator1(0.001), integrator2(0.001);
+    Context context1(system, integrator1, platform);
+    Context context2(system, integrator2, platform, properties);
+    ASSERT_EQUAL("true", platform.getPropertyValue(context2, CpuPlatform::CpuTabulateCustomNonbonded()));
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    for (int iteration = 0; iteration < 3; iteration++) {
+        State state1 = context1.getState(State::Forces | State::Energy);
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-4);
+        for (int i = 0; i < system.getNumParticles(); i++)
+            ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+        if (iteration == 0) {
+            // Changing a global parameter should cause the tables to be rebuilt.
+
+            context1.setParameter("scale", 1.5);
+            context2.setParameter("scale", 1.5);
+        }
+        else if (iteration == 1) {
+            // So should changing per-particle parameters.
+
+            nonbonded->setParticleParameters(1, {0.4, 0.32, 0.2});
+            nonbonded->updateParametersInContext(context1);
+            nonbonded->updateParametersInContext(context2);
+        }
+    }
+}
+
+void testCachedLongRangeCorrection() {
+    // Create a box of particles with two types.
+
+    const int gridSize = 5;
+    const double spacing = 0.5;
+    const double boxSize = gridSize*spacing;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    CustomNonbondedForce* nonbonded = new CustomNonbondedForce("scale*4*eps*((sigma/r)^12-(sigma/r)^6); sigma=0.5*(sigma1+sigma2); eps=sqrt(eps1*eps2)");
+    nonbonded->addPerParticleParameter("sigma");
+    nonbonded->addPerParticleParameter("eps");
+    nonbonded->addGlobalParameter("scale", 1.0);
+    nonbonded->addEnergyParameterDerivative("scale");
+    nonbonded->setNonbondedMethod(CustomNonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setUseLongRangeCorrection(true);
+    vector<Vec3> positions;
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                int type = system.getNumParticles()%2;
+                system.addParticle(1.0);
+                nonbonded->addParticle({0.3+0.05*type, 0.5+0.5*type});
+                positions.push_back(Vec3(i, j, k)*spacing);
+            }
+    system.addForce(nonbonded);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+
+    // Switching back and forth between values of the global parameter should reuse the cached integrals,
+    // giving identical results.
+
+    State state1 = context.getState(State::Energy | State::ParameterDerivatives);
+    context.setParameter("scale", 2.0);
+    State state2 = context.getState(State::Energy | State::ParameterDerivatives);
+    context.setParameter("scale", 1.0);
+    State state3 = context.getState(State::Energy | State::ParameterDerivatives);
+    ASSERT_EQUAL_TOL(2*state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+    ASSERT_EQUAL(state1.getPotentialEnergy(), state3.getPotentialEnergy());
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state1.getEnergyParameterDerivatives().at("scale"), 1e-5);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getEnergyParameterDerivatives().at("scale"), 1e-5);
+
+    // Changing per-particle parameters should give the same result as a newly created Context.
+
+    nonbonded->setParticleParameters(0, {0.4, 0.8});
+    nonbonded->updateParametersInContext(context);
+    VerletIntegrator integrator2(0.001);
+    Context context2(system, integrator2, platform);
+    context2.setPositions(positions);
+    ASSERT_EQUAL_TOL(context2.getState(State::Energy).getPotentialEnergy(), context.getState(State::Energy).getPotentialEnergy(), 1e-6);
+}
+
 void runPlatformTests() {
+    testTabulation();
+    testCachedLongRangeCorrection();
 }
@@ -32,5 +32,40 @@
 #include "CpuTests.h"
 #include "TestEwald.h"
 
+void testReciprocalMatchesReference() {
+    // Use a number of atoms that is not a multiple of the vector width, and a non-cubic box.
+
+    const int numParticles = 203;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(2.1, 0, 0), Vec3(0, 2.5, 0), Vec3(0, 0, 2.9));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::Ewald);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setEwaldErrorTolerance(1e-5);
+    nonbonded->setReciprocalSpaceForceGroup(1);
+    system.addForce(nonbonded);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(genrand_real2(sfmt)-0.5, 0.3, 0.1);
+        positions[i] = Vec3(2.1*genrand_real2(sfmt), 2.5*genrand_real2(sfmt), 2.9*genrand_real2(sfmt));
+    }
+    VerletIntegrator integrator1(0.001);
+    VerletIntegrator integrator2(0.001);
+    ReferencePlatform reference;
+    Context context(system, integrator1, platform);
+    Context refContext(system, integrator2, reference);
+    context.setPositions(positions);
+    refContext.setPositions(positions);
+    State state = context.getState(State::Forces | State::Energy, false, 1<<1);
+    State refState = refContext.getState(State::Forces | State::Energy, false, 1<<1);
+    ASSERT_EQUAL_TOL(refState.getPotentialEnergy(), state.getPotentialEnergy(), 1e-4);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(refState.getForces()[i], state.getForces()[i], 1e-3);
+}
+
 void runPlatformTests() {
+    testReciprocalMatchesReference();
 }
@@ -32,5 +32,75 @@
 #include "CpuTests.h"
 #include "TestGBSAOBCForce.h"
 
+void testNeighborList(double gbCutoff, double nonbondedCutoff, bool periodic) {
+    // Build a dense system where each atom has only a small fraction of the others within the cutoff,
+    // and some of the pairs are bonded exclusions that still contribute to the GB energy.
+
+    const int numParticles = 2000;
+    const double boxSize = 4.0;
+    ReferencePlatform reference;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    GBSAOBCForce* gbsa = new GBSAOBCForce();
+    NonbondedForce* nonbonded = new NonbondedForce();
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        double charge = i%2 == 0 ? -0.5 : 0.5;
+        gbsa->addParticle(charge, 0.12+0.06*genrand_real2(sfmt), 0.7+0.2*genrand_real2(sfmt));
+        nonbonded->addParticle(charge, 0.3, 0.1);
+        if (i%2 == 0)
+            positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+        else {
+            positions[i] = positions[i-1]+Vec3(0.15, 0, 0);
+            nonbonded->addException(i-1, i, 0, 1, 0);
+        }
+    }
+    gbsa->setNonbondedMethod(periodic ? GBSAOBCForce::CutoffPeriodic : GBSAOBCForce::CutoffNonPeriodic);
+    gbsa->setCutoffDistance(gbCutoff);
+    system.addForce(gbsa);
+    if (nonbondedCutoff > 0) {
+        nonbonded->setNonbondedMethod(periodic ? NonbondedForce::CutoffPeriodic : NonbondedForce::CutoffNonPeriodic);
+        nonbonded->setCutoffDistance(nonbondedCutoff);
+        system.addForce(nonbonded);
+    }
+    else
+        delete nonbonded;
+    LangevinIntegrator integrator1(0, 0.1, 0.01);
+    LangevinIntegrator integrator2(0, 0.1, 0.01);
+    Context context(system, integrator1, platform);
+    Context refContext(system, integrator2, reference);
+    context.setPositions(positions);
+    refContext.setPositions(positions);
+    State state = context.getState(State::Forces | State::Energy);
+    State refState = refContext.getState(State::Forces | State::Energy);
+    double norm = 0.0;
+    double diff = 0.0;
+    for (int i = 0; i < numParticles; ++i) {
+        Vec3 f = refState.getForces()[i];
+        norm += f.dot(f);
+        Vec3 delta = state.getForces()[i]-f;
+        diff += delta.dot(delta);
+    }
+    ASSERT_EQUAL_TOL(0.0, sqrt(diff), 1e-3*sqrt(norm));
+    ASSERT_EQUAL_TOL(refState.getPotentialEnergy(), state.getPotentialEnergy(), 1e-4);
+
+    // Move the atoms far enough that the neighbor list must be rebuilt, and check again.
+
+    for (int i = 0; i < numParticles; i++)
+        positions[i] += Vec3(0.3*genrand_real2(sfmt), 0.3*genrand_real2(sfmt), 0.3*genrand_real2(sfmt));
+    context.setPositions(positions);
+    refContext.setPositions(positions);
+    state = context.getState(State::Energy);
+    refState = refContext.getState(State::Energy);
+    ASSERT_EQUAL_TOL(refState.getPotentialEnergy(), state.getPotentialEnergy(), 1e-4);
+}
+
 void runPlatformTests() {
+    testNeighborList(1.2, 0.0, false);
+    testNeighborList(1.2, 1.2, true);
+    testNeighborList(1.0, 1.3, false);
+    testNeighborList(1.3, 1.0, true);
 }
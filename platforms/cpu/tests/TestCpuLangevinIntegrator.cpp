@@ -31,6 +31,38 @@
 
 #include "CpuTests.h"
 #include "TestLangevinIntegrator.h"
+#include "CpuRandom.h"
+
+void testGaussianRandoms() {
+    // Generate values in blocks of odd sizes, mixed with individual values, and check the moments of the distribution.
+
+    const int numValues = 100000;
+    CpuRandom random;
+    random.initialize(5, 2);
+    vector<float> values(numValues);
+    int index = 0;
+    while (index < numValues) {
+        values[index++] = random.getGaussianRandom(1);
+        int count = min(37, numValues-index);
+        random.getGaussianRandoms(1, &values[index], count);
+        index += count;
+    }
+    double mean = 0, var = 0, kurtosis = 0;
+    for (float v : values)
+        mean += v;
+    mean /= numValues;
+    for (float v : values) {
+        double d = v-mean;
+        var += d*d;
+        kurtosis += d*d*d*d;
+    }
+    var /= numValues;
+    kurtosis /= numValues*var*var;
+    ASSERT_EQUAL_TOL(0.0, mean, 0.02);
+    ASSERT_EQUAL_TOL(1.0, var, 0.02);
+    ASSERT_EQUAL_TOL(3.0, kurtosis, 0.05);
+}
 
 void runPlatformTests() {
+    testGaussianRandoms();
 }
@@ -32,5 +32,62 @@
 #include "CpuTests.h"
 #include "TestLangevinMiddleIntegrator.h"
 
+void testWaterBox() {
+    // With no friction the integrator is deterministic, so compare a box of rigid water to the Reference platform.
+    // This uses enough threads that the boundaries between threads need to be moved to keep molecules together.
+
+    const int gridSize = 3;
+    const int numMolecules = gridSize*gridSize*gridSize;
+    System system;
+    NonbondedForce* nonbonded = new NonbondedForce();
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    for (int i = 0; i < numMolecules; i++) {
+        int first = system.addParticle(16.0);
+        system.addParticle(1.0);
+        system.addParticle(1.0);
+        system.addConstraint(first, first+1, 0.1);
+        system.addConstraint(first, first+2, 0.1);
+        system.addConstraint(first+1, first+2, 0.1633);
+        nonbonded->addParticle(-0.5, 0.3, 0.5);
+        nonbonded->addParticle(0.0, 0.1, 0.0);
+        nonbonded->addParticle(0.0, 0.1, 0.0);
+        Vec3 pos(0.4*(i%gridSize), 0.4*((i/gridSize)%gridSize), 0.4*(i/(gridSize*gridSize)));
+        positions.push_back(pos);
+        positions.push_back(pos+Vec3(0.1, 0, 0));
+        positions.push_back(pos+Vec3(-0.0333, 0.0943, 0));
+    }
+    LangevinMiddleIntegrator integrator1(300.0, 0.0, 0.001);
+    LangevinMiddleIntegrator integrator2(300.0, 0.0, 0.001);
+    integrator1.setConstraintTolerance(1e-6);
+    integrator2.setConstraintTolerance(1e-6);
+    map<string, string> properties;
+    properties[CpuPlatform::CpuThreads()] = "4";
+    Context context1(system, integrator1, platform, properties);
+    Context context2(system, integrator2, Platform::getPlatformByName("Reference"));
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    context2.setVelocities(context1.getState(State::Velocities).getVelocities());
+    for (int i = 0; i < 10; i++) {
+        integrator1.step(2);
+        integrator2.step(2);
+        State state1 = context1.getState(State::Positions | State::Velocities);
+        State state2 = context2.getState(State::Positions | State::Velocities);
+        for (int j = 0; j < system.getNumParticles(); j++) {
+            ASSERT_EQUAL_VEC(state2.getPositions()[j], state1.getPositions()[j], 1e-4);
+            ASSERT_EQUAL_VEC(state2.getVelocities()[j], state1.getVelocities()[j], 1e-3);
+        }
+        for (int j = 0; j < system.getNumConstraints(); j++) {
+            int particle1, particle2;
+            double distance;
+            system.getConstraintParameters(j, particle1, particle2, distance);
+            Vec3 delta = state1.getPositions()[particle1]-state1.getPositions()[particle2];
+            ASSERT_EQUAL_TOL(distance, sqrt(delta.dot(delta)), 1e-5);
+        }
+    }
+}
+
 void runPlatformTests() {
+    testWaterBox();
 }
@@ -31,7 +31,140 @@
 
 #include "CpuTests.h"
 #include "TestNonbondedForce.h"
+#include "openmm/HarmonicAngleForce.h"
+#include "openmm/PeriodicTorsionForce.h"
+#include "openmm/RBTorsionForce.h"
+
+void testEnergyOnly(NonbondedForce::NonbondedMethod method) {
+    // Computing only the energy should give the same result as computing energy and forces together.
+
+    const int numParticles = 500;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(method);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setUseSwitchingFunction(true);
+    nonbonded->setSwitchingDistance(0.9);
+    system.addForce(nonbonded);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? -0.5 : 0.5, 0.2, 0.5);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    for (int i = 1; i < numParticles; i += 2) {
+        positions[i] = positions[i-1]+Vec3(0.1, 0, 0);
+        nonbonded->addException(i-1, i, 0.0, 1.0, 0.0);
+    }
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    State state1 = context.getState(State::Energy | State::Forces);
+    State state2 = context.getState(State::Energy);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+
+    // Make sure skipping the forces did not leave anything behind that affects the next evaluation.
+
+    State state3 = context.getState(State::Energy | State::Forces);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state3.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state3.getForces()[i], 1e-5);
+}
+
+void testDeterministicForces(NonbondedForce::NonbondedMethod method, bool includeBonded) {
+    // With DeterministicForces, the direct space forces are accumulated in fixed point and bonded forces
+    // are computed in a fixed order, so they should be exactly the same regardless of the number of threads.
+
+    const int gridSize = 8;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double spacing = 0.375;
+    const double boxSize = gridSize*spacing;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(method);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? -0.5 : 0.5, 0.2, 0.5);
+        Vec3 offset(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+        positions[i] = Vec3(i%gridSize, (i/gridSize)%gridSize, i/(gridSize*gridSize))*spacing + offset*0.1;
+    }
+    if (includeBonded) {
+        // Connect the particles in each row into a chain, and exclude the bonded pairs from the nonbonded
+        // interaction, which gives it exceptions to compute.
+
+        HarmonicBondForce* bonds = new HarmonicBondForce();
+        HarmonicAngleForce* angles = new HarmonicAngleForce();
+        PeriodicTorsionForce* periodic = new PeriodicTorsionForce();
+        RBTorsionForce* rb = new RBTorsionForce();
+        vector<pair<int, int> > bondPairs;
+        for (int i = 0; i < numParticles; i++) {
+            int column = i%gridSize;
+            if (column < gridSize-1) {
+                bonds->addBond(i, i+1, spacing, 100.0);
+                bondPairs.push_back(make_pair(i, i+1));
+            }
+            if (column < gridSize-2)
+                angles->addAngle(i, i+1, i+2, 2.0, 50.0);
+            if (column < gridSize-3) {
+                periodic->addTorsion(i, i+1, i+2, i+3, 2, 0.5, 5.0);
+                rb->addTorsion(i, i+1, i+2, i+3, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6);
+            }
+        }
+        system.addForce(bonds);
+        system.addForce(angles);
+        system.addForce(periodic);
+        system.addForce(rb);
+        nonbonded->createExceptionsFromBonds(bondPairs, 0.5, 0.5);
+    }
+    VerletIntegrator integrator(0.001);
+    map<string, string> properties;
+    properties[CpuPlatform::CpuDeterministicForces()] = "true";
+    properties[CpuPlatform::CpuThreads()] = "1";
+    Context context1(system, integrator, platform, properties);
+    context1.setPositions(positions);
+    State state1 = context1.getState(State::Energy | State::Forces);
+    for (string threads : {"2", "3", "4"}) {
+        VerletIntegrator integrator2(0.001);
+        properties[CpuPlatform::CpuThreads()] = threads;
+        Context context2(system, integrator2, platform, properties);
+        context2.setPositions(positions);
+        State state2 = context2.getState(State::Energy | State::Forces);
+        ASSERT_EQUAL(state1.getPotentialEnergy(), state2.getPotentialEnergy());
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 0.0);
+    }
+
+    // The results should agree with the normal floating point accumulation.
+
+    VerletIntegrator integrator3(0.001);
+    Context context3(system, integrator3, platform);
+    context3.setPositions(positions);
+    State state3 = context3.getState(State::Energy | State::Forces);
+    ASSERT_EQUAL_TOL(state3.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state3.getForces()[i], state1.getForces()[i], 1e-4);
+}
 
 void runPlatformTests() {
     testHugeSystem();
+    testDeterministicForces(NonbondedForce::NoCutoff, false);
+    testDeterministicForces(NonbondedForce::CutoffPeriodic, false);
+    testDeterministicForces(NonbondedForce::PME, false);
+    testDeterministicForces(NonbondedForce::CutoffPeriodic, true);
+    testDeterministicForces(NonbondedForce::PME, true);
+    testEnergyOnly(NonbondedForce::NoCutoff);
+    testEnergyOnly(NonbondedForce::CutoffPeriodic);
+    testEnergyOnly(NonbondedForce::Ewald);
+    testEnergyOnly(NonbondedForce::PME);
+    testEnergyOnly(NonbondedForce::LJPME);
 }
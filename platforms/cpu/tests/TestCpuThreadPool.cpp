@@ -0,0 +1,429 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+/**
+ * This tests the ThreadPool used by the CPU platform.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/internal/ThreadPool.h"
+#include "openmm/Context.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "CpuPlatform.h"
+#include "sfmt/SFMT.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+    #include <sched.h>
+#endif
+
+using namespace OpenMM;
+using namespace std;
+
+void testSynchronization(bool spinWait) {
+    // Run many short tasks that synchronize in the middle, and make sure every thread
+    // sees the results of the previous phase.
+
+    const int numThreads = 4;
+    const int numIterations = 2000;
+    ThreadPool threads(numThreads, spinWait);
+    ASSERT_EQUAL(numThreads, threads.getNumThreads());
+    ASSERT_EQUAL(spinWait, threads.getSpinWait());
+    vector<int> values(numThreads);
+    atomic<int> errors(0);
+    for (int iteration = 0; iteration < numIterations; iteration++) {
+        threads.execute([&] (ThreadPool& threads, int threadIndex) {
+            values[threadIndex] = iteration+threadIndex;
+            threads.syncThreads();
+            for (int i = 0; i < numThreads; i++)
+                if (values[i] != iteration+i)
+                    errors++;
+        });
+        threads.waitForThreads();
+        threads.resumeThreads();
+        threads.waitForThreads();
+    }
+    ASSERT_EQUAL(0, errors);
+}
+
+void testExecuteAndWait(bool spinWait) {
+    // Alternate between execute() and executeAndWait(), including tasks that synchronize in the
+    // middle, and make sure every index is executed exactly once with thread 0 on the calling thread.
+
+    const int numThreads = 4;
+    const int numIterations = 1000;
+    ThreadPool threads(numThreads, spinWait);
+    vector<int> values(numThreads), counts(numThreads, 0);
+    atomic<int> errors(0);
+    pthread_t caller = pthread_self();
+    for (int iteration = 0; iteration < numIterations; iteration++) {
+        threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+            if ((threadIndex == 0) != (pthread_equal(pthread_self(), caller) != 0))
+                errors++;
+            counts[threadIndex]++;
+            values[threadIndex] = iteration+threadIndex;
+            threads.syncThreads();
+            for (int i = 0; i < numThreads; i++)
+                if (values[i] != iteration+i)
+                    errors++;
+            threads.syncThreads();
+            values[threadIndex] = -1;
+        });
+        for (int i = 0; i < numThreads; i++)
+            ASSERT_EQUAL(-1, values[i]);
+        threads.execute([&] (ThreadPool& threads, int threadIndex) {
+            if (pthread_equal(pthread_self(), caller))
+                errors++;
+            counts[threadIndex]++;
+        });
+        threads.waitForThreads();
+    }
+    ASSERT_EQUAL(0, errors);
+    for (int i = 0; i < numThreads; i++)
+        ASSERT_EQUAL(2*numIterations, counts[i]);
+
+    // A pool with a single thread should run everything on the calling thread.
+
+    ThreadPool single(1, spinWait);
+    int count = 0;
+    single.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+        threads.syncThreads();
+        ASSERT(pthread_equal(pthread_self(), caller));
+        count++;
+    });
+    ASSERT_EQUAL(1, count);
+}
+
+void testExecuteAndWaitBound() {
+    // Once the threads are bound to cores, executeAndWait() should run every index on the worker
+    // threads, including tasks that synchronize in the middle.
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    int core = 0;
+    while (core < CPU_SETSIZE-1 && !CPU_ISSET(core, &allowed))
+        core++;
+    const int numThreads = 4;
+    const int numIterations = 200;
+    ThreadPool threads(numThreads);
+    threads.setThreadAffinity(vector<int>(1, core));
+    vector<int> values(numThreads), counts(numThreads, 0);
+    atomic<int> errors(0);
+    pthread_t caller = pthread_self();
+    for (int iteration = 0; iteration < numIterations; iteration++) {
+        threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+            if (pthread_equal(pthread_self(), caller))
+                errors++;
+            counts[threadIndex]++;
+            values[threadIndex] = iteration+threadIndex;
+            threads.syncThreads();
+            for (int i = 0; i < numThreads; i++)
+                if (values[i] != iteration+i)
+                    errors++;
+        });
+    }
+    ASSERT_EQUAL(0, errors);
+    for (int i = 0; i < numThreads; i++)
+        ASSERT_EQUAL(numIterations, counts[i]);
+#endif
+}
+
+void testWorkQueue(int numItems, int chunkSize) {
+    // Have every thread take work from a WorkQueue, and make sure each item is processed exactly
+    // once.  Items at the start of the range take much longer than the others, so the threads that
+    // finish their own shares first need to steal work.  The same queue is reused for a second phase.
+
+    const int numThreads = 4;
+    ThreadPool threads(numThreads);
+    ThreadPool::WorkQueue queue;
+    vector<atomic<int> > counts(numItems);
+    for (auto& count : counts)
+        count = 0;
+    atomic<int> errors(0);
+    auto processRanges = [&] (int threadIndex) {
+        int start, end;
+        while (queue.getNextRange(threadIndex, start, end)) {
+            if (start < 0 || end > numItems || end <= start || end-start > chunkSize)
+                errors++;
+            for (int i = max(0, start); i < min(end, numItems); i++) {
+                counts[i]++;
+                if (i < numItems/4)
+                    this_thread::sleep_for(chrono::microseconds(50));
+            }
+        }
+    };
+    queue.reset(threads, numItems, chunkSize);
+    threads.execute([&] (ThreadPool& threads, int threadIndex) {
+        processRanges(threadIndex);
+        threads.syncThreads();
+        int item;
+        while (queue.getNextItem(threadIndex, item)) {
+            if (item < 0 || item >= numItems)
+                errors++;
+            else
+                counts[item]++;
+        }
+    });
+    threads.waitForThreads();
+    for (int i = 0; i < numItems; i++)
+        ASSERT_EQUAL(1, counts[i]);
+    queue.reset(threads, numItems, chunkSize);
+    threads.resumeThreads();
+    threads.waitForThreads();
+    ASSERT_EQUAL(0, errors);
+    for (int i = 0; i < numItems; i++)
+        ASSERT_EQUAL(2, counts[i]);
+}
+
+void testConcurrentMasters() {
+    // Have several threads use the same ThreadPool at once.  Their tasks must not overlap, so each
+    // one should see its own data at every synchronization point.
+
+    const int numThreads = 4;
+    const int numMasters = 3;
+    const int numIterations = 300;
+    ThreadPool threads(numThreads);
+    atomic<int> errors(0);
+    vector<thread> masters;
+    for (int master = 0; master < numMasters; master++)
+        masters.push_back(thread([&, master] () {
+            vector<int> values(numThreads);
+            for (int iteration = 0; iteration < numIterations; iteration++) {
+                int expected = master*numIterations+iteration;
+                threads.execute([&] (ThreadPool& threads, int threadIndex) {
+                    values[threadIndex] = expected;
+                    threads.syncThreads();
+                    for (int i = 0; i < numThreads; i++)
+                        if (values[i] != expected)
+                            errors++;
+                });
+                threads.waitForThreads();
+                threads.resumeThreads();
+                threads.waitForThreads();
+                threads.executeAndWait([&] (ThreadPool& threads, int threadIndex) {
+                    values[threadIndex] = -expected;
+                    threads.syncThreads();
+                    for (int i = 0; i < numThreads; i++)
+                        if (values[i] != -expected)
+                            errors++;
+                });
+            }
+        }));
+    for (auto& master : masters)
+        master.join();
+    ASSERT_EQUAL(0, errors);
+}
+
+void testSpinWaitProperty() {
+    // Computing forces with spin waiting enabled should give the same results as without it.
+
+    const int numParticles = 200;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? -0.5 : 0.5, 0.2, 0.5);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    CpuPlatform platform;
+    VerletIntegrator integrator1(0.001), integrator2(0.001);
+    map<string, string> properties;
+    properties[CpuPlatform::CpuSpinWait()] = "true";
+    Context context1(system, integrator1, platform);
+    Context context2(system, integrator2, platform, properties);
+    ASSERT_EQUAL("false", platform.getPropertyValue(context1, CpuPlatform::CpuSpinWait()));
+    ASSERT_EQUAL("true", platform.getPropertyValue(context2, CpuPlatform::CpuSpinWait()));
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    State state1 = context1.getState(State::Forces | State::Energy);
+    State state2 = context2.getState(State::Forces | State::Energy);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+}
+
+void testThreadAffinityProperty() {
+    // Binding threads to cores should not change the results, and illegal values should be rejected.
+
+    const int numParticles = 200;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? -0.5 : 0.5, 0.2, 0.5);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    CpuPlatform platform;
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    ASSERT_EQUAL("none", platform.getPropertyValue(context, CpuPlatform::CpuThreadAffinity()));
+    context.setPositions(positions);
+    State state = context.getState(State::Forces | State::Energy);
+    for (string affinity : {"compact", "Scatter"}) {
+        VerletIntegrator integrator2(0.001);
+        map<string, string> properties;
+        properties[CpuPlatform::CpuThreadAffinity()] = affinity;
+        properties[CpuPlatform::CpuThreads()] = "4";
+        Context context2(system, integrator2, platform, properties);
+        transform(affinity.begin(), affinity.end(), affinity.begin(), ::tolower);
+        ASSERT_EQUAL(affinity, platform.getPropertyValue(context2, CpuPlatform::CpuThreadAffinity()));
+        context2.setPositions(positions);
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(state.getForces()[i], state2.getForces()[i], 1e-4);
+    }
+    for (string affinity : {"x", "1-", "3-1", "1,,2", "-2"}) {
+        VerletIntegrator integrator2(0.001);
+        map<string, string> properties;
+        properties[CpuPlatform::CpuThreadAffinity()] = affinity;
+        bool threwException = false;
+        try {
+            Context context2(system, integrator2, platform, properties);
+        }
+        catch (const OpenMMException& ex) {
+            threwException = true;
+        }
+        ASSERT(threwException);
+    }
+}
+
+void testSharedThreadPoolProperty() {
+    // Contexts that share a thread pool should give the same results as ones that don't, even when
+    // they are used from different threads at the same time.
+
+    const int numParticles = 200;
+    const int numContexts = 3;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? -0.5 : 0.5, 0.2, 0.5);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    CpuPlatform platform;
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    ASSERT_EQUAL("false", platform.getPropertyValue(context, CpuPlatform::CpuSharedThreadPool()));
+    context.setPositions(positions);
+    double expectedEnergy = context.getState(State::Energy).getPotentialEnergy();
+    vector<VerletIntegrator*> integrators;
+    vector<Context*> contexts;
+    map<string, string> properties;
+    properties[CpuPlatform::CpuSharedThreadPool()] = "true";
+    properties[CpuPlatform::CpuThreads()] = "4";
+    for (int i = 0; i < numContexts; i++) {
+        integrators.push_back(new VerletIntegrator(0.001));
+        contexts.push_back(new Context(system, *integrators[i], platform, properties));
+        ASSERT_EQUAL("true", platform.getPropertyValue(*contexts[i], CpuPlatform::CpuSharedThreadPool()));
+        ASSERT_EQUAL("4", platform.getPropertyValue(*contexts[i], CpuPlatform::CpuThreads()));
+        contexts[i]->setPositions(positions);
+    }
+    vector<thread> masters;
+    vector<double> maxError(numContexts, 0.0);
+    for (int i = 0; i < numContexts; i++)
+        masters.push_back(thread([&, i] () {
+            for (int j = 0; j < 20; j++) {
+                double energy = contexts[i]->getState(State::Energy).getPotentialEnergy();
+                maxError[i] = max(maxError[i], fabs(energy-expectedEnergy)/fabs(expectedEnergy));
+            }
+        }));
+    for (auto& master : masters)
+        master.join();
+    for (int i = 0; i < numContexts; i++) {
+        ASSERT(maxError[i] < 1e-5);
+        delete contexts[i];
+        delete integrators[i];
+    }
+}
+
+int main() {
+    try {
+        if (!CpuPlatform::isProcessorSupported()) {
+            cout << "CPU is not supported.  Exiting." << endl;
+            return 0;
+        }
+        testSynchronization(false);
+        testSynchronization(true);
+        testExecuteAndWait(false);
+        testExecuteAndWait(true);
+        testExecuteAndWaitBound();
+        testWorkQueue(0, 1);
+        testWorkQueue(3, 1);
+        testWorkQueue(1000, 1);
+        testWorkQueue(1000, 7);
+        testConcurrentMasters();
+        testSpinWaitProperty();
+        testThreadAffinityProperty();
+        testSharedThreadPoolProperty();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
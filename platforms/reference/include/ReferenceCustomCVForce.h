@@ -40,12 +40,23 @@ private:
     std::vector<std::string> variableNames, paramDerivNames;
     std::vector<Lepton::ExpressionProgram> variableDerivExpressions;
     std::vector<Lepton::ExpressionProgram> paramDerivExpressions;
+    std::vector<std::vector<int> > variableParticles;
+
+    /**
+     * Identify the particles a collective variable can apply forces to.  If this cannot be
+     * determined for the type of Force, or the particles can change after the Context is
+     * created, it returns all particles.
+     */
+    static void findAffectedParticles(const OpenMM::Force& force, int numParticles, std::vector<int>& particles);
 
 public:
     /**
      * Constructor
+     *
+     * @param force          the CustomCVForce to create it for
+     * @param numParticles   the number of particles in the System
      */
-    ReferenceCustomCVForce(const OpenMM::CustomCVForce& force);
+    ReferenceCustomCVForce(const OpenMM::CustomCVForce& force, int numParticles);
 
     /**
      * Destructor
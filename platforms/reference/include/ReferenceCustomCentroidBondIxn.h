@@ -33,7 +33,7 @@
 
 namespace OpenMM {
 
-class ReferenceCustomCentroidBondIxn : public ReferenceBondIxn {
+class OPENMM_EXPORT ReferenceCustomCentroidBondIxn : public ReferenceBondIxn {
 
    private:
 
@@ -61,14 +61,14 @@ class ReferenceCustomCentroidBondIxn : public ReferenceBondIxn {
 
          Calculate custom interaction for one bond
 
-         @param bond             the index of the bond
+         @param groups           the indices of the groups in the bond
          @param groupCenters     group center coordinates
          @param forces           force array (forces added)
          @param totalEnergy      total energy
 
          --------------------------------------------------------------------------------------- */
 
-      void calculateOneIxn(int bond, std::vector<OpenMM::Vec3>& groupCenters,
+      void calculateOneIxn(const std::vector<int>& groups, std::vector<OpenMM::Vec3>& groupCenters,
                            std::vector<OpenMM::Vec3>& forces, double* totalEnergy, double* energyParamDerivs);
 
       void computeDelta(int group1, int group2, double* delta, std::vector<OpenMM::Vec3>& groupCenters) const;
@@ -134,6 +134,34 @@ class ReferenceCustomCentroidBondIxn : public ReferenceBondIxn {
                             const std::map<std::string, double>& globalParameters,
                             std::vector<OpenMM::Vec3>& forces, double* totalEnergy, double* energyParamDerivs);
 
+      /**---------------------------------------------------------------------------------------
+
+         Set the values of global parameters.  This must be called before calculateBondIxn().
+
+         @param globalParameters   the values of global parameters
+
+         --------------------------------------------------------------------------------------- */
+
+      void setGlobalParameters(const std::map<std::string, double>& globalParameters);
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate the interaction for a single bond, given the group centers that have already
+         been computed.  Forces are applied to the groups, not to the individual atoms.
+
+         @param atomIndices      the indices of the groups in the bond
+         @param atomCoordinates  group center coordinates
+         @param parameters       the parameters of the bond
+         @param forces           group force array (forces added)
+         @param totalEnergy      if not null, the energy will be added to this
+         @param energyParamDerivs parameter derivatives are added to this
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateBondIxn(std::vector<int>& atomIndices, std::vector<OpenMM::Vec3>& atomCoordinates,
+                            std::vector<double>& parameters, std::vector<OpenMM::Vec3>& forces,
+                            double* totalEnergy, double* energyParamDerivs);
+
 // ---------------------------------------------------------------------------------------
 
 };
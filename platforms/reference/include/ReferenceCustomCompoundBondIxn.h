@@ -33,7 +33,7 @@
 
 namespace OpenMM {
 
-class ReferenceCustomCompoundBondIxn : public ReferenceBondIxn {
+class OPENMM_EXPORT ReferenceCustomCompoundBondIxn : public ReferenceBondIxn {
 
    private:
 
@@ -59,14 +59,14 @@ class ReferenceCustomCompoundBondIxn : public ReferenceBondIxn {
 
          Calculate custom interaction for one bond
 
-         @param bond             the index of the bond
+         @param atoms            the indices of the atoms in the bond
          @param atomCoordinates  atom coordinates
          @param forces           force array (forces added)
          @param totalEnergy      total energy
 
          --------------------------------------------------------------------------------------- */
 
-      void calculateOneIxn(int bond, std::vector<OpenMM::Vec3>& atomCoordinates,
+      void calculateOneIxn(const std::vector<int>& atoms, std::vector<OpenMM::Vec3>& atomCoordinates,
                            std::vector<OpenMM::Vec3>& forces, double* totalEnergy, double* energyParamDerivs);
 
       void computeDelta(int atom1, int atom2, double* delta, std::vector<OpenMM::Vec3>& atomCoordinates) const;
@@ -131,6 +131,34 @@ class ReferenceCustomCompoundBondIxn : public ReferenceBondIxn {
                             const std::map<std::string, double>& globalParameters,
                             std::vector<OpenMM::Vec3>& forces, double* totalEnergy, double* energyParamDerivs);
 
+      /**---------------------------------------------------------------------------------------
+
+         Set the values of global parameters.  This must be called before calculateBondIxn().
+
+         @param globalParameters   the values of global parameters
+
+         --------------------------------------------------------------------------------------- */
+
+      void setGlobalParameters(const std::map<std::string, double>& globalParameters);
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate the interaction for a single bond.  This allows bonds to be divided between
+         threads, each of which uses its own ReferenceCustomCompoundBondIxn.
+
+         @param atomIndices      the indices of the atoms in the bond
+         @param atomCoordinates  atom coordinates
+         @param parameters       the parameters of the bond
+         @param forces           force array (forces added)
+         @param totalEnergy      if not null, the energy will be added to this
+         @param energyParamDerivs parameter derivatives are added to this
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateBondIxn(std::vector<int>& atomIndices, std::vector<OpenMM::Vec3>& atomCoordinates,
+                            std::vector<double>& parameters, std::vector<OpenMM::Vec3>& forces,
+                            double* totalEnergy, double* energyParamDerivs);
+
 // ---------------------------------------------------------------------------------------
 
 };
@@ -34,6 +34,7 @@
 
 #include "ReferencePlatform.h"
 #include "openmm/kernels.h"
+#include "openmm/internal/CustomNonbondedForceImpl.h"
 #include "SimTKOpenMMRealType.h"
 #include "ReferenceNeighborList.h"
 #include "lepton/CompiledExpression.h"
@@ -107,6 +108,13 @@ public:
      * energy directly, <i>or</i> add it to an internal buffer so that it will be included here.
      */
     double finishComputation(ContextImpl& context, bool includeForce, bool includeEnergy, int groups, bool& valid);
+    /**
+     * Get whether every force kernel on this platform returns its energy directly, so finishComputation() never
+     * adds any energy of its own.
+     */
+    bool isEnergyReturnedByForces() const {
+        return true;
+    }
 private:
     std::vector<Vec3> savedForces;
 };
@@ -202,6 +210,11 @@ public:
      */
     void loadCheckpoint(ContextImpl& context, std::istream& stream);
 private:
+    /**
+     * Throw an exception if this context's state is shared with another one (see
+     * ReferencePlatform::PlatformData::shareStateWith()), since writing to it would modify the other context.
+     */
+    void checkStateIsWritable() const;
     ReferencePlatform::PlatformData& data;
 };
 
@@ -674,6 +687,7 @@ private:
     double nonbondedCutoff, switchingDistance, periodicBoxSize[3], longRangeCoefficient;
     bool useSwitchingFunction, hasInitializedLongRangeCorrection;
     CustomNonbondedForce* forceCopy;
+    CustomNonbondedForceImpl::LongRangeCorrectionData longRangeCorrectionData;
     std::map<std::string, double> globalParamValues;
     std::vector<std::set<int> > exclusions;
     Lepton::CompiledExpression energyExpression, forceExpression;
@@ -805,8 +819,8 @@ public:
      * @param force      the CustomExternalForce to copy the parameters from
      */
     void copyParametersToContext(ContextImpl& context, const CustomExternalForce& force);
-private:
     class PeriodicDistanceFunction;
+private:
     int numParticles;
     ReferenceCustomExternalIxn* ixn;
     std::vector<int> particles;
@@ -816,6 +830,10 @@ private:
     Vec3* boxVectors;
 };
 
+/**
+ * This is the implementation of the periodicdistance() function used by CustomExternalForce.  It only
+ * reads the box vectors, so a single copy may safely be evaluated by many threads at once.
+ */
 class ReferenceCalcCustomExternalForceKernel::PeriodicDistanceFunction : public Lepton::CustomFunction {
 public:
     Vec3** boxVectorHandle;
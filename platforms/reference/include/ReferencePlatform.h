@@ -63,6 +63,13 @@ class OPENMM_EXPORT ReferencePlatform::PlatformData {
 public:
     PlatformData(const System& system);
     ~PlatformData();
+    /**
+     * Make this context use the position, velocity, and periodic box storage of another context instead
+     * of its own.  This lets a linked context, such as the inner context of a CustomCVForce, see the
+     * parent context's state without copying it.  The other context must outlive this one.
+     */
+    void shareStateWith(PlatformData& other);
+    bool ownsState;
     int numParticles, stepCount;
     double time;
     std::vector<Vec3>* positions;
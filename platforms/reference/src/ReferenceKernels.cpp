@@ -220,7 +220,13 @@ void ReferenceUpdateStateDataKernel::getPositions(ContextImpl& context, std::vec
         positions[i] = Vec3(posData[i][0], posData[i][1], posData[i][2]);
 }
 
+void ReferenceUpdateStateDataKernel::checkStateIsWritable() const {
+    if (!data.ownsState)
+        throw OpenMMException("This Context shares its positions, velocities, and box vectors with another Context, so they cannot be modified directly");
+}
+
 void ReferenceUpdateStateDataKernel::setPositions(ContextImpl& context, const std::vector<Vec3>& positions) {
+    checkStateIsWritable();
     int numParticles = context.getSystem().getNumParticles();
     vector<Vec3>& posData = extractPositions(context);
     for (int i = 0; i < numParticles; ++i) {
@@ -239,6 +245,7 @@ void ReferenceUpdateStateDataKernel::getVelocities(ContextImpl& context, std::ve
 }
 
 void ReferenceUpdateStateDataKernel::setVelocities(ContextImpl& context, const std::vector<Vec3>& velocities) {
+    checkStateIsWritable();
     int numParticles = context.getSystem().getNumParticles();
     vector<Vec3>& velData = extractVelocities(context);
     for (int i = 0; i < numParticles; ++i) {
@@ -268,6 +275,7 @@ void ReferenceUpdateStateDataKernel::getPeriodicBoxVectors(ContextImpl& context,
 }
 
 void ReferenceUpdateStateDataKernel::setPeriodicBoxVectors(ContextImpl& context, const Vec3& a, const Vec3& b, const Vec3& c) {
+    checkStateIsWritable();
     Vec3& box = extractBoxSize(context);
     box[0] = a[0];
     box[1] = b[1];
@@ -292,6 +300,7 @@ void ReferenceUpdateStateDataKernel::createCheckpoint(ContextImpl& context, ostr
 }
 
 void ReferenceUpdateStateDataKernel::loadCheckpoint(ContextImpl& context, istream& stream) {
+    checkStateIsWritable();
     int version;
     stream.read((char*) &version, sizeof(int));
     if (version != 3)
@@ -1198,6 +1207,7 @@ void ReferenceCalcCustomNonbondedForceKernel::initialize(const System& system, c
     
     if (force.getNonbondedMethod() == CustomNonbondedForce::CutoffPeriodic && force.getUseLongRangeCorrection()) {
         forceCopy = new CustomNonbondedForce(force);
+        CustomNonbondedForceImpl::prepareLongRangeCorrection(force, longRangeCorrectionData);
         hasInitializedLongRangeCorrection = false;
     }
     else {
@@ -1251,7 +1261,7 @@ double ReferenceCalcCustomNonbondedForceKernel::execute(ContextImpl& context, bo
     // Add in the long range correction.
     
     if (!hasInitializedLongRangeCorrection || (globalParamsChanged && forceCopy != NULL)) {
-        CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, context.getOwner(), longRangeCoefficient, longRangeCoefficientDerivs);
+        CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, longRangeCorrectionData, context.getOwner(), longRangeCoefficient, longRangeCoefficientDerivs);
         hasInitializedLongRangeCorrection = true;
     }
     double volume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
@@ -1279,7 +1289,8 @@ void ReferenceCalcCustomNonbondedForceKernel::copyParametersToContext(ContextImp
     // If necessary, recompute the long range correction.
     
     if (forceCopy != NULL) {
-        CustomNonbondedForceImpl::calcLongRangeCorrection(force, context.getOwner(), longRangeCoefficient, longRangeCoefficientDerivs);
+        CustomNonbondedForceImpl::prepareLongRangeCorrection(force, longRangeCorrectionData);
+        CustomNonbondedForceImpl::calcLongRangeCorrection(force, longRangeCorrectionData, context.getOwner(), longRangeCoefficient, longRangeCoefficientDerivs);
         hasInitializedLongRangeCorrection = true;
         *forceCopy = force;
     }
@@ -2023,7 +2034,7 @@ void ReferenceCalcCustomCVForceKernel::initialize(const System& system, const Cu
         globalParameterNames.push_back(force.getGlobalParameterName(i));
     for (int i = 0; i < force.getNumEnergyParameterDerivatives(); i++)
         energyParamDerivNames.push_back(force.getEnergyParameterDerivativeName(i));
-    ixn = new ReferenceCustomCVForce(force);
+    ixn = new ReferenceCustomCVForce(force, system.getNumParticles());
 }
 
 double ReferenceCalcCustomCVForceKernel::execute(ContextImpl& context, ContextImpl& innerContext, bool includeForces, bool includeEnergy) {
@@ -2040,11 +2051,13 @@ double ReferenceCalcCustomCVForceKernel::execute(ContextImpl& context, ContextIm
 }
 
 void ReferenceCalcCustomCVForceKernel::copyState(ContextImpl& context, ContextImpl& innerContext) {
-    extractPositions(innerContext) = extractPositions(context);
-    extractVelocities(innerContext) = extractVelocities(context);
-    Vec3 a, b, c;
-    context.getPeriodicBoxVectors(a, b, c);
-    innerContext.setPeriodicBoxVectors(a, b, c);
+    // The inner context uses the same position, velocity, and box storage as the outer one, so
+    // there is nothing to copy except the time and parameters.
+
+    ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    ReferencePlatform::PlatformData* innerData = reinterpret_cast<ReferencePlatform::PlatformData*>(innerContext.getPlatformData());
+    if (innerData->positions != data->positions)
+        innerData->shareStateWith(*data);
     innerContext.setTime(context.getTime());
     map<string, double> innerParameters = innerContext.getParameters();
     for (auto& param : innerParameters)
@@ -95,7 +95,7 @@ void ReferencePlatform::contextDestroyed(ContextImpl& context) const {
     delete data;
 }
 
-ReferencePlatform::PlatformData::PlatformData(const System& system) : time(0.0), stepCount(0), numParticles(system.getNumParticles()) {
+ReferencePlatform::PlatformData::PlatformData(const System& system) : ownsState(true), time(0.0), stepCount(0), numParticles(system.getNumParticles()) {
     positions = new vector<Vec3>(numParticles);
     velocities = new vector<Vec3>(numParticles);
     forces = new vector<Vec3>(numParticles);
@@ -106,11 +106,27 @@ ReferencePlatform::PlatformData::PlatformData(const System& system) : time(0.0),
 }
 
 ReferencePlatform::PlatformData::~PlatformData() {
-    delete positions;
-    delete velocities;
+    if (ownsState) {
+        delete positions;
+        delete velocities;
+        delete periodicBoxSize;
+        delete[] periodicBoxVectors;
+    }
     delete forces;
-    delete periodicBoxSize;
-    delete[] periodicBoxVectors;
     delete constraints;
     delete energyParameterDerivatives;
 }
+
+void ReferencePlatform::PlatformData::shareStateWith(PlatformData& other) {
+    if (ownsState) {
+        delete positions;
+        delete velocities;
+        delete periodicBoxSize;
+        delete[] periodicBoxVectors;
+    }
+    positions = other.positions;
+    velocities = other.velocities;
+    periodicBoxSize = other.periodicBoxSize;
+    periodicBoxVectors = other.periodicBoxVectors;
+    ownsState = false;
+}
@@ -170,7 +170,7 @@ ReferenceCCMAAlgorithm::ReferenceCCMAAlgorithm(int numberOfAtoms,
         // since this can be very slow.
         
         ThreadPool threads;
-        threads.execute([&] (ThreadPool& pool, int threadIndex) {
+        threads.executeAndWait([&] (ThreadPool& pool, int threadIndex) {
             vector<double> rhs(numberOfConstraints);
             for (int i = threadIndex; i < numberOfConstraints; i += pool.getNumThreads()) {
                 // Extract column i of the inverse matrix.
@@ -186,7 +186,6 @@ ReferenceCCMAAlgorithm::ReferenceCCMAAlgorithm(int numberOfAtoms,
                 }
             }
         });
-        threads.waitForThreads();
 
         // For purposes of thread safety we extracted the matrix in transposed form, so we need to transpose it again.
 
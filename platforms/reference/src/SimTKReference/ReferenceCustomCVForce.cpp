@@ -25,18 +25,32 @@
 #include "ReferenceCustomCVForce.h"
 #include "ReferencePlatform.h"
 #include "ReferenceTabulatedFunction.h"
+#include "openmm/CustomAngleForce.h"
+#include "openmm/CustomBondForce.h"
+#include "openmm/CustomCentroidBondForce.h"
+#include "openmm/CustomCompoundBondForce.h"
+#include "openmm/CustomExternalForce.h"
+#include "openmm/CustomTorsionForce.h"
+#include "openmm/HarmonicAngleForce.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/PeriodicTorsionForce.h"
+#include "openmm/RBTorsionForce.h"
 #include "lepton/CustomFunction.h"
 #include "lepton/ParsedExpression.h"
 #include "lepton/Parser.h"
 #include "lepton/Operation.h"
+#include <set>
 
 using namespace OpenMM;
 using namespace Lepton;
 using namespace std;
 
-ReferenceCustomCVForce::ReferenceCustomCVForce(const CustomCVForce& force) {
-    for (int i = 0; i < force.getNumCollectiveVariables(); i++)
+ReferenceCustomCVForce::ReferenceCustomCVForce(const CustomCVForce& force, int numParticles) {
+    variableParticles.resize(force.getNumCollectiveVariables());
+    for (int i = 0; i < force.getNumCollectiveVariables(); i++) {
         variableNames.push_back(force.getCollectiveVariableName(i));
+        findAffectedParticles(force.getCollectiveVariable(i), numParticles, variableParticles[i]);
+    }
     for (int i = 0; i < force.getNumEnergyParameterDerivatives(); i++)
         paramDerivNames.push_back(force.getEnergyParameterDerivativeName(i));
 
@@ -63,6 +77,93 @@ ReferenceCustomCVForce::ReferenceCustomCVForce(const CustomCVForce& force) {
         delete function.second;
 }
 
+void ReferenceCustomCVForce::findAffectedParticles(const Force& force, int numParticles, vector<int>& particles) {
+    set<int> affected;
+    vector<int> atoms;
+    vector<double> params;
+    int p1, p2, p3, p4;
+    double d1, d2, d3, d4, d5, d6;
+    if (dynamic_cast<const CustomBondForce*>(&force) != NULL) {
+        const CustomBondForce& f = dynamic_cast<const CustomBondForce&>(force);
+        for (int i = 0; i < f.getNumBonds(); i++) {
+            f.getBondParameters(i, p1, p2, params);
+            affected.insert({p1, p2});
+        }
+    }
+    else if (dynamic_cast<const CustomAngleForce*>(&force) != NULL) {
+        const CustomAngleForce& f = dynamic_cast<const CustomAngleForce&>(force);
+        for (int i = 0; i < f.getNumAngles(); i++) {
+            f.getAngleParameters(i, p1, p2, p3, params);
+            affected.insert({p1, p2, p3});
+        }
+    }
+    else if (dynamic_cast<const CustomTorsionForce*>(&force) != NULL) {
+        const CustomTorsionForce& f = dynamic_cast<const CustomTorsionForce&>(force);
+        for (int i = 0; i < f.getNumTorsions(); i++) {
+            f.getTorsionParameters(i, p1, p2, p3, p4, params);
+            affected.insert({p1, p2, p3, p4});
+        }
+    }
+    else if (dynamic_cast<const CustomExternalForce*>(&force) != NULL) {
+        const CustomExternalForce& f = dynamic_cast<const CustomExternalForce&>(force);
+        for (int i = 0; i < f.getNumParticles(); i++) {
+            f.getParticleParameters(i, p1, params);
+            affected.insert(p1);
+        }
+    }
+    else if (dynamic_cast<const CustomCompoundBondForce*>(&force) != NULL) {
+        const CustomCompoundBondForce& f = dynamic_cast<const CustomCompoundBondForce&>(force);
+        for (int i = 0; i < f.getNumBonds(); i++) {
+            f.getBondParameters(i, atoms, params);
+            affected.insert(atoms.begin(), atoms.end());
+        }
+    }
+    else if (dynamic_cast<const CustomCentroidBondForce*>(&force) != NULL) {
+        const CustomCentroidBondForce& f = dynamic_cast<const CustomCentroidBondForce&>(force);
+        for (int i = 0; i < f.getNumGroups(); i++) {
+            f.getGroupParameters(i, atoms, params);
+            affected.insert(atoms.begin(), atoms.end());
+        }
+    }
+    else if (dynamic_cast<const HarmonicBondForce*>(&force) != NULL) {
+        const HarmonicBondForce& f = dynamic_cast<const HarmonicBondForce&>(force);
+        for (int i = 0; i < f.getNumBonds(); i++) {
+            f.getBondParameters(i, p1, p2, d1, d2);
+            affected.insert({p1, p2});
+        }
+    }
+    else if (dynamic_cast<const HarmonicAngleForce*>(&force) != NULL) {
+        const HarmonicAngleForce& f = dynamic_cast<const HarmonicAngleForce&>(force);
+        for (int i = 0; i < f.getNumAngles(); i++) {
+            f.getAngleParameters(i, p1, p2, p3, d1, d2);
+            affected.insert({p1, p2, p3});
+        }
+    }
+    else if (dynamic_cast<const PeriodicTorsionForce*>(&force) != NULL) {
+        const PeriodicTorsionForce& f = dynamic_cast<const PeriodicTorsionForce&>(force);
+        int periodicity;
+        for (int i = 0; i < f.getNumTorsions(); i++) {
+            f.getTorsionParameters(i, p1, p2, p3, p4, periodicity, d1, d2);
+            affected.insert({p1, p2, p3, p4});
+        }
+    }
+    else if (dynamic_cast<const RBTorsionForce*>(&force) != NULL) {
+        const RBTorsionForce& f = dynamic_cast<const RBTorsionForce&>(force);
+        for (int i = 0; i < f.getNumTorsions(); i++) {
+            f.getTorsionParameters(i, p1, p2, p3, p4, d1, d2, d3, d4, d5, d6);
+            affected.insert({p1, p2, p3, p4});
+        }
+    }
+    else {
+        // For any other force, assume it may affect every particle.  This includes RMSDForce, since
+        // updateParametersInContext() on the inner Context can change which particles it uses.
+
+        for (int i = 0; i < numParticles; i++)
+            affected.insert(i);
+    }
+    particles = vector<int>(affected.begin(), affected.end());
+}
+
 static void replaceFunctionsInExpression(map<string, CustomFunction*>& functions, ExpressionProgram& expression) {
     for (int i = 0; i < expression.getNumOperations(); i++) {
         if (expression.getOperation(i).getId() == Operation::CUSTOM) {
@@ -105,18 +206,20 @@ void ReferenceCustomCVForce::calculateIxn(ContextImpl& innerContext, vector<Vec3
     ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(innerContext.getPlatformData());
     vector<Vec3>& innerForces = *((vector<Vec3>*) data->forces);
     map<string, double>& innerDerivs = *((map<string, double>*) data->energyParameterDerivatives);
-    vector<double> cvValues;
-    vector<vector<Vec3> > cvForces;
+    vector<double> cvValues(numCVs);
+    vector<vector<Vec3> > cvForces(numCVs);
     vector<map<string, double> > cvDerivs;
     for (int i = 0; i < numCVs; i++) {
-        cvValues.push_back(innerContext.calcForcesAndEnergy(true, true, 1<<i));
-        cvForces.push_back(innerForces);
+        cvValues[i] = innerContext.calcForcesAndEnergy(true, true, 1<<i);
+        const vector<int>& particles = variableParticles[i];
+        cvForces[i].resize(particles.size());
+        for (int j = 0; j < particles.size(); j++)
+            cvForces[i][j] = innerForces[particles[j]];
         cvDerivs.push_back(innerDerivs);
     }
     
-    // Compute the energy and forces.
+    // Compute the energy and forces.  Each variable only contributes forces to the particles it depends on.
     
-    int numParticles = atomCoordinates.size();
     map<string, double> variables = globalParameters;
     for (int i = 0; i < numCVs; i++)
         variables[variableNames[i]] = cvValues[i];
@@ -124,8 +227,9 @@ void ReferenceCustomCVForce::calculateIxn(ContextImpl& innerContext, vector<Vec3
         *totalEnergy += energyExpression.evaluate(variables);
     for (int i = 0; i < numCVs; i++) {
         double dEdV = variableDerivExpressions[i].evaluate(variables);
-        for (int j = 0; j < numParticles; j++)
-            forces[j] += cvForces[i][j]*dEdV;
+        const vector<int>& particles = variableParticles[i];
+        for (int j = 0; j < particles.size(); j++)
+            forces[particles[j]] += cvForces[i][j]*dEdV;
     }
     
     // Compute the energy parameter derivatives.
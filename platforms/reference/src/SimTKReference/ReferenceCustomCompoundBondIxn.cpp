@@ -119,21 +119,32 @@ void ReferenceCustomCompoundBondIxn::setPeriodic(OpenMM::Vec3* vectors) {
 void ReferenceCustomCompoundBondIxn::calculatePairIxn(vector<Vec3>& atomCoordinates, vector<vector<double> >& bondParameters,
                                              const map<string, double>& globalParameters, vector<Vec3>& forces,
                                              double* totalEnergy, double* energyParamDerivs) {
-    for (auto& param : globalParameters)
-        expressionSet.setVariable(expressionSet.getVariableIndex(param.first), param.second);
+    setGlobalParameters(globalParameters);
     int numBonds = bondAtoms.size();
     for (int bond = 0; bond < numBonds; bond++) {
         for (int i = 0; i < numParameters; i++)
             expressionSet.setVariable(bondParamIndex[i], bondParameters[bond][i]);
-        calculateOneIxn(bond, atomCoordinates, forces, totalEnergy, energyParamDerivs);
+        calculateOneIxn(bondAtoms[bond], atomCoordinates, forces, totalEnergy, energyParamDerivs);
     }
 }
 
+void ReferenceCustomCompoundBondIxn::setGlobalParameters(const map<string, double>& globalParameters) {
+    for (auto& param : globalParameters)
+        expressionSet.setVariable(expressionSet.getVariableIndex(param.first), param.second);
+}
+
+void ReferenceCustomCompoundBondIxn::calculateBondIxn(vector<int>& atomIndices, vector<Vec3>& atomCoordinates, vector<double>& parameters,
+                                                      vector<Vec3>& forces, double* totalEnergy, double* energyParamDerivs) {
+    for (int i = 0; i < numParameters; i++)
+        expressionSet.setVariable(bondParamIndex[i], parameters[i]);
+    calculateOneIxn(atomIndices, atomCoordinates, forces, totalEnergy, energyParamDerivs);
+}
+
   /**---------------------------------------------------------------------------------------
 
      Calculate interaction for one bond
 
-     @param bond             the index of the bond
+     @param atoms            the indices of the atoms in the bond
      @param atomCoordinates  atom coordinates
      @param forces           force array (forces added)
      @param energyByAtom     atom energy
@@ -141,11 +152,10 @@ void ReferenceCustomCompoundBondIxn::calculatePairIxn(vector<Vec3>& atomCoordina
 
      --------------------------------------------------------------------------------------- */
 
-void ReferenceCustomCompoundBondIxn::calculateOneIxn(int bond, vector<Vec3>& atomCoordinates,
+void ReferenceCustomCompoundBondIxn::calculateOneIxn(const vector<int>& atoms, vector<Vec3>& atomCoordinates,
                         vector<Vec3>& forces, double* totalEnergy, double* energyParamDerivs) {
     // Compute all of the variables the energy can depend on.
 
-    const vector<int>& atoms = bondAtoms[bond];
     for (auto& term : particleTerms)
         expressionSet.setVariable(term.index, atomCoordinates[atoms[term.atom]][term.component]);
     for (auto& term : distanceTerms) {
@@ -32,5 +32,74 @@
 #include "ReferenceTests.h"
 #include "TestCustomCVForce.h"
 
+void testSharedState() {
+    // Run a short simulation with a CustomCVForce and with the equivalent ordinary forces.  This checks
+    // that the inner context sees every change to the positions and box without them being copied,
+    // and that forces are applied to the right particles whether or not a variable's particles are known.
+
+    const int numParticles = 50;
+    System system1, system2;
+    for (int i = 0; i < numParticles; i++) {
+        system1.addParticle(1.0);
+        system2.addParticle(1.0);
+    }
+    CustomCVForce* cv = new CustomCVForce("0.5*k*(d-1)^2+0.1*e");
+    cv->addGlobalParameter("k", 5.0);
+    CustomBondForce* d = new CustomBondForce("r");
+    d->addBond(3, 17);
+    cv->addCollectiveVariable("d", d);
+    CustomNonbondedForce* e = new CustomNonbondedForce("exp(-r)");
+    for (int i = 0; i < numParticles; i++)
+        e->addParticle();
+    cv->addCollectiveVariable("e", e);
+    system1.addForce(cv);
+    CustomBondForce* bond = new CustomBondForce("0.5*5.0*(r-1)^2");
+    bond->addBond(3, 17);
+    system2.addForce(bond);
+    CustomNonbondedForce* nonbonded = new CustomNonbondedForce("0.1*exp(-r)");
+    for (int i = 0; i < numParticles; i++)
+        nonbonded->addParticle();
+    system2.addForce(nonbonded);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions;
+    for (int i = 0; i < numParticles; i++)
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*3);
+    VerletIntegrator integrator1(0.002);
+    VerletIntegrator integrator2(0.002);
+    Context context1(system1, integrator1, platform);
+    Context context2(system2, integrator2, platform);
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    for (int i = 0; i < 5; i++) {
+        integrator1.step(10);
+        integrator2.step(10);
+        State state1 = context1.getState(State::Positions | State::Forces | State::Energy);
+        State state2 = context2.getState(State::Positions | State::Forces | State::Energy);
+        State innerState = cv->getInnerContext(context1).getState(State::Positions);
+        ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+        for (int j = 0; j < numParticles; j++) {
+            ASSERT_EQUAL_VEC(state2.getPositions()[j], state1.getPositions()[j], 1e-5);
+            ASSERT_EQUAL_VEC(state1.getPositions()[j], innerState.getPositions()[j], 0);
+            ASSERT_EQUAL_VEC(state2.getForces()[j], state1.getForces()[j], 1e-5);
+        }
+    }
+
+    // Modifying the inner context would change the outer one, so it should throw an exception.
+
+    bool threwException = false;
+    try {
+        cv->getInnerContext(context1).setPositions(positions);
+    }
+    catch (OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+    State finalState = context1.getState(State::Positions);
+    for (int j = 0; j < numParticles; j++)
+        ASSERT(finalState.getPositions()[j] != positions[j]);
+}
+
 void runPlatformTests() {
+    testSharedState();
 }
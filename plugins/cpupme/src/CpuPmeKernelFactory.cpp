@@ -29,6 +29,7 @@
 #include "internal/windowsExportPme.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/OpenMMException.h"
+#include <algorithm>
 
 using namespace OpenMM;
 
@@ -55,9 +56,15 @@ extern "C" OPENMM_EXPORT_PME void registerPlatforms() {
 #endif
 
 KernelImpl* CpuPmeKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
+    // Share worker threads with other kernels only if the Context asked for a shared thread pool.
+
+    const std::string sharedProperty = "SharedThreadPool";
+    const std::vector<std::string>& propertyNames = platform.getPropertyNames();
+    bool useSharedThreadPool = (std::find(propertyNames.begin(), propertyNames.end(), sharedProperty) != propertyNames.end() &&
+            platform.getPropertyValue(context.getOwner(), sharedProperty) == "true");
     if (name == CalcPmeReciprocalForceKernel::Name())
-        return new CpuCalcPmeReciprocalForceKernel(name, platform);
+        return new CpuCalcPmeReciprocalForceKernel(name, platform, useSharedThreadPool);
     if (name == CalcDispersionPmeReciprocalForceKernel::Name())
-        return new CpuCalcDispersionPmeReciprocalForceKernel(name, platform);
+        return new CpuCalcDispersionPmeReciprocalForceKernel(name, platform, useSharedThreadPool);
     throw OpenMMException((std::string("Tried to create kernel with illegal kernel name '")+name+"'").c_str());
 }
@@ -47,12 +47,18 @@ using namespace OpenMM;
 using namespace std;
 
 static const int PME_ORDER = 5;
+static const double FIXED_POINT_SCALE = (double) 0x100000000;
 
 bool CpuCalcDispersionPmeReciprocalForceKernel::hasInitializedThreads = false;
 int CpuCalcDispersionPmeReciprocalForceKernel::numThreads = 0;
 
+/**
+ * Spread the charges onto a grid.  If fixedGrid is not NULL, the charges are accumulated into it as fixed point
+ * values instead of into grid.  That makes the sum independent of the order in which particles are processed,
+ * so particles can still be divided dynamically between threads.
+ */
 static void spreadCharge(float* posq, float* grid, int gridx, int gridy, int gridz, int numParticles, Vec3* periodicBoxVectors, Vec3* recipBoxVectors,
-        atomic<int>& atomicCounter, const float epsilonFactor, int threadIndex, int numThreads, bool deterministic) {
+        atomic<int>& atomicCounter, const float epsilonFactor, int numThreads, long long* fixedGrid) {
     float temp[4];
     fvec4 boxSize((float) periodicBoxVectors[0][0], (float) periodicBoxVectors[1][1], (float) periodicBoxVectors[2][2], 0);
     fvec4 invBoxSize((float) recipBoxVectors[0][0], (float) recipBoxVectors[1][1], (float) recipBoxVectors[2][2], 0);
@@ -64,14 +70,14 @@ static void spreadCharge(float* posq, float* grid, int gridx, int gridy, int gri
     fvec4 one(1);
     fvec4 scale(1.0f/(PME_ORDER-1));
     float posInBox[4] = {0,0,0,0};
-    memset(grid, 0, sizeof(float)*gridx*gridy*gridz);
+    if (fixedGrid != NULL)
+        memset(fixedGrid, 0, sizeof(long long)*gridx*gridy*gridz);
+    else
+        memset(grid, 0, sizeof(float)*gridx*gridy*gridz);
 
     const int groupSize = max(1, numParticles / (10 * numThreads));
-    int start = groupSize * threadIndex;
     while (true) {
-        if (!deterministic)
-            start = atomicCounter.fetch_add(groupSize);
-
+        int start = atomicCounter.fetch_add(groupSize);
         if (start >= numParticles)
             break;
 
@@ -120,7 +126,23 @@ static void spreadCharge(float* posq, float* grid, int gridx, int gridy, int gri
             float charge = epsilonFactor*posq[4*i+3];
             fvec4 zdata0to3(data[0][2], data[1][2], data[2][2], data[3][2]);
             float zdata4 = data[4][2];
-            if (gridIndexZ+4 < gridz) {
+            if (fixedGrid != NULL) {
+                for (int ix = 0; ix < PME_ORDER; ix++) {
+                    int xbase = gridIndexX+ix;
+                    xbase -= (xbase >= gridx ? gridx : 0);
+                    xbase = xbase*gridy*gridz;
+                    float xdata = charge*data[ix][0];
+                    for (int iy = 0; iy < PME_ORDER; iy++) {
+                        int ybase = gridIndexY+iy;
+                        ybase -= (ybase >= gridy ? gridy : 0);
+                        ybase = xbase + ybase*gridz;
+                        float multiplier = xdata*data[iy][1];
+                        for (int iz = 0; iz < PME_ORDER; iz++)
+                            fixedGrid[ybase+zindex[iz]] += (long long) (multiplier*data[iz][2]*FIXED_POINT_SCALE);
+                    }
+                }
+            }
+            else if (gridIndexZ+4 < gridz) {
                 for (int ix = 0; ix < PME_ORDER; ix++) {
                     int xbase = gridIndexX+ix;
                     xbase -= (xbase >= gridx ? gridx : 0);
@@ -159,9 +181,20 @@ static void spreadCharge(float* posq, float* grid, int gridx, int gridy, int gri
                 }
             }
         }
+    }
+}
 
-        if (deterministic)
-            start += groupSize * numThreads;
+/**
+ * Add up the fixed point grids computed by all threads for the range of grid points [start, end), and store the
+ * result into grid.
+ */
+static void sumFixedPointGrids(float* grid, const vector<vector<long long> >& fixedGrid, int start, int end) {
+    int numGrids = fixedGrid.size();
+    for (int i = start; i < end; i++) {
+        long long sum = 0;
+        for (int j = 0; j < numGrids; j++)
+            sum += fixedGrid[j][i];
+        grid[i] = (float) (sum/FIXED_POINT_SCALE);
     }
 }
 
@@ -441,9 +474,16 @@ void CpuCalcPmeReciprocalForceKernel::initialize(int xsize, int ysize, int zsize
     this->deterministic = deterministic;
     force.resize(4*numParticles);
     recipEterm.resize(gridx*gridy*gridz);
+    if (deterministic)
+        fixedGrid.resize(numThreads, vector<long long>(gridx*gridy*gridz));
     
-    // Initialize threads.
+    // Initialize threads.  If the owning context asked for it, the worker threads come from a pool
+    // shared with everything else in the process that uses the same number of threads.
     
+    if (useSharedThreadPool)
+        threadPool = ThreadPool::getSharedThreadPool(numThreads);
+    else
+        threadPool = make_shared<ThreadPool>(numThreads);
     isFinished = false;
     pthread_cond_init(&startCondition, NULL);
     pthread_cond_init(&endCondition, NULL);
@@ -549,7 +589,7 @@ void CpuCalcPmeReciprocalForceKernel::runMainThread() {
     pthread_mutex_lock(&lock);
     isFinished = true;
     pthread_cond_signal(&endCondition);
-    ThreadPool threads(numThreads);
+    ThreadPool& threads = *threadPool;
     while (true) {
         // Wait for the signal to start.
 
@@ -573,12 +613,14 @@ void CpuCalcPmeReciprocalForceKernel::runMainThread() {
             for (auto e : threadEnergy)
                 energy += e;
         }
-        threads.resumeThreads(); // Signal threads to perform reciprocal convolution.
-        threads.waitForThreads();
-        fftwf_execute_dft_c2r(backwardFFT, complexGrid, realGrid);
-        atomicCounter = 0;
-        threads.resumeThreads(); // Signal threads to interpolate forces.
-        threads.waitForThreads();
+        if (includeForces) {
+            threads.resumeThreads(); // Signal threads to perform reciprocal convolution.
+            threads.waitForThreads();
+            fftwf_execute_dft_c2r(backwardFFT, complexGrid, realGrid);
+            atomicCounter = 0;
+            threads.resumeThreads(); // Signal threads to interpolate forces.
+            threads.waitForThreads();
+        }
         isFinished = true;
         lastBoxVectors[0] = periodicBoxVectors[0];
         lastBoxVectors[1] = periodicBoxVectors[1];
@@ -598,14 +640,19 @@ void CpuCalcPmeReciprocalForceKernel::runWorkerThread(ThreadPool& threads, int i
     int complexStart = std::max(1, ((index*complexSize)/numThreads));
     int complexEnd = (((index+1)*complexSize)/numThreads);
     const float epsilonFactor = sqrt(ONE_4PI_EPS0);
-    spreadCharge(posq, tempGrid[index], gridx, gridy, gridz, numParticles, periodicBoxVectors, recipBoxVectors, atomicCounter, epsilonFactor, index, numThreads, deterministic);
+    spreadCharge(posq, tempGrid[index], gridx, gridy, gridz, numParticles, periodicBoxVectors, recipBoxVectors, atomicCounter, epsilonFactor,
+            numThreads, deterministic ? fixedGrid[index].data() : NULL);
     threads.syncThreads();
-    int numGrids = tempGrid.size();
-    for (int i = gridStart; i < gridEnd; i += 4) {
-        fvec4 sum(&realGrid[i]);
-        for (int j = 1; j < numGrids; j++)
-            sum += fvec4(&tempGrid[j][i]);
-        sum.store(&realGrid[i]);
+    if (deterministic)
+        sumFixedPointGrids(realGrid, fixedGrid, gridStart, min(gridEnd, gridx*gridy*gridz));
+    else {
+        int numGrids = tempGrid.size();
+        for (int i = gridStart; i < gridEnd; i += 4) {
+            fvec4 sum(&realGrid[i]);
+            for (int j = 1; j < numGrids; j++)
+                sum += fvec4(&tempGrid[j][i]);
+            sum.store(&realGrid[i]);
+        }
     }
     threads.syncThreads();
     if (lastBoxVectors[0] != periodicBoxVectors[0] || lastBoxVectors[1] != periodicBoxVectors[1] || lastBoxVectors[2] != periodicBoxVectors[2]) {
@@ -614,6 +661,8 @@ void CpuCalcPmeReciprocalForceKernel::runWorkerThread(ThreadPool& threads, int i
     }
     if (includeEnergy) {
         threadEnergy[index] = reciprocalEnergy(gridxStart, gridxEnd, complexGrid, recipEterm, gridx, gridy, gridz, alpha, bsplineModuli, periodicBoxVectors, recipBoxVectors);
+        if (!includeForces)
+            return;
         threads.syncThreads();
     }
     reciprocalConvolution(complexStart, complexEnd, complexGrid, recipEterm);
@@ -622,11 +671,16 @@ void CpuCalcPmeReciprocalForceKernel::runWorkerThread(ThreadPool& threads, int i
 }
 
 void CpuCalcPmeReciprocalForceKernel::beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeEnergy) {
+    beginComputation(io, periodicBoxVectors, includeEnergy, true);
+}
+
+void CpuCalcPmeReciprocalForceKernel::beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeEnergy, bool includeForces) {
     this->io = &io;
     this->periodicBoxVectors[0] = periodicBoxVectors[0];
     this->periodicBoxVectors[1] = periodicBoxVectors[1];
     this->periodicBoxVectors[2] = periodicBoxVectors[2];
-    this->includeEnergy = includeEnergy;
+    this->includeEnergy = includeEnergy || !includeForces;
+    this->includeForces = includeForces;
     energy = 0.0;
 
     // Invert the box vectors.
@@ -651,7 +705,8 @@ double CpuCalcPmeReciprocalForceKernel::finishComputation(IO& io) {
         pthread_cond_wait(&endCondition, &lock);
     }
     pthread_mutex_unlock(&lock);
-    io.setForce(&force[0]);
+    if (includeForces)
+        io.setForce(&force[0]);
     return energy;
 }
 
@@ -732,9 +787,16 @@ void CpuCalcDispersionPmeReciprocalForceKernel::initialize(int xsize, int ysize,
     this->deterministic = deterministic;
     force.resize(4*numParticles);
     recipEterm.resize(gridx*gridy*gridz);
+    if (deterministic)
+        fixedGrid.resize(numThreads, vector<long long>(gridx*gridy*gridz));
     
-    // Initialize threads.
+    // Initialize threads.  If the owning context asked for it, the worker threads come from a pool
+    // shared with everything else in the process that uses the same number of threads.
     
+    if (useSharedThreadPool)
+        threadPool = ThreadPool::getSharedThreadPool(numThreads);
+    else
+        threadPool = make_shared<ThreadPool>(numThreads);
     isFinished = false;
     pthread_cond_init(&startCondition, NULL);
     pthread_cond_init(&endCondition, NULL);
@@ -840,7 +902,7 @@ void CpuCalcDispersionPmeReciprocalForceKernel::runMainThread() {
     pthread_mutex_lock(&lock);
     isFinished = true;
     pthread_cond_signal(&endCondition);
-    ThreadPool threads(numThreads);
+    ThreadPool& threads = *threadPool;
     while (true) {
         // Wait for the signal to start.
 
@@ -865,12 +927,14 @@ void CpuCalcDispersionPmeReciprocalForceKernel::runMainThread() {
             for (auto e : threadEnergy)
                 energy += e;
         }
-        threads.resumeThreads(); // Signal threads to perform reciprocal convolution.
-        threads.waitForThreads();
-        fftwf_execute_dft_c2r(backwardFFT, complexGrid, realGrid);
-        atomicCounter = 0;
-        threads.resumeThreads(); // Signal threads to interpolate forces.
-        threads.waitForThreads();
+        if (includeForces) {
+            threads.resumeThreads(); // Signal threads to perform reciprocal convolution.
+            threads.waitForThreads();
+            fftwf_execute_dft_c2r(backwardFFT, complexGrid, realGrid);
+            atomicCounter = 0;
+            threads.resumeThreads(); // Signal threads to interpolate forces.
+            threads.waitForThreads();
+        }
         isFinished = true;
         lastBoxVectors[0] = periodicBoxVectors[0];
         lastBoxVectors[1] = periodicBoxVectors[1];
@@ -890,14 +954,19 @@ void CpuCalcDispersionPmeReciprocalForceKernel::runWorkerThread(ThreadPool& thre
     int complexStart = std::max(1, ((index*complexSize)/numThreads));
     int complexEnd = (((index+1)*complexSize)/numThreads);
     const float epsilonFactor = 1.0f;
-    spreadCharge(posq, tempGrid[index], gridx, gridy, gridz, numParticles, periodicBoxVectors, recipBoxVectors, atomicCounter, epsilonFactor, index, numThreads, deterministic);
+    spreadCharge(posq, tempGrid[index], gridx, gridy, gridz, numParticles, periodicBoxVectors, recipBoxVectors, atomicCounter, epsilonFactor,
+            numThreads, deterministic ? fixedGrid[index].data() : NULL);
     threads.syncThreads();
-    int numGrids = tempGrid.size();
-    for (int i = gridStart; i < gridEnd; i += 4) {
-        fvec4 sum(&realGrid[i]);
-        for (int j = 1; j < numGrids; j++)
-            sum += fvec4(&tempGrid[j][i]);
-        sum.store(&realGrid[i]);
+    if (deterministic)
+        sumFixedPointGrids(realGrid, fixedGrid, gridStart, min(gridEnd, gridx*gridy*gridz));
+    else {
+        int numGrids = tempGrid.size();
+        for (int i = gridStart; i < gridEnd; i += 4) {
+            fvec4 sum(&realGrid[i]);
+            for (int j = 1; j < numGrids; j++)
+                sum += fvec4(&tempGrid[j][i]);
+            sum.store(&realGrid[i]);
+        }
     }
     threads.syncThreads();
     if (lastBoxVectors[0] != periodicBoxVectors[0] || lastBoxVectors[1] != periodicBoxVectors[1] || lastBoxVectors[2] != periodicBoxVectors[2]) {
@@ -906,6 +975,8 @@ void CpuCalcDispersionPmeReciprocalForceKernel::runWorkerThread(ThreadPool& thre
     }
     if (includeEnergy) {
         threadEnergy[index] = reciprocalDispersionEnergy(gridxStart, gridxEnd, complexGrid, recipEterm, gridx, gridy, gridz, alpha, bsplineModuli, periodicBoxVectors, recipBoxVectors);
+        if (!includeForces)
+            return;
         threads.syncThreads();
     }
     // For dispersion, we include the {0,0,0} term, so the start point needs to be redefined
@@ -916,11 +987,16 @@ void CpuCalcDispersionPmeReciprocalForceKernel::runWorkerThread(ThreadPool& thre
 }
 
 void CpuCalcDispersionPmeReciprocalForceKernel::beginComputation(CalcPmeReciprocalForceKernel::IO& io, const Vec3* periodicBoxVectors, bool includeEnergy) {
+    beginComputation(io, periodicBoxVectors, includeEnergy, true);
+}
+
+void CpuCalcDispersionPmeReciprocalForceKernel::beginComputation(CalcPmeReciprocalForceKernel::IO& io, const Vec3* periodicBoxVectors, bool includeEnergy, bool includeForces) {
     this->io = &io;
     this->periodicBoxVectors[0] = periodicBoxVectors[0];
     this->periodicBoxVectors[1] = periodicBoxVectors[1];
     this->periodicBoxVectors[2] = periodicBoxVectors[2];
-    this->includeEnergy = includeEnergy;
+    this->includeEnergy = includeEnergy || !includeForces;
+    this->includeForces = includeForces;
     energy = 0.0;
 
     // Invert the box vectors.
@@ -945,7 +1021,8 @@ double CpuCalcDispersionPmeReciprocalForceKernel::finishComputation(CalcPmeRecip
         pthread_cond_wait(&endCondition, &lock);
     }
     pthread_mutex_unlock(&lock);
-    io.setForce(&force[0]);
+    if (includeForces)
+        io.setForce(&force[0]);
     return energy;
 }
 
@@ -39,6 +39,7 @@
 #include "openmm/internal/ThreadPool.h"
 #include <atomic>
 #include <fftw3.h>
+#include <memory>
 #include <pthread.h>
 #include <vector>
 
@@ -51,8 +52,17 @@ namespace OpenMM {
 
 class OPENMM_EXPORT_PME CpuCalcPmeReciprocalForceKernel : public CalcPmeReciprocalForceKernel {
 public:
-    CpuCalcPmeReciprocalForceKernel(const std::string& name, const Platform& platform) : CalcPmeReciprocalForceKernel(name, platform),
-            hasCreatedPlan(false), isDeleted(false), realGrid(NULL), complexGrid(NULL) {
+    /**
+     * Create a new kernel.
+     * 
+     * @param name                 the name of the kernel
+     * @param platform             the platform the kernel belongs to
+     * @param useSharedThreadPool  if true, take the worker threads from the pool shared by everything in the
+     *                             process that uses the same number of threads.  Otherwise the kernel creates
+     *                             its own threads.
+     */
+    CpuCalcPmeReciprocalForceKernel(const std::string& name, const Platform& platform, bool useSharedThreadPool=false) : CalcPmeReciprocalForceKernel(name, platform),
+            useSharedThreadPool(useSharedThreadPool), hasCreatedPlan(false), isDeleted(false), realGrid(NULL), complexGrid(NULL) {
     }
     /**
      * Initialize the kernel.
@@ -62,7 +72,9 @@ public:
      * @param gridz        the z size of the PME grid
      * @param numParticles the number of particles in the system
      * @param alpha        the Ewald blending parameter
-     * @param deterministic whether it should attempt to make the resulting forces deterministic
+     * @param deterministic whether to accumulate the charge grid in fixed point, so the forces do not depend on
+     *                      how particles are divided between threads.  This allocates one 64-bit grid per thread,
+     *                      or numThreads*gridx*gridy*gridz*8 bytes.
      */
     void initialize(int xsize, int ysize, int zsize, int numParticles, double alpha, bool deterministic);
     ~CpuCalcPmeReciprocalForceKernel();
@@ -74,6 +86,16 @@ public:
      * @param includeEnergy       true if potential energy should be computed
      */
     void beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeEnergy);
+    /**
+     * Begin computing the energy, and optionally the force.  When forces are not needed, the
+     * convolution, inverse FFT, and force interpolation are skipped.
+     * 
+     * @param io                  an object that coordinates data transfer
+     * @param periodicBoxVectors  the vectors defining the periodic box (measured in nm)
+     * @param includeEnergy       true if potential energy should be computed
+     * @param includeForces       true if forces should be computed
+     */
+    void beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeEnergy, bool includeForces);
     /**
      * Finish computing the force and energy.
      * 
@@ -111,7 +133,7 @@ private:
     static int numThreads;
     int gridx, gridy, gridz, numParticles;
     double alpha;
-    bool deterministic;
+    bool deterministic, useSharedThreadPool;
     bool hasCreatedPlan, isFinished, isDeleted;
     std::vector<float> force;
     std::vector<float> bsplineModuli[3];
@@ -119,6 +141,8 @@ private:
     Vec3 lastBoxVectors[3];
     std::vector<float> threadEnergy;
     std::vector<float*> tempGrid;
+    std::vector<std::vector<long long> > fixedGrid;
+    std::shared_ptr<ThreadPool> threadPool;
     float* realGrid;
     fftwf_complex* complexGrid;
     fftwf_plan forwardFFT, backwardFFT;
@@ -131,7 +155,7 @@ private:
     float energy;
     float* posq;
     Vec3 periodicBoxVectors[3], recipBoxVectors[3];
-    bool includeEnergy;
+    bool includeEnergy, includeForces;
     std::atomic<int> atomicCounter;
 };
 
@@ -144,8 +168,17 @@ private:
 
 class OPENMM_EXPORT_PME CpuCalcDispersionPmeReciprocalForceKernel : public CalcDispersionPmeReciprocalForceKernel {
 public:
-    CpuCalcDispersionPmeReciprocalForceKernel(const std::string& name, const Platform& platform) : CalcDispersionPmeReciprocalForceKernel(name, platform),
-            hasCreatedPlan(false), isDeleted(false), realGrid(NULL), complexGrid(NULL)  {
+    /**
+     * Create a new kernel.
+     * 
+     * @param name                 the name of the kernel
+     * @param platform             the platform the kernel belongs to
+     * @param useSharedThreadPool  if true, take the worker threads from the pool shared by everything in the
+     *                             process that uses the same number of threads.  Otherwise the kernel creates
+     *                             its own threads.
+     */
+    CpuCalcDispersionPmeReciprocalForceKernel(const std::string& name, const Platform& platform, bool useSharedThreadPool=false) : CalcDispersionPmeReciprocalForceKernel(name, platform),
+            useSharedThreadPool(useSharedThreadPool), hasCreatedPlan(false), isDeleted(false), realGrid(NULL), complexGrid(NULL) {
     }
     /**
      * Initialize the kernel.
@@ -155,7 +188,9 @@ public:
      * @param gridz        the z size of the PME grid
      * @param numParticles the number of particles in the system
      * @param alpha        the Ewald blending parameter
-     * @param deterministic whether it should attempt to make the resulting forces deterministic
+     * @param deterministic whether to accumulate the charge grid in fixed point, so the forces do not depend on
+     *                      how particles are divided between threads.  This allocates one 64-bit grid per thread,
+     *                      or numThreads*gridx*gridy*gridz*8 bytes.
      */
     void initialize(int xsize, int ysize, int zsize, int numParticles, double alpha, bool deterministic);
     ~CpuCalcDispersionPmeReciprocalForceKernel();
@@ -167,6 +202,16 @@ public:
      * @param includeEnergy       true if potential energy should be computed
      */
     void beginComputation(CalcPmeReciprocalForceKernel::IO& io, const Vec3* periodicBoxVectors, bool includeEnergy);
+    /**
+     * Begin computing the energy, and optionally the force.  When forces are not needed, the
+     * convolution, inverse FFT, and force interpolation are skipped.
+     * 
+     * @param io                  an object that coordinates data transfer
+     * @param periodicBoxVectors  the vectors defining the periodic box (measured in nm)
+     * @param includeEnergy       true if potential energy should be computed
+     * @param includeForces       true if forces should be computed
+     */
+    void beginComputation(CalcPmeReciprocalForceKernel::IO& io, const Vec3* periodicBoxVectors, bool includeEnergy, bool includeForces);
     /**
      * Finish computing the force and energy.
      * 
@@ -205,7 +250,7 @@ private:
     static int numThreads;
     int gridx, gridy, gridz, numParticles;
     double alpha;
-    bool deterministic;
+    bool deterministic, useSharedThreadPool;
     bool hasCreatedPlan, isFinished, isDeleted;
     std::vector<float> force;
     std::vector<float> bsplineModuli[3];
@@ -213,6 +258,8 @@ private:
     Vec3 lastBoxVectors[3];
     std::vector<float> threadEnergy;
     std::vector<float*> tempGrid;
+    std::vector<std::vector<long long> > fixedGrid;
+    std::shared_ptr<ThreadPool> threadPool;
     float* realGrid;
     fftwf_complex* complexGrid;
     fftwf_plan forwardFFT, backwardFFT;
@@ -225,7 +272,7 @@ private:
     float energy;
     float* posq;
     Vec3 periodicBoxVectors[3], recipBoxVectors[3];
-    bool includeEnergy;
+    bool includeEnergy, includeForces;
     std::atomic<int> atomicCounter;
 };
 
@@ -40,20 +40,28 @@
 #include "openmm/System.h"
 #include "openmm/VerletIntegrator.h"
 #include "openmm/internal/ContextImpl.h"
+#include "openmm/internal/ThreadPool.h"
 #include "openmm/Units.h"
 #include "../src/CpuPmeKernels.h"
 #include "SimTKOpenMMRealType.h"
 #include "sfmt/SFMT.h"
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <thread>
 #include <vector>
 
 using namespace OpenMM;
 using namespace std;
 
+extern "C" void registerKernelFactories();
+
 class IO : public CalcPmeReciprocalForceKernel::IO {
 public:
     vector<float> posq;
     float* force;
+    IO() : force(NULL) {
+    }
     float* getPosq() {
         return &posq[0];
     }
@@ -706,6 +714,219 @@ void testLJPME(bool triclinic) {
         ASSERT_EQUAL_VEC(refState.getForces()[i], Vec3(io.force[4*i], io.force[4*i+1], io.force[4*i+2]), 1e-3);
 }
 
+void testEnergyOnly(bool dispersion) {
+    // Create a cloud of random particles.
+
+    const int numParticles = 51;
+    const double boxWidth = 5.0;
+    const double alpha = 2.91842;
+    Vec3 boxVectors[3] = {Vec3(boxWidth, 0, 0), Vec3(0.2*boxWidth, boxWidth, 0), Vec3(-0.3*boxWidth, -0.1*boxWidth, boxWidth)};
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    IO io1, io2;
+    for (int i = 0; i < numParticles; i++) {
+        io1.posq.push_back(boxWidth*genrand_real2(sfmt));
+        io1.posq.push_back(boxWidth*genrand_real2(sfmt));
+        io1.posq.push_back(boxWidth*genrand_real2(sfmt));
+        io1.posq.push_back(dispersion ? 0.1*genrand_real2(sfmt) : -1.0+i*2.0/(numParticles-1));
+    }
+    io2.posq = io1.posq;
+
+    // Compute the energy with and without forces.  Skipping the forces should not change the energy,
+    // and no forces should be returned.
+
+    Platform& platform = Platform::getPlatformByName("Reference");
+    double energy1, energy2;
+    if (dispersion) {
+        CpuCalcDispersionPmeReciprocalForceKernel pme(CalcDispersionPmeReciprocalForceKernel::Name(), platform);
+        pme.initialize(32, 32, 32, numParticles, alpha, false);
+        pme.beginComputation(io1, boxVectors, true, true);
+        energy1 = pme.finishComputation(io1);
+        pme.beginComputation(io2, boxVectors, true, false);
+        energy2 = pme.finishComputation(io2);
+    }
+    else {
+        CpuCalcPmeReciprocalForceKernel pme(CalcPmeReciprocalForceKernel::Name(), platform);
+        pme.initialize(32, 32, 32, numParticles, alpha, false);
+        pme.beginComputation(io1, boxVectors, true, true);
+        energy1 = pme.finishComputation(io1);
+        pme.beginComputation(io2, boxVectors, true, false);
+        energy2 = pme.finishComputation(io2);
+    }
+    ASSERT(io1.force != NULL);
+    ASSERT(io2.force == NULL);
+    ASSERT(energy1 != 0.0);
+    ASSERT_EQUAL_TOL(energy1, energy2, 1e-6);
+}
+
+#ifdef CPU_PLATFORM_LIBRARY
+void testDeterministic(bool dispersion) {
+    // Create a cloud of random particles, and a second copy with the particles in reverse order.
+
+    const int numParticles = 51;
+    const double boxWidth = 5.0;
+    const double alpha = 2.91842;
+    Vec3 boxVectors[3] = {Vec3(boxWidth, 0, 0), Vec3(0.2*boxWidth, boxWidth, 0), Vec3(-0.3*boxWidth, -0.1*boxWidth, boxWidth)};
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    IO io1, io2;
+    for (int i = 0; i < numParticles; i++) {
+        io1.posq.push_back(boxWidth*genrand_real2(sfmt));
+        io1.posq.push_back(boxWidth*genrand_real2(sfmt));
+        io1.posq.push_back(boxWidth*genrand_real2(sfmt));
+        io1.posq.push_back(dispersion ? 0.1*genrand_real2(sfmt) : -1.0+i*2.0/(numParticles-1));
+    }
+    for (int i = numParticles-1; i >= 0; i--)
+        for (int j = 0; j < 4; j++)
+            io2.posq.push_back(io1.posq[4*i+j]);
+
+    // With deterministic forces, the charge grid is accumulated in fixed point, so the order in which
+    // particles are spread cannot change the results.  They should be bitwise identical.
+
+    Platform& platform = Platform::getPlatformByName("Reference");
+    double energy1, energy2;
+    vector<float> force1(4*numParticles), force2(4*numParticles);
+    if (dispersion) {
+        CpuCalcDispersionPmeReciprocalForceKernel pme(CalcDispersionPmeReciprocalForceKernel::Name(), platform);
+        pme.initialize(32, 32, 32, numParticles, alpha, true);
+        pme.beginComputation(io1, boxVectors, true, true);
+        energy1 = pme.finishComputation(io1);
+        copy(io1.force, io1.force+4*numParticles, force1.begin());
+        pme.beginComputation(io2, boxVectors, true, true);
+        energy2 = pme.finishComputation(io2);
+        copy(io2.force, io2.force+4*numParticles, force2.begin());
+    }
+    else {
+        CpuCalcPmeReciprocalForceKernel pme(CalcPmeReciprocalForceKernel::Name(), platform);
+        pme.initialize(32, 32, 32, numParticles, alpha, true);
+        pme.beginComputation(io1, boxVectors, true, true);
+        energy1 = pme.finishComputation(io1);
+        copy(io1.force, io1.force+4*numParticles, force1.begin());
+        pme.beginComputation(io2, boxVectors, true, true);
+        energy2 = pme.finishComputation(io2);
+        copy(io2.force, io2.force+4*numParticles, force2.begin());
+    }
+    ASSERT(energy1 != 0.0);
+    ASSERT_EQUAL(energy1, energy2);
+    for (int i = 0; i < numParticles; i++)
+        for (int j = 0; j < 3; j++)
+            ASSERT_EQUAL(force1[4*i+j], force2[4*(numParticles-1-i)+j]);
+}
+
+void testCpuPlatform(NonbondedForce::NonbondedMethod method) {
+    // Create a cloud of random particles.
+
+    const int numParticles = 51;
+    const double boxWidth = 5.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxWidth, 0, 0), Vec3(0, boxWidth, 0), Vec3(0, 0, boxWidth));
+    NonbondedForce* force = new NonbondedForce();
+    system.addForce(force);
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(-1.0+i*2.0/(numParticles-1), 0.3, 0.5);
+        positions[i] = Vec3(boxWidth*genrand_real2(sfmt), boxWidth*genrand_real2(sfmt), boxWidth*genrand_real2(sfmt));
+    }
+    force->setNonbondedMethod(method);
+    force->setCutoffDistance(1.0);
+    force->setEwaldErrorTolerance(1e-4);
+
+    // The CPU platform should use the kernels from this plugin for reciprocal space.  Check that it agrees
+    // with the reference platform.
+
+    Platform& cpu = Platform::getPlatformByName("CPU");
+    vector<string> kernelNames;
+    kernelNames.push_back(CalcPmeReciprocalForceKernel::Name());
+    kernelNames.push_back(CalcDispersionPmeReciprocalForceKernel::Name());
+    ASSERT(cpu.supportsKernels(kernelNames));
+    VerletIntegrator integrator1(0.01), integrator2(0.01);
+    Context context1(system, integrator1, Platform::getPlatformByName("Reference"));
+    Context context2(system, integrator2, cpu);
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    State state1 = context1.getState(State::Forces | State::Energy);
+    State state2 = context2.getState(State::Forces | State::Energy);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-4);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-3);
+
+    // Computing energies by group should include the reciprocal space energy.
+
+    vector<double> groupEnergy = context2.getPotentialEnergyByGroup();
+    ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), groupEnergy[0], 1e-5);
+}
+#endif
+
+void testSharedThreadPool() {
+    // The PME kernels and CPU contexts that use a shared thread pool may all use the same worker threads.
+    // Evaluate several contexts at once and make sure they still get the right results.
+
+    const int numParticles = 51;
+    const int numContexts = 3;
+    const double boxWidth = 5.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxWidth, 0, 0), Vec3(0, boxWidth, 0), Vec3(0, 0, boxWidth));
+    NonbondedForce* force = new NonbondedForce();
+    system.addForce(force);
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(-1.0+i*2.0/(numParticles-1), 0.3, 0.5);
+        positions[i] = Vec3(boxWidth*genrand_real2(sfmt), boxWidth*genrand_real2(sfmt), boxWidth*genrand_real2(sfmt));
+    }
+    force->setNonbondedMethod(NonbondedForce::PME);
+    force->setCutoffDistance(1.0);
+    force->setEwaldErrorTolerance(1e-4);
+    VerletIntegrator referenceIntegrator(0.01);
+    Context referenceContext(system, referenceIntegrator, Platform::getPlatformByName("Reference"));
+    referenceContext.setPositions(positions);
+    double expectedEnergy = referenceContext.getState(State::Energy).getPotentialEnergy();
+
+    // A Context that does not ask for a shared pool should not put its PME threads in one either.
+
+    Platform& platform = Platform::getPlatformByName("CPU");
+    VerletIntegrator privateIntegrator(0.01);
+    Context privateContext(system, privateIntegrator, platform);
+    privateContext.setPositions(positions);
+    privateContext.getState(State::Energy);
+    int numThreads = stoi(platform.getPropertyValue(privateContext, "Threads"));
+    ASSERT_EQUAL(1, ThreadPool::getSharedThreadPool(numThreads).use_count());
+    map<string, string> properties;
+    properties["SharedThreadPool"] = "true";
+    vector<VerletIntegrator*> integrators;
+    vector<Context*> contexts;
+    for (int i = 0; i < numContexts; i++) {
+        integrators.push_back(new VerletIntegrator(0.01));
+        contexts.push_back(new Context(system, *integrators[i], platform, properties));
+        contexts[i]->setPositions(positions);
+    }
+    vector<thread> masters;
+    vector<double> maxError(numContexts, 0.0);
+    for (int i = 0; i < numContexts; i++)
+        masters.push_back(thread([&, i] () {
+            for (int j = 0; j < 10; j++) {
+                double energy = contexts[i]->getState(State::Energy).getPotentialEnergy();
+                maxError[i] = max(maxError[i], fabs(energy-expectedEnergy)/fabs(expectedEnergy));
+            }
+        }));
+    for (auto& master : masters)
+        master.join();
+
+    // Each Context and each of their PME kernels should hold a reference to the shared pool.
+
+    ASSERT(ThreadPool::getSharedThreadPool(numThreads).use_count() > 2*numContexts);
+    for (int i = 0; i < numContexts; i++) {
+        ASSERT(maxError[i] < 1e-4);
+        delete contexts[i];
+        delete integrators[i];
+    }
+}
+
 int main(int argc, char* argv[]) {
     try {
         if (!CpuCalcPmeReciprocalForceKernel::isProcessorSupported()) {
@@ -717,6 +938,17 @@ int main(int argc, char* argv[]) {
         testLJPME(false);
         testLJPME(true);
         test_water2_dpme_energies_forces_no_exclusions();
+        testEnergyOnly(false);
+        testEnergyOnly(true);
+        testDeterministic(false);
+        testDeterministic(true);
+#ifdef CPU_PLATFORM_LIBRARY
+        Platform::loadPluginLibrary(CPU_PLATFORM_LIBRARY);
+        registerKernelFactories();
+        testCpuPlatform(NonbondedForce::PME);
+        testCpuPlatform(NonbondedForce::LJPME);
+        testSharedThreadPool();
+#endif
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
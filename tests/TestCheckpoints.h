@@ -32,6 +32,7 @@
 #include "openmm/internal/AssertionUtilities.h"
 #include "openmm/AndersenThermostat.h"
 #include "openmm/Context.h"
+#include "openmm/LangevinMiddleIntegrator.h"
 #include "openmm/NonbondedForce.h"
 #include "openmm/System.h"
 #include "openmm/VerletIntegrator.h"
@@ -116,12 +117,58 @@ void testSetState() {
     }
 }
 
+void testCheckpointRandomState() {
+    // A checkpoint should include the state of the random number generators, so a Langevin simulation
+    // restored from it repeats exactly the same steps.
+
+    const int numParticles = 50;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    system.addForce(nonbonded);
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? 0.1 : -0.1, 0.2, 0.1);
+        positions[i] = Vec3(0.6*(i%5), 0.6*((i/5)%5), 0.6*(i/25));
+    }
+    LangevinMiddleIntegrator integrator(300.0, 1.0, 0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(300.0);
+    integrator.step(10);
+
+    // Create a checkpoint, continue the simulation, and record the state.
+
+    stringstream stream(ios_base::out | ios_base::in | ios_base::binary);
+    context.createCheckpoint(stream);
+    State s1 = context.getState(State::Positions | State::Velocities | State::Parameters | State::Energy);
+    integrator.step(20);
+    State s2 = context.getState(State::Positions | State::Velocities | State::Parameters);
+
+    // Load the checkpoint and repeat the same steps.
+
+    context.setPeriodicBoxVectors(Vec3(2*boxSize, 0, 0), Vec3(0, 2*boxSize, 0), Vec3(0, 0, 2*boxSize));
+    stream.seekg(0, stream.beg);
+    context.loadCheckpoint(stream);
+    State s3 = context.getState(State::Positions | State::Velocities | State::Parameters | State::Energy);
+    compareStates(s1, s3);
+    ASSERT_EQUAL_TOL(s1.getPotentialEnergy(), s3.getPotentialEnergy(), TOL);
+    integrator.step(20);
+    State s4 = context.getState(State::Positions | State::Velocities | State::Parameters);
+    compareStates(s2, s4);
+}
+
 void runPlatformTests();
 
 int main(int argc, char* argv[]) {
     try {
         initializeTests(argc, argv);
         testSetState();
+        testCheckpointRandomState();
         runPlatformTests();
     }
     catch(const exception& e) {
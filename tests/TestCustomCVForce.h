@@ -38,6 +38,7 @@
 #include "openmm/CustomCVForce.h"
 #include "openmm/CustomExternalForce.h"
 #include "openmm/CustomNonbondedForce.h"
+#include "openmm/RMSDForce.h"
 #include "openmm/System.h"
 #include "openmm/VerletIntegrator.h"
 #include "sfmt/SFMT.h"
@@ -234,6 +235,51 @@ void testReordering() {
     ASSERT_EQUAL_VEC(delta*2/r, state.getForces()[10], 1e-5);
 }
 
+void testChangeRMSDParticles() {
+    // Use an RMSDForce as a collective variable, then change which particles it includes through the
+    // inner Context.  The forces should match a standalone RMSDForce using the new particles.
+
+    const int numParticles = 20;
+    System system;
+    vector<Vec3> referencePos, positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        referencePos.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*2);
+        positions.push_back(referencePos[i]+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.3);
+    }
+    vector<int> particles1, particles2;
+    for (int i = 0; i < numParticles/2; i++) {
+        particles1.push_back(i);
+        particles2.push_back(numParticles-1-i);
+    }
+    CustomCVForce* cv = new CustomCVForce("2*rmsd");
+    cv->addCollectiveVariable("rmsd", new RMSDForce(referencePos, particles1));
+    system.addForce(cv);
+    VerletIntegrator integrator(0.01);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    context.getState(State::Forces);
+    Context& innerContext = cv->getInnerContext(context);
+    RMSDForce& innerRmsd = dynamic_cast<RMSDForce&>(const_cast<Force&>(innerContext.getSystem().getForce(0)));
+    innerRmsd.setParticles(particles2);
+    innerRmsd.updateParametersInContext(innerContext);
+    State state1 = context.getState(State::Energy | State::Forces);
+
+    System system2;
+    for (int i = 0; i < numParticles; i++)
+        system2.addParticle(1.0);
+    system2.addForce(new RMSDForce(referencePos, particles2));
+    VerletIntegrator integrator2(0.01);
+    Context context2(system2, integrator2, platform);
+    context2.setPositions(positions);
+    State state2 = context2.getState(State::Energy | State::Forces);
+    ASSERT_EQUAL_TOL(2*state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state2.getForces()[i]*2, state1.getForces()[i], 1e-5);
+}
+
 void runPlatformTests();
 
 int main(int argc, char* argv[]) {
@@ -243,6 +289,7 @@ int main(int argc, char* argv[]) {
         testEnergyParameterDerivatives();
         testTabulatedFunction();
         testReordering();
+        testChangeRMSDParticles();
         runPlatformTests();
     }
     catch(const exception& e) {
@@ -903,6 +903,43 @@ void testLongRangeCorrection() {
     ASSERT_EQUAL_TOL(standardEnergy1-standardEnergy2, customEnergy1-customEnergy2, 1e-4);
 }
 
+void testLongRangeCorrectionCache() {
+    // Step a global parameter through more values than the cache holds, then go back over them.  Both
+    // cached and recomputed integrals should give the same energies as the first time.
+
+    const int numParticles = 27;
+    const int numValues = 20;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    CustomNonbondedForce* nonbonded = new CustomNonbondedForce("4*eps*((sigma/r)^12-(sigma/r)^6); sigma=scale*0.5*(sigma1+sigma2); eps=sqrt(eps1*eps2)");
+    nonbonded->addPerParticleParameter("sigma");
+    nonbonded->addPerParticleParameter("eps");
+    nonbonded->addGlobalParameter("scale", 1.0);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle({i%2 == 0 ? 0.3 : 0.35, i%2 == 0 ? 0.5 : 1.0});
+        positions[i] = Vec3((i%3)*boxSize/3, ((i/3)%3)*boxSize/3, (i/9)*boxSize/3);
+    }
+    nonbonded->setNonbondedMethod(CustomNonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setUseLongRangeCorrection(true);
+    system.addForce(nonbonded);
+    VerletIntegrator integrator(0.01);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    vector<double> energy(numValues);
+    for (int i = 0; i < numValues; i++) {
+        context.setParameter("scale", 1.0+0.01*i);
+        energy[i] = context.getState(State::Energy).getPotentialEnergy();
+    }
+    for (int i = numValues-1; i >= 0; i--) {
+        context.setParameter("scale", 1.0+0.01*i);
+        ASSERT_EQUAL_TOL(energy[i], context.getState(State::Energy).getPotentialEnergy(), 1e-6);
+    }
+}
+
 void testInteractionGroups() {
     const int numParticles = 6;
     System system;
@@ -1453,6 +1490,7 @@ int main(int argc, char* argv[]) {
         testCoulombLennardJones();
         testSwitchingFunction();
         testLongRangeCorrection();
+        testLongRangeCorrectionCache();
         testInteractionGroups();
         testLargeInteractionGroup();
         testInteractionGroupLongRangeCorrection();
@@ -933,6 +933,125 @@ void testEwaldExceptions() {
     ASSERT_EQUAL_TOL(expectedChange, e2-e1, 1e-5);
 }
 
+void testEnergyByGroup() {
+    // Create a system with forces in several groups, including a NonbondedForce whose
+    // reciprocal space interactions are in a different group from its direct space ones.
+
+    const int numParticles = 100;
+    const double boxSize = 2.5;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setReciprocalSpaceForceGroup(3);
+    system.addForce(nonbonded);
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    bonds->setForceGroup(1);
+    system.addForce(bonds);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? -0.5 : 0.5, 0.2, 0.5);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    for (int i = 1; i < numParticles; i += 2) {
+        positions[i] = positions[i-1]+Vec3(0.1, 0, 0);
+        nonbonded->addException(i-1, i, 0.0, 1.0, 0.0);
+        bonds->addBond(i-1, i, 0.12, 1000.0);
+    }
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+
+    // The energy of each group should match what getState() gives for that group alone.
+
+    vector<double> energy = context.getPotentialEnergyByGroup();
+    ASSERT_EQUAL(32, energy.size());
+    for (int i = 0; i < 32; i++)
+        ASSERT_EQUAL_TOL(context.getState(State::Energy, false, 1<<i).getPotentialEnergy(), energy[i], TOL);
+    ASSERT(energy[0] != 0.0);
+    ASSERT(energy[1] != 0.0);
+    ASSERT(energy[3] != 0.0);
+
+    // Groups that are not requested should be left as 0.
+
+    energy = context.getPotentialEnergyByGroup((1<<1) + (1<<3));
+    ASSERT_EQUAL(0.0, energy[0]);
+    ASSERT_EQUAL_TOL(context.getState(State::Energy, false, 1<<1).getPotentialEnergy(), energy[1], TOL);
+    ASSERT_EQUAL_TOL(context.getState(State::Energy, false, 1<<3).getPotentialEnergy(), energy[3], TOL);
+}
+
+void testEnergyForParameters() {
+    // Create a periodic system with a NonbondedForce that has parameter offsets, plus
+    // a HarmonicBondForce that does not depend on any parameter.
+
+    const int numParticles = 100;
+    const double boxSize = 2.5;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->addGlobalParameter("lambda", 0.0);
+    nonbonded->addGlobalParameter("scale", 1.0);
+    system.addForce(nonbonded);
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    system.addForce(bonds);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? -0.5 : 0.5, 0.2, 0.5);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    for (int i = 1; i < numParticles; i += 2) {
+        positions[i] = positions[i-1]+Vec3(0.1, 0, 0);
+        nonbonded->addException(i-1, i, 0.0, 1.0, 0.0);
+        bonds->addBond(i-1, i, 0.12, 1000.0);
+    }
+    for (int i = 0; i < 10; i++)
+        nonbonded->addParticleParameterOffset("lambda", i, (i%2 == 0 ? 0.5 : -0.5), 0.0, -0.5);
+    nonbonded->addParticleParameterOffset("scale", 20, 0.2, 0.1, 0.3);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+
+    // Compute the energy for several parameter sets and compare to evaluating them one at a time.
+
+    vector<map<string, double> > parameterSets;
+    for (int i = 0; i < 5; i++) {
+        map<string, double> params;
+        params["lambda"] = 0.25*i;
+        if (i%2 == 1)
+            params["scale"] = 0.5*i;
+        parameterSets.push_back(params);
+    }
+    vector<double> energy = context.getPotentialEnergyForParameters(parameterSets);
+    ASSERT_EQUAL(parameterSets.size(), energy.size());
+    ASSERT_EQUAL(0.0, context.getParameter("lambda"));
+    ASSERT_EQUAL(1.0, context.getParameter("scale"));
+    for (int i = 0; i < (int) parameterSets.size(); i++) {
+        for (auto& param : parameterSets[i])
+            context.setParameter(param.first, param.second);
+        ASSERT_EQUAL_TOL(context.getState(State::Energy).getPotentialEnergy(), energy[i], TOL);
+        context.setParameter("lambda", 0.0);
+        context.setParameter("scale", 1.0);
+    }
+    ASSERT(energy[0] != energy[4]);
+
+    // Try it with only one force group.
+
+    bonds->setForceGroup(1);
+    context.reinitialize(true);
+    energy = context.getPotentialEnergyForParameters(parameterSets, 1<<1);
+    for (int i = 0; i < (int) parameterSets.size(); i++)
+        ASSERT_EQUAL_TOL(context.getState(State::Energy, false, 1<<1).getPotentialEnergy(), energy[i], TOL);
+}
+
 void runPlatformTests();
 
 int main(int argc, char* argv[]) {
@@ -954,6 +1073,8 @@ int main(int argc, char* argv[]) {
         testTwoForces();
         testParameterOffsets();
         testEwaldExceptions();
+        testEnergyByGroup();
+        testEnergyForParameters();
         runPlatformTests();
     }
     catch(const exception& e) {
@@ -222,6 +222,44 @@ void testCustomFunction(const string& expression, const string& equivalent) {
     verifySameValue(deriv3, deriv4, 2.0, -3.0);
 }
 
+/**
+ * Test compiling several expressions together, and verify that each output matches
+ * evaluating the expression by itself.
+ */
+
+void testMultipleOutputs() {
+    ParsedExpression energy = Parser::parse("4*eps*((sigma/x)^12-(sigma/x)^6)+y*x; eps=2.5; sigma=0.3").optimize();
+    vector<ParsedExpression> expressions;
+    expressions.push_back(energy);
+    expressions.push_back(energy.differentiate("x").optimize());
+    expressions.push_back(energy.differentiate("y").optimize());
+    expressions.push_back(Parser::parse("x"));
+    CompiledExpression compiled(expressions);
+    ASSERT_EQUAL(4, compiled.getNumOutputs());
+    double x, y;
+    map<string, double*> variablePointers;
+    variablePointers["x"] = &x;
+    variablePointers["y"] = &y;
+    compiled.setVariableLocations(variablePointers);
+    CompiledExpression copy = compiled;
+    for (int i = 0; i < 5; i++) {
+        x = 0.25+0.1*i;
+        y = -1.0+0.5*i;
+        map<string, double> variables;
+        variables["x"] = x;
+        variables["y"] = y;
+        double value = compiled.evaluate();
+        ASSERT_EQUAL_TOL(expressions[0].evaluate(variables), value, 1e-10);
+        for (int j = 0; j < (int) expressions.size(); j++)
+            ASSERT_EQUAL_TOL(expressions[j].evaluate(variables), compiled.getOutputValue(j), 1e-10);
+        copy.getVariableReference("x") = x;
+        copy.getVariableReference("y") = y;
+        copy.evaluate();
+        for (int j = 0; j < (int) expressions.size(); j++)
+            ASSERT_EQUAL_TOL(expressions[j].evaluate(variables), copy.getOutputValue(j), 1e-10);
+    }
+}
+
 int main() {
     try {
         verifyEvaluation("5", 5.0);
@@ -305,6 +343,7 @@ int main() {
         verifyDerivative("select(x, x^2, 3*x)", "select(x, 2*x, 3)");
         testCustomFunction("custom(x, y)/2", "x*y");
         testCustomFunction("custom(x^2, 1)+custom(2, y-1)", "2*x^2+4*(y-1)");
+        testMultipleOutputs();
         cout << Parser::parse("x*x").optimize() << endl;
         cout << Parser::parse("x*(x*x)").optimize() << endl;
         cout << Parser::parse("(x*x)*x").optimize() << endl;
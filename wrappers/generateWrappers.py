@@ -72,6 +72,7 @@ class WrapperGenerator:
                             'void OpenMM::Context::createCheckpoint',
                             'void OpenMM::Context::loadCheckpoint',
                             'const std::vector<std::vector<int> >& OpenMM::Context::getMolecules',
+                            'std::vector<double> OpenMM::Context::getPotentialEnergyForParameters',
                             'static std::vector<std::string> OpenMM::Platform::getPluginLoadFailures',
                             'static std::vector<std::string> OpenMM::Platform::loadPluginsFromDirectory',
                             'Vec3 OpenMM::LocalCoordinatesSite::getOriginWeights',
@@ -95,6 +95,7 @@ SKIP_METHODS = [('State', 'getPositions'),
                 ('Context',  'getIntegrator'),
                 ('Context',  'createCheckpoint'),
                 ('Context',  'loadCheckpoint'),
+                ('Context',  'getPotentialEnergyForParameters'),
                 ('CudaPlatform',),
                 ('Force',    'Force'),
                 ('ParticleParameterInfo',),